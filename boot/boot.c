@@ -0,0 +1,695 @@
+/* boot.c */
+/* USB HID bootloader, resides in the write-protected boot block */
+
+#include <p18cxxx.h>
+#include <string.h>   /* for memcpy() */
+
+/* Configuration */
+/* NOTE: the application cannot change these, it runs with the
+  configuration of the bootloader */
+#pragma config FOSC = XTPLL_XT    /* XT oscillator, PLL */
+#pragma config PLLDIV = 1         /* 4MHz input */
+#pragma config CPUDIV = OSC3_PLL4	/* CPU=96MHz PLL / 4 */
+#pragma config FCMEN = OFF        /* Fail-safe clock monitor */
+#pragma config IESO = OFF         /* internal/external switch over */
+#pragma config PWRT = OFF         /* power-up timer (see ../src/main.c) */
+#pragma config BOR = ON           /* brown-out reset, in hardware */
+#pragma config BORV = 1           /* at about 4.3 V */
+#pragma config WDT = OFF          /* watchdog timer */
+#pragma config LVP = OFF          /* low voltage ICSP */
+#pragma config VREGEN = ON        /* USB voltage regulator */
+#pragma config MCLRE = OFF        /* Master Clear Reset */
+#pragma config PBADEN = OFF       /* PORTB are digital I/O */
+#pragma config BBSIZ = BB2K       /* boot block is 0x0000..0x0FFF */
+#pragma config WRTB = ON          /* boot block is write-protected */
+
+/* program memory */
+#define APP_START    0x1000  /* reset vector of the application */
+#define APP_END      0x4000  /* end of program memory */
+#define ERASE_SIZE   64      /* bytes erased at once */
+#define WRITE_SIZE   16      /* bytes written at once */
+
+/* pins on PortA (see main.c) */
+#define SNES_LATCH   0x04
+#define SNES_CLOCK   0x20
+#define SNES_DATA    0x08
+#define SNES_VCC     0x10
+
+/* bit names of USB registers (see usb.c) */
+#define _UOWN     0x80
+#define _DTS      0x40
+#define _DTSEN    0x08
+#define _BSTALL   0x04
+#define _PPBRST   0x40
+#define _PKTDIS   0x10
+#define _USBEN    0x08
+#define _DIR      0x04
+#define _EPHSHK   0x10
+#define _EPCONDIS 0x08
+#define _EPOUTEN  0x04
+#define _EPINEN   0x02
+#define _TRNI     0x08
+#define _URSTI    0x01
+
+#define PID_SETUP (unsigned char)(0xD << 2)
+
+/* endpoint set, laid out in USB RAM by usbmem.h */
+#define USBMEM_NUM_EP  2
+#define USBMEM_PPB     USBMEM_PPB_NONE
+#define USBMEM_TABLE \
+  USBMEM_EP( 0, 8, 8 )  /* control transfers */ \
+  USBMEM_EP( 1, 0, 8 )  /* HID input reports (never sent) */
+#include "usbmem.h"
+
+/* commands (first byte of output report) */
+enum boot_cmd
+{
+  CMD_WRITE  = 0x01,  /* erase and program a 64 byte block */
+  CMD_ERASE  = 0x02,  /* erase a 64 byte block */
+  CMD_VERIFY = 0x03,  /* compare CRC of application memory */
+  CMD_RUN    = 0x04   /* leave bootloader, start application */
+};
+
+/* error codes in status report */
+enum boot_error
+{
+  ERR_NONE    = 0x00,
+  ERR_COMMAND = 0x01,  /* unknown command */
+  ERR_ADDRESS = 0x02,  /* block outside application memory */
+  ERR_CRC     = 0x03,  /* CRC mismatch */
+  ERR_NOAPP   = 0x04   /* no application to start */
+};
+
+/* output report: command, sequence number, address, data */
+#define CMD_SIZE     ( 4 + ERASE_SIZE )
+/* feature report: status */
+/* [0] sequence number of last completed command, [1] queued commands,
+  [2] error code (sticky), [4..5] CRC computed by CMD_VERIFY */
+#define STATUS_SIZE  8
+/* number of commands that can be queued while flash is busy */
+#define FIFO_SIZE    2
+
+/* type of current control transfer */
+enum ctrl_state
+{
+  CTRL_IDLE,
+  CTRL_IN,      /* data stage to host */
+  CTRL_OUT,     /* data stage from host */
+  CTRL_STATUS   /* waiting for IN status stage */
+};
+
+
+static const rom unsigned char dev_desc[18] =
+{
+  18, 0x01,           /* bLength, bDescriptorType: device */
+  0x00, 0x02,         /* bcdUSB */
+  0x00, 0x00, 0x00,   /* class, subclass, protocol: see interface */
+  USBMEM_EP0_IN_SIZE, /* bMaxPacketSize */
+  0xD8, 0x04,         /* idVendor (0x04D8=Microchip) */
+  0x02, 0x00,         /* idProduct: bootloader */
+  0x01, 0x00,         /* bcdDevice */
+  0, 0, 0,            /* no strings */
+  0x01                /* bNumConfigurations */
+};
+
+static const rom unsigned char report_desc[31];  /* forward declaration */
+
+static const rom unsigned char cfg_desc[34] =
+{
+  9, 0x02,            /* configuration descriptor */
+  sizeof( cfg_desc ), 0,
+  1, 1, 0,            /* bNumInterfaces, bConfigurationValue, iConfiguration */
+  0x80, 50,           /* bus powered, 100mA */
+  9, 0x04,            /* interface descriptor */
+  0, 0, 1,            /* bInterfaceNumber, bAlternateSetting, bNumEndpoints */
+  0x03, 0, 0, 0,      /* HID, no subclass, no protocol, no string */
+  9, 0x21,            /* HID descriptor */
+  0x10, 0x01, 0, 1,   /* bcdHID, bCountryCode, bNumDescriptors */
+  0x22, sizeof( report_desc ), 0x00,
+  7, 0x05,            /* endpoint descriptor */
+  0x81, 0x03,         /* EP1 IN, interrupt */
+  USBMEM_EP1_IN_SIZE, 0x00,
+  0x0A                /* bInterval */
+};
+
+static const rom unsigned char report_desc[31] =
+{
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined Page 1)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+    0x95, STATUS_SIZE,             //   REPORT_COUNT (8)
+    0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+    0xb1, 0x02,                    //   FEATURE (Data,Var,Abs)
+    0x95, CMD_SIZE,                //   REPORT_COUNT (68)
+    0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+    0xc0                           // END_COLLECTION
+};
+
+
+/* USB Memory (BDT and endpoint buffers, see usbmem.h) */
+#pragma udata usb_ram = 0x400
+static volatile unsigned char g_usbram[ USBMEM_SIZE ];
+#pragma udata
+
+#define BD0OUT    USBMEM_BD( 0, USBMEM_OUT, 0 )
+#define BD0IN     USBMEM_BD( 0, USBMEM_IN, 0 )
+#define EP0RXBUF  USBMEM_PTR( EP0_OUT )
+#define EP0TXBUF  USBMEM_PTR( EP0_IN )
+
+/* static data */
+static enum ctrl_state g_ctrl;        /* state of control transfer */
+static unsigned char   g_ctrl_dts;    /* DTS value for next transaction */
+static const rom unsigned char * g_ctrl_rom;  /* IN data from ROM */
+static unsigned char * g_ctrl_ram;    /* IN data from RAM, OUT data */
+static unsigned char   g_ctrl_left;   /* bytes left in data stage */
+static unsigned char   g_addr;        /* address to set after status */
+static unsigned char   g_setup_wait;  /* SETUP waits for free FIFO slot */
+static unsigned char   g_run;         /* CMD_RUN done, start after status */
+
+static unsigned char   g_fifo[ FIFO_SIZE ][ CMD_SIZE ];  /* commands */
+static unsigned char   g_fifo_in;     /* slot being received */
+static unsigned char   g_fifo_out;    /* slot being executed */
+static unsigned char   g_fifo_count;  /* number of complete commands */
+static unsigned char   g_step;        /* progress of current command */
+
+static unsigned char   g_status[ STATUS_SIZE ];  /* status report */
+
+/* local prototypes */
+static unsigned char boot_requested( void );
+static void usb_poll( void );
+static void process_setup( void );
+static void prepare_ep0( void );
+static void flash_service( void );
+static void flash_erase( unsigned short addr );
+static void flash_write( unsigned short addr, unsigned char * data );
+static unsigned short flash_crc( void );
+static void run_app( void );
+
+
+/* Interrupt Vectors: the bootloader runs without interrupts, they
+  belong to the application */
+#pragma code high_vector = 0x08
+void interrupt_at_high_vector( void )
+{
+  _asm goto 0x1008 _endasm
+}
+#pragma code low_vector = 0x18
+void interrupt_at_low_vector( void )
+{
+  _asm goto 0x1018 _endasm
+}
+#pragma code    /* default code section */
+
+
+/* main entry point */
+void main( void )
+{
+  ADCON1 = 0x0F; /* all pins to digital */
+  LATA = 0x01;
+  TRISA = 0x00;  /* all pins to output */
+  TRISB = 0xC0;
+  TRISC = 0x00;
+
+  if ( boot_requested() == 0U )
+  {
+    run_app();
+  }
+
+  /* stay in bootloader */
+  LATA &= ~0x01;  /* LED on */
+
+  UCFG = 0x10 | USBMEM_PPB;  /* low speed, internal transciever, on-chip pullup */
+  UIE  = 0x00;               /* bootloader polls, no interrupts */
+  UEP0 = _EPHSHK | _EPOUTEN | _EPINEN;
+  UEP1 = _EPHSHK | _EPCONDIS | _EPINEN;
+  BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+  BD0OUT.BDADR  = USBMEM_ADDR( EP0_OUT );
+  BD0OUT.BDSTAT = _UOWN;
+  BD0IN.BDSTAT  = 0x00;
+  BD0IN.BDADR   = USBMEM_ADDR( EP0_IN );
+  UCON = _PPBRST | _PKTDIS | _USBEN;  /* enable USB module */
+
+  while (1)
+  {
+    usb_poll();
+    flash_service();
+  }
+}
+
+
+/* decide whether to stay in the bootloader */
+static unsigned char boot_requested( void )
+{
+  unsigned short i;
+
+  if ( ( RCON & 0x10 ) == 0U )
+  {
+    /* RESET instruction: application requested the bootloader */
+    RCON |= 0x10;
+    return 1;
+  }
+
+  if ( *(const rom unsigned short *)APP_START == 0xFFFFU )
+  {
+    /* no application, or an update did not complete: the uploader writes
+      the block of the reset vector last */
+    return 1;
+  }
+
+  /* B button held on the pad: recovery from a broken application */
+  LATA  |= SNES_VCC | SNES_CLOCK;
+  TRISA |= SNES_DATA;
+  for ( i = 0; i < 20000U; i++ ) /* let pad power up (some ms) */
+  {
+    Nop();
+  }
+  LATA |= SNES_LATCH;
+  for ( i = 0; i < 20U; i++ )
+  {
+    Nop();
+  }
+  LATA &= ~SNES_LATCH;
+  for ( i = 0; i < 20U; i++ )
+  {
+    Nop();
+  }
+  /* first bit after latch is B, low when pressed */
+  return ( PORTA & SNES_DATA ) == 0U;
+}
+
+
+/* handle USB events (polled) */
+static void usb_poll( void )
+{
+  if ( UIR & _URSTI )
+  {
+    /* USB reset */
+    g_ctrl = CTRL_IDLE;
+    g_addr = 0;
+    g_setup_wait = 0;
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN;
+    BD0IN.BDSTAT  = 0x00;
+    UIR = 0x00;
+    return;
+  }
+
+  if ( g_setup_wait && g_fifo_count < FIFO_SIZE )
+  {
+    /* command FIFO has room now for the SETUP that was held back */
+    g_setup_wait = 0;
+    process_setup();
+  }
+
+  if ( ( UIR & _TRNI ) == 0U )
+  {
+    return;
+  }
+
+  if ( ( USTAT & 0x78 ) == 0x00U )
+  {
+    if ( ( USTAT & _DIR ) == 0U )
+    {
+      if ( ( BD0OUT.BDSTAT & 0x3C ) == PID_SETUP )
+      {
+        process_setup();
+      }
+      else if ( g_ctrl == CTRL_OUT )
+      {
+        /* data stage packet of SET_REPORT */
+        unsigned char cnt;
+
+        cnt = BD0OUT.BDCNT;
+        if ( cnt > g_ctrl_left )
+        {
+          cnt = g_ctrl_left;
+        }
+        memcpy( (void *)g_ctrl_ram, (const void *)EP0RXBUF, cnt );
+        g_ctrl_ram += cnt;
+        g_ctrl_left -= cnt;
+        g_ctrl_dts ^= _DTS;
+        if ( g_ctrl_left == 0U )
+        {
+          /* command complete -> queue it and send status */
+          g_fifo_in = ( g_fifo_in + 1 ) % FIFO_SIZE;
+          ++g_fifo_count;
+          g_ctrl = CTRL_STATUS;
+        }
+        prepare_ep0();
+      }
+      else
+      {
+        /* status stage of IN transfer */
+        g_ctrl = CTRL_IDLE;
+        if ( g_run )
+        {
+          run_app();
+        }
+        prepare_ep0();
+      }
+    }
+    else
+    {
+      if ( g_ctrl == CTRL_IN )
+      {
+        g_ctrl_dts ^= _DTS;
+      }
+      else
+      {
+        /* status stage of OUT transfer */
+        g_ctrl = CTRL_IDLE;
+        if ( g_addr != 0U )
+        {
+          UADDR = g_addr;
+          g_addr = 0;
+        }
+        if ( g_run )
+        {
+          /* the host has its answer to CMD_RUN, detach now */
+          run_app();
+        }
+      }
+      prepare_ep0();
+    }
+  }
+
+  UIR &= ~_TRNI;  /* advance USTAT FIFO */
+}
+
+
+/* decode SETUP packet */
+static void process_setup( void )
+{
+  unsigned char  type;
+  unsigned char  req;
+  unsigned char  hi;
+  unsigned short len;
+
+  type = EP0RXBUF[0];
+  req  = EP0RXBUF[1];
+  hi   = EP0RXBUF[3];   /* wValue high byte */
+  len  = EP0RXBUF[6] | ( (unsigned short)EP0RXBUF[7] << 8 );
+
+  g_ctrl = CTRL_STATUS;  /* no data stage unless set below */
+  g_ctrl_dts = _DTS;
+  g_ctrl_rom = 0;
+  g_ctrl_ram = 0;
+  g_ctrl_left = 0;
+
+  if ( type == 0x80U && req == 0x06U )
+  {
+    /* GET_DESCRIPTOR */
+    g_ctrl = CTRL_IN;
+    if ( hi == 0x01U )
+    {
+      g_ctrl_rom = dev_desc;
+      g_ctrl_left = sizeof( dev_desc );
+    }
+    else if ( hi == 0x02U )
+    {
+      g_ctrl_rom = cfg_desc;
+      g_ctrl_left = sizeof( cfg_desc );
+    }
+    else
+    {
+      g_ctrl = CTRL_IDLE;  /* stall */
+    }
+  }
+  else if ( type == 0x81U && req == 0x06U && hi == 0x22U )
+  {
+    /* GET_DESCRIPTOR (report) */
+    g_ctrl = CTRL_IN;
+    g_ctrl_rom = report_desc;
+    g_ctrl_left = sizeof( report_desc );
+  }
+  else if ( type == 0x00U && req == 0x05U )
+  {
+    /* SET_ADDRESS */
+    g_addr = EP0RXBUF[2] & 0x7F;
+  }
+  else if ( type == 0x00U && req == 0x09U )
+  {
+    /* SET_CONFIGURATION: nothing to do */
+  }
+  else if ( type == 0x21U && req == 0x0AU )
+  {
+    /* SET_IDLE: nothing to do */
+  }
+  else if ( type == 0xA1U && req == 0x01U )
+  {
+    /* GET_REPORT: status */
+    g_status[1] = g_fifo_count;
+    g_ctrl = CTRL_IN;
+    g_ctrl_ram = g_status;
+    g_ctrl_left = STATUS_SIZE;
+  }
+  else if ( type == 0x21U && req == 0x09U && hi == 0x02U )
+  {
+    /* SET_REPORT (output): next command */
+    if ( g_fifo_count >= FIFO_SIZE )
+    {
+      /* NOTE: we leave PKTDIS set, so the SIE NAKs the data stage until
+        the flash has caught up (flow control for the host) */
+      g_setup_wait = 1;
+      return;
+    }
+    g_ctrl = CTRL_OUT;
+    g_ctrl_ram = g_fifo[ g_fifo_in ];
+    g_ctrl_left = CMD_SIZE;
+  }
+  else
+  {
+    g_ctrl = CTRL_IDLE;  /* stall */
+  }
+
+  if ( g_ctrl == CTRL_IDLE )
+  {
+    /* unsupported request -> STALL (cleared with next SETUP) */
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN | _BSTALL;
+    BD0IN.BDSTAT  = _UOWN | _BSTALL;
+  }
+  else
+  {
+    if ( g_ctrl == CTRL_IN && len < g_ctrl_left )
+    {
+      g_ctrl_left = len;
+    }
+    prepare_ep0();
+  }
+
+  UCON &= ~_PKTDIS;
+}
+
+
+/* arm EP0 for the next transaction */
+static void prepare_ep0( void )
+{
+  unsigned char cnt;
+
+  if ( g_ctrl == CTRL_IN )
+  {
+    cnt = ( g_ctrl_left <= USBMEM_EP0_IN_SIZE ) ?
+      g_ctrl_left : USBMEM_EP0_IN_SIZE;
+    if ( g_ctrl_rom != 0 )
+    {
+      memcpypgm2ram( (void *)EP0TXBUF, (const rom void *)g_ctrl_rom, cnt );
+      g_ctrl_rom += cnt;
+    }
+    else
+    {
+      memcpy( (void *)EP0TXBUF, (const void *)g_ctrl_ram, cnt );
+      g_ctrl_ram += cnt;
+    }
+    g_ctrl_left -= cnt;
+    BD0IN.BDCNT  = cnt;
+    BD0IN.BDSTAT = _UOWN | _DTSEN | g_ctrl_dts;
+    BD0OUT.BDCNT  = 0;    /* status stage */
+    BD0OUT.BDSTAT = _UOWN | _DTSEN | _DTS;
+  }
+  else if ( g_ctrl == CTRL_OUT )
+  {
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN | _DTSEN | g_ctrl_dts;
+  }
+  else if ( g_ctrl == CTRL_STATUS )
+  {
+    BD0IN.BDCNT  = 0;     /* status stage */
+    BD0IN.BDSTAT = _UOWN | _DTSEN | _DTS;
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN;
+  }
+  else
+  {
+    /* ready for next SETUP */
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN;
+  }
+}
+
+
+/* execute queued commands, one flash operation per call */
+/* NOTE: the CPU stalls during each erase/write cycle while the SIE keeps
+  receiving the next command into the armed EP0 buffer, so commands
+  stream in while the flash is busy */
+static void flash_service( void )
+{
+  unsigned char * cmd;
+  unsigned short  addr;
+  unsigned short  crc;
+  unsigned char   i;
+
+  if ( g_fifo_count == 0U )
+  {
+    return;
+  }
+
+  cmd = g_fifo[ g_fifo_out ];
+  addr = cmd[2] | ( (unsigned short)cmd[3] << 8 );
+
+  switch ( cmd[0] )
+  {
+    case CMD_WRITE:
+    case CMD_ERASE:
+      if ( addr < APP_START || addr >= APP_END || ( addr % ERASE_SIZE ) != 0U )
+      {
+        g_status[2] = ERR_ADDRESS;
+        g_step = 0;
+        break;
+      }
+      if ( g_step == 0U )
+      {
+        flash_erase( addr );
+      }
+      else
+      {
+        /* NOTE: from the end of the block down, so the reset vector at
+          APP_START is the last part written (see boot_requested()) */
+        i = ERASE_SIZE / WRITE_SIZE - g_step;
+        flash_write( addr + i * WRITE_SIZE, &cmd[ 4 + i * WRITE_SIZE ] );
+      }
+      if ( cmd[0] == CMD_WRITE && g_step < ERASE_SIZE / WRITE_SIZE )
+      {
+        ++g_step;
+        return;   /* continue with next write cycle */
+      }
+      g_step = 0;
+      break;
+    case CMD_VERIFY:
+      crc = flash_crc();
+      g_status[4] = crc & 0xFF;
+      g_status[5] = crc >> 8;
+      if ( cmd[4] != g_status[4] || cmd[5] != g_status[5] )
+      {
+        g_status[2] = ERR_CRC;
+      }
+      break;
+    case CMD_RUN:
+      if ( *(const rom unsigned short *)APP_START == 0xFFFFU )
+      {
+        g_status[2] = ERR_NOAPP;
+        break;
+      }
+      /* NOTE: the command is queued as soon as its data stage arrived,
+        detaching before the status stage has been sent would fail the
+        SET_REPORT on the host; usb_poll() starts the application once
+        the current control transfer has completed */
+      g_run = 1;
+      if ( g_ctrl == CTRL_IDLE )
+      {
+        run_app();
+      }
+      break;
+    default:
+      g_status[2] = ERR_COMMAND;
+  }
+
+  /* command done */
+  g_status[0] = cmd[1];   /* sequence number */
+  g_fifo_out = ( g_fifo_out + 1 ) % FIFO_SIZE;
+  --g_fifo_count;
+}
+
+
+/* erase 64 byte block */
+static void flash_erase( unsigned short addr )
+{
+  TBLPTRU = 0;
+  TBLPTRH = addr >> 8;
+  TBLPTRL = addr & 0xFF;
+  EECON1 = 0x94;    /* EEPGD | WREN | FREE */
+  EECON2 = 0x55;
+  EECON2 = 0xAA;
+  EECON1 |= 0x02;   /* WR: CPU stalls until erase is done */
+  EECON1 &= ~0x04;  /* WREN off */
+}
+
+
+/* write 16 byte block */
+static void flash_write( unsigned short addr, unsigned char * data )
+{
+  unsigned char i;
+
+  TBLPTRU = 0;
+  TBLPTRH = addr >> 8;
+  TBLPTRL = addr & 0xFF;
+  for ( i = 0; i < WRITE_SIZE; i++ )
+  {
+    TABLAT = data[i];
+    _asm TBLWTPOSTINC _endasm   /* into holding register */
+  }
+  /* point back into the block being written */
+  TBLPTRH = addr >> 8;
+  TBLPTRL = addr & 0xFF;
+  EECON1 = 0x84;    /* EEPGD | WREN */
+  EECON2 = 0x55;
+  EECON2 = 0xAA;
+  EECON1 |= 0x02;   /* WR: CPU stalls until write is done */
+  EECON1 &= ~0x04;  /* WREN off */
+}
+
+
+/* CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) of the
+  application memory */
+static unsigned short flash_crc( void )
+{
+  const rom unsigned char * p;
+  unsigned short crc;
+  unsigned char  i;
+
+  crc = 0xFFFF;
+  for ( p = (const rom unsigned char *)APP_START;
+    p != (const rom unsigned char *)APP_END; ++p )
+  {
+    crc ^= (unsigned short)*p << 8;
+    for ( i = 0; i < 8U; i++ )
+    {
+      crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+
+/* start application */
+static void run_app( void )
+{
+  unsigned short i;
+
+  if ( UCON & _USBEN )
+  {
+    /* detach, so the host enumerates the application afresh */
+    UCON = 0x00;
+    for ( i = 0; i < 60000U; i++ )
+    {
+      Nop();
+    }
+  }
+  _asm goto 0x1000 _endasm
+}
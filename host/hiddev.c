@@ -0,0 +1,132 @@
+/* hiddev.c */
+/* locating adapters through sysfs */
+
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hiddev.h"
+
+
+/* find hidraw nodes of devices with given vendor/product ID */
+int hiddev_find( unsigned short vid, unsigned short pid,
+  char paths[][ HIDDEV_PATH_MAX ], int max )
+{
+  DIR *           dir;
+  struct dirent * ent;
+  FILE *          f;
+  char            name[ PATH_MAX ];
+  char            line[ 128 ];
+  char            id[ 32 ];
+  int             count;
+
+  /* uevent of the HID device contains HID_ID=bus:vendor:product */
+  snprintf( id, sizeof( id ), "HID_ID=0003:0000%04X:0000%04X", vid, pid );
+
+  count = 0;
+  dir = opendir( "/sys/class/hidraw" );
+  if ( dir == NULL )
+  {
+    return 0;
+  }
+  while ( count < max && ( ent = readdir( dir ) ) != NULL )
+  {
+    if ( strncmp( ent->d_name, "hidraw", 6 ) != 0 )
+    {
+      continue;
+    }
+    snprintf( name, sizeof( name ), "/sys/class/hidraw/%s/device/uevent",
+      ent->d_name );
+    f = fopen( name, "r" );
+    if ( f == NULL )
+    {
+      continue;
+    }
+    while ( fgets( line, sizeof( line ), f ) != NULL )
+    {
+      if ( strncmp( line, id, strlen( id ) ) == 0 )
+      {
+        snprintf( paths[ count ], HIDDEV_PATH_MAX, "/dev/%.58s", ent->d_name );
+        ++count;
+        break;
+      }
+    }
+    fclose( f );
+  }
+  closedir( dir );
+  return count;
+}
+
+
+/* find usbfs node belonging to a hidraw node */
+int hiddev_usbnode( const char * hidraw, char * usbnode )
+{
+  char   name[ PATH_MAX + 16 ];
+  char   real[ PATH_MAX ];
+  char * p;
+  FILE * f;
+  int    bus;
+  int    dev;
+  int    i;
+
+  p = strrchr( hidraw, '/' );
+  snprintf( name, sizeof( name ), "/sys/class/hidraw/%s/device",
+    p ? p + 1 : hidraw );
+  if ( realpath( name, real ) == NULL )
+  {
+    return -1;
+  }
+
+  /* .../<usb device>/<interface>/<hid device> */
+  for ( i = 0; i < 2; i++ )
+  {
+    p = strrchr( real, '/' );
+    if ( p == NULL )
+    {
+      return -1;
+    }
+    *p = '\0';
+  }
+
+  bus = -1;
+  dev = -1;
+  snprintf( name, sizeof( name ), "%s/busnum", real );
+  f = fopen( name, "r" );
+  if ( f != NULL )
+  {
+    if ( fscanf( f, "%d", &bus ) != 1 )
+    {
+      bus = -1;
+    }
+    fclose( f );
+  }
+  snprintf( name, sizeof( name ), "%s/devnum", real );
+  f = fopen( name, "r" );
+  if ( f != NULL )
+  {
+    if ( fscanf( f, "%d", &dev ) != 1 )
+    {
+      dev = -1;
+    }
+    fclose( f );
+  }
+  if ( bus < 0 || dev < 0 )
+  {
+    return -1;
+  }
+  snprintf( usbnode, HIDDEV_PATH_MAX, "/dev/bus/usb/%03d/%03d", bus, dev );
+  return 0;
+}
+
+
+/* monotonic time */
+unsigned long long hiddev_now_us( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
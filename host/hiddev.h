@@ -0,0 +1,23 @@
+#ifndef HIDDEV_H
+#define HIDDEV_H
+
+/* USB IDs of the adapter (see dev_desc in ../src/usb.c) */
+#define HIDDEV_VID       0x04D8
+#define HIDDEV_PID       0x0001
+/* USB IDs of the bootloader (see dev_desc in ../boot/boot.c) */
+#define HIDDEV_PID_BOOT  0x0002
+
+/* maximum length of a device path */
+#define HIDDEV_PATH_MAX  64
+
+/* finds hidraw nodes of all devices with given IDs, returns their number */
+int hiddev_find( unsigned short vid, unsigned short pid,
+  char paths[][ HIDDEV_PATH_MAX ], int max );
+
+/* finds the usbfs node (/dev/bus/usb/BBB/DDD) of a hidraw node */
+int hiddev_usbnode( const char * hidraw, char * usbnode );
+
+/* returns monotonic time in microseconds */
+unsigned long long hiddev_now_us( void );
+
+#endif  /* defined HIDDEV_H */
@@ -0,0 +1,205 @@
+/* console.c */
+/* model of the controller port of a SNES console, in place of the
+  controller (pad.c), for the PLAYBACK build (../../src/playback.h)
+
+  The console powers the port and reads it once per frame, as its
+  automatic read does: latch high for 12 us, 6 us later 16 clock pulses of
+  6 us low and 6 us high. It samples DATA at each falling clock edge, low
+  is pressed. Edges are exact in virtual time, sim.c stops at each of them
+  (see console_next()).
+
+  The adapter must have the next bit on DATA before the next falling edge.
+  Its response is the time from a rising edge to the change of DATA; a
+  change while the clock is low, or between the latch and the first
+  falling edge, comes too late for the read it belongs to. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "p18cxxx.h"
+#include "sim.h"
+#include "../../src/snes.h"
+
+/* waveform of a read [ns after the latch rises] */
+#define CON_T_LATCH   ( 12 * SIM_US )   /* latch falls */
+#define CON_T_FIRST   ( 18 * SIM_US )   /* first falling clock edge */
+#define CON_T_STEP    ( 6 * SIM_US )    /* clock phase */
+#define CON_EDGES     34                /* latch up and down, 16 pulses */
+
+/* one read of the console */
+struct con_read
+{
+  unsigned long long time;     /* latch rose [ns] */
+  unsigned short     buttons;  /* read, 1 = pressed */
+};
+
+/* static data */
+static int                g_con_on;       /* connected */
+static unsigned long long g_con_period;   /* [ns] */
+static unsigned long long g_con_start;    /* latch of the current read */
+static int                g_con_edge;     /* next edge of it */
+static unsigned short     g_con_shift;
+static unsigned char      g_con_data;     /* DATA level as last seen */
+static unsigned long long g_con_rise;     /* last rising clock edge, or 0 */
+static struct con_read *  g_con_reads;
+static int                g_con_nreads;
+
+/* statistics */
+static unsigned long long g_con_respmax;  /* rising edge to DATA [ns] */
+static unsigned long long g_con_respsum;
+static unsigned long      g_con_resps;
+static unsigned long      g_con_late;     /* changes too late for a read */
+
+/* local prototypes */
+static unsigned long long con_edgetime( int edge );
+static unsigned char con_data( void );
+
+
+/* connect the console, the first read at time first, then every period */
+void console_init( unsigned long long first, unsigned long long period )
+{
+  pad_unplug();
+  g_con_on = 1;
+  g_con_period = period;
+  g_con_start = first;
+  g_con_edge = 0;
+  g_con_data = con_data();
+  PORTA = ( PORTA & ~SNES_LATCH ) | SNES_CLOCK | SNES_VCC;
+}
+
+/* follow time and the firmware's DATA */
+void console_update( void )
+{
+  unsigned char      data;
+  unsigned long long t;
+
+  if ( !g_con_on )
+  {
+    return;
+  }
+
+  /* DATA changed since we last looked: now, as the firmware takes no
+    time between two waits */
+  data = con_data();
+  if ( data != g_con_data )
+  {
+    g_con_data = data;
+    if ( g_con_edge >= 2 && g_con_edge < CON_EDGES && ( g_con_edge & 1 ) )
+    {
+      /* clock low (or latch to first falling edge): sampled already */
+      ++g_con_late;
+    }
+    else if ( g_con_edge == 1 || g_con_edge == 2 )
+    {
+      ++g_con_late;   /* bit 0 changed after the latch */
+    }
+    else if ( g_con_rise != 0 )
+    {
+      t = g_sim_ns - g_con_rise;
+      g_con_respmax = t > g_con_respmax ? t : g_con_respmax;
+      g_con_respsum += t;
+      ++g_con_resps;
+      g_con_rise = 0;
+    }
+  }
+
+  while ( con_edgetime( g_con_edge ) <= g_sim_ns )
+  {
+    if ( g_con_edge == 0 )
+    {
+      PORTA |= SNES_LATCH;
+      g_con_shift = 0;
+      g_con_rise = 0;
+    }
+    else if ( g_con_edge == 1 )
+    {
+      PORTA &= ~SNES_LATCH;
+    }
+    else if ( g_con_edge & 1 )
+    {
+      PORTA |= SNES_CLOCK;
+      g_con_rise = con_edgetime( g_con_edge );
+    }
+    else
+    {
+      /* falling edge: the console samples */
+      PORTA &= ~SNES_CLOCK;
+      g_con_shift >>= 1;
+      if ( !g_con_data )
+      {
+        g_con_shift |= 0x8000;
+      }
+      g_con_rise = 0;
+    }
+    if ( ++g_con_edge == CON_EDGES )
+    {
+      g_con_reads = realloc( g_con_reads,
+        ( g_con_nreads + 1 ) * sizeof( *g_con_reads ) );
+      if ( g_con_reads == NULL )
+      {
+        perror( "realloc" );
+        exit( 1 );
+      }
+      g_con_reads[ g_con_nreads ].time = g_con_start;
+      g_con_reads[ g_con_nreads ].buttons = g_con_shift;
+      ++g_con_nreads;
+      g_con_start += g_con_period;
+      g_con_edge = 0;
+      /* a change after the last rising edge loads the next read, whenever
+        that comes: not a response to the clock */
+      g_con_rise = 0;
+    }
+  }
+}
+
+/* time of the next edge */
+unsigned long long console_next( void )
+{
+  return g_con_on ? con_edgetime( g_con_edge ) : ~0ULL;
+}
+
+/* number of reads so far */
+int console_reads( void )
+{
+  return g_con_nreads;
+}
+
+/* buttons of the n-th read, and when it started */
+unsigned short console_read( int n, unsigned long long * time )
+{
+  *time = g_con_reads[n].time;
+  return g_con_reads[n].buttons;
+}
+
+/* print reads and response */
+void console_summary( void )
+{
+  fprintf( stderr, "console: %d reads, response to the rising clock edge "
+    "[us]: mean %.2f max %.2f, %lu changes too late\n", g_con_nreads,
+    g_con_resps ? g_con_respsum / (double)g_con_resps / SIM_US : 0.0,
+    g_con_respmax / (double)SIM_US, g_con_late );
+}
+
+
+/* time of an edge of the current read */
+static unsigned long long con_edgetime( int edge )
+{
+  if ( edge == 0 )
+  {
+    return g_con_start;
+  }
+  if ( edge == 1 )
+  {
+    return g_con_start + CON_T_LATCH;
+  }
+  return g_con_start + CON_T_FIRST + ( edge - 2 ) * CON_T_STEP;
+}
+
+/* DATA level, pulled up while the firmware does not drive it */
+static unsigned char con_data( void )
+{
+  if ( TRISA & SNES_DATA )
+  {
+    return 1;
+  }
+  return ( LATA & SNES_DATA ) != 0;
+}
@@ -0,0 +1,282 @@
+/* host.c */
+/* host side of the bus: transactions with retries, control transfers and
+  enumeration */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+
+/* USB requests */
+#define REQ_SET_ADDRESS        0x05
+#define REQ_GET_DESCRIPTOR     0x06
+#define REQ_SET_CONFIGURATION  0x09
+#define REQ_SET_IDLE           0x0A
+
+
+/* local prototypes */
+static int host_token( unsigned char pid, unsigned char addr,
+  unsigned char ep, unsigned char * data, unsigned char * len,
+  unsigned char * toggle, unsigned long long deadline );
+
+unsigned int       g_host_errors;
+unsigned int       g_host_naks;
+unsigned long long g_host_attached;
+unsigned long long g_host_configured;
+unsigned long long g_host_timeout = HOST_CTRL_TIMEOUT;
+int                g_host_handshake;
+unsigned char      g_host_mps0 = 8;
+
+
+/* error injection */
+int host_error( void )
+{
+  return g_host_errors != 0 && (unsigned int)rand() % 1000 < g_host_errors;
+}
+
+/* bus time of one transaction */
+unsigned long long host_txtime( unsigned char len )
+{
+  /* token, data and handshake packet with sync, PID, CRC, EOP and
+    inter-packet delays are about 100 bit times plus the data */
+  return ( 100ULL + 8ULL * len ) * ( sie_fullspeed() ? 83 : 667 );
+}
+
+/* control transfer */
+int host_control( unsigned char addr, unsigned char bmRequestType,
+  unsigned char bRequest, unsigned short wValue, unsigned short wIndex,
+  unsigned short wLength, unsigned char * data )
+{
+  unsigned long long deadline;
+  unsigned char      setup[8];
+  unsigned char      toggle;
+  unsigned char      len;
+  unsigned short     done;
+  int                r;
+
+  setup[0] = bmRequestType;
+  setup[1] = bRequest;
+  setup[2] = wValue & 0xFF;
+  setup[3] = wValue >> 8;
+  setup[4] = wIndex & 0xFF;
+  setup[5] = wIndex >> 8;
+  setup[6] = wLength & 0xFF;
+  setup[7] = wLength >> 8;
+  deadline = g_sim_ns + g_host_timeout;
+
+  /* setup stage */
+  len = 8;
+  r = host_token( SIE_PID_SETUP, addr, 0, setup, &len, &toggle, deadline );
+  g_host_handshake = r;
+  if ( r != SIE_ACK )
+  {
+    return -1;
+  }
+
+  /* data stage */
+  done = 0;
+  toggle = 1;
+  while ( done < wLength )
+  {
+    len = wLength - done < g_host_mps0 ? wLength - done : g_host_mps0;
+    if ( bmRequestType & 0x80 )
+    {
+      r = host_token( SIE_PID_IN, addr, 0, data + done, &len, &toggle,
+        deadline );
+    }
+    else
+    {
+      r = host_token( SIE_PID_OUT, addr, 0, data + done, &len, &toggle,
+        deadline );
+    }
+    g_host_handshake = r;
+    if ( r != SIE_ACK )
+    {
+      return -1;
+    }
+    done += len;
+    toggle ^= 1;
+    if ( len < g_host_mps0 )
+    {
+      break;  /* short packet ends the data stage */
+    }
+  }
+
+  /* status stage, always DATA1 in the other direction */
+  len = 0;
+  toggle = 1;
+  if ( ( bmRequestType & 0x80 ) && wLength != 0 )
+  {
+    r = host_token( SIE_PID_OUT, addr, 0, NULL, &len, &toggle, deadline );
+    g_host_handshake = r;
+  }
+  else
+  {
+    r = host_token( SIE_PID_IN, addr, 0, setup, &len, &toggle, deadline );
+    g_host_handshake = r;
+    if ( r == SIE_ACK && len != 0 )
+    {
+      fprintf( stderr, "host: status stage with %d bytes\n", len );
+      return -1;
+    }
+  }
+  return r == SIE_ACK ? done : -1;
+}
+
+/* connection */
+void host_attach( void )
+{
+  /* the hub sees the pull-up, then debounces the connection for 100 ms */
+  while ( !sie_attached() )
+  {
+    sim_run( 10 * SIM_US );
+  }
+  g_host_attached = g_sim_ns;
+  sim_run( 100 * SIM_MS );
+}
+
+/* enumeration */
+int host_enumerate( void )
+{
+  unsigned char  buf[ 256 ];
+  unsigned short total;
+  unsigned char  i;
+
+  host_attach();
+
+  /* reset and reset recovery */
+  sie_reset();
+  sim_run( 10 * SIM_MS );
+
+  /* first 8 bytes of device descriptor at the default address, with the
+    max. packet size Linux assumes until it has read bMaxPacketSize0 */
+  g_host_mps0 = sie_fullspeed() ? 64 : 8;
+  if ( host_control( 0, 0x80, REQ_GET_DESCRIPTOR, 0x0100, 0, 64, buf ) < 8 )
+  {
+    fprintf( stderr, "host: no device descriptor\n" );
+    return -1;
+  }
+  g_host_mps0 = buf[7];
+  sie_reset();
+  sim_run( 10 * SIM_MS );
+
+  if ( host_control( 0, 0x00, REQ_SET_ADDRESS, HOST_ADDR, 0, 0, NULL ) < 0 )
+  {
+    fprintf( stderr, "host: SET_ADDRESS failed\n" );
+    return -1;
+  }
+  sim_run( 2 * SIM_MS );  /* SET_ADDRESS recovery */
+
+  if ( host_control( HOST_ADDR, 0x80, REQ_GET_DESCRIPTOR, 0x0100, 0, 18,
+    buf ) != 18 )
+  {
+    fprintf( stderr, "host: no device descriptor at new address\n" );
+    return -1;
+  }
+  if ( host_control( HOST_ADDR, 0x80, REQ_GET_DESCRIPTOR, 0x0200, 0, 9,
+    buf ) != 9 )
+  {
+    fprintf( stderr, "host: no configuration descriptor\n" );
+    return -1;
+  }
+  total = buf[2] | buf[3] << 8;
+  if ( total > sizeof( buf ) || host_control( HOST_ADDR, 0x80,
+    REQ_GET_DESCRIPTOR, 0x0200, 0, total, buf ) != total )
+  {
+    fprintf( stderr, "host: incomplete configuration descriptor\n" );
+    return -1;
+  }
+
+  /* language IDs and strings */
+  host_control( HOST_ADDR, 0x80, REQ_GET_DESCRIPTOR, 0x0300, 0, 255, buf );
+  for ( i = 1; i <= 3; i++ )
+  {
+    host_control( HOST_ADDR, 0x80, REQ_GET_DESCRIPTOR, 0x0300 | i, 0x0409,
+      255, buf );
+  }
+
+  if ( host_control( HOST_ADDR, 0x00, REQ_SET_CONFIGURATION, 1, 0, 0,
+    NULL ) < 0 )
+  {
+    fprintf( stderr, "host: SET_CONFIGURATION failed\n" );
+    return -1;
+  }
+  g_host_configured = g_sim_ns;
+
+  /* usbhid: SET_IDLE (may be stalled), then the report descriptor */
+  host_control( HOST_ADDR, 0x21, REQ_SET_IDLE, 0, 0, 0, NULL );
+  if ( host_control( HOST_ADDR, 0x81, REQ_GET_DESCRIPTOR, 0x2200, 0, 255,
+    buf ) <= 0 )
+  {
+    fprintf( stderr, "host: no report descriptor\n" );
+    return -1;
+  }
+  return 0;
+}
+
+
+/* one transaction, NAKs are retried until the deadline */
+static int host_token( unsigned char pid, unsigned char addr,
+  unsigned char ep, unsigned char * data, unsigned char * len,
+  unsigned char * toggle, unsigned long long deadline )
+{
+  unsigned char expect;
+  unsigned char max;
+  unsigned char errors;
+  int           r;
+
+  expect = *toggle;
+  max = *len;
+  errors = 0;
+  for ( ;; )
+  {
+    /* the transaction completes at the device after its bus time */
+    sim_run( host_txtime( max ) );
+    if ( host_error() )
+    {
+      r = sie_error( pid );
+    }
+    else
+    {
+      switch ( pid )
+      {
+        case SIE_PID_SETUP:
+          r = sie_setup( addr, data );
+          break;
+        case SIE_PID_OUT:
+          r = sie_out( addr, ep, data, *len, *toggle );
+          break;
+        default:
+          r = sie_in( addr, ep, data, len, toggle );
+          if ( r == SIE_ACK && *len > max )
+          {
+            fprintf( stderr, "host: EP%d babble (%d > %d bytes)\n", ep,
+              *len, max );
+            return SIE_TIMEOUT;
+          }
+          if ( r == SIE_ACK && *toggle != expect )
+          {
+            fprintf( stderr, "host: EP%d IN data toggle mismatch\n", ep );
+            r = SIE_TIMEOUT;
+          }
+          break;
+      }
+    }
+    if ( r == SIE_ACK || r == SIE_STALL )
+    {
+      return r;
+    }
+    if ( r == SIE_NAK )
+    {
+      ++g_host_naks;
+    }
+    if ( r == SIE_TIMEOUT && ++errors == 3 )
+    {
+      return r;   /* three strikes */
+    }
+    if ( g_sim_ns >= deadline )
+    {
+      fprintf( stderr, "host: EP%d transfer timed out\n", ep );
+      return SIE_TIMEOUT;
+    }
+  }
+}
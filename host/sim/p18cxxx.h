@@ -0,0 +1,44 @@
+#ifndef SIM_P18CXXX_H
+#define SIM_P18CXXX_H
+
+/* Device header of the host simulator
+
+  Stands in for the MCC18 header when modules of ../../src are compiled for
+  the host. Special function registers are plain variables, read and
+  written by the models in sim.c and sie.c. Inline assembly is not
+  available, firmware code uses "#if defined( __18CXX )" around it. */
+
+#include <string.h>
+
+/* MCC18 storage qualifiers */
+#define rom
+#define near
+#define far
+
+/* MCC18 library */
+#define memcpypgm2ram( dst, src, len )  memcpy( dst, src, len )
+#define Nop()
+#define Sleep()   sim_sleep()
+#define Reset()   sim_reset()
+
+/* special function registers */
+#define SIM_SFR( name )  extern volatile unsigned char name;
+#include "sfr.h"
+#undef SIM_SFR
+
+/* endpoint control registers UEP0..UEP15 */
+extern volatile unsigned char g_sim_uep[16];
+#define UEP0   g_sim_uep[0]
+#define UEP1   g_sim_uep[1]
+#define UEP2   g_sim_uep[2]
+#define UEP3   g_sim_uep[3]
+
+/* configuration words 0x300000.. (CONFIG1L first) */
+extern unsigned char g_sim_config[14];
+
+/* hooks into the simulator */
+void sim_delay_us( unsigned char us );  /* busy wait, virtual time passes */
+void sim_sleep( void );                 /* SLEEP instruction, idle mode */
+void sim_reset( void );                 /* RESET instruction */
+
+#endif  /* defined SIM_P18CXXX_H */
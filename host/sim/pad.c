@@ -0,0 +1,278 @@
+/* pad.c */
+/* model of the SNES controller: two 4021 shift registers behind the
+  latch, clock and data lines of ../../src/snes.h
+
+  Edges on LATA are seen when the firmware lets time pass (sim_delay_us()),
+  which is where snes_read() puts them, and right after each CCP1 compare
+  interrupt of the timed scan, so edge times are exact in virtual time but
+  instructions between two delays take none. The controller is powered
+  from SNES_VCC and gives garbage until its supply has settled. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "p18cxxx.h"
+#include "sim.h"
+#include "../../src/snes.h"
+
+/* 4021 timing at 5 V (CD4021B data sheet, worst case) [ns] */
+#define PAD_T_LATCH   160   /* minimum latch (P/S) pulse width */
+#define PAD_T_CLOCK   180   /* minimum clock pulse width, high and low */
+#define PAD_T_PD      320   /* clock or load to data output */
+
+/* the supply of the controller settles after power-up (assumed) [ns] */
+#define PAD_T_POWER   5000000ULL
+
+/* violations printed at most */
+#define PAD_MAX_MSGS  10
+
+/* button timeline */
+struct pad_event
+{
+  unsigned long long time;     /* [ns] */
+  unsigned short     buttons;  /* pressed buttons from then on */
+  unsigned long long sampled;  /* first latched by the firmware, or 0 */
+};
+
+/* static data */
+static struct pad_event * g_pad_events;
+static int                g_pad_nevents;
+static int                g_pad_next;      /* next event to apply */
+static unsigned short     g_pad_buttons;   /* pressed buttons now */
+static unsigned char      g_pad_lat;       /* LATA as last seen */
+static unsigned long long g_pad_tlatch;    /* last latch edge */
+static unsigned long long g_pad_tclock;    /* last clock edge */
+static unsigned short     g_pad_shift;     /* shift register, 1 = pressed */
+static unsigned char      g_pad_bits;      /* clock pulses since latch */
+static unsigned char      g_pad_dout;      /* data output, 1 = pressed */
+static unsigned char      g_pad_pending;   /* data output changes ... */
+static unsigned long long g_pad_tpending;  /* ... at this time */
+static unsigned long long g_pad_tpower;    /* SNES_VCC rose, or 0 */
+
+/* statistics */
+static unsigned long      g_pad_scans;
+static unsigned long long g_pad_first;     /* first latch */
+static unsigned long long g_pad_sample;    /* last sample (latch fall) */
+static unsigned long      g_pad_viol_latch;
+static unsigned long      g_pad_viol_clock;
+static unsigned long      g_pad_viol_setup;
+static unsigned long      g_pad_short;     /* scans with less than 16 bits */
+static unsigned long      g_pad_early;     /* scans before it settled */
+static int                g_pad_msgs;
+static int                g_pad_unplugged;
+
+/* local prototypes */
+static void pad_output( unsigned char level );
+static void pad_violation( unsigned long * counter, const char * what,
+  unsigned long long width );
+
+
+/* controller plugged in, no button pressed, not powered yet */
+void pad_init( void )
+{
+  g_pad_lat = LATA;
+  g_pad_dout = 0;
+  g_pad_pending = 0xFF;
+  PORTA |= SNES_DATA;
+}
+
+/* append to the button timeline */
+void pad_event( unsigned long long time, unsigned short buttons )
+{
+  g_pad_events = realloc( g_pad_events,
+    ( g_pad_nevents + 1 ) * sizeof( *g_pad_events ) );
+  if ( g_pad_events == NULL )
+  {
+    perror( "realloc" );
+    exit( 1 );
+  }
+  g_pad_events[ g_pad_nevents ].time = time;
+  g_pad_events[ g_pad_nevents ].buttons = buttons;
+  g_pad_events[ g_pad_nevents ].sampled = 0;
+  ++g_pad_nevents;
+}
+
+/* follow time and the firmware's pin changes */
+void pad_update( void )
+{
+  unsigned char  lat;
+  unsigned char  changed;
+  unsigned short buttons;
+
+  if ( g_pad_unplugged )
+  {
+    return;
+  }
+
+  /* buttons */
+  while ( g_pad_next < g_pad_nevents &&
+    g_pad_events[ g_pad_next ].time <= g_sim_ns )
+  {
+    g_pad_buttons = g_pad_events[ g_pad_next++ ].buttons;
+  }
+
+  /* data output settles */
+  if ( g_pad_pending != 0xFF && g_sim_ns >= g_pad_tpending )
+  {
+    g_pad_dout = g_pad_pending;
+    g_pad_pending = 0xFF;
+  }
+
+  lat = LATA;
+  changed = lat ^ g_pad_lat;
+  g_pad_lat = lat;
+
+  if ( changed & SNES_VCC )
+  {
+    g_pad_tpower = ( lat & SNES_VCC ) ? g_sim_ns : 0;
+  }
+
+  if ( changed & SNES_LATCH )
+  {
+    if ( lat & SNES_LATCH )
+    {
+      if ( g_pad_scans != 0 && g_pad_bits < 16 )
+      {
+        ++g_pad_short;
+      }
+    }
+    else
+    {
+      if ( g_sim_ns - g_pad_tlatch < PAD_T_LATCH )
+      {
+        pad_violation( &g_pad_viol_latch, "latch pulse",
+          g_sim_ns - g_pad_tlatch );
+      }
+      /* buttons are captured when the latch falls */
+      if ( g_pad_scans++ == 0 )
+      {
+        g_pad_first = g_sim_ns;
+      }
+      g_pad_sample = g_sim_ns;
+      g_pad_bits = 0;
+      if ( g_pad_tpower == 0 || g_sim_ns < g_pad_tpower + PAD_T_POWER )
+      {
+        ++g_pad_early;
+      }
+      if ( g_pad_next != 0 && g_pad_events[ g_pad_next - 1 ].sampled == 0 )
+      {
+        g_pad_events[ g_pad_next - 1 ].sampled = g_sim_ns;
+      }
+    }
+    g_pad_tlatch = g_sim_ns;
+  }
+  if ( lat & SNES_LATCH )
+  {
+    /* parallel mode: the registers follow the buttons, clock is ignored */
+    /* NOTE: before the supply has settled they hold garbage, modeled as
+      all buttons pressed */
+    buttons = g_pad_buttons;
+    if ( g_pad_tpower == 0 || g_sim_ns < g_pad_tpower + PAD_T_POWER )
+    {
+      buttons = 0xFFFF;
+    }
+    if ( g_pad_shift != buttons || ( changed & SNES_LATCH ) )
+    {
+      g_pad_shift = buttons;
+      pad_output( g_pad_shift & 1 );
+    }
+  }
+  else if ( changed & SNES_CLOCK )
+  {
+    if ( g_sim_ns - g_pad_tclock < PAD_T_CLOCK )
+    {
+      pad_violation( &g_pad_viol_clock, ( lat & SNES_CLOCK ) ?
+        "clock low phase" : "clock high phase", g_sim_ns - g_pad_tclock );
+    }
+    if ( lat & SNES_CLOCK )
+    {
+      /* rising edge: shift, the serial input is tied to ground, which
+        reads as pressed after the 16th bit */
+      g_pad_shift = g_pad_shift >> 1 | 0x8000;
+      pad_output( g_pad_shift & 1 );
+      ++g_pad_bits;
+    }
+    else if ( g_pad_pending != 0xFF )
+    {
+      /* falling edge: the firmware samples now, the data is not valid */
+      pad_violation( &g_pad_viol_setup, "data setup",
+        g_sim_ns - ( g_pad_tpending - PAD_T_PD ) );
+    }
+  }
+  if ( changed & SNES_CLOCK )
+  {
+    g_pad_tclock = g_sim_ns;
+  }
+
+  /* pressed buttons pull the data line low */
+  if ( g_pad_dout )
+  {
+    PORTA &= ~SNES_DATA;
+  }
+  else
+  {
+    PORTA |= SNES_DATA;
+  }
+}
+
+/* number of scans so far (latch pulses) */
+unsigned long pad_scans( void )
+{
+  return g_pad_scans;
+}
+
+/* time the firmware first latched the buttons of an event */
+unsigned long long pad_sampled( int event )
+{
+  return event < g_pad_nevents ? g_pad_events[ event ].sampled : 0;
+}
+
+/* print scan rate and violations */
+void pad_summary( void )
+{
+  double rate;
+
+  rate = 0;
+  if ( g_pad_scans > 1 && g_pad_sample > g_pad_first )
+  {
+    rate = ( g_pad_scans - 1 ) / ( ( g_pad_sample - g_pad_first ) /
+      (double)( 1000 * SIM_MS ) );
+  }
+  fprintf( stderr, "pad: powered at %.3f ms, %lu scans before it settled\n",
+    g_pad_tpower / (double)SIM_MS, g_pad_early );
+  fprintf( stderr, "pad: %lu scans, %.0f per second, short scans %lu, "
+    "violations: latch %lu clock %lu setup %lu\n", g_pad_scans, rate,
+    g_pad_short, g_pad_viol_latch, g_pad_viol_clock, g_pad_viol_setup );
+}
+
+/* the model's timing, for drivers that measure it */
+void pad_timing( unsigned long long * pd, unsigned long long * power )
+{
+  *pd = PAD_T_PD;
+  *power = PAD_T_POWER;
+}
+
+/* disconnect the controller */
+void pad_unplug( void )
+{
+  g_pad_unplugged = 1;
+}
+
+
+/* data output changes after the propagation delay */
+static void pad_output( unsigned char level )
+{
+  g_pad_pending = level;
+  g_pad_tpending = g_sim_ns + PAD_T_PD;
+}
+
+/* timing violation */
+static void pad_violation( unsigned long * counter, const char * what,
+  unsigned long long width )
+{
+  ++*counter;
+  if ( g_pad_msgs++ < PAD_MAX_MSGS )
+  {
+    fprintf( stderr, "pad: %s %llu ns at %llu us\n", what, width,
+      g_sim_ns / SIM_US );
+  }
+}
@@ -0,0 +1,57 @@
+/* padtiming.c */
+/* runs the pad timing image of ../../hwtest/padtiming.c against the
+  controller model
+
+  usage: padtiming [-t ms] [-b buttons]
+
+  The image runs for -t ms (default 4000, enough for the first summary)
+  of virtual time with the buttons of -b (hex, enum snes_buttons) held
+  from power-on. Its report goes to stdout, as it would come from the
+  EUSART. The timing of the model follows on stderr, to compare the
+  measurement with. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "p18cxxx.h"
+#include "sim.h"
+
+
+int main( int argc, char * argv[] )
+{
+  unsigned long long pd;
+  unsigned long long power;
+  unsigned int       duration;
+  unsigned int       buttons;
+  int                opt;
+
+  duration = 4000;
+  buttons = 0;
+  while ( ( opt = getopt( argc, argv, "t:b:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 't': duration = atoi( optarg ); break;
+      case 'b': buttons = strtoul( optarg, NULL, 16 ); break;
+      default:
+        fprintf( stderr, "usage: %s [-t ms] [-b buttons]\n", argv[0] );
+        return 2;
+    }
+  }
+
+  /* the configuration words of the image: 48 MHz, whatever the firmware
+    was built for, and the power-up timer (PWRTEN is active low) */
+  g_sim_config[0] &= ~0x18;
+  g_sim_config[2] &= ~0x01;
+  sim_start();
+  pad_event( 0, buttons );
+  sim_run( duration * SIM_MS );
+  fflush( stdout );
+
+  pad_timing( &pd, &power );
+  fprintf( stderr, "padtiming: model propagation delay %.2f us, supply "
+    "settles %.2f ms after power-up\n", pd / (double)SIM_US,
+    power / (double)SIM_MS );
+  pad_summary();
+  return 0;
+}
@@ -0,0 +1,58 @@
+/* sfr.h */
+/* special function registers used by the firmware, expanded by
+  p18cxxx.h (declarations) and sim.c (definitions) */
+
+/* ports */
+SIM_SFR( PORTA )
+SIM_SFR( PORTB )
+SIM_SFR( LATA )
+SIM_SFR( TRISA )
+SIM_SFR( TRISB )
+SIM_SFR( TRISC )
+SIM_SFR( ADCON1 )
+
+/* core, interrupts */
+SIM_SFR( OSCCON )
+SIM_SFR( RCON )
+SIM_SFR( INTCON )
+SIM_SFR( INTCON2 )
+SIM_SFR( PIE1 )
+SIM_SFR( PIE2 )
+SIM_SFR( PIR1 )
+SIM_SFR( PIR2 )
+SIM_SFR( IPR1 )
+SIM_SFR( IPR2 )
+
+/* Timer0 */
+SIM_SFR( T0CON )
+SIM_SFR( TMR0L )
+SIM_SFR( TMR0H )
+
+/* Timer1 */
+SIM_SFR( T1CON )
+SIM_SFR( TMR1L )
+SIM_SFR( TMR1H )
+
+/* CCP1 */
+SIM_SFR( CCP1CON )
+SIM_SFR( CCPR1L )
+SIM_SFR( CCPR1H )
+
+/* EUSART */
+SIM_SFR( SPBRG )
+SIM_SFR( BAUDCON )
+SIM_SFR( TXSTA )
+SIM_SFR( RCSTA )
+SIM_SFR( TXREG )
+
+/* USB */
+SIM_SFR( UCON )
+SIM_SFR( UCFG )
+SIM_SFR( USTAT )
+SIM_SFR( UADDR )
+SIM_SFR( UFRML )
+SIM_SFR( UFRMH )
+SIM_SFR( UIR )
+SIM_SFR( UIE )
+SIM_SFR( UEIR )
+SIM_SFR( UEIE )
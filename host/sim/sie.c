@@ -0,0 +1,328 @@
+/* sie.c */
+/* model of the PIC18 USB serial interface engine */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "p18cxxx.h"
+#include "sim.h"
+
+/* the firmware's USB RAM (see ../../src/usb.c), mapped to 0x400 */
+extern volatile unsigned char g_usbram[];
+#define SIE_RAM_BASE  0x400
+#define SIE_RAM_SIZE  256
+
+/* register bits */
+#define SIE_UOWN      0x80
+#define SIE_DTS       0x40
+#define SIE_DTSEN     0x08
+#define SIE_BSTALL    0x04
+#define SIE_PKTDIS    0x10
+#define SIE_USBEN     0x08
+#define SIE_SUSPND    0x02
+#define SIE_PPBRST    0x40
+#define SIE_FSEN      0x04
+#define SIE_UPUEN     0x10
+#define SIE_EPCONDIS  0x08
+#define SIE_EPOUTEN   0x04
+#define SIE_EPINEN    0x02
+#define SIE_EPSTALL   0x01
+#define SIE_SOFI      0x40
+#define SIE_STALLI    0x20
+#define SIE_TRNI      0x08
+#define SIE_UERRI     0x02
+#define SIE_URSTI     0x01
+#define SIE_CRC16EF   0x04
+#define SIE_BTOEF     0x10
+
+/* depth of the USTAT FIFO */
+#define SIE_FIFO      4
+
+/* static data */
+static unsigned char  g_sie_fifo[ SIE_FIFO ];  /* USTAT values */
+static int            g_sie_nfifo;
+static unsigned char  g_sie_odd[16][2];  /* next ping-pong buffer */
+static unsigned short g_sie_frame;       /* frame number */
+
+/* local prototypes */
+static int sie_ready( unsigned char addr, unsigned char ep );
+static volatile unsigned char * sie_bd( unsigned char ep, unsigned char dir );
+static volatile unsigned char * sie_buf( volatile unsigned char * bd,
+  unsigned char len );
+static void sie_complete( unsigned char ep, unsigned char dir,
+  volatile unsigned char * bd, unsigned char pid, unsigned char toggle );
+static int sie_stall( void );
+
+
+/* bus reset */
+void sie_reset( void )
+{
+  UADDR = 0;
+  UIR |= SIE_URSTI;
+  sim_interrupt();
+}
+
+/* new frame */
+void sie_frame( void )
+{
+  sie_update();
+  g_sie_frame = ( g_sie_frame + 1 ) & 0x7FF;
+
+  /* NOTE: a low-speed device only sees keep-alives, no SOF tokens */
+  if ( sie_fullspeed() && ( UCON & SIE_USBEN ) && !( UCON & SIE_SUSPND ) )
+  {
+    UFRML = g_sie_frame & 0xFF;
+    UFRMH = g_sie_frame >> 8;
+    UIR |= SIE_SOFI;
+  }
+}
+
+/* corrupted transaction */
+int sie_error( unsigned char pid )
+{
+  sie_update();
+  if ( ( UCON & ( SIE_USBEN | SIE_SUSPND ) ) != SIE_USBEN )
+  {
+    return SIE_TIMEOUT;
+  }
+  /* a packet from the host fails its CRC, a corrupted IN data packet is
+    not acknowledged by the host, so the device times out waiting for the
+    handshake and keeps the buffer descriptor for the retry */
+  UEIR |= pid == SIE_PID_IN ? SIE_BTOEF : SIE_CRC16EF;
+  if ( UEIR & UEIE )
+  {
+    UIR |= SIE_UERRI;
+  }
+  sim_interrupt();
+  return SIE_TIMEOUT;
+}
+
+/* whether the device has attached */
+int sie_attached( void )
+{
+  return ( UCON & SIE_USBEN ) && ( UCFG & SIE_UPUEN );
+}
+
+/* whether the device uses full-speed */
+int sie_fullspeed( void )
+{
+  return ( UCFG & SIE_FSEN ) != 0;
+}
+
+/* SETUP transaction */
+int sie_setup( unsigned char addr, const unsigned char * setup )
+{
+  volatile unsigned char * bd;
+  volatile unsigned char * buf;
+  unsigned char i;
+
+  if ( !sie_ready( addr, 0 ) ||
+    ( UEP0 & ( SIE_EPOUTEN | SIE_EPCONDIS ) ) != SIE_EPOUTEN )
+  {
+    return SIE_TIMEOUT;
+  }
+  bd = sie_bd( 0, 0 );
+  if ( !( bd[0] & SIE_UOWN ) || g_sie_nfifo == SIE_FIFO )
+  {
+    /* NOTE: SETUP cannot be NAKed, the SIE ignores it */
+    return SIE_TIMEOUT;
+  }
+  buf = sie_buf( bd, 8 );
+  for ( i = 0; i < 8; i++ )
+  {
+    buf[i] = setup[i];
+  }
+  bd[1] = 8;
+  UCON |= SIE_PKTDIS;
+  sie_complete( 0, 0, bd, SIE_PID_SETUP, 0 );
+  return SIE_ACK;
+}
+
+/* OUT transaction */
+int sie_out( unsigned char addr, unsigned char ep,
+  const unsigned char * data, unsigned char len, unsigned char toggle )
+{
+  volatile unsigned char * bd;
+  volatile unsigned char * buf;
+  unsigned char i;
+
+  if ( !sie_ready( addr, ep ) || !( g_sim_uep[ ep ] & SIE_EPOUTEN ) )
+  {
+    return SIE_TIMEOUT;
+  }
+  if ( g_sim_uep[ ep ] & SIE_EPSTALL )
+  {
+    return sie_stall();
+  }
+  bd = sie_bd( ep, 0 );
+  if ( ( ep == 0 && ( UCON & SIE_PKTDIS ) ) || g_sie_nfifo == SIE_FIFO ||
+    !( bd[0] & SIE_UOWN ) )
+  {
+    return SIE_NAK;
+  }
+  if ( bd[0] & SIE_BSTALL )
+  {
+    return sie_stall();
+  }
+  if ( ( bd[0] & SIE_DTSEN ) && ( ( bd[0] & SIE_DTS ) != 0 ) != toggle )
+  {
+    /* data toggle mismatch: acknowledged, but discarded */
+    return SIE_ACK;
+  }
+  if ( len > bd[1] )
+  {
+    fprintf( stderr, "sie: EP%d OUT buffer overrun (%d > %d bytes)\n",
+      ep, len, bd[1] );
+    len = bd[1];
+  }
+  buf = sie_buf( bd, len );
+  for ( i = 0; i < len; i++ )
+  {
+    buf[i] = data[i];
+  }
+  bd[1] = len;
+  sie_complete( ep, 0, bd, SIE_PID_OUT, toggle );
+  return SIE_ACK;
+}
+
+/* IN transaction */
+int sie_in( unsigned char addr, unsigned char ep,
+  unsigned char * data, unsigned char * len, unsigned char * toggle )
+{
+  volatile unsigned char * bd;
+  volatile unsigned char * buf;
+  unsigned char i;
+
+  if ( !sie_ready( addr, ep ) || !( g_sim_uep[ ep ] & SIE_EPINEN ) )
+  {
+    return SIE_TIMEOUT;
+  }
+  if ( g_sim_uep[ ep ] & SIE_EPSTALL )
+  {
+    return sie_stall();
+  }
+  bd = sie_bd( ep, 1 );
+  if ( ( ep == 0 && ( UCON & SIE_PKTDIS ) ) || g_sie_nfifo == SIE_FIFO ||
+    !( bd[0] & SIE_UOWN ) )
+  {
+    return SIE_NAK;
+  }
+  if ( bd[0] & SIE_BSTALL )
+  {
+    return sie_stall();
+  }
+  *len = bd[1];
+  *toggle = ( bd[0] & SIE_DTS ) != 0;
+  buf = sie_buf( bd, *len );
+  for ( i = 0; i < *len; i++ )
+  {
+    data[i] = buf[i];
+  }
+  sie_complete( ep, 1, bd, SIE_PID_IN, *toggle );
+  return SIE_ACK;
+}
+
+
+/* whether the device answers tokens to addr/ep */
+static int sie_ready( unsigned char addr, unsigned char ep )
+{
+  sie_update();
+  if ( UCON & SIE_PPBRST )
+  {
+    memset( g_sie_odd, 0, sizeof( g_sie_odd ) );
+  }
+  return ( UCON & ( SIE_USBEN | SIE_SUSPND ) ) == SIE_USBEN &&
+    addr == UADDR && ep < 16;
+}
+
+/* buffer descriptor the SIE uses next for ep/dir */
+static volatile unsigned char * sie_bd( unsigned char ep, unsigned char dir )
+{
+  unsigned char odd;
+  unsigned char i;
+
+  odd = g_sie_odd[ ep ][ dir ];
+  switch ( UCFG & 0x03 )
+  {
+    case 0:   /* no ping-pong buffers */
+      i = ep * 2 + dir;
+      break;
+    case 1:   /* EP0 OUT only */
+      i = ep == 0 ? ( dir == 0 ? odd : 2 ) : ep * 2 + dir + 1;
+      break;
+    case 2:   /* all endpoints */
+      i = ep * 4 + dir * 2 + odd;
+      break;
+    default:  /* all but EP0 */
+      i = ep == 0 ? dir : ep * 4 - 2 + dir * 2 + odd;
+      break;
+  }
+  return &g_usbram[ i * 4 ];
+}
+
+/* endpoint buffer of a buffer descriptor */
+static volatile unsigned char * sie_buf( volatile unsigned char * bd,
+  unsigned char len )
+{
+  unsigned short adr;
+
+  adr = bd[2] | (unsigned short)bd[3] << 8;
+  if ( adr < SIE_RAM_BASE || adr + len > SIE_RAM_BASE + SIE_RAM_SIZE )
+  {
+    fprintf( stderr, "sie: buffer address %04X outside of USB RAM\n", adr );
+    exit( 1 );
+  }
+  return &g_usbram[ adr - SIE_RAM_BASE ];
+}
+
+/* hand buffer descriptor back to the CPU, report transaction in USTAT */
+static void sie_complete( unsigned char ep, unsigned char dir,
+  volatile unsigned char * bd, unsigned char pid, unsigned char toggle )
+{
+  unsigned char ustat;
+  unsigned char pp;
+
+  pp = ( UCFG & 0x03 ) == 2 || ( ( UCFG & 0x03 ) == 3 && ep != 0 ) ||
+    ( ( UCFG & 0x03 ) == 1 && ep == 0 && dir == 0 );
+  ustat = ep << 3 | dir << 2 | g_sie_odd[ ep ][ dir ] << 1;
+  if ( pp )
+  {
+    g_sie_odd[ ep ][ dir ] ^= 1;
+  }
+
+  bd[0] = pid << 2 | ( toggle ? SIE_DTS : 0 );
+
+  g_sie_fifo[ g_sie_nfifo++ ] = ustat;
+  if ( g_sie_nfifo == 1 )
+  {
+    USTAT = ustat;
+    UIR |= SIE_TRNI;
+  }
+  sim_interrupt();
+}
+
+/* STALL handshake */
+static int sie_stall( void )
+{
+  UIR |= SIE_STALLI;
+  sim_interrupt();
+  return SIE_STALL;
+}
+
+/* advance the USTAT FIFO once the firmware has cleared TRNIF */
+void sie_update( void )
+{
+  int i;
+
+  if ( g_sie_nfifo != 0 && !( UIR & SIE_TRNI ) )
+  {
+    for ( i = 1; i < g_sie_nfifo; i++ )
+    {
+      g_sie_fifo[ i - 1 ] = g_sie_fifo[i];
+    }
+    if ( --g_sie_nfifo != 0 )
+    {
+      USTAT = g_sie_fifo[0];
+      UIR |= SIE_TRNI;
+    }
+  }
+}
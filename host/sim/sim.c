@@ -0,0 +1,334 @@
+/* sim.c */
+/* virtual time, firmware coroutine and interrupt delivery */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "p18cxxx.h"
+#include "sim.h"
+#include "../../src/timebase.h"
+#include "../../src/config.h"
+#include "../../src/snes.h"
+#include "../../src/playback.h"
+
+/* entry points of the firmware (main.c is compiled with -Dmain=fw_main) */
+void fw_main( void );
+void isr_dispatch( void );
+
+/* special function registers */
+#define SIM_SFR( name )  volatile unsigned char name;
+#include "sfr.h"
+#undef SIM_SFR
+volatile unsigned char g_sim_uep[16];
+
+/* configuration words, as set by ../../src/main.c for the build's CPU
+  clock (../../src/config.h, CPUDIV: 96 MHz PLL / 2, 3, 4 or 6): XTPLL, no
+  power-up timer, brown-out reset */
+#if CONFIG_XTAL_MHZ != 4
+#error "the simulator models the 4 MHz crystal of the board"
+#endif
+#define SIM_CPUDIV \
+  ( 96 / CONFIG_CPU_MHZ == 6 ? 3 : 96 / CONFIG_CPU_MHZ - 2 )
+unsigned char g_sim_config[14] = { 0x20 | SIM_CPUDIV << 3, 0x02, 0x2F };
+
+unsigned long long g_sim_ns;  /* virtual time */
+
+/* static data */
+static ucontext_t         g_sim_host;    /* context of the scenario */
+static ucontext_t         g_sim_fw;      /* context of the firmware */
+static char               g_sim_stack[ 256 * 1024 ];
+static unsigned long long g_sim_until;   /* firmware runs up to here */
+static unsigned long long g_sim_frametimes[ 2048 ];
+static int                g_sim_inisr;
+static int                g_sim_inhigh;  /* in the high priority ISR */
+static unsigned long long g_sim_matched; /* Timer1 count of the last match */
+static unsigned long long g_sim_t1count; /* Timer1 count as last set */
+static int                g_sim_wake;    /* an enabled flag was raised */
+
+/* local prototypes */
+static void sim_fw_entry( void );
+static void sim_tick( void );
+static int sim_pending( int high );
+static void sim_timer1( void );
+static unsigned long long sim_compare( void );
+static unsigned long long sim_mips( void );
+static void sim_pins( void );
+
+
+/* start the firmware coroutine */
+void sim_start( void )
+{
+  /* reset time-outs from power-on (time 0) to the first instruction:
+    power-up timer if enabled (PWRTEN, active low), oscillator start-up
+    timer (1024 periods of the 4 MHz crystal) and PLL lock */
+  /* NOTE: the supply is ideal, brown-out reset never holds the device */
+  g_sim_ns = 256 * SIM_US + 2 * SIM_MS;
+  if ( !( g_sim_config[2] & 0x01 ) )
+  {
+    g_sim_ns += 65600 * SIM_US;
+  }
+
+  PORTA = 0xFF;   /* inputs pulled up */
+  pad_init();
+  IPR1 = 0xFF;    /* reset values: all sources at high priority */
+  IPR2 = 0xFF;
+  INTCON2 = 0xF5;
+
+  getcontext( &g_sim_fw );
+  g_sim_fw.uc_stack.ss_sp = g_sim_stack;
+  g_sim_fw.uc_stack.ss_size = sizeof( g_sim_stack );
+  g_sim_fw.uc_link = NULL;
+  makecontext( &g_sim_fw, sim_fw_entry, 0 );
+}
+
+/* let the firmware run */
+void sim_run( unsigned long long ns )
+{
+  g_sim_until = g_sim_ns + ns;
+  swapcontext( &g_sim_host, &g_sim_fw );
+}
+
+/* deliver pending interrupts */
+void sim_interrupt( void )
+{
+  if ( UIR & UIE )
+  {
+    PIR2 |= 0x20;   /* USBIF, also without GIE (USB_POLLED build) */
+  }
+  if ( ( PIE1 & PIR1 ) || ( PIE2 & PIR2 ) ||
+    ( ( INTCON & 0x20 ) && ( INTCON & 0x04 ) ) )
+  {
+    g_sim_wake = 1;   /* ends SLEEP, whatever GIE says */
+  }
+  if ( ( INTCON & 0x80 ) == 0 )
+  {
+    return;   /* GIE, or GIEH with priorities */
+  }
+  if ( RCON & 0x80 )
+  {
+    /* IPEN: the high priority vector is the timed scan or the playback
+      window (see main.c), it may interrupt the low priority ISR */
+    if ( !g_sim_inhigh && sim_pending( 1 ) )
+    {
+      g_sim_inhigh = 1;
+#if defined( SNES_TIMED )
+      snes_ccpint();
+#elif defined( PLAYBACK )
+      playback_ccpint();
+#endif
+      g_sim_inhigh = 0;
+    }
+    if ( ( INTCON & 0x40 ) == 0 )
+    {
+      return;   /* GIEL */
+    }
+  }
+  if ( g_sim_inisr || g_sim_inhigh )
+  {
+    return;   /* GIE is cleared while in the ISR */
+  }
+  if ( sim_pending( 0 ) )
+  {
+    g_sim_inisr = 1;
+    isr_dispatch();
+    g_sim_inisr = 0;
+  }
+}
+
+/* time of a firmware frame number */
+unsigned long long sim_frametime( unsigned short frame )
+{
+  return g_sim_frametimes[ frame & 0x7FF ];
+}
+
+
+/* busy wait of the firmware */
+void sim_delay_us( unsigned char us )
+{
+  unsigned long long end;
+  unsigned long long next;
+  unsigned long long tick;
+  unsigned long long match;
+  unsigned long long edge;
+
+  end = g_sim_ns + us * SIM_US;
+  sim_pins();
+  sie_update();
+  sim_interrupt();
+  while ( g_sim_ns < end )
+  {
+    if ( g_sim_ns >= g_sim_until )
+    {
+      /* back to the scenario until it calls sim_run() again */
+      swapcontext( &g_sim_fw, &g_sim_host );
+    }
+    next  = end < g_sim_until ? end : g_sim_until;
+    tick  = ( g_sim_ns / SIM_MS + 1 ) * SIM_MS;
+    match = sim_compare();
+    edge  = console_next();
+    if ( edge <= next && edge < tick && edge < match )
+    {
+      /* the console drives an edge */
+      g_sim_ns = edge;
+      sim_timer1();
+      console_update();
+    }
+    else if ( match <= next && match < tick )
+    {
+      /* CCP1 compare match, the controller sees the edges it writes */
+      g_sim_ns = match;
+      g_sim_matched = g_sim_ns * sim_mips() / SIM_US;
+      sim_timer1();
+      sim_pins();
+      PIR1 |= 0x04;   /* CCP1IF */
+      sim_interrupt();
+      sim_pins();
+    }
+    else if ( tick <= next )
+    {
+      g_sim_ns = tick;
+      sim_timer1();
+      sim_tick();
+    }
+    else
+    {
+      g_sim_ns = next;
+      sim_timer1();
+    }
+  }
+  sim_pins();
+}
+
+/* SLEEP instruction */
+void sim_sleep( void )
+{
+  unsigned long long tick;
+
+  /* NOTE: the bus model never suspends, so this is the idle mode of the
+    clock profiles (or a sleep woken up right away): the next interrupt
+    comes with the next millisecond at the latest, a transaction of the
+    host or a timer may end it earlier (to the us) */
+  tick = ( g_sim_ns / SIM_MS + 1 ) * SIM_MS;
+  g_sim_wake = 0;
+  while ( g_sim_ns < tick && !g_sim_wake )
+  {
+    sim_delay_us( 1 );
+  }
+}
+
+/* RESET instruction */
+void sim_reset( void )
+{
+  fprintf( stderr, "sim: device reset at %llu us\n", g_sim_ns / SIM_US );
+  exit( 1 );
+}
+
+
+/* firmware coroutine */
+static void sim_fw_entry( void )
+{
+  fw_main();
+  fprintf( stderr, "sim: main() returned\n" );
+  exit( 1 );
+}
+
+/* whether an enabled interrupt of the given priority is pending */
+static int sim_pending( int high )
+{
+  unsigned char pir1;
+  unsigned char pir2;
+  unsigned char tmr0;
+
+  pir1 = PIE1 & PIR1;
+  pir2 = PIE2 & PIR2;
+  tmr0 = ( INTCON & 0x20 ) && ( INTCON & 0x04 );
+  if ( RCON & 0x80 )
+  {
+    /* IPEN: sources go by their priority bits */
+    pir1 &= high ? IPR1 : ~IPR1;
+    pir2 &= high ? IPR2 : ~IPR2;
+    tmr0 = tmr0 && ( ( INTCON2 & 0x04 ) != 0 ) == high;
+  }
+  return pir1 || pir2 || tmr0;
+}
+
+/* Timer1 counts instruction cycles while it is on, TMR1IF is set when the
+  count wraps */
+/* NOTE: the count is not kept across T1CON changes, firmware only starts
+  it and lets it run */
+static void sim_timer1( void )
+{
+  unsigned long long count;
+
+  if ( T1CON & 0x01 )
+  {
+    count = g_sim_ns * sim_mips() / SIM_US;
+    TMR1L = count & 0xFF;
+    TMR1H = ( count >> 8 ) & 0xFF;
+    if ( g_sim_t1count != 0 && ( count >> 16 ) != ( g_sim_t1count >> 16 ) )
+    {
+      PIR1 |= 0x01;   /* TMR1IF */
+    }
+    g_sim_t1count = count;
+  }
+  else
+  {
+    g_sim_t1count = 0;
+  }
+}
+
+/* time of the next CCP1 compare match, ~0 if none */
+static unsigned long long sim_compare( void )
+{
+  unsigned long long count;
+  unsigned long long delta;
+
+  if ( !( T1CON & 0x01 ) || ( CCP1CON & 0x0F ) != 0x0A )
+  {
+    return ~0ULL;
+  }
+  count = g_sim_ns * sim_mips() / SIM_US;
+  delta = ( ( CCPR1H << 8 | CCPR1L ) - count ) & 0xFFFF;
+  if ( delta == 0 )
+  {
+    if ( count != g_sim_matched )
+    {
+      return g_sim_ns;
+    }
+    delta = 0x10000;  /* just matched, next time after a wrap-around */
+  }
+  return ( ( count + delta ) * SIM_US + sim_mips() - 1 ) / sim_mips();
+}
+
+/* instruction cycles per us of the configured CPU clock */
+/* NOTE: the firmware assumes its build's (CONFIG_MIPS), a driver that
+  changes the configuration words runs an image built for them */
+static unsigned long long sim_mips( void )
+{
+  unsigned char cpudiv;
+
+  cpudiv = ( g_sim_config[0] >> 3 ) & 0x03;
+  return 24 / ( cpudiv == 3 ? 6 : cpudiv + 2 );
+}
+
+/* the pin models follow time and the firmware's latches */
+static void sim_pins( void )
+{
+  pad_update();
+  console_update();
+}
+
+/* millisecond boundary */
+static void sim_tick( void )
+{
+  /* NOTE: Timer0 is not simulated count by count, if it runs it overflows
+    once per millisecond */
+  if ( T0CON & 0x80 )
+  {
+    INTCON |= 0x04;   /* TMR0IF */
+  }
+  sie_frame();
+  sim_interrupt();
+
+  g_sim_frametimes[ timebase_frame() & 0x7FF ] = g_sim_ns;
+}
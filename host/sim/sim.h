@@ -0,0 +1,177 @@
+#ifndef SIM_H
+#define SIM_H
+
+/* Host simulator of the adapter
+
+  The firmware (../../src, built with the device header of this directory)
+  runs unmodified in a coroutine. Virtual time only passes while it waits
+  in a delay, and interrupts are taken at those points. The scenario in
+  snessim.c plays the USB host: it lets the firmware run with sim_run() and
+  talks to it through the SIE model (sie.c) and the host side transfer
+  functions (host.c). */
+
+/* virtual time [ns] */
+#define SIM_US  1000ULL
+#define SIM_MS  1000000ULL
+extern unsigned long long g_sim_ns;
+
+/* powers up the device at time 0, firmware starts with main() after the
+  reset time-outs */
+void sim_start( void );
+
+/* lets the firmware run for ns */
+void sim_run( unsigned long long ns );
+
+/* takes pending interrupts, called by the models after setting flags */
+void sim_interrupt( void );
+
+/* returns the time at which the firmware's frame number (see
+  timebase_frame()) last took the given value */
+unsigned long long sim_frametime( unsigned short frame );
+
+
+/* SIE model (sie.c) */
+
+/* handshake of a transaction */
+enum sie_result
+{
+  SIE_ACK,
+  SIE_NAK,
+  SIE_STALL,
+  SIE_TIMEOUT   /* no response from the device */
+};
+
+/* token PIDs */
+enum sie_pid
+{
+  SIE_PID_OUT   = 0x1,
+  SIE_PID_IN    = 0x9,
+  SIE_PID_SETUP = 0xD
+};
+
+/* signals a bus reset */
+void sie_reset( void );
+
+/* notices TRNIF cleared by the firmware, called whenever it waits */
+void sie_update( void );
+
+/* start of a new frame, called once per millisecond */
+void sie_frame( void );
+
+/* returns whether the device has attached (USB enabled, pull-up on) */
+int sie_attached( void );
+
+/* returns whether the device is attached as full-speed device */
+int sie_fullspeed( void );
+
+/* a transaction with token pid was corrupted on the bus, sets the
+  device's error flags, returns SIE_TIMEOUT */
+int sie_error( unsigned char pid );
+
+/* transactions, data toggle is 0 (DATA0) or 1 (DATA1) */
+int sie_setup( unsigned char addr, const unsigned char * setup );
+int sie_out( unsigned char addr, unsigned char ep,
+  const unsigned char * data, unsigned char len, unsigned char toggle );
+int sie_in( unsigned char addr, unsigned char ep,
+  unsigned char * data, unsigned char * len, unsigned char * toggle );
+
+
+/* SNES controller model (pad.c) */
+
+/* connects the controller, no button pressed, powered by SNES_VCC */
+void pad_init( void );
+
+/* appends to the button timeline: buttons (enum snes_buttons) are
+  pressed from time [ns] on */
+void pad_event( unsigned long long time, unsigned short buttons );
+
+/* follows virtual time and LATA, called whenever the firmware waits */
+void pad_update( void );
+
+/* returns when the firmware first latched the buttons of the n-th
+  event, 0 if not yet */
+unsigned long long pad_sampled( int event );
+
+/* returns the number of scans so far */
+unsigned long pad_scans( void );
+
+/* prints power-up, scan rate and timing violations */
+void pad_summary( void );
+
+/* returns the propagation delay from clock or latch to data, and the
+  time the supply takes to settle after power-up [ns] */
+void pad_timing( unsigned long long * pd, unsigned long long * power );
+
+/* disconnects the controller, DATA is left to the firmware */
+void pad_unplug( void );
+
+
+/* SNES console model (console.c), for the PLAYBACK build */
+
+/* connects the console in place of the controller: it powers the port and
+  reads it at time first [ns], then every period [ns] */
+void console_init( unsigned long long first, unsigned long long period );
+
+/* follows virtual time and DATA, called whenever the firmware waits */
+void console_update( void );
+
+/* returns the time of the next latch or clock edge, ~0 if unplugged */
+unsigned long long console_next( void );
+
+/* returns the number of complete reads */
+int console_reads( void );
+
+/* returns the buttons the n-th read got (enum snes_buttons), and when its
+  latch rose [ns] */
+unsigned short console_read( int n, unsigned long long * time );
+
+/* prints reads and the response to the clock */
+void console_summary( void );
+
+
+/* host side (host.c) */
+
+/* device address assigned by host_enumerate() */
+#define HOST_ADDR  1
+
+/* corrupted transactions per 1000 */
+extern unsigned int g_host_errors;
+
+/* control transfers time out after this [ns], 5 s like on Linux */
+#define HOST_CTRL_TIMEOUT  ( 5000 * SIM_MS )
+extern unsigned long long g_host_timeout;
+
+/* handshake (enum sie_result) that ended the last control transfer */
+extern int g_host_handshake;
+
+/* max. packet size of EP0, as Linux assumes it (64 at full-speed, 8 at
+  low-speed) until host_enumerate() has read it */
+extern unsigned char g_host_mps0;
+
+/* NAKed transactions of control transfers and host_enumerate() */
+extern unsigned int g_host_naks;
+
+/* time the device attached, and SET_CONFIGURATION completed in
+  host_enumerate() */
+extern unsigned long long g_host_attached;
+extern unsigned long long g_host_configured;
+
+/* returns whether the next transaction is corrupted (see g_host_errors) */
+int host_error( void );
+
+/* time a transaction with len data bytes occupies the bus [ns] */
+unsigned long long host_txtime( unsigned char len );
+
+/* performs a control transfer, returns number of data bytes or -1 */
+int host_control( unsigned char addr, unsigned char bmRequestType,
+  unsigned char bRequest, unsigned short wValue, unsigned short wIndex,
+  unsigned short wLength, unsigned char * data );
+
+/* waits for the device to attach, and the 100 ms debounce interval */
+void host_attach( void );
+
+/* host_attach(), then resets and configures the device like a Linux host
+  with usbhid does, returns 0 on success */
+int host_enumerate( void );
+
+#endif  /* defined SIM_H */
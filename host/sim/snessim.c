@@ -0,0 +1,826 @@
+/* snessim.c */
+/* runs the firmware against a simulated Linux host
+
+  usage: snessim [-t ms] [-p ms] [-l us] [-j us] [-s seed] [-e errors]
+                 [-q us]
+                 [-c period,spread,count,mask | -b script | -v movie |
+                  -w ms]
+
+  Powers up the device and enumerates it, printing when it attached, when
+  it was configured and when its report descriptor was read (all from
+  power-on) and how many NAKs the host saw at EP0 meanwhile. Then starts
+  the loopback test mode with the settings of -c (see
+  ../../src/loopback.h) and polls the report endpoint every -p ms for -t
+  ms. Each report is printed as "snesbench -w" records it, with an arrival
+  time that adds -l us fixed and up to -j us uniformly distributed OS
+  latency to the end of the IN transaction.
+
+  The true latency, from the start of the frame stamped into the report
+  to its arrival, is printed to stderr. "snessim | snesbench -r -" must
+  report the same distribution, shifted by its minimum. The first report,
+  the button states the device queued at power-up, is only printed to
+  stderr with its arrival time.
+
+  With -b the buttons come from the controller model (pad.c) instead of
+  the loopback test mode. Each line of the script is "ms buttons": time
+  after the start of polling and the pressed buttons in hex (enum
+  snes_buttons, ../../src/snes.h). For each change the time from the
+  press to the arrival of its report is printed, and the sample age: how
+  old the scan was when its report arrived. Changes that never show up in
+  a report of their own are counted as missed.
+
+  -q sends a latch request (USB_LATCH, see ../../src/usb.h) that many us
+  before each poll, as a game would right before it reads the pad, unless
+  the last one is still unanswered, and prints the time from each request
+  to the arrival of its answer. The first request puts the device into the
+  on-demand mode.
+
+  -v plays a movie to a console (PLAYBACK, see ../../src/playback.h):
+  the console model (console.c) replaces the controller, reads the port
+  at the NTSC rate from shortly after enumeration on, and the frames of
+  the movie, one per line in hex (enum snes_buttons), go to EP2 OUT: up to
+  16 per packet, one attempt every -p ms. Playback starts once the buffer
+  is full (the first NAK), and ends when it has run dry after the last
+  frame or after -t ms. Prints the reads of the console compared with the
+  movie, the playback status and the response of the adapter to the clock.
+
+  -w reads the sample stream (USB_STREAM, see ../../src/usb.h) at EP2 IN
+  every -w ms instead of polling the report endpoint, then every frame for
+  a few ms to collect what is left. Each packet must carry the next
+  sequence number and a drop counter that never goes back. At the end the
+  samples received and the samples dropped are compared with the scans of
+  the controller model meanwhile: they must add up, give or take the two
+  buffers of the adapter. An interval above what two packets hold (about
+  5 ms at 48 MHz) makes the adapter drop samples.
+
+  The CPU clock, the bus speed and bInterval are those the firmware was
+  built for (../../src/config.h, "make CPU_MHZ=24 FULLSPEED=0" builds the
+  simulator for low-speed), -p defaults to the polling interval Linux
+  makes of bInterval. -e corrupts that many transactions per 1000 on the
+  bus. The scan rate and timing violations of the controller model and the
+  link statistics of the device (see ../../src/stats.h) are printed at the
+  end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "p18cxxx.h"
+#include "sim.h"
+#include "../../src/snes.h"
+#include "../../src/timebase.h"
+#include "../../src/config.h"
+
+/* report IDs (see ../../src/usb.c) */
+#define REPORT_ID           1
+#define REPORT_SIZE         5
+#define LOOPBACK_REPORT_ID  2
+#define STATS_REPORT_ID     3
+#define STATS_COUNT         10
+#define LATCH_REPORT_ID     4
+#define PLAYBACK_REPORT_ID  5
+#define PLAYBACK_SIZE       11
+
+/* playback stream (see ../../src/usb.h) */
+#define PLAYBACK_EP         2
+#define PLAYBACK_PACKET     32
+
+/* sample stream (see ../../src/usb.h) */
+#define STREAM_EP           2
+#define STREAM_SIZE         64
+#define STREAM_HEADER       4
+#define STREAM_SAMPLE       5
+#define STREAM_SAMPLES      ( ( STREAM_SIZE - STREAM_HEADER ) / STREAM_SAMPLE )
+#define STREAM_DRAIN        3   /* polls every frame at the end */
+
+/* console model: NTSC frame period, the first read after enumeration */
+#define CONSOLE_PERIOD      ( 16639 * SIM_US )
+#define CONSOLE_FIRST       ( 10 * SIM_MS + 123 * SIM_US )
+
+/* HID class requests */
+#define REQ_GET_REPORT  0x01
+#define REQ_SET_REPORT  0x09
+
+/* button script of -b */
+struct script
+{
+  unsigned long long time;     /* [ns] after the start of polling */
+  unsigned short     buttons;
+};
+
+/* minimum, mean and maximum */
+struct minmax
+{
+  unsigned long n;
+  double        sum;
+  double        min;
+  double        max;
+};
+
+/* static data */
+static struct script *  g_script;
+static int              g_nscript;
+static unsigned short * g_movie;
+static int              g_nmovie;
+
+
+/* read the button script */
+static int load_script( const char * file )
+{
+  FILE *       f;
+  char         line[ 128 ];
+  double       ms;
+  unsigned int buttons;
+
+  f = fopen( file, "r" );
+  if ( f == NULL )
+  {
+    perror( file );
+    return -1;
+  }
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] == '#' || sscanf( line, "%lf %x", &ms, &buttons ) != 2 )
+    {
+      continue;
+    }
+    g_script = realloc( g_script, ( g_nscript + 1 ) * sizeof( *g_script ) );
+    if ( g_script == NULL )
+    {
+      perror( "realloc" );
+      exit( 1 );
+    }
+    g_script[ g_nscript ].time = (unsigned long long)( ms * SIM_MS );
+    g_script[ g_nscript ].buttons = buttons;
+    ++g_nscript;
+  }
+  fclose( f );
+  return 0;
+}
+
+/* read the movie of -v */
+static int load_movie( const char * file )
+{
+  FILE *       f;
+  char         line[ 128 ];
+  unsigned int buttons;
+
+  f = fopen( file, "r" );
+  if ( f == NULL )
+  {
+    perror( file );
+    return -1;
+  }
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] == '#' || sscanf( line, "%x", &buttons ) != 1 )
+    {
+      continue;
+    }
+    g_movie = realloc( g_movie, ( g_nmovie + 1 ) * sizeof( *g_movie ) );
+    if ( g_movie == NULL )
+    {
+      perror( "realloc" );
+      exit( 1 );
+    }
+    g_movie[ g_nmovie++ ] = buttons;
+  }
+  fclose( f );
+  return 0;
+}
+
+/* add a value in ms */
+static void add_minmax( struct minmax * m, unsigned long long ns )
+{
+  double x;
+
+  x = ns / (double)SIM_MS;
+  if ( m->n++ == 0 || x < m->min )
+  {
+    m->min = x;
+  }
+  if ( m->n == 1 || x > m->max )
+  {
+    m->max = x;
+  }
+  m->sum += x;
+}
+
+/* print minimum, mean and maximum */
+static void print_minmax( const char * what, const struct minmax * m )
+{
+  if ( m->n != 0 )
+  {
+    fprintf( stderr, "snessim: %s [ms]: min %.3f mean %.3f max %.3f\n",
+      what, m->min, m->sum / m->n, m->max );
+  }
+}
+
+
+/* start the loopback test mode */
+static int start_loopback( unsigned short period, unsigned char spread,
+  unsigned short count, unsigned short mask )
+{
+  unsigned char buf[9];
+
+  buf[0] = LOOPBACK_REPORT_ID;
+  buf[1] = 1;
+  buf[2] = period & 0xFF;
+  buf[3] = period >> 8;
+  buf[4] = spread;
+  buf[5] = count & 0xFF;
+  buf[6] = count >> 8;
+  buf[7] = mask & 0xFF;
+  buf[8] = mask >> 8;
+  if ( host_control( HOST_ADDR, 0x21, REQ_SET_REPORT,
+    0x0300 | LOOPBACK_REPORT_ID, 0, sizeof( buf ), buf ) != sizeof( buf ) )
+  {
+    return -1;
+  }
+
+  /* the main loop applies the settings */
+  sim_run( 5 * SIM_MS );
+  if ( host_control( HOST_ADDR, 0xA1, REQ_GET_REPORT,
+    0x0300 | LOOPBACK_REPORT_ID, 0, sizeof( buf ), buf ) != sizeof( buf ) ||
+    buf[0] != LOOPBACK_REPORT_ID || buf[1] != 1 )
+  {
+    return -1;
+  }
+  return 0;
+}
+
+
+/* print the link statistics */
+static void print_stats( void )
+{
+  static const char * const names[ STATS_COUNT ] =
+  {
+    "resets", "stalls", "pid", "crc5", "crc16", "dfn8", "bto", "bts",
+    "sent", "coalesced"
+  };
+  unsigned char buf[ 1 + 2 * STATS_COUNT ];
+  int           i;
+
+  if ( host_control( HOST_ADDR, 0xA1, REQ_GET_REPORT,
+    0x0300 | STATS_REPORT_ID, 0, sizeof( buf ), buf ) != sizeof( buf ) ||
+    buf[0] != STATS_REPORT_ID )
+  {
+    fprintf( stderr, "snessim: no link statistics\n" );
+    return;
+  }
+  fprintf( stderr, "snessim: link" );
+  for ( i = 0; i < STATS_COUNT; i++ )
+  {
+    fprintf( stderr, " %s %u", names[i], buf[ 1 + 2 * i ] |
+      buf[ 2 + 2 * i ] << 8 );
+  }
+  fprintf( stderr, "\n" );
+}
+
+
+/* playback control, 1 starts and 0 stops */
+static int playback_control( unsigned char play )
+{
+  unsigned char buf[ 1 + PLAYBACK_SIZE ];
+
+  memset( buf, 0, sizeof( buf ) );
+  buf[0] = PLAYBACK_REPORT_ID;
+  buf[1] = play;
+  return host_control( HOST_ADDR, 0x21, REQ_SET_REPORT,
+    0x0300 | PLAYBACK_REPORT_ID, 0, sizeof( buf ), buf ) == sizeof( buf ) ?
+    0 : -1;
+}
+
+/* playback status */
+static int playback_status( unsigned char * buf )
+{
+  return host_control( HOST_ADDR, 0xA1, REQ_GET_REPORT,
+    0x0300 | PLAYBACK_REPORT_ID, 0, 1 + PLAYBACK_SIZE, buf ) ==
+    1 + PLAYBACK_SIZE && buf[0] == PLAYBACK_REPORT_ID ? 0 : -1;
+}
+
+/* play the movie to the console model */
+static int run_playback( unsigned int duration, unsigned int interval )
+{
+  unsigned char      packet[ PLAYBACK_PACKET ];
+  unsigned char      status[ 1 + PLAYBACK_SIZE ];
+  unsigned long long poll;
+  unsigned long long end;
+  unsigned long long started;
+  unsigned long long stopped;
+  unsigned long long time;
+  unsigned long      naks;
+  unsigned long      gaps;
+  unsigned long      wrong;
+  unsigned short     buttons;
+  unsigned char      toggle;
+  unsigned char      buffered;
+  int                sent;
+  int                played;
+  int                len;
+  int                r;
+  int                i;
+
+  if ( playback_status( status ) != 0 )
+  {
+    fprintf( stderr, "snessim: no playback control (PLAYBACK)\n" );
+    return 1;
+  }
+  console_init( g_sim_ns + CONSOLE_FIRST, CONSOLE_PERIOD );
+
+  /* feed EP2 OUT, one attempt per interval; a packet NAKed or corrupted
+    goes again with the same toggle */
+  toggle = 0;
+  sent = 0;
+  naks = 0;
+  started = 0;
+  poll = ( g_sim_ns / SIM_MS + 1 ) * SIM_MS;
+  end = g_sim_ns + duration * SIM_MS;
+  while ( poll < end )
+  {
+    sim_run( poll - g_sim_ns );
+    poll += interval * SIM_MS;
+    if ( sent < g_nmovie )
+    {
+      len = 0;
+      for ( i = sent; i < g_nmovie && len < PLAYBACK_PACKET; i++ )
+      {
+        packet[ len++ ] = g_movie[i] & 0xFF;
+        packet[ len++ ] = g_movie[i] >> 8;
+      }
+      r = host_error() ? sie_error( SIE_PID_OUT ) :
+        sie_out( HOST_ADDR, PLAYBACK_EP, packet, len, toggle );
+      if ( r == SIE_TIMEOUT && sent == 0 && naks == 0 && !host_error() )
+      {
+        fprintf( stderr, "snessim: no playback endpoint (full-speed "
+          "only)\n" );
+        return 1;
+      }
+      if ( r == SIE_ACK )
+      {
+        toggle ^= 1;
+        sent += len / 2;
+      }
+      else if ( r == SIE_NAK )
+      {
+        ++naks;
+      }
+      if ( started == 0 && ( r == SIE_NAK || sent == g_nmovie ) )
+      {
+        /* buffer full, or all of the movie in it */
+        if ( playback_control( 1 ) != 0 )
+        {
+          fprintf( stderr, "snessim: playback not started\n" );
+          return 1;
+        }
+        started = g_sim_ns;
+        fprintf( stderr, "snessim: playback started at %.3f ms with %d "
+          "frames sent\n", started / (double)SIM_MS, sent );
+      }
+    }
+    else if ( playback_status( status ) != 0 )
+    {
+      return 1;
+    }
+    else if ( status[8] == 0 )
+    {
+      /* ran dry: the last frame went to the last latch */
+      sim_run( CONSOLE_PERIOD );
+      break;
+    }
+  }
+  if ( playback_status( status ) != 0 )
+  {
+    return 1;
+  }
+  buffered = status[8];
+  if ( playback_control( 0 ) != 0 )
+  {
+    return 1;
+  }
+  stopped = g_sim_ns;
+  sim_run( SIM_MS );    /* the main loop applies it */
+  if ( playback_status( status ) != 0 )
+  {
+    return 1;
+  }
+
+  /* the console's reads from the start to the stop against the movie: a
+    read of no buttons where the movie has some is a latch without a frame
+    (before the first, an underrun or a lost latch), which consumes none */
+  /* NOTE: where the movie has no buttons either, it counts as played */
+  played = 0;
+  gaps = 0;
+  wrong = 0;
+  for ( i = 0; i < console_reads(); i++ )
+  {
+    buttons = console_read( i, &time );
+    if ( started == 0 || time < started || time >= stopped ||
+      played == g_nmovie )
+    {
+      continue;
+    }
+    if ( buttons == g_movie[ played ] )
+    {
+      ++played;
+    }
+    else if ( buttons == 0 )
+    {
+      ++gaps;
+    }
+    else
+    {
+      ++wrong;
+      ++played;
+    }
+  }
+  fprintf( stderr, "snessim: %d of %d frames sent (%lu NAKs), console read "
+    "%d as played, %lu wrong, %lu reads without a frame\n", sent,
+    g_nmovie, naks, played - (int)wrong, wrong, gaps );
+  fprintf( stderr, "snessim: playback stopped, state %02x, played %u "
+    "underruns %u lost %u, buffer %u of %u, period %u us\n", status[1],
+    status[2] | status[3] << 8, status[4] | status[5] << 8,
+    status[6] | status[7] << 8, buffered, status[9],
+    status[10] | status[11] << 8 );
+  console_summary();
+  print_stats();
+  return 0;
+}
+
+
+/* read the sample stream, check it against the scans */
+static int run_stream( unsigned int duration, unsigned int interval )
+{
+  unsigned char      data[ STREAM_SIZE ];
+  unsigned long long poll;
+  unsigned long long end;
+  unsigned long      packets;
+  unsigned long      samples;
+  unsigned long      drops;
+  unsigned long      gaps;
+  unsigned long      bad;
+  unsigned long      scans;
+  unsigned char      len;
+  unsigned char      toggle;
+  unsigned char      expect;
+  unsigned char      seq;
+  unsigned char      dropped;
+  long               left;
+  int                drain;
+  int                r;
+
+  packets = 0;
+  samples = 0;
+  drops = 0;
+  gaps = 0;
+  bad = 0;
+  scans = 0;
+  expect = 0;
+  seq = 0;
+  dropped = 0;
+  drain = 0;
+  poll = ( g_sim_ns / SIM_MS + 1 ) * SIM_MS;
+  end = g_sim_ns + duration * SIM_MS;
+  while ( drain < STREAM_DRAIN )
+  {
+    sim_run( poll - g_sim_ns );
+    if ( poll < end )
+    {
+      poll += interval * SIM_MS;
+    }
+    else
+    {
+      poll += SIM_MS;
+      ++drain;
+    }
+    len = sizeof( data );
+    r = host_error() ? sie_error( SIE_PID_IN ) :
+      sie_in( HOST_ADDR, STREAM_EP, data, &len, &toggle );
+    if ( r == SIE_TIMEOUT && packets == 0 && !host_error() )
+    {
+      fprintf( stderr, "snessim: no stream endpoint (USB_STREAM, "
+        "full-speed only)\n" );
+      return 1;
+    }
+    if ( r != SIE_ACK || toggle != expect )
+    {
+      continue;   /* NAK, corrupted, or the retry of an ACK we lost */
+    }
+    expect ^= 1;
+    if ( len < STREAM_HEADER || data[3] > STREAM_SAMPLES ||
+      len != STREAM_HEADER + data[3] * STREAM_SAMPLE ||
+      data[2] != CONFIG_MIPS )
+    {
+      ++bad;
+      continue;
+    }
+
+    /* the first packet holds the first scan after the configuration, the
+      count starts from here */
+    if ( packets++ != 0 )
+    {
+      if ( data[0] != (unsigned char)( seq + 1 ) )
+      {
+        ++gaps;
+      }
+      /* NOTE: 8 bit, so no more than 255 drops between two packets */
+      drops += (unsigned char)( data[1] - dropped );
+      samples += data[3];
+    }
+    else
+    {
+      scans = pad_scans();
+    }
+    seq = data[0];
+    dropped = data[1];
+  }
+  scans = pad_scans() - scans;
+
+  /* samples scanned before the first packet arrived go out with the
+    second, those scanned after the last one arrived are still in the
+    adapter: either way no more than a packet and the scan running */
+  left = (long)scans - (long)( samples + drops );
+  fprintf( stderr, "snessim: stream: %lu packets, %lu sequence gaps, %lu "
+    "malformed, %lu samples, %lu dropped, %lu scans meanwhile, %ld not "
+    "accounted for: %s\n", packets, gaps, bad, samples, drops, scans, left,
+    packets != 0 && gaps == 0 && bad == 0 &&
+    left >= -( STREAM_SAMPLES + 1 ) && left <= STREAM_SAMPLES + 1 ?
+    "OK" : "MISMATCH" );
+  pad_summary();
+  print_stats();
+  return 0;
+}
+
+
+int main( int argc, char * argv[] )
+{
+  unsigned long long start;
+  unsigned long long end;
+  unsigned long long poll;
+  unsigned long long arrival;
+  unsigned long long lat;
+  unsigned char      data[8];
+  unsigned char      len;
+  unsigned char      toggle;
+  unsigned char      expect;
+  unsigned char      latch[2];
+  unsigned char      latch_toggle;
+  unsigned long long latch_time;
+  unsigned short     latch_frame;
+  unsigned int       ahead;
+  unsigned long      latch_naks;
+  unsigned int       period;
+  unsigned int       spread;
+  unsigned int       count;
+  unsigned int       mask;
+  unsigned int       duration;
+  unsigned int       interval;
+  unsigned int       latency;
+  unsigned int       jitter;
+  unsigned short     frame;
+  unsigned long      n;
+  double             sum;
+  double             sum2;
+  double             min;
+  double             max;
+  double             x;
+  int                r;
+  int                ev;
+  int                i;
+  unsigned long      missed;
+  unsigned char      hid[2];
+  struct minmax      presslat;
+  struct minmax      age;
+  struct minmax      answer;
+  const char *       script;
+  const char *       movie;
+  unsigned int       stream;
+  int                opt;
+
+  duration = 60000;
+  interval = CONFIG_POLL_HOST_MS;
+  latency  = 50;
+  jitter   = 0;
+  period   = 100;
+  spread   = 37;
+  count    = 0;
+  mask     = 0x0001;  /* B */
+  script   = NULL;
+  movie    = NULL;
+  ahead    = 0;
+  stream   = 0;
+  while ( ( opt = getopt( argc, argv, "t:p:l:j:s:e:q:c:b:v:w:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 't': duration = atoi( optarg ); break;
+      case 'p': interval = atoi( optarg ); break;
+      case 'l': latency = atoi( optarg ); break;
+      case 'j': jitter = atoi( optarg ); break;
+      case 's': srand( atoi( optarg ) ); break;
+      case 'e': g_host_errors = atoi( optarg ); break;
+      case 'q': ahead = atoi( optarg ); break;
+      case 'b': script = optarg; break;
+      case 'v': movie = optarg; break;
+      case 'w': stream = atoi( optarg ); break;
+      case 'c':
+        if ( sscanf( optarg, "%u,%u,%u,%x", &period, &spread, &count,
+          &mask ) != 4 )
+        {
+          fprintf( stderr, "-c period,spread,count,mask\n" );
+          return 2;
+        }
+        break;
+      default:
+        fprintf( stderr, "usage: %s [-t ms] [-p ms] [-l us] [-j us] "
+          "[-s seed] [-e errors] [-q us]\n       [-c period,spread,count,"
+          "mask | -b script | -v movie | -w ms]\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( interval == 0 )
+  {
+    interval = 1;
+  }
+  if ( ahead >= interval * 1000 )
+  {
+    fprintf( stderr, "-q below the polling interval\n" );
+    return 2;
+  }
+  if ( script != NULL && load_script( script ) != 0 )
+  {
+    return 1;
+  }
+  if ( movie != NULL && load_movie( movie ) != 0 )
+  {
+    return 1;
+  }
+
+  /* power up, the firmware initializes and attaches */
+  sim_start();
+  if ( host_enumerate() != 0 )
+  {
+    return 1;
+  }
+  fprintf( stderr, "snessim: attached after %.3f ms, configured after "
+    "%.3f ms, ready (report descriptor read) after %.3f ms from power-on, "
+    "%u NAKs at EP0\n", g_host_attached / (double)SIM_MS,
+    g_host_configured / (double)SIM_MS, g_sim_ns / (double)SIM_MS,
+    g_host_naks );
+  if ( movie != NULL )
+  {
+    return run_playback( duration, interval );
+  }
+  if ( stream != 0 )
+  {
+    return run_stream( duration, stream );
+  }
+  if ( script == NULL &&
+    start_loopback( period, spread, count, mask ) != 0 )
+  {
+    fprintf( stderr, "snessim: loopback mode not started\n" );
+    return 1;
+  }
+
+  /* interrupt IN polling, one attempt per interval */
+  n = 0;
+  sum = sum2 = 0;
+  min = 1e9;
+  max = 0;
+  expect = 0;
+  poll = ( g_sim_ns / SIM_MS + 1 ) * SIM_MS;
+  start = poll;
+  end = g_sim_ns + duration * SIM_MS;
+  for ( i = 0; i < g_nscript; i++ )
+  {
+    g_script[i].time += poll;
+    pad_event( g_script[i].time, g_script[i].buttons );
+  }
+  ev = 0;
+  missed = 0;
+  presslat.n = 0;
+  age.n = 0;
+  answer.n = 0;
+  latch[0] = LATCH_REPORT_ID;
+  latch[1] = 1;   /* scan now */
+  latch_toggle = 0;
+  latch_time = 0;
+  latch_frame = 0;
+  latch_naks = 0;
+  while ( poll < end )
+  {
+    if ( ahead != 0 && poll != start && latch_time == 0 )
+    {
+      /* as a game does, the next request only after the answer to the
+        last one (a report armed at EP1 before goes out first, so does the
+        one queued at power-up, hence not before the first poll) */
+      /* NOTE: a corrupted request is not retried either */
+      sim_run( poll - ahead * SIM_US - g_sim_ns );
+      if ( host_error() )
+      {
+        r = sie_error( SIE_PID_OUT );
+      }
+      else
+      {
+        r = sie_out( HOST_ADDR, 1, latch, sizeof( latch ), latch_toggle );
+        if ( r == SIE_TIMEOUT )
+        {
+          fprintf( stderr, "snessim: no latch endpoint (USB_LATCH, "
+            "full-speed only)\n" );
+          return 1;
+        }
+      }
+      if ( r == SIE_ACK )
+      {
+        latch_toggle ^= 1;
+        latch_time = g_sim_ns + host_txtime( sizeof( latch ) );
+        latch_frame = timebase_frame();
+      }
+      else if ( r == SIE_NAK )
+      {
+        ++latch_naks;
+      }
+    }
+    sim_run( poll - g_sim_ns );
+    len = sizeof( data );
+    /* NOTE: a corrupted poll is not retried before the next interval */
+    r = host_error() ? sie_error( SIE_PID_IN ) :
+      sie_in( HOST_ADDR, 1, data, &len, &toggle );
+    if ( r == SIE_ACK &&
+      toggle == expect && len == REPORT_SIZE && data[0] == REPORT_ID )
+    {
+      expect ^= 1;
+      frame = data[3] | data[4] << 8;
+      arrival = g_sim_ns + host_txtime( len ) + latency * SIM_US;
+      if ( jitter != 0 )
+      {
+        arrival += (unsigned long long)( rand() % jitter ) * SIM_US;
+      }
+      if ( latch_time != 0 && ( ( frame - latch_frame ) & 0x7FF ) < 0x400 )
+      {
+        /* stamped in the frame of the request or later: the answer */
+        add_minmax( &answer, arrival - latch_time );
+        latch_time = 0;
+      }
+      if ( sim_frametime( frame ) < start )
+      {
+        /* queued before polling started: the state at power-up */
+        fprintf( stderr, "snessim: first report after %.3f ms from "
+          "power-on, buttons %02x%02x\n", arrival / (double)SIM_MS,
+          data[1], data[2] );
+        poll += interval * SIM_MS;
+        continue;
+      }
+      printf( "%llu %u %02x%02x%02x%02x%02x\n", arrival / SIM_US, frame,
+        data[0], data[1], data[2], data[3], data[4] );
+
+      lat = arrival - sim_frametime( frame );
+      x = lat / (double)SIM_MS;
+      sum += x;
+      sum2 += x * x;
+      min = x < min ? x : min;
+      max = x > max ? x : max;
+      ++n;
+
+      /* which change of the script does the report show? */
+      for ( i = ev; i < g_nscript && g_script[i].time < g_sim_ns; i++ )
+      {
+        snes_tohid( g_script[i].buttons, hid );
+        if ( hid[0] == data[1] && hid[1] == data[2] )
+        {
+          missed += i - ev;
+          ev = i + 1;
+          add_minmax( &presslat, arrival - g_script[i].time );
+          add_minmax( &age, arrival - pad_sampled( i ) );
+          break;
+        }
+      }
+    }
+    poll += interval * SIM_MS;
+  }
+
+  if ( n != 0 )
+  {
+    x = sum / n;
+    fprintf( stderr, "snessim: %lu reports, true latency [ms]: min %.3f "
+      "mean %.3f max %.3f stddev %.3f (above min: mean %.3f)\n", n, min, x,
+      max, sqrt( sum2 / n - x * x ), x - min );
+  }
+  if ( g_nscript != 0 )
+  {
+    fprintf( stderr, "snessim: %lu of %d changes reported, %lu missed\n",
+      presslat.n, g_nscript, missed + ( g_nscript - ev ) );
+    print_minmax( "press to arrival", &presslat );
+    print_minmax( "sample age at arrival", &age );
+  }
+  if ( ahead != 0 )
+  {
+    fprintf( stderr, "snessim: %lu latch requests answered, %lu NAKed\n",
+      answer.n, latch_naks );
+    print_minmax( "latch request to arrival", &answer );
+  }
+  pad_summary();
+  print_stats();
+  return 0;
+}
@@ -0,0 +1,1030 @@
+/* usbreplay.c */
+/* replays a Linux usbmon capture against the firmware
+
+  usage: usbreplay [-d dev] [-p port] [-b us] [-i ms] [-f]
+                   [-w script] capture
+
+  The capture is the text output of usbmon (/sys/kernel/debug/usb/usbmon,
+  "u" or "t" format), a pcap file of it (tcpdump or Wireshark on usbmonN,
+  link types 189 and 220), or a script written by -w. Scripts are plain
+  text, one URB per line, and can be kept as a corpus and edited:
+
+    time reset
+    time ctrl dev setup status length data duration
+    time intr dev ep interval status length data duration
+
+  with times in us from the start of the capture, the device number of
+  the capture (0: default address), setup and data in hex ("-": none),
+  status and length as usbmon reports them at completion. For OUT
+  transfers data is what the host sent, for IN what the device returned.
+
+  The device of -d (default: the first one asked for a HID report
+  descriptor) and all traffic at the default address are replayed, each
+  URB at its time in the capture or, with -f or when the device is
+  behind, right after the one before. A SET_FEATURE(PORT_RESET) to a hub
+  (only port -p, if given) resets the bus. Without a SET_ADDRESS in the
+  capture (xHCI addresses devices itself) one is sent before the first
+  request to the device number.
+
+  For each control transfer one line shows the request, the bytes
+  transferred, the time it took in the capture and in the simulator, the
+  NAKs at EP0, and the verdict: the status (ACK or STALL), length and
+  captured data must match. A transfer the capture does not show to
+  complete (unlinked, errors) is not checked. Transfers taking longer
+  than the limits of the USB 2.0 specification (9.2.6.4: 50 ms without,
+  500 ms with data stage) or than -b us are flagged as slow.
+
+  Interrupt URBs are polled every interval ms (-i if the capture does not
+  tell, by default what Linux makes of the bInterval of the build, see
+  ../../src/config.h) until the time they completed in the capture.
+  Button states differ from the capture, so only whether a report came is
+  counted.
+  NOTE: polls wait while a control transfer is in progress.
+
+  The exit status is 1 if any transfer mismatched or was slow. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "p18cxxx.h"
+#include "sim.h"
+#include "../../src/config.h"
+
+/* data bytes kept per URB */
+#define MAX_DATA  1024
+
+/* usbmon status values */
+#define ST_OK       0
+#define ST_EPIPE    ( -32 )   /* STALL */
+
+/* pcap link types of usbmon, with 48 and 64 byte headers */
+#define LINKTYPE_USB_LINUX          189
+#define LINKTYPE_USB_LINUX_MMAPPED  220
+
+/* one URB of the capture, or a bus reset */
+struct urb
+{
+  unsigned long long time;      /* submission [us] */
+  unsigned long long duration;  /* until completion [us] */
+  char               kind;      /* 'R' reset, 'C' control, 'I' intr/bulk */
+  unsigned char      dev;       /* device number */
+  unsigned char      ep;        /* endpoint address, bit 7 for IN */
+  unsigned char      interval;  /* polling interval [ms], 0 if unknown */
+  unsigned char      setup[8];
+  int                status;    /* at completion */
+  unsigned short     length;    /* bytes transferred (OUT: to transfer) */
+  unsigned short     ncap;      /* bytes of data captured */
+  unsigned char      data[ MAX_DATA ];
+};
+
+/* an URB between submission and completion, while parsing */
+struct open_urb
+{
+  unsigned long long tag;
+  unsigned short     bus;
+  int                index;     /* in g_urbs */
+};
+
+/* interrupt URB being polled */
+struct poll
+{
+  int                index;     /* in g_urbs */
+  unsigned long long next;      /* next poll [ns] */
+  unsigned long long end;       /* no more polls after [ns] */
+};
+
+/* static data */
+static struct urb *      g_urbs;
+static int               g_nurbs;
+static struct open_urb * g_open;
+static int               g_nopen;
+static int               g_dev = -1;    /* -d */
+static int               g_port = -1;   /* -p */
+static unsigned char     g_toggle[16][2];   /* next data toggle [ep][IN] */
+
+/* local prototypes */
+static struct urb * new_urb( void );
+static int open_urb( unsigned long long tag, unsigned short bus );
+static int close_urb( unsigned long long tag, unsigned short bus );
+static void submitted( unsigned long long tag, unsigned short bus,
+  unsigned long long time, char kind, unsigned char dev, unsigned char ep,
+  unsigned char interval, const unsigned char * setup,
+  const unsigned char * data, unsigned short ncap, unsigned short length );
+static void completed( unsigned long long tag, unsigned short bus,
+  unsigned long long time, int status, const unsigned char * data,
+  unsigned short ncap, unsigned short length );
+static int load_text( FILE * f );
+static int load_pcap( FILE * f );
+static int load_script( FILE * f );
+static void select_device( void );
+static void write_script( const char * file );
+static void put_hex( FILE * f, const unsigned char * data, unsigned short n );
+static unsigned short get_hex( const char * s, unsigned char * data,
+  unsigned short max );
+static const char * request_name( const unsigned char * setup );
+static int replay( int fast, unsigned long long budget,
+  unsigned char interval );
+static int replay_control( struct urb * u, unsigned char * addr,
+  int * addressed, int fast, unsigned long long budget );
+static int poll_urb( struct poll * p, unsigned char addr );
+static unsigned short le16( const unsigned char * p );
+static unsigned long le32( const unsigned char * p );
+
+
+/* new URB at the end of the list */
+static struct urb * new_urb( void )
+{
+  g_urbs = realloc( g_urbs, ( g_nurbs + 1 ) * sizeof( *g_urbs ) );
+  if ( g_urbs == NULL )
+  {
+    perror( "realloc" );
+    exit( 1 );
+  }
+  memset( &g_urbs[ g_nurbs ], 0, sizeof( *g_urbs ) );
+  return &g_urbs[ g_nurbs++ ];
+}
+
+/* remember a submitted URB */
+static int open_urb( unsigned long long tag, unsigned short bus )
+{
+  g_open = realloc( g_open, ( g_nopen + 1 ) * sizeof( *g_open ) );
+  if ( g_open == NULL )
+  {
+    perror( "realloc" );
+    exit( 1 );
+  }
+  g_open[ g_nopen ].tag = tag;
+  g_open[ g_nopen ].bus = bus;
+  g_open[ g_nopen ].index = g_nurbs - 1;
+  return g_nopen++;
+}
+
+/* index of a submitted URB, which is forgotten, or -1 */
+static int close_urb( unsigned long long tag, unsigned short bus )
+{
+  int i;
+  int index;
+
+  for ( i = 0; i < g_nopen; i++ )
+  {
+    if ( g_open[i].tag == tag && g_open[i].bus == bus )
+    {
+      index = g_open[i].index;
+      g_open[i] = g_open[ --g_nopen ];
+      return index;
+    }
+  }
+  return -1;
+}
+
+/* submission event of the capture */
+static void submitted( unsigned long long tag, unsigned short bus,
+  unsigned long long time, char kind, unsigned char dev, unsigned char ep,
+  unsigned char interval, const unsigned char * setup,
+  const unsigned char * data, unsigned short ncap, unsigned short length )
+{
+  struct urb * u;
+
+  /* SET_FEATURE(PORT_RESET) to a hub */
+  if ( kind == 'C' && setup != NULL && setup[0] == 0x23 &&
+    setup[1] == 0x03 && le16( setup + 2 ) == 0x0004 &&
+    ( g_port < 0 || le16( setup + 4 ) == g_port ) )
+  {
+    u = new_urb();
+    u->time = time;
+    u->kind = 'R';
+    return;
+  }
+
+  u = new_urb();
+  u->time = time;
+  u->kind = kind;
+  u->dev = dev;
+  u->ep = ep;
+  u->interval = interval;
+  u->status = -1;   /* until it completes */
+  if ( setup != NULL )
+  {
+    memcpy( u->setup, setup, 8 );
+  }
+  if ( !( ep & 0x80 ) )
+  {
+    /* OUT: data comes with the submission */
+    u->length = length;
+    u->ncap = ncap < MAX_DATA ? ncap : MAX_DATA;
+    memcpy( u->data, data, u->ncap );
+  }
+  open_urb( tag, bus );
+}
+
+/* completion event of the capture */
+static void completed( unsigned long long tag, unsigned short bus,
+  unsigned long long time, int status, const unsigned char * data,
+  unsigned short ncap, unsigned short length )
+{
+  struct urb * u;
+  int          i;
+
+  i = close_urb( tag, bus );
+  if ( i < 0 )
+  {
+    return;   /* submitted before the capture started */
+  }
+  u = &g_urbs[i];
+  u->duration = time - u->time;
+  u->status = status;
+  if ( u->ep & 0x80 )
+  {
+    u->length = length;
+    u->ncap = ncap < MAX_DATA ? ncap : MAX_DATA;
+    memcpy( u->data, data, u->ncap );
+  }
+}
+
+
+/* usbmon text, "u" or the older "t" format (without bus number) */
+static int load_text( FILE * f )
+{
+  char               line[ 4096 ];
+  char *             field[ 64 ];
+  int                n;
+  int                k;
+  unsigned long long tag;
+  unsigned long long ts;
+  unsigned long long last;
+  unsigned long long wrap;
+  char               type;
+  char               xfer;
+  unsigned int       nums[3];
+  int                nnums;
+  unsigned short     bus;
+  unsigned char      dev;
+  unsigned char      ep;
+  unsigned char      setup[8];
+  unsigned char      data[ MAX_DATA ];
+  unsigned short     ncap;
+  unsigned short     length;
+  int                status;
+  unsigned char      interval;
+  int                hassetup;
+  char *             p;
+
+  last = 0;
+  wrap = 0;
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    n = 0;
+    for ( p = strtok( line, " \t\r\n" ); p != NULL && n < 64;
+      p = strtok( NULL, " \t\r\n" ) )
+    {
+      field[ n++ ] = p;
+    }
+    if ( n < 6 || strlen( field[3] ) < 4 || field[3][2] != ':' )
+    {
+      continue;
+    }
+    tag = strtoull( field[0], NULL, 16 );
+    ts = strtoull( field[1], NULL, 10 );
+    /* the timestamp is 32 bits */
+    if ( ts + wrap + 0x80000000ULL < last )
+    {
+      wrap += 0x100000000ULL;
+    }
+    ts += wrap;
+    last = ts;
+    type = field[2][0];
+    xfer = field[3][0];
+    nnums = sscanf( field[3] + 3, "%u:%u:%u", &nums[0], &nums[1], &nums[2] );
+    if ( nnums == 3 )
+    {
+      bus = nums[0];
+      dev = nums[1];
+      ep = nums[2];
+    }
+    else if ( nnums == 2 )
+    {
+      bus = 0;
+      dev = nums[0];
+      ep = nums[1];
+    }
+    else
+    {
+      continue;
+    }
+    if ( field[3][1] == 'i' )
+    {
+      ep |= 0x80;
+    }
+    if ( xfer != 'C' && xfer != 'I' && xfer != 'B' )
+    {
+      continue;   /* isochronous */
+    }
+
+    /* setup packet or status word */
+    k = 4;
+    hassetup = 0;
+    status = 0;
+    interval = 0;
+    if ( strcmp( field[k], "s" ) == 0 )
+    {
+      if ( n < k + 6 )
+      {
+        continue;
+      }
+      setup[0] = strtoul( field[ k + 1 ], NULL, 16 );
+      setup[1] = strtoul( field[ k + 2 ], NULL, 16 );
+      setup[2] = strtoul( field[ k + 3 ], NULL, 16 ) & 0xFF;
+      setup[3] = strtoul( field[ k + 3 ], NULL, 16 ) >> 8;
+      setup[4] = strtoul( field[ k + 4 ], NULL, 16 ) & 0xFF;
+      setup[5] = strtoul( field[ k + 4 ], NULL, 16 ) >> 8;
+      setup[6] = strtoul( field[ k + 5 ], NULL, 16 ) & 0xFF;
+      setup[7] = strtoul( field[ k + 5 ], NULL, 16 ) >> 8;
+      hassetup = 1;
+      k += 6;
+    }
+    else
+    {
+      /* "status" or "status:interval[:start frame...]" */
+      status = strtol( field[k], &p, 10 );
+      if ( *p == ':' )
+      {
+        interval = strtoul( p + 1, NULL, 10 );
+      }
+      k++;
+    }
+    if ( k >= n )
+    {
+      continue;
+    }
+    length = strtoul( field[k], NULL, 10 );
+    k++;
+
+    /* data words after "=" */
+    ncap = 0;
+    if ( k < n && strcmp( field[k], "=" ) == 0 )
+    {
+      for ( k++; k < n; k++ )
+      {
+        ncap += get_hex( field[k], data + ncap, MAX_DATA - ncap );
+      }
+    }
+
+    if ( type == 'S' )
+    {
+      submitted( tag, bus, ts, xfer == 'C' ? 'C' : 'I', dev, ep, interval,
+        hassetup ? setup : NULL, data, ncap, length );
+    }
+    else if ( type == 'C' )
+    {
+      completed( tag, bus, ts, status, data, ncap, length );
+    }
+    else
+    {
+      close_urb( tag, bus );  /* 'E': submission failed */
+    }
+  }
+  return 0;
+}
+
+/* pcap file of a usbmon interface */
+static int load_pcap( FILE * f )
+{
+  unsigned char      head[24];
+  unsigned char      rec[16];
+  unsigned char *    pkt;
+  unsigned long      linktype;
+  unsigned long      incl;
+  unsigned long      hdrlen;
+  unsigned long long ts;
+  unsigned long      len_cap;
+  unsigned short     bus;
+  unsigned char      ep;
+  unsigned char      interval;
+  char               kind;
+
+  if ( fread( head, 1, sizeof( head ), f ) != sizeof( head ) )
+  {
+    return -1;
+  }
+  linktype = le32( head + 20 );
+  if ( linktype == LINKTYPE_USB_LINUX )
+  {
+    hdrlen = 48;
+  }
+  else if ( linktype == LINKTYPE_USB_LINUX_MMAPPED )
+  {
+    hdrlen = 64;
+  }
+  else
+  {
+    fprintf( stderr, "usbreplay: pcap link type %lu is not usbmon\n",
+      linktype );
+    return -1;
+  }
+
+  while ( fread( rec, 1, sizeof( rec ), f ) == sizeof( rec ) )
+  {
+    incl = le32( rec + 8 );
+    pkt = malloc( incl );
+    if ( pkt == NULL || fread( pkt, 1, incl, f ) != incl )
+    {
+      free( pkt );
+      break;
+    }
+    /* usbmon packet header (Documentation/usb/usbmon.rst), host order */
+    if ( incl >= hdrlen && pkt[9] != 0 )  /* not isochronous */
+    {
+      ts = (unsigned long long)le32( pkt + 16 ) * 1000000ULL +
+        le32( pkt + 24 );
+      len_cap = le32( pkt + 36 );
+      if ( len_cap > incl - hdrlen )
+      {
+        len_cap = incl - hdrlen;
+      }
+      bus = le16( pkt + 12 );
+      ep = pkt[10];
+      interval = hdrlen == 64 ? (unsigned char)le32( pkt + 48 ) : 0;
+      kind = pkt[9] == 2 ? 'C' : 'I';
+      if ( pkt[8] == 'S' )
+      {
+        submitted( le32( pkt ) | (unsigned long long)le32( pkt + 4 ) << 32,
+          bus, ts, kind, pkt[11], ep, interval, pkt[14] == 0 ? pkt + 40 :
+          NULL, pkt + hdrlen, len_cap, le32( pkt + 32 ) );
+      }
+      else if ( pkt[8] == 'C' )
+      {
+        completed( le32( pkt ) | (unsigned long long)le32( pkt + 4 ) << 32,
+          bus, ts, (int)le32( pkt + 28 ), pkt + hdrlen, len_cap,
+          le32( pkt + 32 ) );
+      }
+      else
+      {
+        close_urb( le32( pkt ) | (unsigned long long)le32( pkt + 4 ) << 32,
+          bus );
+      }
+    }
+    free( pkt );
+  }
+  return 0;
+}
+
+/* script written by -w */
+static int load_script( FILE * f )
+{
+  char               line[ 4096 ];
+  char               what[8];
+  char               setup[20];
+  char               data[ 2 * MAX_DATA + 2 ];
+  unsigned long long time;
+  unsigned long long duration;
+  unsigned int       dev;
+  unsigned int       ep;
+  unsigned int       interval;
+  unsigned int       length;
+  int                status;
+  struct urb *       u;
+
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] == '#' ||
+      sscanf( line, "%llu %7s", &time, what ) != 2 )
+    {
+      continue;
+    }
+    if ( strcmp( what, "reset" ) == 0 )
+    {
+      u = new_urb();
+      u->time = time;
+      u->kind = 'R';
+    }
+    else if ( strcmp( what, "ctrl" ) == 0 && sscanf( line,
+      "%*u %*s %u %19s %d %u %2049s %llu", &dev, setup, &status, &length,
+      data, &duration ) == 6 )
+    {
+      u = new_urb();
+      u->time = time;
+      u->kind = 'C';
+      u->dev = dev;
+      get_hex( setup, u->setup, 8 );
+      u->ep = u->setup[0] & 0x80;
+      u->status = status;
+      u->length = length;
+      u->ncap = get_hex( data, u->data, MAX_DATA );
+      u->duration = duration;
+    }
+    else if ( strcmp( what, "intr" ) == 0 && sscanf( line,
+      "%*u %*s %u %x %u %d %u %2049s %llu", &dev, &ep, &interval, &status,
+      &length, data, &duration ) == 7 )
+    {
+      u = new_urb();
+      u->time = time;
+      u->kind = 'I';
+      u->dev = dev;
+      u->ep = ep;
+      u->interval = interval;
+      u->status = status;
+      u->length = length;
+      u->ncap = get_hex( data, u->data, MAX_DATA );
+      u->duration = duration;
+    }
+    else
+    {
+      fprintf( stderr, "usbreplay: bad script line: %s", line );
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+/* keep the URBs of the device and of the default address */
+static void select_device( void )
+{
+  int i;
+  int n;
+
+  for ( i = 0; g_dev < 0 && i < g_nurbs; i++ )
+  {
+    /* GET_DESCRIPTOR(HID report) */
+    if ( g_urbs[i].kind == 'C' && g_urbs[i].dev != 0 &&
+      g_urbs[i].setup[0] == 0x81 && g_urbs[i].setup[1] == 0x06 &&
+      g_urbs[i].setup[3] == 0x22 )
+    {
+      g_dev = g_urbs[i].dev;
+    }
+  }
+
+  n = 0;
+  for ( i = 0; i < g_nurbs; i++ )
+  {
+    /* NOTE: URBs that never completed are dropped, as are those of other
+      devices */
+    if ( g_urbs[i].kind == 'R' || ( g_urbs[i].status != -1 &&
+      ( g_urbs[i].dev == g_dev ||
+      ( g_urbs[i].dev == 0 && g_urbs[i].kind == 'C' ) ) ) )
+    {
+      g_urbs[ n++ ] = g_urbs[i];
+    }
+  }
+  g_nurbs = n;
+
+  /* times from the start of the capture */
+  for ( i = n - 1; i >= 0; i-- )
+  {
+    g_urbs[i].time -= g_urbs[0].time;
+  }
+}
+
+/* write the URBs as script */
+static void write_script( const char * file )
+{
+  FILE *       f;
+  struct urb * u;
+  int          i;
+
+  f = fopen( file, "w" );
+  if ( f == NULL )
+  {
+    perror( file );
+    exit( 1 );
+  }
+  fprintf( f, "# usbreplay script of device %d, time [us] from the start\n"
+    "# time reset\n"
+    "# time ctrl dev setup status length data duration\n"
+    "# time intr dev ep interval status length data duration\n", g_dev );
+  for ( i = 0; i < g_nurbs; i++ )
+  {
+    u = &g_urbs[i];
+    fprintf( f, "%llu ", u->time );
+    if ( u->kind == 'R' )
+    {
+      fprintf( f, "reset\n" );
+      continue;
+    }
+    if ( u->kind == 'C' )
+    {
+      fprintf( f, "ctrl %u ", u->dev );
+      put_hex( f, u->setup, 8 );
+    }
+    else
+    {
+      fprintf( f, "intr %u %02x %u", u->dev, u->ep, u->interval );
+    }
+    fprintf( f, " %d %u ", u->status, u->length );
+    put_hex( f, u->data, u->ncap );
+    fprintf( f, " %llu\n", u->duration );
+  }
+  fclose( f );
+}
+
+/* data as hex digits, "-" for none */
+static void put_hex( FILE * f, const unsigned char * data, unsigned short n )
+{
+  unsigned short i;
+
+  if ( n == 0 )
+  {
+    fputc( '-', f );
+  }
+  for ( i = 0; i < n; i++ )
+  {
+    fprintf( f, "%02x", data[i] );
+  }
+}
+
+/* hex digits to data, returns the number of bytes */
+static unsigned short get_hex( const char * s, unsigned char * data,
+  unsigned short max )
+{
+  unsigned short n;
+  unsigned int   byte;
+
+  n = 0;
+  while ( n < max && sscanf( s, "%2x", &byte ) == 1 && s[1] != '\0' )
+  {
+    data[ n++ ] = byte;
+    s += 2;
+  }
+  return n;
+}
+
+/* name of a request */
+static const char * request_name( const unsigned char * setup )
+{
+  static const char * const standard[] =
+  {
+    "GET_STATUS", "CLEAR_FEATURE", "?", "SET_FEATURE", "?", "SET_ADDRESS",
+    "GET_DESCRIPTOR", "SET_DESCRIPTOR", "GET_CONFIGURATION",
+    "SET_CONFIGURATION", "GET_INTERFACE", "SET_INTERFACE", "SYNCH_FRAME"
+  };
+  static const char * const hid[] =
+  {
+    "?", "GET_REPORT", "GET_IDLE", "GET_PROTOCOL", "?", "?", "?", "?", "?",
+    "SET_REPORT", "SET_IDLE", "SET_PROTOCOL"
+  };
+
+  switch ( setup[0] & 0x60 )
+  {
+    case 0x00:
+      return setup[1] < 13 ? standard[ setup[1] ] : "?";
+    case 0x20:
+      return setup[1] < 12 ? hid[ setup[1] ] : "?";
+    default:
+      return "VENDOR";
+  }
+}
+
+
+/* replay all URBs, returns the number of failed checks */
+static int replay( int fast, unsigned long long budget,
+  unsigned char interval )
+{
+  struct poll *      polls;
+  int                npolls;
+  int                reports;
+  int                intrs;
+  int                failed;
+  int                addressed;
+  unsigned char      addr;
+  unsigned long long base;
+  unsigned long long at;
+  unsigned long long next;
+  struct urb *       u;
+  int                i;
+  int                j;
+
+  polls = calloc( g_nurbs + 1, sizeof( *polls ) );
+  if ( polls == NULL )
+  {
+    perror( "calloc" );
+    exit( 1 );
+  }
+  npolls = 0;
+  reports = 0;
+  intrs = 0;
+  failed = 0;
+  addr = 0;
+  addressed = 0;
+
+  /* the capture starts at the end of the debounce interval, or with the
+    reset that follows it */
+  host_attach();
+  if ( g_nurbs == 0 || g_urbs[0].kind != 'R' )
+  {
+    sie_reset();
+    sim_run( 10 * SIM_MS );
+  }
+  base = g_sim_ns;
+  printf( "%10s  %-20s %-5s %9s  %9s %9s %5s\n", "time [ms]", "request",
+    "value", "bytes", "capture", "sim [ms]", "NAKs" );
+
+  i = 0;
+  while ( i < g_nurbs || npolls != 0 )
+  {
+    /* next URB or poll, whichever comes first */
+    at = ~0ULL;
+    if ( i < g_nurbs )
+    {
+      at = fast ? g_sim_ns : base + g_urbs[i].time * SIM_US;
+      at = at < g_sim_ns ? g_sim_ns : at;
+    }
+    next = ~0ULL;
+    for ( j = 0; j < npolls; j++ )
+    {
+      next = polls[j].next < next ? polls[j].next : next;
+    }
+    if ( next < at )
+    {
+      sim_run( next > g_sim_ns ? next - g_sim_ns : 0 );
+      for ( j = 0; j < npolls; j++ )
+      {
+        if ( polls[j].next <= g_sim_ns && poll_urb( &polls[j], addr ) )
+        {
+          reports += g_urbs[ polls[j].index ].status >= 0 ? 1 : 0;
+          polls[ j-- ] = polls[ --npolls ];
+        }
+      }
+      continue;
+    }
+
+    sim_run( at - g_sim_ns );
+    u = &g_urbs[ i++ ];
+    if ( fast )
+    {
+      /* keep the time of the replay */
+      base = g_sim_ns - u->time * SIM_US;
+    }
+    switch ( u->kind )
+    {
+      case 'R':
+        printf( "%10.3f  bus reset\n", u->time / 1000.0 );
+        sie_reset();
+        addr = 0;
+        addressed = 0;
+        g_host_mps0 = sie_fullspeed() ? 64 : 8;
+        memset( g_toggle, 0, sizeof( g_toggle ) );
+        if ( fast )
+        {
+          sim_run( 10 * SIM_MS );   /* reset recovery */
+        }
+        break;
+      case 'C':
+        failed += replay_control( u, &addr, &addressed, fast, budget );
+        break;
+      default:
+        /* polled until it completed in the capture */
+        ++intrs;
+        polls[ npolls ].index = u - g_urbs;
+        polls[ npolls ].next = g_sim_ns;
+        polls[ npolls ].end = g_sim_ns + u->duration * SIM_US;
+        if ( u->interval == 0 )
+        {
+          u->interval = interval;
+        }
+        u->status = -1;   /* from now on the result of the replay */
+        ++npolls;
+        break;
+    }
+  }
+  printf( "usbreplay: %d transfers failed, %d of %d interrupt URBs "
+    "completed, %.3f ms replayed (capture %.3f ms)\n", failed, reports,
+    intrs, ( g_sim_ns - base ) / (double)SIM_MS,
+    g_nurbs != 0 ? g_urbs[ g_nurbs - 1 ].time / 1000.0 : 0.0 );
+  free( polls );
+  return failed;
+}
+
+/* replay a control transfer, returns 1 if it failed its checks */
+static int replay_control( struct urb * u, unsigned char * addr,
+  int * addressed, int fast, unsigned long long budget )
+{
+  unsigned char      buf[ MAX_DATA ];
+  unsigned long long start;
+  unsigned long long limit;
+  unsigned long long took;
+  unsigned short     wvalue;
+  unsigned short     wlength;
+  unsigned int       naks;
+  const char *       verdict;
+  int                n;
+
+  wvalue = le16( u->setup + 2 );
+  wlength = le16( u->setup + 6 );
+
+  /* xHCI: the controller has addressed the device */
+  if ( u->dev != 0 && !*addressed )
+  {
+    printf( "%10.3f  %-20s %04x  (not in the capture)\n", u->time / 1000.0,
+      "SET_ADDRESS", u->dev );
+    host_control( 0, 0x00, 0x05, u->dev, 0, 0, NULL );
+    sim_run( 2 * SIM_MS );
+    *addr = u->dev;
+    *addressed = 1;
+  }
+
+  memset( buf, 0, sizeof( buf ) );
+  if ( !( u->setup[0] & 0x80 ) )
+  {
+    memcpy( buf, u->data, u->ncap );  /* NOTE: zeros beyond the capture */
+  }
+  /* a transfer that did not complete in the capture is given as long */
+  g_host_timeout = u->status < 0 && u->status != ST_EPIPE ?
+    u->duration * SIM_US : HOST_CTRL_TIMEOUT;
+  naks = g_host_naks;
+  start = g_sim_ns;
+  n = host_control( u->dev != 0 ? *addr : 0, u->setup[0], u->setup[1],
+    wvalue, le16( u->setup + 4 ), wlength < MAX_DATA ? wlength : MAX_DATA,
+    buf );
+  took = g_sim_ns - start;
+  g_host_timeout = HOST_CTRL_TIMEOUT;
+
+  /* verdict */
+  verdict = "ok";
+  if ( u->status != ST_OK && u->status != ST_EPIPE )
+  {
+    verdict = "-";    /* not checked */
+  }
+  else if ( u->status == ST_EPIPE )
+  {
+    verdict = n < 0 && g_host_handshake == SIE_STALL ? "ok" :
+      "STALL EXPECTED";
+  }
+  else if ( n < 0 )
+  {
+    verdict = g_host_handshake == SIE_STALL ? "STALLED" : "NO RESPONSE";
+  }
+  else if ( ( u->setup[0] & 0x80 ) && n != u->length )
+  {
+    verdict = "LENGTH";
+  }
+  else if ( ( u->setup[0] & 0x80 ) &&
+    memcmp( buf, u->data, u->ncap < n ? u->ncap : n ) != 0 )
+  {
+    verdict = "DATA";
+  }
+  limit = ( wlength != 0 ? 500 : 50 ) * SIM_MS;
+  if ( budget != 0 && budget * SIM_US < limit )
+  {
+    limit = budget * SIM_US;
+  }
+  if ( strcmp( verdict, "ok" ) == 0 && took > limit )
+  {
+    verdict = "SLOW";
+  }
+  printf( "%10.3f  %-20s %04x  %4d/%-4u  %9.3f %9.3f %5u  %s\n",
+    u->time / 1000.0, request_name( u->setup ), wvalue, n, u->length,
+    u->duration / 1000.0, took / (double)SIM_MS, g_host_naks - naks,
+    verdict );
+
+  /* what the host learns from it */
+  if ( n >= 8 && u->setup[0] == 0x80 && u->setup[1] == 0x06 &&
+    u->setup[3] == 0x01 )
+  {
+    g_host_mps0 = buf[7];
+  }
+  if ( n >= 0 && u->setup[0] == 0x00 && u->setup[1] == 0x05 )
+  {
+    *addr = wvalue;
+    *addressed = 1;
+    if ( fast )
+    {
+      sim_run( 2 * SIM_MS );  /* SET_ADDRESS recovery */
+    }
+  }
+  if ( n >= 0 && ( ( u->setup[0] == 0x00 && u->setup[1] == 0x09 ) ||
+    ( u->setup[0] == 0x02 && u->setup[1] == 0x01 && wvalue == 0 ) ) )
+  {
+    /* SET_CONFIGURATION or CLEAR_FEATURE(ENDPOINT_HALT) */
+    memset( g_toggle, 0, sizeof( g_toggle ) );
+  }
+  return strcmp( verdict, "ok" ) != 0 && strcmp( verdict, "-" ) != 0;
+}
+
+/* one poll of an interrupt URB, returns whether it is done */
+static int poll_urb( struct poll * p, unsigned char addr )
+{
+  struct urb *  u;
+  unsigned char buf[64];
+  unsigned char len;
+  unsigned char toggle;
+  unsigned char ep;
+  unsigned char in;
+  int           r;
+
+  u = &g_urbs[ p->index ];
+  ep = u->ep & 0x0F;
+  in = ( u->ep & 0x80 ) != 0;
+  toggle = g_toggle[ ep ][ in ];
+  if ( in )
+  {
+    len = u->length < sizeof( buf ) ? u->length : sizeof( buf );
+    r = sie_in( addr, ep, buf, &len, &toggle );
+  }
+  else
+  {
+    len = u->ncap < sizeof( buf ) ? u->ncap : sizeof( buf );
+    r = sie_out( addr, ep, u->data, len, toggle );
+  }
+  if ( r == SIE_ACK && toggle == g_toggle[ ep ][ in ] )
+  {
+    g_toggle[ ep ][ in ] ^= 1;
+    u->status = ST_OK;
+    return 1;
+  }
+  if ( r == SIE_STALL )
+  {
+    u->status = ST_EPIPE;
+    return 1;
+  }
+  p->next += u->interval * SIM_MS;
+  return p->next > p->end;
+}
+
+
+static unsigned short le16( const unsigned char * p )
+{
+  return p[0] | p[1] << 8;
+}
+
+static unsigned long le32( const unsigned char * p )
+{
+  return p[0] | p[1] << 8 | (unsigned long)p[2] << 16 |
+    (unsigned long)p[3] << 24;
+}
+
+
+int main( int argc, char * argv[] )
+{
+  FILE *             f;
+  unsigned char      magic[4];
+  unsigned long long budget;
+  const char *       script;
+  int                interval;
+  int                fast;
+  int                r;
+  int                opt;
+
+  budget   = 0;
+  script   = NULL;
+  interval = CONFIG_POLL_HOST_MS;
+  fast     = 0;
+  while ( ( opt = getopt( argc, argv, "d:p:b:i:fw:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'd': g_dev = atoi( optarg ); break;
+      case 'p': g_port = atoi( optarg ); break;
+      case 'b': budget = strtoull( optarg, NULL, 10 ); break;
+      case 'i': interval = atoi( optarg ); break;
+      case 'f': fast = 1; break;
+      case 'w': script = optarg; break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if ( optind != argc - 1 )
+  {
+    fprintf( stderr, "usage: %s [-d dev] [-p port] [-b us] "
+      "[-i ms] [-f]\n       [-w script] capture\n", argv[0] );
+    return 2;
+  }
+
+  /* pcap, script or usbmon text */
+  f = fopen( argv[ optind ], "rb" );
+  if ( f == NULL )
+  {
+    perror( argv[ optind ] );
+    return 2;
+  }
+  if ( fread( magic, 1, 4, f ) == 4 && le32( magic ) == 0xA1B2C3D4UL )
+  {
+    rewind( f );
+    r = load_pcap( f );
+  }
+  else
+  {
+    rewind( f );
+    r = fgets( (char *)magic, 4, f ) != NULL && magic[0] == '#' ?
+      ( rewind( f ), load_script( f ) ) : ( rewind( f ), load_text( f ) );
+  }
+  fclose( f );
+  if ( r != 0 )
+  {
+    return 2;
+  }
+  select_device();
+  if ( g_nurbs == 0 )
+  {
+    fprintf( stderr, "usbreplay: nothing to replay (-d?)\n" );
+    return 2;
+  }
+  if ( script != NULL )
+  {
+    write_script( script );
+  }
+
+  sim_start();
+  return replay( fast, budget, interval ) != 0 ? 1 : 0;
+}
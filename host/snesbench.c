@@ -0,0 +1,429 @@
+/* snesbench.c */
+/* measures input latency with the loopback test mode of the adapter
+
+  usage: snesbench [-d /dev/hidrawN] [-n reports] [-w log]
+                   [-c period,spread,count,mask]
+         snesbench -r log
+
+  Starts the loopback test mode (see ../src/loopback.h) with the settings
+  of -c (default 100,37,0,0001: toggle B every 100..136 ms), records the
+  arrival time of -n reports (default 1000) and stops it again. With -r the
+  records come from a log written by -w or by sim/snessim instead.
+
+  Each report carries the frame number of the button change. Device frames
+  and host clock have an unknown offset, so latency is given relative to
+  the fastest report: the spread shows what polling interval, host
+  controller and input stack add on top of the minimum. A linear drift
+  between the clocks (Timer0 of a low-speed device) is removed first.
+
+  The link statistics of the adapter (see ../src/stats.h) are read before
+  and after a live run, their differences show bus errors and reports
+  that were replaced before the host polled them. */
+
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include "hiddev.h"
+
+/* report IDs (see ../src/usb.c) */
+#define REPORT_ID           1
+#define REPORT_SIZE         5
+#define LOOPBACK_REPORT_ID  2
+#define LOOPBACK_SIZE       8
+#define STATS_REPORT_ID     3
+#define STATS_COUNT         10
+
+/* histogram */
+#define BIN_US     250
+#define MAX_BINS   80
+
+/* one received report */
+struct record
+{
+  unsigned long long time;   /* arrival [us] */
+  unsigned short     frame;  /* frame number stamped by the device */
+};
+
+/* static data */
+static struct record * g_records;
+static int             g_count;
+static int             g_size;
+static volatile int    g_stop;
+
+
+/* append a record */
+static void add_record( unsigned long long time, unsigned short frame )
+{
+  if ( g_count == g_size )
+  {
+    g_size = g_size ? 2 * g_size : 1024;
+    g_records = realloc( g_records, g_size * sizeof( *g_records ) );
+    if ( g_records == NULL )
+    {
+      perror( "realloc" );
+      exit( 1 );
+    }
+  }
+  g_records[ g_count ].time = time;
+  g_records[ g_count ].frame = frame & 0x7FF;
+  ++g_count;
+}
+
+/* read records "time frame [report]" */
+static int read_log( const char * file )
+{
+  FILE *             f;
+  char               line[ 256 ];
+  unsigned long long time;
+  unsigned int       frame;
+
+  f = strcmp( file, "-" ) == 0 ? stdin : fopen( file, "r" );
+  if ( f == NULL )
+  {
+    perror( file );
+    return -1;
+  }
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] != '#' && sscanf( line, "%llu %u", &time, &frame ) == 2 )
+    {
+      add_record( time, frame );
+    }
+  }
+  if ( f != stdin )
+  {
+    fclose( f );
+  }
+  return 0;
+}
+
+/* write loopback feature report */
+static int set_loopback( int fd, unsigned char mode, unsigned short period,
+  unsigned char spread, unsigned short count, unsigned short mask )
+{
+  unsigned char buf[ 1 + LOOPBACK_SIZE ];
+
+  buf[0] = LOOPBACK_REPORT_ID;
+  buf[1] = mode;
+  buf[2] = period & 0xFF;
+  buf[3] = period >> 8;
+  buf[4] = spread;
+  buf[5] = count & 0xFF;
+  buf[6] = count >> 8;
+  buf[7] = mask & 0xFF;
+  buf[8] = mask >> 8;
+  return ioctl( fd, HIDIOCSFEATURE( sizeof( buf ) ), buf ) < 0 ? -1 : 0;
+}
+
+/* read link statistics feature report */
+static int get_stats( int fd, unsigned short * stats )
+{
+  unsigned char buf[ 1 + 2 * STATS_COUNT ];
+  int           i;
+
+  buf[0] = STATS_REPORT_ID;
+  if ( ioctl( fd, HIDIOCGFEATURE( sizeof( buf ) ), buf ) < 0 )
+  {
+    return -1;
+  }
+  for ( i = 0; i < STATS_COUNT; i++ )
+  {
+    stats[i] = buf[ 1 + 2 * i ] | buf[ 2 + 2 * i ] << 8;
+  }
+  return 0;
+}
+
+/* print differences of the link statistics */
+static void print_stats( const unsigned short * before,
+  const unsigned short * after )
+{
+  static const char * const names[ STATS_COUNT ] =
+  {
+    "resets", "stalls", "pid", "crc5", "crc16", "dfn8", "bto", "bts",
+    "sent", "coalesced"
+  };
+  int i;
+
+  printf( "link:" );
+  for ( i = 0; i < STATS_COUNT; i++ )
+  {
+    /* NOTE: 16 bit counters, the difference is right across a wrap */
+    printf( " %s %u", names[i], (unsigned short)( after[i] - before[i] ) );
+  }
+  printf( "\n" );
+}
+
+static void on_signal( int sig )
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+/* record reports from the device */
+static int record( const char * dev, int n, FILE * log, unsigned short period,
+  unsigned char spread, unsigned short count, unsigned short mask )
+{
+  unsigned char      buf[ 64 ];
+  unsigned short     before[ STATS_COUNT ];
+  unsigned short     after[ STATS_COUNT ];
+  unsigned long long time;
+  ssize_t            len;
+  int                stats;
+  int                first;
+  int                fd;
+
+  fd = open( dev, O_RDWR );
+  if ( fd < 0 )
+  {
+    perror( dev );
+    return -1;
+  }
+  /* NOTE: firmware without statistics stalls the request */
+  stats = get_stats( fd, before ) == 0;
+  if ( set_loopback( fd, 1, period, spread, count, mask ) != 0 )
+  {
+    perror( dev );
+    close( fd );
+    return -1;
+  }
+  signal( SIGINT, on_signal );
+
+  /* the first report is skipped, it may be one the device queued long
+    before, such as the controller's state at power-up */
+  first = 1;
+  while ( !g_stop && g_count < n )
+  {
+    len = read( fd, buf, sizeof( buf ) );
+    time = hiddev_now_us();
+    if ( len < 0 )
+    {
+      break;  /* interrupted */
+    }
+    if ( len < REPORT_SIZE || buf[0] != REPORT_ID )
+    {
+      continue;
+    }
+    if ( first )
+    {
+      first = 0;
+      continue;
+    }
+    add_record( time, buf[3] | buf[4] << 8 );
+    if ( log != NULL )
+    {
+      fprintf( log, "%llu %u %02x%02x%02x%02x%02x\n", time,
+        buf[3] | buf[4] << 8, buf[0], buf[1], buf[2], buf[3], buf[4] );
+    }
+  }
+
+  set_loopback( fd, 0, 0, 0, 0, 0 );
+  if ( stats && get_stats( fd, after ) == 0 )
+  {
+    print_stats( before, after );
+  }
+  close( fd );
+  return 0;
+}
+
+
+static int compare( const void * a, const void * b )
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* latency and jitter distribution of the records */
+static void analyze( void )
+{
+  double *     lat;
+  double *     frames;
+  double       dt;
+  double       d;
+  double       sx, sy, sxx, sxy;
+  double       slope;
+  double       min;
+  double       mean;
+  double       var;
+  unsigned int bins[ MAX_BINS ];
+  int          i;
+  int          k;
+
+  if ( g_count < 2 )
+  {
+    fprintf( stderr, "not enough reports\n" );
+    return;
+  }
+  lat = malloc( g_count * sizeof( *lat ) );
+  frames = malloc( g_count * sizeof( *frames ) );
+
+  /* unwrap the 11 bit frame numbers, using the host clock to count the
+    wraps in long gaps; lat[] holds the clock offsets for now */
+  frames[0] = 0;
+  for ( i = 1; i < g_count; i++ )
+  {
+    d = ( g_records[i].frame - g_records[ i - 1 ].frame ) & 0x7FF;
+    dt = ( g_records[i].time - g_records[ i - 1 ].time ) / 1000.0;
+    k = (int)floor( ( dt - d ) / 2048.0 + 0.5 );
+    frames[i] = frames[ i - 1 ] + d + 2048.0 * ( k > 0 ? k : 0 );
+  }
+  for ( i = 0; i < g_count; i++ )
+  {
+    lat[i] = ( g_records[i].time - g_records[0].time ) / 1000.0 - frames[i];
+  }
+
+  /* remove linear drift between device and host clock (least squares) */
+  sx = sy = sxx = sxy = 0;
+  for ( i = 0; i < g_count; i++ )
+  {
+    d = frames[i];
+    sx += d;
+    sy += lat[i];
+    sxx += d * d;
+    sxy += d * lat[i];
+  }
+  d = g_count * sxx - sx * sx;
+  slope = d != 0 ? ( g_count * sxy - sx * sy ) / d : 0;
+  min = 1e300;
+  for ( i = 0; i < g_count; i++ )
+  {
+    lat[i] -= slope * frames[i];
+    min = lat[i] < min ? lat[i] : min;
+  }
+
+  /* relative to the fastest report */
+  mean = 0;
+  for ( i = 0; i < g_count; i++ )
+  {
+    lat[i] -= min;
+    mean += lat[i];
+  }
+  mean /= g_count;
+  var = 0;
+  for ( i = 0; i < g_count; i++ )
+  {
+    var += ( lat[i] - mean ) * ( lat[i] - mean );
+  }
+  var /= g_count;
+  qsort( lat, g_count, sizeof( *lat ), compare );
+
+  printf( "%d reports, clock drift %+.1f ppm\n", g_count, slope * 1e6 );
+  printf( "latency above minimum [ms]: mean %.3f  stddev %.3f\n", mean,
+    sqrt( var ) );
+  printf( "  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+    lat[ g_count / 2 ], lat[ g_count * 9 / 10 ], lat[ g_count * 99 / 100 ],
+    lat[ g_count - 1 ] );
+
+  memset( bins, 0, sizeof( bins ) );
+  for ( i = 0; i < g_count; i++ )
+  {
+    k = (int)( lat[i] * 1000 / BIN_US );
+    ++bins[ k < MAX_BINS ? k : MAX_BINS - 1 ];
+  }
+  for ( k = MAX_BINS - 1; k > 0 && bins[k] == 0; k-- )
+  {
+  }
+  for ( i = 0; i <= k; i++ )
+  {
+    printf( "%6.2f %6u ", i * BIN_US / 1000.0, bins[i] );
+    for ( d = 0; d < bins[i] * 60.0 / g_count; d++ )
+    {
+      putchar( '#' );
+    }
+    putchar( '\n' );
+  }
+  free( frames );
+  free( lat );
+}
+
+
+int main( int argc, char * argv[] )
+{
+  char         paths[1][ HIDDEV_PATH_MAX ];
+  const char * dev;
+  const char * replay;
+  FILE *       log;
+  unsigned int period;
+  unsigned int spread;
+  unsigned int count;
+  unsigned int mask;
+  int          n;
+  int          opt;
+
+  dev = NULL;
+  replay = NULL;
+  log = NULL;
+  n = 1000;
+  period = 100;
+  spread = 37;
+  count = 0;
+  mask = 0x0001;
+  while ( ( opt = getopt( argc, argv, "d:n:w:c:r:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'd': dev = optarg; break;
+      case 'n': n = atoi( optarg ); break;
+      case 'r': replay = optarg; break;
+      case 'w':
+        log = fopen( optarg, "w" );
+        if ( log == NULL )
+        {
+          perror( optarg );
+          return 1;
+        }
+        break;
+      case 'c':
+        if ( sscanf( optarg, "%u,%u,%u,%x", &period, &spread, &count,
+          &mask ) != 4 )
+        {
+          fprintf( stderr, "-c period,spread,count,mask\n" );
+          return 2;
+        }
+        break;
+      default:
+        fprintf( stderr, "usage: %s [-d hidraw] [-n reports] [-w log] "
+          "[-c period,spread,count,mask]\n"
+          "       %s -r log\n", argv[0], argv[0] );
+        return 2;
+    }
+  }
+
+  if ( replay != NULL )
+  {
+    if ( read_log( replay ) != 0 )
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    if ( dev == NULL )
+    {
+      if ( hiddev_find( HIDDEV_VID, HIDDEV_PID, paths, 1 ) == 0 )
+      {
+        fprintf( stderr, "no adapter found\n" );
+        return 1;
+      }
+      dev = paths[0];
+    }
+    if ( record( dev, n, log, period, spread, count, mask ) != 0 )
+    {
+      return 1;
+    }
+    if ( log != NULL )
+    {
+      fclose( log );
+    }
+  }
+
+  analyze();
+  return 0;
+}
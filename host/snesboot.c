@@ -0,0 +1,445 @@
+/* snesboot.c */
+/* uploads firmware to all attached adapters through the USB bootloader
+
+  usage: snesboot main.hex
+
+  The hex file must be built with "make BOOT=1" (see ../src/Makefile).
+  Adapters running the application are restarted into the bootloader, then
+  every adapter in bootloader mode is programmed, verified and started,
+  all of them at the same time. Adapters that fail are listed at the end
+  and do not stop the others. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include <linux/usbdevice_fs.h>
+#include "hiddev.h"
+
+/* program memory layout (see ../boot/boot.c) */
+#define APP_START    0x1000
+#define APP_END      0x4000
+#define BLOCK_SIZE   64
+
+/* bootloader commands */
+#define CMD_WRITE    0x01
+#define CMD_ERASE    0x02
+#define CMD_VERIFY   0x03
+#define CMD_RUN      0x04
+
+/* report sizes */
+#define CMD_SIZE     ( 4 + BLOCK_SIZE )
+#define STATUS_SIZE  8
+
+/* vendor request of the application (see REQ_ENTER_BOOTLOADER in usb.c) */
+#define REQ_ENTER_BOOTLOADER  0x01
+
+#define MAX_DEVICES  256
+
+/* time for the bootloader to detach after CMD_RUN [us] */
+#define RUN_TIMEOUT_US  2000000
+
+/* one adapter being programmed */
+struct boot_dev
+{
+  const char *       path;
+  int                fd;
+  pthread_t          thread;
+  int                ok;          /* programmed, verified and started */
+  unsigned long long ms;          /* time to program and verify */
+  char               error[ 96 ]; /* why not */
+};
+
+/* static data */
+static unsigned char g_image[ APP_END ];  /* program memory image */
+
+
+/* read Intel HEX file into g_image */
+static int load_hex( const char * file )
+{
+  FILE *        f;
+  char          line[ 600 ];
+  unsigned int  len;
+  unsigned int  addr;
+  unsigned int  type;
+  unsigned int  byte;
+  unsigned long base;
+  unsigned long a;
+  unsigned int  i;
+  int           count;
+
+  f = fopen( file, "r" );
+  if ( f == NULL )
+  {
+    perror( file );
+    return -1;
+  }
+
+  memset( g_image, 0xFF, sizeof( g_image ) );
+  base = 0;
+  count = 0;
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] != ':' ||
+      sscanf( line + 1, "%2x%4x%2x", &len, &addr, &type ) != 3 ||
+      strlen( line ) < 11 + 2 * len )
+    {
+      continue;
+    }
+    if ( type == 0x01 )
+    {
+      break;    /* end of file */
+    }
+    if ( type == 0x04 && len == 2 )
+    {
+      sscanf( line + 9, "%4x", &addr );
+      base = (unsigned long)addr << 16;
+      continue;
+    }
+    if ( type != 0x00 )
+    {
+      continue;
+    }
+    for ( i = 0; i < len; i++ )
+    {
+      sscanf( line + 9 + 2 * i, "%2x", &byte );
+      a = base + addr + i;
+      if ( a >= APP_START && a < APP_END )
+      {
+        g_image[ a ] = (unsigned char)byte;
+        ++count;
+      }
+      /* NOTE: the boot block (reset vector of c018i), configuration and
+        ID locations cannot be changed by the bootloader and are skipped */
+    }
+  }
+  fclose( f );
+  return count;
+}
+
+
+/* CRC-16/CCITT of the application memory, as computed by the bootloader,
+  with the first block erased unless vector is set */
+static unsigned short image_crc( int vector )
+{
+  unsigned short crc;
+  unsigned long  a;
+  int            i;
+
+  crc = 0xFFFF;
+  for ( a = APP_START; a < APP_END; a++ )
+  {
+    crc ^= (unsigned short)( vector || a >= APP_START + BLOCK_SIZE ?
+      g_image[ a ] : 0xFF ) << 8;
+    for ( i = 0; i < 8; i++ )
+    {
+      crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+
+/* restart an adapter running the application into the bootloader */
+static void enter_bootloader( const char * hidraw )
+{
+  struct usbdevfs_ctrltransfer ctrl;
+  char usbnode[ HIDDEV_PATH_MAX ];
+  int  fd;
+
+  if ( hiddev_usbnode( hidraw, usbnode ) != 0 )
+  {
+    fprintf( stderr, "%s: no USB device found\n", hidraw );
+    return;
+  }
+  fd = open( usbnode, O_RDWR );
+  if ( fd < 0 )
+  {
+    perror( usbnode );
+    return;
+  }
+  memset( &ctrl, 0, sizeof( ctrl ) );
+  ctrl.bRequestType = 0x40;   /* vendor, host-to-device, device */
+  ctrl.bRequest = REQ_ENTER_BOOTLOADER;
+  ctrl.timeout = 1000;
+  if ( ioctl( fd, USBDEVFS_CONTROL, &ctrl ) < 0 && errno != ENODEV )
+  {
+    /* NOTE: ENODEV is fine, the device may be gone before we return */
+    perror( usbnode );
+  }
+  close( fd );
+}
+
+
+/* record why an adapter failed, returns it for the thread */
+static void * dev_error( struct boot_dev * dev, const char * what )
+{
+  snprintf( dev->error, sizeof( dev->error ), "%s: %s", what,
+    strerror( errno ) );
+  return dev;
+}
+
+
+/* send one command, blocks while the bootloader's queue is full */
+static int send_cmd( int fd, unsigned char cmd, unsigned char seq,
+  unsigned short addr, const unsigned char * data, int len )
+{
+  unsigned char buf[ 1 + CMD_SIZE ];
+
+  memset( buf, 0, sizeof( buf ) );
+  buf[0] = 0;         /* report number: no report IDs */
+  buf[1] = cmd;
+  buf[2] = seq;
+  buf[3] = addr & 0xFF;
+  buf[4] = addr >> 8;
+  if ( data != NULL )
+  {
+    memcpy( buf + 5, data, len );
+  }
+  return write( fd, buf, sizeof( buf ) ) == (ssize_t)sizeof( buf ) ? 0 : -1;
+}
+
+
+/* read status report */
+static int get_status( int fd, unsigned char * status )
+{
+  unsigned char buf[ 1 + STATUS_SIZE ];
+
+  buf[0] = 0;
+  if ( ioctl( fd, HIDIOCGFEATURE( sizeof( buf ) ), buf ) < 0 )
+  {
+    return -1;
+  }
+  memcpy( status, buf + 1, STATUS_SIZE );
+  return 0;
+}
+
+
+/* verify the application memory against the given CRC, returns 0 if it
+  matches */
+static int verify( struct boot_dev * dev, unsigned char seq,
+  unsigned short crc )
+{
+  unsigned char status[ STATUS_SIZE ];
+  unsigned char crcbuf[2];
+
+  crcbuf[0] = crc & 0xFF;
+  crcbuf[1] = crc >> 8;
+  if ( send_cmd( dev->fd, CMD_VERIFY, seq, 0, crcbuf, 2 ) != 0 )
+  {
+    dev_error( dev, "verify" );
+    return -1;
+  }
+
+  /* wait until the verify command has been executed */
+  do
+  {
+    if ( get_status( dev->fd, status ) != 0 )
+    {
+      dev_error( dev, "status" );
+      return -1;
+    }
+  }
+  while ( status[0] != seq || status[1] != 0 );
+
+  if ( status[2] != 0 )
+  {
+    snprintf( dev->error, sizeof( dev->error ),
+      "error %d, CRC %02X%02X (expected %04X)", status[2], status[5],
+      status[4], crc );
+    return -1;
+  }
+  return 0;
+}
+
+
+/* program, verify and start one adapter, on its own thread */
+static void * program( void * arg )
+{
+  struct boot_dev *  dev;
+  unsigned char      status[ STATUS_SIZE ];
+  unsigned char      seq;
+  unsigned long      a;
+  unsigned long long start;
+  int                i;
+
+  dev = arg;
+  start = hiddev_now_us();
+
+  /* NOTE: the bootloader starts the application whenever the reset vector
+    at APP_START is programmed, so its block is erased first and written
+    last, once the rest has been verified: an update cut short leaves the
+    adapter in the bootloader */
+  seq = 0;
+  if ( send_cmd( dev->fd, CMD_ERASE, ++seq, APP_START, NULL, 0 ) != 0 )
+  {
+    return dev_error( dev, "erase" );
+  }
+
+  /* NOTE: each write returns as soon as the bootloader has queued the
+    block, so transfers overlap with erase/write cycles of earlier blocks */
+  for ( a = APP_START + BLOCK_SIZE; a < APP_END; a += BLOCK_SIZE )
+  {
+    for ( i = 0; i < BLOCK_SIZE && g_image[ a + i ] == 0xFF; i++ )
+    {
+    }
+    if ( send_cmd( dev->fd, i == BLOCK_SIZE ? CMD_ERASE : CMD_WRITE, ++seq,
+      (unsigned short)a, g_image + a, BLOCK_SIZE ) != 0 )
+    {
+      return dev_error( dev, "write" );
+    }
+  }
+  if ( verify( dev, ++seq, image_crc( 0 ) ) != 0 )
+  {
+    return dev;
+  }
+
+  /* then the reset vector */
+  if ( send_cmd( dev->fd, CMD_WRITE, ++seq, APP_START, g_image + APP_START,
+    BLOCK_SIZE ) != 0 )
+  {
+    return dev_error( dev, "write" );
+  }
+  if ( verify( dev, ++seq, image_crc( 1 ) ) != 0 )
+  {
+    return dev;
+  }
+  dev->ms = ( hiddev_now_us() - start ) / 1000;
+
+  /* start the application: the bootloader answers the command, then
+    detaches, which is the only way this ends well */
+  if ( send_cmd( dev->fd, CMD_RUN, ++seq, 0, NULL, 0 ) != 0 )
+  {
+    return dev_error( dev, "run" );
+  }
+  start = hiddev_now_us();
+  for ( ;; )
+  {
+    if ( get_status( dev->fd, status ) == 0 )
+    {
+      if ( status[0] == seq && status[2] != 0 )
+      {
+        snprintf( dev->error, sizeof( dev->error ),
+          "error %d, application not started", status[2] );
+        return dev;
+      }
+    }
+    else if ( errno == ENODEV )
+    {
+      break;    /* detached */
+    }
+    if ( hiddev_now_us() - start > RUN_TIMEOUT_US )
+    {
+      snprintf( dev->error, sizeof( dev->error ),
+        "application not started, still attached" );
+      return dev;
+    }
+    /* NOTE: requests in flight while the device detaches fail with
+      other errors (EPROTO, EPIPE, ...) until hidraw has seen it go */
+    usleep( 10000 );
+  }
+  dev->ok = 1;
+  return dev;
+}
+
+
+int main( int argc, char * argv[] )
+{
+  static char            paths[ MAX_DEVICES ][ HIDDEV_PATH_MAX ];
+  static struct boot_dev devs[ MAX_DEVICES ];
+  unsigned long long     start;
+  int                    count;
+  int                    failed;
+  int                    tries;
+  int                    i;
+
+  if ( argc != 2 )
+  {
+    fprintf( stderr, "usage: %s main.hex\n", argv[0] );
+    return 2;
+  }
+  if ( load_hex( argv[1] ) <= 0 )
+  {
+    fprintf( stderr, "%s: no data for application memory\n", argv[1] );
+    return 1;
+  }
+
+  /* restart running adapters into the bootloader */
+  count = hiddev_find( HIDDEV_VID, HIDDEV_PID, paths, MAX_DEVICES );
+  for ( i = 0; i < count; i++ )
+  {
+    enter_bootloader( paths[i] );
+  }
+
+  /* wait for them to enumerate as bootloaders */
+  tries = count != 0 ? 50 : 1;
+  do
+  {
+    if ( count != 0 )
+    {
+      usleep( 100000 );
+    }
+    i = hiddev_find( HIDDEV_VID, HIDDEV_PID_BOOT, paths, MAX_DEVICES );
+  }
+  while ( i < count && --tries != 0 );
+  count = i;
+
+  if ( count == 0 )
+  {
+    fprintf( stderr, "no adapter found\n" );
+    return 1;
+  }
+
+  /* open all of them, then program them at the same time: the blocks are
+    SET_REPORT control transfers, each write blocks until its bootloader
+    has taken the block, so every adapter gets a thread of its own */
+  start = hiddev_now_us();
+  for ( i = 0; i < count; i++ )
+  {
+    devs[i].path = paths[i];
+    devs[i].fd = open( paths[i], O_RDWR );
+    if ( devs[i].fd < 0 )
+    {
+      dev_error( &devs[i], "open" );
+      continue;
+    }
+    if ( pthread_create( &devs[i].thread, NULL, program, &devs[i] ) != 0 )
+    {
+      dev_error( &devs[i], "thread" );
+      close( devs[i].fd );
+      devs[i].fd = -1;
+    }
+  }
+  for ( i = 0; i < count; i++ )
+  {
+    if ( devs[i].fd >= 0 )
+    {
+      pthread_join( devs[i].thread, NULL );
+      close( devs[i].fd );
+    }
+  }
+
+  /* one failing adapter does not stop the others, report them all */
+  failed = 0;
+  for ( i = 0; i < count; i++ )
+  {
+    if ( devs[i].ok )
+    {
+      printf( "%s: programmed and verified in %llu ms\n", devs[i].path,
+        devs[i].ms );
+    }
+    else
+    {
+      fprintf( stderr, "%s: %s\n", devs[i].path, devs[i].error );
+      ++failed;
+    }
+  }
+  printf( "%d of %d adapters programmed in %llu ms\n", count - failed, count,
+    ( hiddev_now_us() - start ) / 1000 );
+  return failed != 0;
+}
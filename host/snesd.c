@@ -0,0 +1,641 @@
+/* snesd.c */
+/* republishes adapters as uinput gamepads
+
+  usage: snesd [-m] [-n] [-s seconds] [-p priority] [-d /dev/hidrawN]...
+
+  Opens all adapters (or those of -d) through hidraw and creates a uinput
+  gamepad for each, "SNES pad 1", "SNES pad 2", ... in the order they
+  were found. With -m all adapters drive one gamepad, "SNES pads", which
+  shows a button pressed while it is pressed on any of them. With -n no
+  gamepads are created, for statistics only. Adapters plugged in later
+  are picked up within a second, unplugged ones are dropped.
+
+  One epoll loop serves all adapters. Each wakeup is timestamped and all
+  reports queued by then are read at once, so the events of one wakeup
+  go out in the order of the adapters, each adapter's in one write.
+  -p runs the loop at SCHED_FIFO priority with locked memory.
+
+  Statistics are printed to stderr every -s seconds, on SIGUSR1 and at
+  exit, for the time since they were last printed:
+
+    /dev/hidrawN: <reports> reports, <wakeups with more than one report>
+      batched, hid <mean>/<max> ms, out <mean>/<max> us
+
+  hid is the arrival time of the reports relative to the fastest one,
+  against the frame number the adapter stamps them with (see snesbench.c):
+  what polling interval, host controller and input stack add to the
+  minimum latency. out is the time from the wakeup to the events written
+  to the gamepad. The first report after opening an adapter is published
+  but not counted, it may have been queued long before.
+  NOTE: the device clock drifts against the host clock by up to about
+  0.1 ms per second, long intervals overstate hid. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/uinput.h>
+#include "hiddev.h"
+
+/* report of the buttons (see ../src/usb.c and snes_report() in
+  ../src/snes.c) */
+#define REPORT_ID    1
+#define REPORT_SIZE  5
+
+#define MAX_PADS     16
+/* arrival times kept per adapter and statistics interval */
+#define MAX_SAMPLES  8192
+/* events of one report: 2 axes, 8 buttons, SYN_REPORT */
+#define MAX_EVENTS   11
+
+/* one adapter */
+struct pad
+{
+  char               path[ HIDDEV_PATH_MAX ];
+  int                fd;          /* hidraw, -1 when gone */
+  int                ui;          /* uinput, -1 if none or merged */
+  unsigned char      state[2];    /* report bytes 1 and 2 published */
+  int                first;       /* next report is the first */
+  int                ready;       /* reported by epoll_wait() */
+  /* statistics */
+  unsigned long      reports;
+  unsigned long      batched;
+  unsigned long long out_sum;
+  unsigned long long out_max;
+  unsigned long long last_time;   /* arrival of the previous report */
+  unsigned short     last_frame;
+  double             frame;       /* unwrapped frame number */
+  double *           offsets;     /* arrival [ms] - frame */
+  int                samples;
+};
+
+/* buttons in the order of the report bits (byte 2) */
+static const unsigned short g_keys[8] =
+{
+  BTN_SOUTH,    /* B */
+  BTN_WEST,     /* Y */
+  BTN_EAST,     /* A */
+  BTN_NORTH,    /* X */
+  BTN_TL,       /* L */
+  BTN_TR,       /* R */
+  BTN_START,
+  BTN_SELECT
+};
+
+/* static data */
+static struct pad    g_pads[ MAX_PADS ];
+static int           g_npads;
+static int           g_epoll;
+static int           g_merged = -1;   /* uinput of -m */
+static unsigned char g_mstate[2];     /* published by the merged device */
+static int           g_uinput = 1;
+static volatile int  g_stop;
+static volatile int  g_dump;
+
+
+static void on_signal( int sig )
+{
+  if ( sig == SIGUSR1 )
+  {
+    g_dump = 1;
+  }
+  else
+  {
+    g_stop = 1;
+  }
+}
+
+/* create a uinput gamepad */
+static int ui_create( const char * name )
+{
+  struct uinput_setup     setup;
+  struct uinput_abs_setup abs;
+  int                     fd;
+  int                     i;
+
+  fd = open( "/dev/uinput", O_WRONLY | O_NONBLOCK );
+  if ( fd < 0 )
+  {
+    perror( "/dev/uinput" );
+    return -1;
+  }
+  ioctl( fd, UI_SET_EVBIT, EV_KEY );
+  for ( i = 0; i < 8; i++ )
+  {
+    ioctl( fd, UI_SET_KEYBIT, g_keys[i] );
+  }
+  ioctl( fd, UI_SET_EVBIT, EV_ABS );
+  memset( &abs, 0, sizeof( abs ) );
+  abs.absinfo.minimum = -1;
+  abs.absinfo.maximum = 1;
+  abs.code = ABS_X;
+  ioctl( fd, UI_SET_ABSBIT, ABS_X );
+  ioctl( fd, UI_ABS_SETUP, &abs );
+  abs.code = ABS_Y;
+  ioctl( fd, UI_SET_ABSBIT, ABS_Y );
+  ioctl( fd, UI_ABS_SETUP, &abs );
+
+  /* NOTE: not BUS_USB, so programs looking for the adapter do not take
+    the gamepad for one */
+  memset( &setup, 0, sizeof( setup ) );
+  setup.id.bustype = BUS_VIRTUAL;
+  setup.id.vendor = HIDDEV_VID;
+  setup.id.product = HIDDEV_PID;
+  snprintf( setup.name, sizeof( setup.name ), "%s", name );
+  if ( ioctl( fd, UI_DEV_SETUP, &setup ) < 0 ||
+    ioctl( fd, UI_DEV_CREATE ) < 0 )
+  {
+    perror( "uinput" );
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+/* axis value of 2 report bits (-1, 0 or 1) */
+static int axis( unsigned char bits )
+{
+  bits &= 0x03;
+  return bits == 0x03 ? -1 : bits;
+}
+
+/* append events for the change from old to state, returns their number */
+static int events( struct input_event * ev, const unsigned char * old,
+  const unsigned char * state )
+{
+  int n;
+  int i;
+
+  n = 0;
+  memset( ev, 0, MAX_EVENTS * sizeof( *ev ) );
+  if ( ( old[0] ^ state[0] ) & 0x03 )
+  {
+    ev[n].type = EV_ABS;
+    ev[n].code = ABS_X;
+    ev[ n++ ].value = axis( state[0] );
+  }
+  if ( ( old[0] ^ state[0] ) & 0x0C )
+  {
+    ev[n].type = EV_ABS;
+    ev[n].code = ABS_Y;
+    ev[ n++ ].value = axis( state[0] >> 2 );
+  }
+  for ( i = 0; i < 8; i++ )
+  {
+    if ( ( old[1] ^ state[1] ) & ( 1 << i ) )
+    {
+      ev[n].type = EV_KEY;
+      ev[n].code = g_keys[i];
+      ev[ n++ ].value = ( state[1] >> i ) & 1;
+    }
+  }
+  if ( n != 0 )
+  {
+    ev[n].type = EV_SYN;
+    ev[ n++ ].code = SYN_REPORT;
+  }
+  return n;
+}
+
+/* open an adapter */
+static void pad_open( const char * path )
+{
+  struct epoll_event ev;
+  struct pad *       pad;
+  char               name[ 32 ];
+  int                i;
+
+  for ( i = 0; i < g_npads && g_pads[i].fd >= 0; i++ )
+  {
+  }
+  if ( i == MAX_PADS )
+  {
+    return;
+  }
+  pad = &g_pads[i];
+  pad->fd = open( path, O_RDONLY | O_NONBLOCK );
+  if ( pad->fd < 0 )
+  {
+    perror( path );
+    return;
+  }
+  snprintf( pad->path, sizeof( pad->path ), "%s", path );
+  pad->ui = -1;
+  if ( g_uinput && g_merged < 0 )
+  {
+    /* an adapter plugged in again gets the number of the one gone */
+    snprintf( name, sizeof( name ), "SNES pad %d", i + 1 );
+    pad->ui = ui_create( name );
+  }
+  memset( pad->state, 0, sizeof( pad->state ) );
+  pad->first = 1;
+  pad->reports = 0;
+  pad->batched = 0;
+  pad->out_sum = 0;
+  pad->out_max = 0;
+  pad->samples = 0;
+  if ( pad->offsets == NULL )
+  {
+    pad->offsets = malloc( MAX_SAMPLES * sizeof( *pad->offsets ) );
+    if ( pad->offsets == NULL )
+    {
+      perror( "malloc" );
+      exit( 1 );
+    }
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = pad;
+  epoll_ctl( g_epoll, EPOLL_CTL_ADD, pad->fd, &ev );
+  g_npads = i == g_npads ? g_npads + 1 : g_npads;
+  fprintf( stderr, "%s: pad %d\n", path, i + 1 );
+}
+
+/* drop an adapter that is gone */
+static void pad_close( struct pad * pad )
+{
+  unsigned char      none[2] = { 0, 0 };
+  struct input_event ev[ MAX_EVENTS ];
+  int                n;
+
+  fprintf( stderr, "%s: gone\n", pad->path );
+  epoll_ctl( g_epoll, EPOLL_CTL_DEL, pad->fd, NULL );
+  close( pad->fd );
+  pad->fd = -1;
+  /* release what it held */
+  if ( pad->ui >= 0 )
+  {
+    n = events( ev, pad->state, none );
+    if ( n != 0 && write( pad->ui, ev, n * sizeof( *ev ) ) < 0 )
+    {
+      perror( pad->path );
+    }
+    ioctl( pad->ui, UI_DEV_DESTROY );
+    close( pad->ui );
+    pad->ui = -1;
+  }
+  memset( pad->state, 0, sizeof( pad->state ) );
+}
+
+/* open adapters that are not open yet */
+static void scan( void )
+{
+  char paths[ MAX_PADS ][ HIDDEV_PATH_MAX ];
+  int  n;
+  int  i;
+  int  k;
+
+  n = hiddev_find( HIDDEV_VID, HIDDEV_PID, paths, MAX_PADS );
+  for ( k = 0; k < n; k++ )
+  {
+    for ( i = 0; i < g_npads; i++ )
+    {
+      if ( g_pads[i].fd >= 0 && strcmp( g_pads[i].path, paths[k] ) == 0 )
+      {
+        break;
+      }
+    }
+    if ( i == g_npads )
+    {
+      pad_open( paths[k] );
+    }
+  }
+}
+
+/* note arrival of a report for the statistics */
+static void sample( struct pad * pad, unsigned long long now,
+  unsigned short frame )
+{
+  double d;
+  double dt;
+  int    k;
+
+  frame &= 0x7FF;
+  if ( pad->reports == 0 )
+  {
+    pad->frame = 0;
+    pad->samples = 0;
+  }
+  else
+  {
+    /* unwrap the 11 bit frame number, the host clock counts the wraps */
+    d = ( frame - pad->last_frame ) & 0x7FF;
+    dt = ( now - pad->last_time ) / 1000.0;
+    k = (int)( ( dt - d ) / 2048.0 + 0.5 );
+    pad->frame += d + 2048.0 * ( k > 0 ? k : 0 );
+  }
+  pad->last_time = now;
+  pad->last_frame = frame;
+  if ( pad->samples < MAX_SAMPLES )
+  {
+    pad->offsets[ pad->samples++ ] = now / 1000.0 - pad->frame;
+  }
+  ++pad->reports;
+}
+
+/* read all reports an adapter has queued, publish them */
+static void pad_read( struct pad * pad, unsigned long long now )
+{
+  struct input_event ev[ 64 * MAX_EVENTS ];
+  unsigned char      buf[ 64 ];
+  unsigned long long out;
+  ssize_t            len;
+  int                reports;
+  int                n;
+
+  n = 0;
+  reports = 0;
+  for ( ;; )
+  {
+    len = read( pad->fd, buf, sizeof( buf ) );
+    if ( len < 0 )
+    {
+      if ( errno != EAGAIN && errno != EINTR )
+      {
+        pad_close( pad );
+        return;
+      }
+      break;
+    }
+    if ( len < REPORT_SIZE || buf[0] != REPORT_ID )
+    {
+      continue;   /* statistics or loopback report */
+    }
+    ++reports;
+    if ( pad->first )
+    {
+      pad->first = 0;
+    }
+    else
+    {
+      sample( pad, now, buf[3] | buf[4] << 8 );
+    }
+    if ( pad->ui >= 0 && n <= ( 63 * MAX_EVENTS ) )
+    {
+      n += events( ev + n, pad->state, buf + 1 );
+    }
+    pad->state[0] = buf[1];
+    pad->state[1] = buf[2];
+  }
+  if ( reports > 1 )
+  {
+    ++pad->batched;
+  }
+  if ( n != 0 )
+  {
+    if ( write( pad->ui, ev, n * sizeof( *ev ) ) < 0 )
+    {
+      perror( pad->path );
+    }
+    out = hiddev_now_us() - now;
+    pad->out_sum += out;
+    pad->out_max = out > pad->out_max ? out : pad->out_max;
+  }
+}
+
+/* publish the merged state of all adapters */
+static void merge( unsigned long long now )
+{
+  struct input_event ev[ MAX_EVENTS ];
+  unsigned char      state[2];
+  unsigned long long out;
+  int                x;
+  int                y;
+  int                n;
+  int                i;
+
+  x = 0;
+  y = 0;
+  state[1] = 0;
+  for ( i = 0; i < g_npads; i++ )
+  {
+    x += axis( g_pads[i].state[0] );
+    y += axis( g_pads[i].state[0] >> 2 );
+    state[1] |= g_pads[i].state[1];
+  }
+  /* opposite directions cancel out */
+  state[0] = ( x < 0 ? 0x03 : x > 0 ? 0x01 : 0 ) |
+    ( y < 0 ? 0x0C : y > 0 ? 0x04 : 0 );
+  n = events( ev, g_mstate, state );
+  if ( n == 0 )
+  {
+    return;
+  }
+  if ( write( g_merged, ev, n * sizeof( *ev ) ) < 0 )
+  {
+    perror( "uinput" );
+  }
+  g_mstate[0] = state[0];
+  g_mstate[1] = state[1];
+  out = hiddev_now_us() - now;
+  for ( i = 0; i < g_npads; i++ )
+  {
+    g_pads[i].out_sum += out;
+    g_pads[i].out_max = out > g_pads[i].out_max ? out : g_pads[i].out_max;
+  }
+}
+
+/* epoll time-out until a deadline [ms], 0 if it has passed already */
+static int wait_ms( unsigned long long deadline, unsigned long long now )
+{
+  long long left;
+
+  left = (long long)( deadline - now );
+  return left > 0 ? (int)( left / 1000 + 1 ) : 0;
+}
+
+
+/* print and restart the statistics */
+static void dump( void )
+{
+  struct pad * pad;
+  double       min;
+  double       max;
+  double       sum;
+  int          i;
+  int          k;
+
+  for ( i = 0; i < g_npads; i++ )
+  {
+    pad = &g_pads[i];
+    if ( pad->fd < 0 )
+    {
+      continue;
+    }
+    min = 1e300;
+    max = 0;
+    sum = 0;
+    for ( k = 0; k < pad->samples; k++ )
+    {
+      min = pad->offsets[k] < min ? pad->offsets[k] : min;
+    }
+    for ( k = 0; k < pad->samples; k++ )
+    {
+      sum += pad->offsets[k] - min;
+      max = pad->offsets[k] - min > max ? pad->offsets[k] - min : max;
+    }
+    fprintf( stderr, "%s: %lu reports, %lu batched, hid %.3f/%.3f ms, "
+      "out %llu/%llu us\n", pad->path, pad->reports, pad->batched,
+      pad->samples ? sum / pad->samples : 0.0, max,
+      pad->reports ? pad->out_sum / pad->reports : 0, pad->out_max );
+    pad->reports = 0;
+    pad->batched = 0;
+    pad->out_sum = 0;
+    pad->out_max = 0;
+    pad->samples = 0;
+  }
+}
+
+
+int main( int argc, char * argv[] )
+{
+  struct epoll_event  ev[ MAX_PADS ];
+  struct sched_param  param;
+  const char *        paths[ MAX_PADS ];
+  unsigned long long  now;
+  unsigned long long  next_scan;
+  unsigned long long  next_dump;
+  unsigned long long  period;
+  int                 npaths;
+  int                 prio;
+  int                 timeout;
+  int                 n;
+  int                 i;
+  int                 opt;
+
+  npaths = 0;
+  period = 0;
+  prio = 0;
+  while ( ( opt = getopt( argc, argv, "mns:p:d:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'm': g_merged = 0; break;
+      case 'n': g_uinput = 0; break;
+      case 's': period = strtoull( optarg, NULL, 10 ) * 1000000ULL; break;
+      case 'p': prio = atoi( optarg ); break;
+      case 'd':
+        if ( npaths < MAX_PADS )
+        {
+          paths[ npaths++ ] = optarg;
+        }
+        break;
+      default:
+        fprintf( stderr, "usage: %s [-m] [-n] [-s seconds] [-p priority] "
+          "[-d hidraw]...\n", argv[0] );
+        return 2;
+    }
+  }
+
+  if ( prio > 0 )
+  {
+    param.sched_priority = prio;
+    if ( sched_setscheduler( 0, SCHED_FIFO, &param ) != 0 ||
+      mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+    {
+      perror( "-p" );
+      return 1;
+    }
+  }
+  g_epoll = epoll_create1( 0 );
+  if ( g_epoll < 0 )
+  {
+    perror( "epoll_create1" );
+    return 1;
+  }
+  if ( g_merged == 0 )
+  {
+    g_merged = g_uinput ? ui_create( "SNES pads" ) : -1;
+    if ( g_uinput && g_merged < 0 )
+    {
+      return 1;
+    }
+  }
+  for ( i = 0; i < npaths; i++ )
+  {
+    pad_open( paths[i] );
+  }
+  if ( npaths == 0 )
+  {
+    scan();
+  }
+
+  signal( SIGINT, on_signal );
+  signal( SIGTERM, on_signal );
+  signal( SIGUSR1, on_signal );
+  now = hiddev_now_us();
+  next_scan = now + 1000000ULL;
+  next_dump = now + period;
+  while ( !g_stop )
+  {
+    /* wake up for the next rescan or statistics */
+    now = hiddev_now_us();
+    timeout = npaths != 0 ? -1 : wait_ms( next_scan, now );
+    if ( period != 0 &&
+      ( timeout < 0 || wait_ms( next_dump, now ) < timeout ) )
+    {
+      timeout = wait_ms( next_dump, now );
+    }
+    n = epoll_wait( g_epoll, ev, MAX_PADS, timeout );
+    now = hiddev_now_us();
+    for ( i = 0; i < n; i++ )
+    {
+      ( (struct pad *)ev[i].data.ptr )->ready = ev[i].events;
+    }
+    /* in the order of the adapters, not of epoll */
+    for ( i = 0; i < g_npads; i++ )
+    {
+      if ( g_pads[i].fd < 0 || !g_pads[i].ready )
+      {
+        continue;
+      }
+      if ( g_pads[i].ready & EPOLLIN )
+      {
+        pad_read( &g_pads[i], now );
+      }
+      else
+      {
+        pad_close( &g_pads[i] );  /* EPOLLERR or EPOLLHUP only */
+      }
+      g_pads[i].ready = 0;
+    }
+    if ( g_merged >= 0 && n > 0 )
+    {
+      merge( now );
+    }
+
+    if ( g_dump || ( period != 0 && now >= next_dump ) )
+    {
+      g_dump = 0;
+      dump();
+      next_dump = now + period;
+    }
+    if ( npaths == 0 && now >= next_scan )
+    {
+      scan();
+      next_scan = now + 1000000ULL;
+    }
+  }
+
+  dump();
+  for ( i = 0; i < g_npads; i++ )
+  {
+    if ( g_pads[i].fd >= 0 )
+    {
+      pad_close( &g_pads[i] );
+    }
+  }
+  if ( g_merged >= 0 )
+  {
+    ioctl( g_merged, UI_DEV_DESTROY );
+    close( g_merged );
+  }
+  return 0;
+}
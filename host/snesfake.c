@@ -0,0 +1,244 @@
+/* snesfake.c */
+/* fake adapters through uhid, to run snesd and snesbench without hardware
+
+  usage: snesfake [-n adapters] [-c period,mask]
+
+  Creates -n (default 1) HID devices with the IDs and report descriptor of
+  the adapter (see ../src/usb.c), which the kernel gives hidraw nodes like
+  the real ones. Each toggles the buttons of mask (hex, enum snes_buttons
+  of ../src/snes.h, default 0001: B) every period ms (default 100), the
+  adapters one ms apart. Reports are stamped with the ms of the monotonic
+  clock as frame number, as the adapter stamps them with its USB frame.
+
+  Feature reports (loopback, statistics) are answered with EIO, as
+  firmware without them stalls the request. Runs until interrupted. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+#include "hiddev.h"
+
+#define MAX_FAKES  16
+
+/* report descriptor of the adapter, report_desc in ../src/usb.c */
+static const unsigned char g_report_desc[] =
+{
+  0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x01, 0x09, 0x30, 0x09, 0x31,
+  0x15, 0xFF, 0x25, 0x01, 0x75, 0x02, 0x95, 0x02, 0x81, 0x02, 0x75, 0x01,
+  0x95, 0x04, 0x81, 0x03, 0x05, 0x09, 0x19, 0x01, 0x29, 0x06, 0x15, 0x00,
+  0x95, 0x06, 0x81, 0x02, 0x05, 0x01, 0x09, 0x3D, 0x09, 0x3E, 0x95, 0x02,
+  0x81, 0x02, 0x06, 0x00, 0xFF, 0x09, 0x01, 0x26, 0xFF, 0x07, 0x75, 0x10,
+  0x95, 0x01, 0x81, 0x02, 0x85, 0x03, 0x09, 0x03, 0x27, 0xFF, 0xFF, 0x00,
+  0x00, 0x95, 0x0A, 0xB1, 0x02, 0x85, 0x02, 0x09, 0x02, 0x26, 0xFF, 0x00,
+  0x75, 0x08, 0x95, 0x08, 0xB1, 0x02, 0xC0
+};
+
+/* static data */
+static volatile int g_stop;
+
+
+static void on_signal( int sig )
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+/* create a fake adapter */
+static int fake_create( int n )
+{
+  struct uhid_event ev;
+  int               fd;
+
+  fd = open( "/dev/uhid", O_RDWR | O_CLOEXEC );
+  if ( fd < 0 )
+  {
+    perror( "/dev/uhid" );
+    return -1;
+  }
+  memset( &ev, 0, sizeof( ev ) );
+  ev.type = UHID_CREATE2;
+  snprintf( (char *)ev.u.create2.name, sizeof( ev.u.create2.name ),
+    "snesfake %d", n );
+  snprintf( (char *)ev.u.create2.phys, sizeof( ev.u.create2.phys ),
+    "snesfake/%d", n );
+  ev.u.create2.rd_size = sizeof( g_report_desc );
+  ev.u.create2.bus = BUS_USB;
+  ev.u.create2.vendor = HIDDEV_VID;
+  ev.u.create2.product = HIDDEV_PID;
+  memcpy( ev.u.create2.rd_data, g_report_desc, sizeof( g_report_desc ) );
+  if ( write( fd, &ev, sizeof( ev ) ) < 0 )
+  {
+    perror( "uhid" );
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+/* answer requests of the kernel */
+static void fake_event( int fd )
+{
+  struct uhid_event ev;
+  struct uhid_event reply;
+
+  if ( read( fd, &ev, sizeof( ev ) ) <= 0 )
+  {
+    return;
+  }
+  memset( &reply, 0, sizeof( reply ) );
+  switch ( ev.type )
+  {
+    case UHID_GET_REPORT:
+      reply.type = UHID_GET_REPORT_REPLY;
+      reply.u.get_report_reply.id = ev.u.get_report.id;
+      reply.u.get_report_reply.err = EIO;
+      break;
+    case UHID_SET_REPORT:
+      reply.type = UHID_SET_REPORT_REPLY;
+      reply.u.set_report_reply.id = ev.u.set_report.id;
+      reply.u.set_report_reply.err = EIO;
+      break;
+    default:
+      return;   /* START, OPEN, CLOSE, OUTPUT */
+  }
+  if ( write( fd, &reply, sizeof( reply ) ) < 0 )
+  {
+    perror( "uhid" );
+  }
+}
+
+/* send a report with the given buttons */
+static void fake_report( int fd, unsigned short buttons,
+  unsigned short frame )
+{
+  struct uhid_event ev;
+  unsigned char *   report;
+
+  memset( &ev, 0, sizeof( ev ) );
+  ev.type = UHID_INPUT2;
+  ev.u.input2.size = 5;
+  report = ev.u.input2.data;
+  /* as snes_report() in ../src/snes.c */
+  report[0] = 1;
+  if ( buttons & 0x0040 ) report[1] |= 0x03;  /* left */
+  if ( buttons & 0x0080 ) report[1] |= 0x01;  /* right */
+  if ( buttons & 0x0020 ) report[1] |= 0x04;  /* down */
+  if ( buttons & 0x0010 ) report[1] |= 0x0C;  /* up */
+  if ( buttons & 0x0001 ) report[2] |= 0x01;  /* B */
+  if ( buttons & 0x0002 ) report[2] |= 0x02;  /* Y */
+  if ( buttons & 0x0100 ) report[2] |= 0x04;  /* A */
+  if ( buttons & 0x0200 ) report[2] |= 0x08;  /* X */
+  if ( buttons & 0x0400 ) report[2] |= 0x10;  /* L */
+  if ( buttons & 0x0800 ) report[2] |= 0x20;  /* R */
+  if ( buttons & 0x0008 ) report[2] |= 0x40;  /* start */
+  if ( buttons & 0x0004 ) report[2] |= 0x80;  /* select */
+  report[3] = frame & 0xFF;
+  report[4] = ( frame >> 8 ) & 0x07;
+  if ( write( fd, &ev, sizeof( ev ) ) < 0 )
+  {
+    perror( "uhid" );
+  }
+}
+
+
+int main( int argc, char * argv[] )
+{
+  struct pollfd      fds[ MAX_FAKES ];
+  unsigned short     buttons[ MAX_FAKES ];
+  unsigned long long next[ MAX_FAKES ];
+  unsigned long long now;
+  unsigned long long wait;
+  unsigned int       period;
+  unsigned int       mask;
+  int                n;
+  int                i;
+  int                opt;
+
+  n = 1;
+  period = 100;
+  mask = 0x0001;
+  while ( ( opt = getopt( argc, argv, "n:c:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n': n = atoi( optarg ); break;
+      case 'c':
+        if ( sscanf( optarg, "%u,%x", &period, &mask ) != 2 || period == 0 )
+        {
+          fprintf( stderr, "-c period,mask\n" );
+          return 2;
+        }
+        break;
+      default:
+        fprintf( stderr, "usage: %s [-n adapters] [-c period,mask]\n",
+          argv[0] );
+        return 2;
+    }
+  }
+  if ( n < 1 || n > MAX_FAKES )
+  {
+    fprintf( stderr, "-n 1..%d\n", MAX_FAKES );
+    return 2;
+  }
+
+  now = hiddev_now_us();
+  for ( i = 0; i < n; i++ )
+  {
+    fds[i].fd = fake_create( i + 1 );
+    fds[i].events = POLLIN;
+    if ( fds[i].fd < 0 )
+    {
+      return 1;
+    }
+    buttons[i] = 0;
+    next[i] = now + period * 1000ULL + i * 1000ULL;
+  }
+  signal( SIGINT, on_signal );
+  signal( SIGTERM, on_signal );
+
+  while ( !g_stop )
+  {
+    now = hiddev_now_us();
+    wait = ~0ULL;
+    for ( i = 0; i < n; i++ )
+    {
+      if ( next[i] <= now )
+      {
+        buttons[i] ^= mask;
+        fake_report( fds[i].fd, buttons[i], now / 1000 );
+        next[i] += period * 1000ULL;
+      }
+      if ( next[i] <= now )
+      {
+        wait = 0;   /* behind */
+      }
+      else if ( next[i] - now < wait )
+      {
+        wait = next[i] - now;
+      }
+    }
+    if ( poll( fds, n, (int)( ( wait + 999 ) / 1000 ) ) > 0 )
+    {
+      for ( i = 0; i < n; i++ )
+      {
+        if ( fds[i].revents & POLLIN )
+        {
+          fake_event( fds[i].fd );
+        }
+      }
+    }
+  }
+
+  /* closing /dev/uhid destroys the devices */
+  for ( i = 0; i < n; i++ )
+  {
+    close( fds[i].fd );
+  }
+  return 0;
+}
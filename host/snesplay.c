@@ -0,0 +1,270 @@
+/* snesplay.c */
+/* plays a movie to a console through the adapter (PLAYBACK in
+  ../src/playback.h)
+
+  usage: snesplay [-d /dev/hidrawN] movie
+
+  The movie holds one frame per line, the buttons in hex (enum
+  snes_buttons, ../src/snes.h), '#' starts a comment; "-" reads stdin.
+  Each frame answers one latch of the console.
+
+  Fills the buffer of the adapter through its playback endpoint (usbfs),
+  starts the playback with the feature report, streams the rest as fast
+  as the adapter takes it (it NAKs while its buffer is full) and waits
+  until the buffer has run dry. Then the counters of the adapter are
+  printed to stderr and the playback is stopped, also when interrupted.
+  NOTE: the endpoint only exists at full-speed. No kernel driver binds its
+  interface, so write access to the usbfs node is all it takes. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include <linux/usbdevice_fs.h>
+#include "hiddev.h"
+
+/* playback interface, endpoint and control (see ../src/usb.h and
+  ../src/playback.h) */
+#define PLAYBACK_INTERFACE  1
+#define PLAYBACK_EP         0x02
+#define PLAYBACK_PACKET     32
+#define PLAYBACK_REPORT_ID  5
+#define PLAYBACK_SIZE       11
+
+/* static data */
+static volatile int     g_stop;
+static unsigned short * g_movie;
+static int              g_nmovie;
+
+
+static void on_signal( int sig )
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+/* read the movie */
+static int load_movie( const char * file )
+{
+  FILE *       f;
+  char         line[ 128 ];
+  unsigned int buttons;
+
+  f = strcmp( file, "-" ) == 0 ? stdin : fopen( file, "r" );
+  if ( f == NULL )
+  {
+    perror( file );
+    return -1;
+  }
+  while ( fgets( line, sizeof( line ), f ) != NULL )
+  {
+    if ( line[0] == '#' || sscanf( line, "%x", &buttons ) != 1 )
+    {
+      continue;
+    }
+    g_movie = realloc( g_movie, ( g_nmovie + 1 ) * sizeof( *g_movie ) );
+    if ( g_movie == NULL )
+    {
+      perror( "realloc" );
+      exit( 1 );
+    }
+    g_movie[ g_nmovie++ ] = buttons;
+  }
+  if ( f != stdin )
+  {
+    fclose( f );
+  }
+  return 0;
+}
+
+/* write playback control, 1 starts and 0 stops */
+static int set_playback( int fd, unsigned char play )
+{
+  unsigned char buf[ 1 + PLAYBACK_SIZE ];
+
+  memset( buf, 0, sizeof( buf ) );
+  buf[0] = PLAYBACK_REPORT_ID;
+  buf[1] = play;
+  return ioctl( fd, HIDIOCSFEATURE( sizeof( buf ) ), buf ) < 0 ? -1 : 0;
+}
+
+/* read playback status */
+static int get_playback( int fd, unsigned char * buf )
+{
+  buf[0] = PLAYBACK_REPORT_ID;
+  return ioctl( fd, HIDIOCGFEATURE( 1 + PLAYBACK_SIZE ), buf ) < 0 ? -1 : 0;
+}
+
+/* send the packet of frames from the given one on, returns the number of
+  frames sent, 0 if the adapter did not take it within a second, -1 on
+  errors */
+static int send_frames( int fd, int first )
+{
+  struct usbdevfs_bulktransfer bulk;
+  unsigned char                buf[ PLAYBACK_PACKET ];
+  int                          len;
+  int                          i;
+
+  len = 0;
+  for ( i = first; i < g_nmovie && len < PLAYBACK_PACKET; i++ )
+  {
+    buf[ len++ ] = g_movie[i] & 0xFF;
+    buf[ len++ ] = g_movie[i] >> 8;
+  }
+  bulk.ep = PLAYBACK_EP;
+  bulk.len = len;
+  bulk.timeout = 1000;
+  bulk.data = buf;
+  if ( ioctl( fd, USBDEVFS_BULK, &bulk ) < 0 )
+  {
+    return errno == ETIMEDOUT ? 0 : -1;
+  }
+  return len / 2;
+}
+
+
+int main( int argc, char * argv[] )
+{
+  char          paths[1][ HIDDEV_PATH_MAX ];
+  char          usbnode[ HIDDEV_PATH_MAX ];
+  unsigned char status[ 1 + PLAYBACK_SIZE ];
+  const char *  dev;
+  unsigned int  iface;
+  int           hid;
+  int           fd;
+  int           sent;
+  int           n;
+  int           r;
+  int           opt;
+
+  dev = NULL;
+  while ( ( opt = getopt( argc, argv, "d:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'd': dev = optarg; break;
+      default:
+        fprintf( stderr, "usage: %s [-d hidraw] movie\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind + 1 != argc )
+  {
+    fprintf( stderr, "usage: %s [-d hidraw] movie\n", argv[0] );
+    return 2;
+  }
+  if ( load_movie( argv[ optind ] ) != 0 )
+  {
+    return 1;
+  }
+  if ( dev == NULL )
+  {
+    if ( hiddev_find( HIDDEV_VID, HIDDEV_PID, paths, 1 ) == 0 )
+    {
+      fprintf( stderr, "no adapter found\n" );
+      return 1;
+    }
+    dev = paths[0];
+  }
+  hid = open( dev, O_RDWR );
+  if ( hid < 0 )
+  {
+    perror( dev );
+    return 1;
+  }
+  if ( get_playback( hid, status ) != 0 )
+  {
+    fprintf( stderr, "%s: no playback control, firmware built without "
+      "PLAYBACK?\n", dev );
+    close( hid );
+    return 1;
+  }
+  if ( hiddev_usbnode( dev, usbnode ) != 0 )
+  {
+    fprintf( stderr, "%s: no USB device\n", dev );
+    close( hid );
+    return 1;
+  }
+  fd = open( usbnode, O_RDWR );
+  if ( fd < 0 )
+  {
+    perror( usbnode );
+    close( hid );
+    return 1;
+  }
+  iface = PLAYBACK_INTERFACE;
+  if ( ioctl( fd, USBDEVFS_CLAIMINTERFACE, &iface ) < 0 )
+  {
+    fprintf( stderr, "%s: no playback interface (%s), at low-speed?\n",
+      usbnode, strerror( errno ) );
+    close( fd );
+    close( hid );
+    return 1;
+  }
+  signal( SIGINT, on_signal );
+
+  /* stop a playback left over, then fill the buffer */
+  set_playback( hid, 0 );
+  sent = 0;
+  while ( !g_stop && sent < g_nmovie && sent < status[9] )
+  {
+    n = send_frames( fd, sent );
+    if ( n <= 0 )
+    {
+      break;
+    }
+    sent += n;
+  }
+  if ( g_stop || set_playback( hid, 1 ) != 0 )
+  {
+    fprintf( stderr, "%s: playback not started\n", dev );
+    g_stop = 1;
+  }
+
+  /* the rest as the adapter takes it: a time-out only means the console
+    does not read (off, or in a game's pause) */
+  while ( !g_stop && sent < g_nmovie )
+  {
+    n = send_frames( fd, sent );
+    if ( n < 0 )
+    {
+      if ( errno != EINTR )
+      {
+        perror( usbnode );
+      }
+      break;
+    }
+    sent += n;
+  }
+
+  /* until the last frame has been played */
+  r = 0;
+  while ( !g_stop && ( r = get_playback( hid, status ) ) == 0 &&
+    status[8] != 0 )
+  {
+    usleep( 100000 );
+  }
+  if ( r != 0 || get_playback( hid, status ) != 0 )
+  {
+    perror( dev );
+  }
+  else
+  {
+    fprintf( stderr, "%d of %d frames sent, played %u, underruns %u, latches "
+      "lost %u, %u left in the buffer, latch period %u us%s\n", sent,
+      g_nmovie, status[2] | status[3] << 8, status[4] | status[5] << 8,
+      status[6] | status[7] << 8, status[8], status[10] | status[11] << 8,
+      status[1] & 0x04 ? "" : ", console off" );
+  }
+  set_playback( hid, 0 );
+
+  ioctl( fd, USBDEVFS_RELEASEINTERFACE, &iface );
+  close( fd );
+  close( hid );
+  return 0;
+}
@@ -0,0 +1,210 @@
+/* snesstream.c */
+/* records the sample stream of the adapter (USB_STREAM in ../src/usb.h)
+
+  usage: snesstream [-d /dev/hidrawN] [-n samples] [-w log]
+
+  Reads the stream endpoint through usbfs until -n samples (default
+  10000) have arrived or it is interrupted, and writes the timeline of
+  every scan, "time buttons" with the time in us from the first sample
+  and the buttons in hex (enum snes_buttons, ../src/snes.h), to -w or
+  stdout. Stamps are device time: the ms tick counts the Timer1 wraps
+  between two samples, Timer1 gives the time within.
+
+  At the end the scan rate, the shortest and longest time between two
+  scans, packets lost on the way (sequence numbers) and samples the
+  device had to drop (its counter) are printed to stderr.
+  NOTE: the stream only exists at full-speed. No kernel driver binds its
+  interface, so write access to the usbfs node is all it takes. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include "hiddev.h"
+
+/* stream interface and endpoint, packet layout (see ../src/usb.h) */
+#define STREAM_INTERFACE  1
+#define STREAM_EP         0x82
+#define STREAM_SIZE       64
+#define STREAM_HEADER     4
+#define STREAM_SAMPLE     5
+
+/* static data */
+static volatile int g_stop;
+
+
+static void on_signal( int sig )
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+
+int main( int argc, char * argv[] )
+{
+  struct usbdevfs_bulktransfer bulk;
+  char                         paths[1][ HIDDEV_PATH_MAX ];
+  char                         usbnode[ HIDDEV_PATH_MAX ];
+  unsigned char                buf[ STREAM_SIZE ];
+  const unsigned char *        p;
+  const char *                 dev;
+  FILE *                       log;
+  unsigned int                 iface;
+  unsigned long                samples;
+  unsigned long                n;
+  unsigned long                lost;
+  unsigned long                dropped;
+  unsigned char                seq;
+  unsigned char                drops;
+  unsigned char                tick;
+  unsigned short               timer;
+  long long                    cycles;
+  long long                    estimate;
+  double                       time;
+  double                       dt;
+  double                       dtmin;
+  double                       dtmax;
+  int                          len;
+  int                          fd;
+  int                          i;
+  int                          opt;
+
+  dev = NULL;
+  log = stdout;
+  n = 10000;
+  while ( ( opt = getopt( argc, argv, "d:n:w:" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'd': dev = optarg; break;
+      case 'n': n = strtoul( optarg, NULL, 10 ); break;
+      case 'w':
+        log = fopen( optarg, "w" );
+        if ( log == NULL )
+        {
+          perror( optarg );
+          return 1;
+        }
+        break;
+      default:
+        fprintf( stderr, "usage: %s [-d hidraw] [-n samples] [-w log]\n",
+          argv[0] );
+        return 2;
+    }
+  }
+  if ( dev == NULL )
+  {
+    if ( hiddev_find( HIDDEV_VID, HIDDEV_PID, paths, 1 ) == 0 )
+    {
+      fprintf( stderr, "no adapter found\n" );
+      return 1;
+    }
+    dev = paths[0];
+  }
+  if ( hiddev_usbnode( dev, usbnode ) != 0 )
+  {
+    fprintf( stderr, "%s: no USB device\n", dev );
+    return 1;
+  }
+  fd = open( usbnode, O_RDWR );
+  if ( fd < 0 )
+  {
+    perror( usbnode );
+    return 1;
+  }
+  iface = STREAM_INTERFACE;
+  if ( ioctl( fd, USBDEVFS_CLAIMINTERFACE, &iface ) < 0 )
+  {
+    fprintf( stderr, "%s: no stream interface (%s), firmware built without "
+      "USB_STREAM or at low-speed?\n", usbnode, strerror( errno ) );
+    close( fd );
+    return 1;
+  }
+  signal( SIGINT, on_signal );
+
+  samples = 0;
+  lost = 0;
+  dropped = 0;
+  seq = 0;
+  drops = 0;
+  tick = 0;
+  timer = 0;
+  time = 0;
+  dtmin = 1e300;
+  dtmax = 0;
+  while ( !g_stop && samples < n )
+  {
+    bulk.ep = STREAM_EP;
+    bulk.len = sizeof( buf );
+    bulk.timeout = 1000;
+    bulk.data = buf;
+    len = ioctl( fd, USBDEVFS_BULK, &bulk );
+    if ( len < 0 )
+    {
+      if ( errno == ETIMEDOUT )
+      {
+        continue;   /* no scans, the adapter is idle */
+      }
+      if ( errno != EINTR )
+      {
+        perror( usbnode );
+      }
+      break;
+    }
+    if ( len < STREAM_HEADER ||
+      STREAM_HEADER + buf[3] * STREAM_SAMPLE > len )
+    {
+      fprintf( stderr, "short packet (%d bytes)\n", len );
+      continue;
+    }
+    if ( samples != 0 )
+    {
+      lost += (unsigned char)( buf[0] - seq - 1 );
+      dropped += (unsigned char)( buf[1] - drops );
+    }
+    seq = buf[0];
+    drops = buf[1];
+
+    for ( i = 0; i < buf[3]; i++ )
+    {
+      p = buf + STREAM_HEADER + i * STREAM_SAMPLE;
+      if ( samples != 0 )
+      {
+        /* the Timer1 difference, plus as many wraps as bring it closest
+          to what the ticks say (which are off by less than one ms) */
+        cycles = (unsigned short)( ( p[3] | p[4] << 8 ) - timer );
+        estimate = (unsigned char)( p[2] - tick );
+        estimate *= buf[2] * 1000;
+        while ( cycles + 32768 < estimate )
+        {
+          cycles += 65536;
+        }
+        dt = (double)cycles / buf[2];
+        time += dt;
+        dtmin = dt < dtmin ? dt : dtmin;
+        dtmax = dt > dtmax ? dt : dtmax;
+      }
+      tick = p[2];
+      timer = p[3] | p[4] << 8;
+      fprintf( log, "%.1f %04x\n", time, p[0] | p[1] << 8 );
+      ++samples;
+    }
+  }
+
+  fprintf( stderr, "%lu samples in %.3f s, %.0f per second, %.1f..%.1f us "
+    "apart\n%lu packets lost, %lu samples dropped by the device\n", samples,
+    time / 1e6, time > 0 ? ( samples - 1 ) / time * 1e6 : 0.0,
+    samples > 1 ? dtmin : 0.0, dtmax, lost, dropped );
+  ioctl( fd, USBDEVFS_RELEASEINTERFACE, &iface );
+  close( fd );
+  if ( log != stdout )
+  {
+    fclose( log );
+  }
+  return 0;
+}
@@ -0,0 +1,573 @@
+/* padtiming.c */
+/* timing characterization of the controller on the SNES port: measures
+  with Timer1 how fast the pad responds and reports over the EUSART (RC6,
+  9600 Baud 8N1, as the DEBUG build of ../src/debug.c)
+
+  A sweep powers the pad up from off and reads it, with the waveform of
+  snes_read() (../src/snes.c), while each latch and clock edge is followed
+  by a window in which DATA is polled:
+
+    power  SNES_VCC rising to the first read from which on all reads of
+           the power-up phase (TM_POWER_MS) agree
+    latch  latch rising to the last change of DATA while it is high; only
+           when bit 0 (B) differs from DATA before, which is low after the
+           16th clock pulse: B must not be held
+    clock  rising clock edge to the last change of DATA before the falling
+           edge, for each bit that differs from the one before; the 16th
+           always does (the serial input is grounded), and so does every
+           bit next to a held button
+
+  Times are upper bounds: the end of the polling pass that saw the change.
+  The length of a pass is calibrated against Timer1 at start and printed
+  as the resolution. Changes while the clock is low, and windows with more
+  than one change (bounce), are counted; neither should happen.
+
+  Each sweep prints a line with its minimum, mean and maximum. Every
+  TM_SWEEPS sweeps a summary of them follows, with the worst cases turned
+  into SNES_STEP_US and SNES_SETTLE_MS (../src/snes.h, set in
+  ../src/config.h). The port has a single pad, so characterize one pad per
+  run, and power-cycle the board to change pads.
+
+  NOTE: the host simulator runs this image against its controller model
+  (../host/sim/padtiming.c). There a polling pass takes 1 us of virtual
+  time, and the report goes to stdout. */
+
+#include <p18cxxx.h>
+#include "../src/snes.h"
+#if !defined( __18CXX )
+#include <stdio.h>
+#endif
+
+/* Configuration */
+#pragma config FOSC = XTPLL_XT    /* XT oscillator, PLL */
+#pragma config PLLDIV = 1         /* 4MHz input */
+#pragma config CPUDIV = OSC1_PLL2 /* CPU=96MHz PLL / 2 */
+#pragma config FCMEN = OFF        /* Fail-safe clock monitor */
+#pragma config IESO = OFF         /* internal/external switch over */
+#pragma config PWRT = ON          /* power-up timer */
+#pragma config BOR = OFF          /* brown-out reset */
+#pragma config WDT = OFF          /* watchdog timer */
+#pragma config LVP = OFF          /* low voltage ICSP */
+#pragma config VREGEN = OFF       /* USB voltage regulator */
+#pragma config MCLRE = OFF        /* Master Clear Reset */
+#pragma config PBADEN = OFF       /* PORTB are digital I/O */
+
+/* instruction cycles per us at 48 MHz */
+#define TM_MIPS  12U
+
+/* sweep: pad off, power-up phase, reads measured [ms] */
+#define TM_OFF_MS    100U
+#define TM_POWER_MS  100U
+#define TM_READS     64U
+
+/* sweeps per summary */
+#define TM_SWEEPS  16U
+
+/* waveform of snes_read() [us] */
+#define TM_LATCH_US  12U
+#define TM_STEP_US   6U
+
+/* polling passes for the calibration */
+#define TM_CALIBRATE  200U
+
+/* polling passes let virtual time pass in the host simulator build */
+#if defined( __18CXX )
+#define TM_WAIT()
+#else
+#define TM_WAIT()  sim_delay_us( 1 )
+#endif
+
+/* what is measured */
+enum tm_kinds
+{
+  TM_POWER,
+  TM_LATCH,
+  TM_CLOCK,
+  TM_KINDS
+};
+
+/* minimum, maximum and sum [ns] */
+struct tm_stat
+{
+  unsigned long  min;
+  unsigned long  max;
+  unsigned long  sum;
+  unsigned short n;
+};
+
+/* polling, in access RAM so the passes stay short */
+#pragma udata access padtiming_access
+static near unsigned char g_tm_mask;     /* SNES_DATA, 0 to calibrate */
+static near unsigned char g_tm_data;     /* DATA as last seen */
+static near unsigned char g_tm_left;     /* passes left in the window */
+#pragma udata
+
+/* static data */
+static unsigned short g_tm_pass;         /* one polling pass [ns] */
+static unsigned char  g_tm_latchwin;     /* windows [passes] */
+static unsigned char  g_tm_stepwin;
+static unsigned char  g_tm_sample;       /* DATA before the last edge */
+static unsigned char  g_tm_changes;      /* changes in the last window */
+static unsigned short g_tm_wraps;        /* Timer1 wraps seen by tm_now() */
+static struct tm_stat g_tm_sweep[ TM_KINDS ];
+static struct tm_stat g_tm_total[ TM_KINDS ];
+static unsigned short g_tm_bounces;      /* windows with several changes */
+static unsigned short g_tm_falling;      /* changes while the clock is low */
+static unsigned short g_tm_sweeps;
+
+/* local prototypes */
+static void tm_calibrate( void );
+static void tm_sweep( void );
+static unsigned short tm_read( unsigned char measure );
+static unsigned char tm_edge( unsigned char lat, unsigned char window );
+static void tm_add( struct tm_stat * stat, unsigned long ns );
+static void tm_merge( struct tm_stat * total, const struct tm_stat * stat );
+static void tm_summary( void );
+static void tm_putstat( const rom char * name, const struct tm_stat * stat,
+  unsigned long unit, const rom char * units );
+static void tm_delay( unsigned char timeus );
+static unsigned short tm_timer( void );
+static unsigned long tm_now( void );
+static void tm_puts( const rom char * s );
+static void tm_putu( unsigned long value );
+static void tm_putfix( unsigned long value, unsigned long unit );
+static void tm_putc( char c );
+
+
+/* main entry point */
+void main( void )
+{
+  ADCON1 = 0x0F; /* all pins to digital */
+  LATA = 0x00;   /* pad off */
+  TRISA = SNES_DATA;
+  TRISB = 0xC0;
+  TRISC = 0x80;  /* RC7 (RX) input, RC6 (TX) output */
+
+  /* no interrupts, the EUSART and Timer1 are polled */
+  /* IPEN in RCON is already 0 */
+  PIE1 = 0x00;    /* disable interrupt sources */
+  PIE2 = 0x00;
+
+  /* fOSC/(64*(SPBRG+1)) */
+  SPBRG = (unsigned char)( ( TM_MIPS * 62500UL + 4800 ) / 9600 - 1 );
+  TXSTA = 0x20;   /* transmit enabled */
+  RCSTA = 0x90;   /* serial port enabled */
+
+  /* Timer1 runs free at the instruction clock */
+  T1CON = 0x81;   /* 16 bit read/write, internal clock, no prescaler, on */
+  /* NOTE: the host simulator brings Timer1 up to date only when time
+    passes, so let some pass before the calibration reads it */
+  tm_delay( 1 );
+
+  tm_calibrate();
+  tm_puts( "padtiming: min mean max, resolution " );
+  tm_putfix( g_tm_pass, 1000 );
+  tm_puts( " us\r\n" );
+
+  while (1)
+  {
+    tm_sweep();
+    if ( g_tm_sweeps % TM_SWEEPS == 0U )
+    {
+      tm_summary();
+    }
+  }
+}
+
+
+#if !defined( __18CXX )
+/* host simulator build: no interrupts are enabled */
+void isr_dispatch( void )
+{
+}
+#endif
+
+
+/* length of a polling pass, and the windows in passes */
+static void tm_calibrate( void )
+{
+  unsigned short start;
+  unsigned short cycles;
+
+  /* with no pin to watch, the window runs out */
+  g_tm_mask = 0;
+  start = tm_timer();
+  tm_edge( LATA, TM_CALIBRATE );
+  cycles = tm_timer() - start;
+  g_tm_mask = SNES_DATA;
+
+  g_tm_pass = (unsigned short)( cycles * 1000UL /
+    ( TM_MIPS * TM_CALIBRATE ) );
+  if ( g_tm_pass == 0U )
+  {
+    g_tm_pass = 1;
+  }
+  g_tm_latchwin = (unsigned char)( TM_LATCH_US * 1000UL / g_tm_pass );
+  g_tm_stepwin  = (unsigned char)( TM_STEP_US * 1000UL / g_tm_pass );
+}
+
+/* power the pad up from off, then read it */
+static void tm_sweep( void )
+{
+  unsigned long  on;
+  unsigned long  now;
+  unsigned long  settled;
+  unsigned short buttons;
+  unsigned short last;
+  unsigned char  i;
+
+  /* off, latch and clock too: the pad must not draw its supply through
+    its inputs */
+  LATA &= ~( SNES_VCC | SNES_LATCH | SNES_CLOCK );
+  for ( i = 0; i < TM_OFF_MS; ++i )
+  {
+    tm_delay( 250 );
+    tm_delay( 250 );
+    tm_delay( 250 );
+    tm_delay( 250 );
+  }
+
+  /* power-up phase: the last change of the buttons read */
+  LATA |= SNES_VCC | SNES_CLOCK;
+  on = tm_now();
+  settled = on;
+  last = 0;
+  i = 0;
+  do
+  {
+    now = tm_now();
+    buttons = tm_read( 0 );
+    if ( i == 0U || buttons != last )
+    {
+      last = buttons;
+      settled = now;
+      i = 1;
+    }
+  }
+  while ( now - on < TM_POWER_MS * 1000UL * TM_MIPS );
+
+  for ( i = 0; i < TM_KINDS; ++i )
+  {
+    g_tm_sweep[i].n = 0;
+  }
+  tm_add( &g_tm_sweep[ TM_POWER ], ( settled - on ) * 1000UL / TM_MIPS );
+
+  for ( i = 0; i < TM_READS; ++i )
+  {
+    buttons = tm_read( 1 );
+    tm_delay( 100 );
+  }
+
+  ++g_tm_sweeps;
+  tm_puts( "sweep " );
+  tm_putu( g_tm_sweeps );
+  tm_putstat( ": power", &g_tm_sweep[ TM_POWER ], 1000000UL, " ms" );
+  tm_putstat( ", latch", &g_tm_sweep[ TM_LATCH ], 1000, " us" );
+  tm_putstat( ", clock", &g_tm_sweep[ TM_CLOCK ], 1000, " us" );
+  tm_puts( ", buttons " );
+  for ( i = 16; i != 0U; i -= 4 )
+  {
+    last = ( buttons >> ( i - 4 ) ) & 0x0F;
+    tm_putc( last < 10U ? '0' + last : 'a' + last - 10 );
+  }
+  tm_puts( "\r\n" );
+  for ( i = 0; i < TM_KINDS; ++i )
+  {
+    tm_merge( &g_tm_total[i], &g_tm_sweep[i] );
+  }
+}
+
+/* a read with the waveform of snes_read(), returns the pressed buttons */
+static unsigned short tm_read( unsigned char measure )
+{
+  unsigned short buttons;
+  unsigned char  bit;
+  unsigned char  pass;
+
+  /* latch pulse, bit 0 comes with it */
+  pass = tm_edge( LATA | SNES_LATCH, g_tm_latchwin );
+  if ( measure && pass != 0U )
+  {
+    tm_add( &g_tm_sweep[ TM_LATCH ], (unsigned long)pass * g_tm_pass );
+    if ( g_tm_changes > 1U )
+    {
+      ++g_tm_bounces;
+    }
+  }
+  LATA &= ~SNES_LATCH;
+  tm_delay( TM_STEP_US );
+
+  buttons = 0;
+  for ( bit = 0; bit < 16U; ++bit )
+  {
+    /* falling edge: sampled as it comes, nothing may change */
+    tm_edge( LATA & ~SNES_CLOCK, g_tm_stepwin );
+    if ( !g_tm_sample )
+    {
+      /* button is pressed */
+      buttons |= (unsigned short)1 << bit;
+    }
+    if ( measure )
+    {
+      g_tm_falling += g_tm_changes;
+    }
+
+    /* rising edge: the next bit */
+    pass = tm_edge( LATA | SNES_CLOCK, g_tm_stepwin );
+    if ( measure && pass != 0U )
+    {
+      tm_add( &g_tm_sweep[ TM_CLOCK ], (unsigned long)pass * g_tm_pass );
+      if ( g_tm_changes > 1U )
+      {
+        ++g_tm_bounces;
+      }
+    }
+  }
+  return buttons;
+}
+
+/* writes an edge to LATA and polls DATA for window passes, returns the
+  pass that saw its last change, 0 if none */
+static unsigned char tm_edge( unsigned char lat, unsigned char window )
+{
+  unsigned char last;
+
+  last = 0;
+  g_tm_changes = 0;
+  g_tm_data = PORTA & g_tm_mask;
+  g_tm_sample = g_tm_data;
+  g_tm_left = window;
+  LATA = lat;
+  for ( ;; )
+  {
+    while ( ( PORTA & g_tm_mask ) == g_tm_data && --g_tm_left != 0U )
+    {
+      TM_WAIT();
+    }
+    if ( g_tm_left == 0U )
+    {
+      break;
+    }
+    /* changed in this pass */
+    g_tm_data ^= g_tm_mask;
+    ++g_tm_changes;
+    last = window - g_tm_left + 1;
+    if ( --g_tm_left == 0U )
+    {
+      break;
+    }
+    TM_WAIT();
+  }
+  return last;
+}
+
+
+/* add a value */
+static void tm_add( struct tm_stat * stat, unsigned long ns )
+{
+  if ( stat->n == 0U || ns < stat->min )
+  {
+    stat->min = ns;
+  }
+  if ( stat->n == 0U || ns > stat->max )
+  {
+    stat->max = ns;
+  }
+  if ( stat->n == 0U )
+  {
+    stat->sum = 0;
+  }
+  stat->sum += ns;
+  ++stat->n;
+}
+
+/* add the values of a sweep to the summary */
+static void tm_merge( struct tm_stat * total, const struct tm_stat * stat )
+{
+  if ( stat->n == 0U )
+  {
+    return;
+  }
+  if ( total->n == 0U || stat->min < total->min )
+  {
+    total->min = stat->min;
+  }
+  if ( total->n == 0U || stat->max > total->max )
+  {
+    total->max = stat->max;
+  }
+  if ( total->n == 0U )
+  {
+    total->sum = 0;
+  }
+  total->sum += stat->sum;
+  total->n += stat->n;
+}
+
+/* summary of the last TM_SWEEPS sweeps, and the timing they allow */
+static void tm_summary( void )
+{
+  unsigned long need;
+  unsigned char i;
+
+  tm_puts( "summary" );
+  tm_putstat( ": power", &g_tm_total[ TM_POWER ], 1000000UL, " ms" );
+  tm_putstat( ", latch", &g_tm_total[ TM_LATCH ], 1000, " us" );
+  tm_putstat( ", clock", &g_tm_total[ TM_CLOCK ], 1000, " us" );
+  tm_puts( ", bounces " );
+  tm_putu( g_tm_bounces );
+  tm_puts( ", changes while the clock is low " );
+  tm_putu( g_tm_falling );
+  tm_puts( "\r\n" );
+
+  if ( g_tm_total[ TM_CLOCK ].n == 0U )
+  {
+    /* the 16th bit changes with any pad */
+    tm_puts( "no pad?\r\n" );
+  }
+  else
+  {
+    /* the timed scan samples one step after each rising clock edge and
+      three after the latch rose */
+    need = g_tm_total[ TM_CLOCK ].max;
+    if ( g_tm_total[ TM_LATCH ].n != 0U &&
+      ( g_tm_total[ TM_LATCH ].max + 2 ) / 3 > need )
+    {
+      need = ( g_tm_total[ TM_LATCH ].max + 2 ) / 3;
+    }
+    tm_puts( "SNES_STEP_US >= " );
+    tm_putu( need / 1000 + 1 );
+    tm_puts( " (is " );
+    tm_putu( SNES_STEP_US );
+    tm_puts( "), SNES_SETTLE_MS >= " );
+    tm_putu( g_tm_total[ TM_POWER ].max / 1000000UL + 1 );
+    tm_puts( " (is " );
+    tm_putu( SNES_SETTLE_MS );
+    tm_puts( ")\r\n" );
+  }
+
+  for ( i = 0; i < TM_KINDS; ++i )
+  {
+    g_tm_total[i].n = 0;
+  }
+  g_tm_bounces = 0;
+  g_tm_falling = 0;
+}
+
+/* " name min mean max units (n)", or " name -" */
+static void tm_putstat( const rom char * name, const struct tm_stat * stat,
+  unsigned long unit, const rom char * units )
+{
+  tm_puts( name );
+  if ( stat->n == 0U )
+  {
+    tm_puts( " -" );
+    return;
+  }
+  tm_putc( ' ' );
+  tm_putfix( stat->min, unit );
+  tm_putc( ' ' );
+  tm_putfix( stat->sum / stat->n, unit );
+  tm_putc( ' ' );
+  tm_putfix( stat->max, unit );
+  tm_puts( units );
+  tm_puts( " (" );
+  tm_putu( stat->n );
+  tm_putc( ')' );
+}
+
+
+/* wait timeus microseconds (1..255) */
+static void tm_delay( unsigned char timeus )
+{
+  unsigned short start;
+
+  start = tm_timer();
+  while ( (unsigned short)( tm_timer() - start ) <
+    (unsigned short)timeus * TM_MIPS )
+  {
+    TM_WAIT();
+  }
+}
+
+/* Timer1 count */
+static unsigned short tm_timer( void )
+{
+  unsigned short count;
+
+  count  = TMR1L;   /* reading TMR1L latches TMR1H */
+  count |= (unsigned short)TMR1H << 8;
+  return count;
+}
+
+/* Timer1 count with the wraps since the last call, which must be less
+  than 5.4 ms ago */
+static unsigned long tm_now( void )
+{
+  unsigned short count;
+
+  count = tm_timer();
+  if ( PIR1 & 0x01 )
+  {
+    /* TMR1IF: wrapped, read again so the count belongs to the wrap */
+    PIR1 &= ~0x01;
+    ++g_tm_wraps;
+    count = tm_timer();
+  }
+  return (unsigned long)g_tm_wraps << 16 | count;
+}
+
+
+/* write a string */
+static void tm_puts( const rom char * s )
+{
+  while ( *s != '\0' )
+  {
+    tm_putc( *s++ );
+  }
+}
+
+/* write a number in decimal */
+static void tm_putu( unsigned long value )
+{
+  char          digits[10];
+  unsigned char n;
+
+  n = 0;
+  do
+  {
+    digits[ n++ ] = '0' + value % 10;
+    value /= 10;
+  }
+  while ( value != 0U );
+  while ( n != 0U )
+  {
+    tm_putc( digits[ --n ] );
+  }
+}
+
+/* write value / unit with two decimals */
+static void tm_putfix( unsigned long value, unsigned long unit )
+{
+  unsigned char hundredths;
+
+  hundredths = (unsigned char)( ( value % unit ) * 100 / unit );
+  tm_putu( value / unit );
+  tm_putc( '.' );
+  tm_putc( '0' + hundredths / 10 );
+  tm_putc( '0' + hundredths % 10 );
+}
+
+/* write a character, waits for the transmitter */
+static void tm_putc( char c )
+{
+#if defined( __18CXX )
+  while ( !( TXSTA & 0x02 ) )
+  {
+    /* TRMT: the shift register is empty */
+  }
+  TXREG = c;
+#else
+  putchar( c );
+#endif
+}
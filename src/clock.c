@@ -0,0 +1,68 @@
+/* clock.c */
+
+#include <p18cxxx.h>
+#include "clock.h"
+#include "timebase.h"
+
+/* static data */
+static unsigned short g_clock_activity;  /* tick of the last activity */
+static unsigned short g_clock_scan;      /* tick of the last idle scan */
+
+#pragma code
+
+
+/* run profile on the primary clock */
+void clock_init( void )
+{
+  OSCCON = 0x00;  /* Sleep mode enabled, primary oscillator */
+  g_clock_activity = 0;
+}
+
+/* note activity */
+void clock_activity( void )
+{
+  g_clock_activity = timebase_now();
+}
+
+/* run or idle profile */
+unsigned char clock_scan( void )
+{
+  unsigned short now;
+  unsigned short idle;    /* ms since the last activity */
+
+  now = timebase_now();
+  idle = now - g_clock_activity;
+  if ( idle < CLOCK_IDLE_DELAY )
+  {
+    /* run profile */
+    g_clock_scan = now;
+    return 1;
+  }
+
+  /* idle profile: stop the core until the next interrupt */
+  clock_idle();
+
+  now = timebase_now();
+  if ( (unsigned short)( now - g_clock_scan ) <
+    ( idle < CLOCK_DEEP_DELAY ? CLOCK_IDLE_PERIOD : CLOCK_DEEP_PERIOD ) )
+  {
+    return 0;
+  }
+  g_clock_scan = now;
+
+  /* NOTE: the activity tick is held CLOCK_DEEP_DELAY behind at most, so it
+    never falls a wrap-around behind */
+  if ( idle > CLOCK_DEEP_DELAY )
+  {
+    g_clock_activity = now - CLOCK_DEEP_DELAY;
+  }
+  return 1;
+}
+
+/* primary idle mode */
+void clock_idle( void )
+{
+  OSCCON |= 0x80;   /* IDLEN: SLEEP enters primary idle mode */
+  Sleep();
+  OSCCON &= ~0x80;
+}
@@ -0,0 +1,52 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "config.h"
+
+/* Clock profiles
+
+  run:     CPU on the primary clock, as configured (CPUDIV in main.c or
+           the bootloader), scans back to back
+  idle:    no input and no control transfer for CLOCK_IDLE_DELAY ms, the
+           CPU core stops (primary idle mode) between interrupts and scans
+           only every CLOCK_IDLE_PERIOD ms, after CLOCK_DEEP_DELAY ms only
+           every CLOCK_DEEP_PERIOD ms
+  suspend: bus suspended, SLEEP until bus activity (see usb.c)
+
+  NOTE: CPUDIV cannot be changed at run time, and low-speed USB only works
+  with a 24 MHz CPU clock. The instruction rate and the bus speed are
+  therefore fixed at build time (config.h), and delay loops, timer and baud
+  rate settings are derived from them.
+
+  NOTE: SLEEP itself would stop the oscillator, which the USB module needs
+  while the bus is active, so idle keeps it running.
+
+  Idle scans are one tick interrupt apart, the first change after idle is
+  therefore seen at most CLOCK_IDLE_PERIOD or CLOCK_DEEP_PERIOD ms later
+  than in the run profile, to which that change returns at once. With
+  CLOCK_DEEP_PERIOD at the host's polling interval (CONFIG_POLL_HOST_MS,
+  8 ms for bInterval 10 on Linux) the first press is delayed by one poll
+  at most. */
+
+/* idle profile parameters [ms] */
+/* NOTE: CLOCK_DEEP_DELAY must stay below the wrap-around of the tick */
+#define CLOCK_IDLE_DELAY   10000U
+#define CLOCK_DEEP_DELAY   60000U
+#define CLOCK_DEEP_PERIOD  CONFIG_POLL_HOST_MS
+#define CLOCK_IDLE_PERIOD  ( CLOCK_DEEP_PERIOD < 4U ? CLOCK_DEEP_PERIOD : 4U )
+
+/* sets up the run profile, call first */
+void clock_init( void );
+
+/* something happened, back to (or stay in) the run profile */
+void clock_activity( void );
+
+/* returns whether the main loop should scan the controller now, in the
+  idle profile waits for the next interrupt first */
+unsigned char clock_scan( void );
+
+/* stops the core until the next interrupt (primary idle mode), which is at
+  most one millisecond away (tick or SOF) */
+void clock_idle( void );
+
+#endif  /* defined CLOCK_H */
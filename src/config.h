@@ -0,0 +1,126 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* Build configuration
+
+  The firmware is specialized for one clock and bus setup at build time:
+  the configuration words (main.c), the delay loops and scan timing
+  (snes.c), the tick (timebase.c), the baud rate of the debug output
+  (debug.c), UCFG and the USB descriptors (usb.c) all derive from the
+  values below. Each of them can be given on the command line instead (see
+  Makefile, e.g. "make CPU_MHZ=16"). Combinations that cannot work fail
+  the build here, in usb.c (report and endpoint sizes) or in usbmem.h (USB
+  RAM).
+
+  Variants from the same tree, for example:
+
+    low latency  POLL_MS=1 EP0_SIZE=32 (the host polls every frame, and
+                 feature reports take fewer EP0 transactions; without
+                 USB_STREAM and PLAYBACK, which leave no USB RAM for it)
+    low power    CPU_MHZ=16 POLL_MS=8 (a third of the instruction rate,
+                 the idle profile scans at the polling interval)
+
+  NOTE: an image started by the USB bootloader (BOOTLOADER, see Makefile)
+  runs with the configuration words of ../boot/boot.c, so it is built for
+  24 MHz and low-speed. */
+
+/* crystal of the board [MHz]: 4, 8, 12, 16, 20 or 24, the PLL divides it
+  down to 4 MHz */
+#ifndef CONFIG_XTAL_MHZ
+#define CONFIG_XTAL_MHZ  4
+#endif
+
+/* CPU clock [MHz]: the 96 MHz PLL divided by 2, 3, 4 or 6 (48, 32, 24 or
+  16 MHz) */
+#ifndef CONFIG_CPU_MHZ
+#ifdef BOOTLOADER
+#define CONFIG_CPU_MHZ  24
+#else
+#define CONFIG_CPU_MHZ  48
+#endif
+#endif
+
+/* USB speed: 1 full-speed (USB clock from the PLL), 0 low-speed (from the
+  CPU clock, which must run at 24 MHz then) */
+#ifndef CONFIG_FULLSPEED
+#ifdef BOOTLOADER
+#define CONFIG_FULLSPEED  0
+#else
+#define CONFIG_FULLSPEED  1
+#endif
+#endif
+
+/* polling interval of the HID report endpoint EP1 IN (bInterval) [ms] */
+#ifndef CONFIG_POLL_MS
+#define CONFIG_POLL_MS  10
+#endif
+
+/* max. packet size of EP0 (bMaxPacketSize0) and of the HID report
+  endpoints EP1 IN and OUT (wMaxPacketSize) */
+#ifndef CONFIG_EP0_SIZE
+#define CONFIG_EP0_SIZE  8
+#endif
+#ifndef CONFIG_EP1_SIZE
+#define CONFIG_EP1_SIZE  8
+#endif
+
+/* scan timing: time between two edges of a scan [us], see SNES_STEP_US in
+  snes.h, and the time the controller needs after power-up [ms] */
+#ifndef CONFIG_SNES_STEP_US
+#define CONFIG_SNES_STEP_US  6
+#endif
+#ifndef CONFIG_SNES_SETTLE_MS
+#define CONFIG_SNES_SETTLE_MS  20
+#endif
+
+
+/* derived values */
+
+/* instruction cycles per us */
+#define CONFIG_MIPS  ( CONFIG_CPU_MHZ / 4 )
+
+/* the polling interval as Linux schedules it, rounded down to a power of
+  2 (8 ms for bInterval 10) */
+#define CONFIG_POLL_HOST_MS \
+  ( CONFIG_POLL_MS >= 128 ? 128 : CONFIG_POLL_MS >= 64 ? 64 : \
+    CONFIG_POLL_MS >= 32 ? 32 : CONFIG_POLL_MS >= 16 ? 16 : \
+    CONFIG_POLL_MS >= 8 ? 8 : CONFIG_POLL_MS >= 4 ? 4 : \
+    CONFIG_POLL_MS >= 2 ? 2 : 1 )
+
+
+/* build fails here for combinations that cannot work */
+#if CONFIG_XTAL_MHZ % 4 != 0 || CONFIG_XTAL_MHZ < 4 || CONFIG_XTAL_MHZ > 24
+#error "CONFIG_XTAL_MHZ: 4, 8, 12, 16, 20 or 24"
+#endif
+#if CONFIG_CPU_MHZ != 48 && CONFIG_CPU_MHZ != 32 && \
+  CONFIG_CPU_MHZ != 24 && CONFIG_CPU_MHZ != 16
+#error "CONFIG_CPU_MHZ: 48, 32, 24 or 16"
+#endif
+#if CONFIG_FULLSPEED != 0 && CONFIG_FULLSPEED != 1
+#error "CONFIG_FULLSPEED: 0 or 1"
+#endif
+#if !CONFIG_FULLSPEED && CONFIG_CPU_MHZ != 24
+#error "low-speed USB needs a 24 MHz CPU clock"
+#endif
+#if defined( BOOTLOADER ) && \
+  ( CONFIG_XTAL_MHZ != 4 || CONFIG_CPU_MHZ != 24 || CONFIG_FULLSPEED )
+#error "the bootloader configures a 4 MHz crystal, 24 MHz and low-speed"
+#endif
+#if CONFIG_POLL_MS < 1 || CONFIG_POLL_MS > 255
+#error "CONFIG_POLL_MS: 1..255"
+#endif
+#if !CONFIG_FULLSPEED && CONFIG_POLL_MS < 10
+#error "low-speed interrupt endpoints are polled every 10 ms at most"
+#endif
+#if CONFIG_EP0_SIZE != 8 && ( !CONFIG_FULLSPEED || ( CONFIG_EP0_SIZE != 16 && \
+  CONFIG_EP0_SIZE != 32 && CONFIG_EP0_SIZE != 64 ) )
+#error "CONFIG_EP0_SIZE: 8, at full-speed also 16, 32 or 64"
+#endif
+#if CONFIG_EP1_SIZE < 1 || CONFIG_EP1_SIZE > ( CONFIG_FULLSPEED ? 64 : 8 )
+#error "CONFIG_EP1_SIZE: 1..8 at low-speed, 1..64 at full-speed"
+#endif
+#if CONFIG_SNES_STEP_US < 1 || CONFIG_SNES_STEP_US > 127
+#error "CONFIG_SNES_STEP_US: 1..127 (a latch pulse of two steps)"
+#endif
+
+#endif  /* defined CONFIG_H */
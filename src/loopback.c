@@ -0,0 +1,189 @@
+/* loopback.c */
+
+#include <p18cxxx.h>
+#include "loopback.h"
+#include "snes.h"
+#include "timebase.h"
+
+/* chord to enter and leave the test mode */
+#define LB_CHORD       ( BUT_SELECT | BUT_START | BUT_L | BUT_R )
+#define LB_CHORD_TIME  3000U    /* [ms] */
+
+/* settings used when entered by the chord */
+#define LB_DEF_PERIOD  100U
+#define LB_DEF_SPREAD  37U
+#define LB_DEF_MASK    BUT_B
+
+/* static data */
+static unsigned char   g_lb_active;   /* test mode is active */
+static unsigned short  g_lb_buttons;  /* generated button states */
+static unsigned short  g_lb_period;   /* [ms] */
+static unsigned char   g_lb_spread;   /* [ms] */
+static unsigned short  g_lb_count;    /* toggles left, 0 = endless */
+static unsigned short  g_lb_mask;     /* buttons to toggle */
+static unsigned short  g_lb_random;   /* LFSR state */
+static struct tb_timer g_lb_timer;    /* next toggle */
+static unsigned short  g_lb_chord;    /* tick the chord was pressed at */
+static unsigned char   g_lb_chordstate;  /* 0: up, 1: held, 2: handled */
+
+/* request from the host, applied by loopback_poll() */
+/* NOTE: written by usb_service() only while g_lb_request is clear, read by
+  loopback_poll() only while it is set */
+static unsigned char          g_lb_reqbuf[ LOOPBACK_REPORT_SIZE ];
+static volatile unsigned char g_lb_request;
+
+/* local prototypes */
+static void lb_start( void );
+static void lb_stop( void );
+static void lb_event( struct tb_timer * timer );
+static unsigned short lb_delay( void );
+
+#pragma code
+
+
+/* called from the main loop */
+void loopback_poll( unsigned short buttons )
+{
+  /* chord must be held for LB_CHORD_TIME, then released */
+  if ( ( buttons & LB_CHORD ) != LB_CHORD )
+  {
+    g_lb_chordstate = 0;
+  }
+  else if ( g_lb_chordstate == 0U )
+  {
+    g_lb_chord = timebase_now();
+    g_lb_chordstate = 1;
+  }
+  else if ( g_lb_chordstate == 1U &&
+    (unsigned short)( timebase_now() - g_lb_chord ) >= LB_CHORD_TIME )
+  {
+    g_lb_chordstate = 2;
+    if ( g_lb_active )
+    {
+      lb_stop();
+    }
+    else
+    {
+      g_lb_period = LB_DEF_PERIOD;
+      g_lb_spread = LB_DEF_SPREAD;
+      g_lb_count  = 0;
+      g_lb_mask   = LB_DEF_MASK;
+      lb_start();
+    }
+  }
+
+  if ( g_lb_request )
+  {
+    /* apply settings received by loopback_setreport() */
+    lb_stop();
+    if ( g_lb_reqbuf[0] != 0U )
+    {
+      g_lb_period = g_lb_reqbuf[1] | (unsigned short)g_lb_reqbuf[2] << 8;
+      g_lb_spread = g_lb_reqbuf[3];
+      g_lb_count  = g_lb_reqbuf[4] | (unsigned short)g_lb_reqbuf[5] << 8;
+      g_lb_mask   = g_lb_reqbuf[6] | (unsigned short)g_lb_reqbuf[7] << 8;
+      lb_start();
+    }
+    g_lb_request = 0;
+  }
+}
+
+/* returns whether the test mode is active */
+unsigned char loopback_active( void )
+{
+  return g_lb_active;
+}
+
+/* returns the generated button states */
+unsigned short loopback_buttons( void )
+{
+  return g_lb_buttons;
+}
+
+/* feature report received */
+void loopback_setreport( const unsigned char * report )
+{
+  unsigned char i;
+
+  if ( g_lb_request )
+  {
+    return;   /* last request not yet applied, drop this one */
+  }
+  for ( i = 0; i < LOOPBACK_REPORT_SIZE; ++i )
+  {
+    g_lb_reqbuf[i] = report[i];
+  }
+  g_lb_request = 1;
+}
+
+/* fill in the feature report */
+void loopback_getreport( unsigned char * report )
+{
+  report[0] = g_lb_active;
+  report[1] = g_lb_period & 0xFF;
+  report[2] = g_lb_period >> 8;
+  report[3] = g_lb_spread;
+  report[4] = g_lb_count & 0xFF;
+  report[5] = g_lb_count >> 8;
+  report[6] = g_lb_mask & 0xFF;
+  report[7] = g_lb_mask >> 8;
+}
+
+
+/* enter the test mode, all buttons released */
+static void lb_start( void )
+{
+  if ( g_lb_period == 0U )
+  {
+    g_lb_period = 1;
+  }
+  if ( g_lb_random == 0U )
+  {
+    g_lb_random = 0xACE1;  /* LFSR must not be zero */
+  }
+  g_lb_buttons = 0;
+  g_lb_active = 1;
+  timebase_start( &g_lb_timer, lb_event, lb_delay(), 0 );
+}
+
+/* leave the test mode */
+static void lb_stop( void )
+{
+  timebase_stop( &g_lb_timer );
+  g_lb_active = 0;
+  g_lb_buttons = 0;
+}
+
+/* toggle timer expired */
+static void lb_event( struct tb_timer * timer )
+{
+  g_lb_buttons ^= g_lb_mask;
+  if ( g_lb_count != 0U && --g_lb_count == 0U )
+  {
+    /* NOTE: from now on the controller is reported again, so the last
+      toggle should release the buttons (even count) */
+    g_lb_active = 0;
+    return;
+  }
+  timebase_start( timer, lb_event, lb_delay(), 0 );
+}
+
+/* time until the next toggle */
+static unsigned short lb_delay( void )
+{
+  unsigned char lsb;
+
+  if ( g_lb_spread == 0U )
+  {
+    return g_lb_period;
+  }
+
+  /* 16 bit Galois LFSR, x^16 + x^14 + x^13 + x^11 + 1 */
+  lsb = g_lb_random & 1;
+  g_lb_random >>= 1;
+  if ( lsb )
+  {
+    g_lb_random ^= 0xB400;
+  }
+  return g_lb_period + g_lb_random % g_lb_spread;
+}
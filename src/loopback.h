@@ -0,0 +1,41 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+/* Loopback test mode
+
+  While active, the buttons reported to the host do not come from the
+  controller but are toggled at programmed times, so a host can measure
+  its input latency against the frame number stamped into each report
+  (see ../host/snesbench.c).
+
+  The mode is entered and left by holding SELECT+START+L+R for 3 s, or by
+  the feature report LOOPBACK_REPORT_ID:
+
+    byte 0     mode: 0 = off, 1 = on
+    byte 1..2  period between toggles [ms]
+    byte 3     spread [ms]: a pseudo-random 0..spread-1 is added to each
+               period, so events do not phase-lock to the host's polling
+    byte 4..5  number of toggles until the mode ends, 0 = endless
+               (reads back the number left)
+    byte 6..7  SNES buttons toggled (enum snes_buttons) */
+
+#define LOOPBACK_REPORT_ID    2
+#define LOOPBACK_REPORT_SIZE  8   /* without report ID */
+
+/* handles the chord and pending requests, to be called from the main loop
+  with the buttons read from the controller */
+void loopback_poll( unsigned short buttons );
+
+/* returns whether the test mode is active */
+unsigned char loopback_active( void );
+
+/* returns the generated button states */
+unsigned short loopback_buttons( void );
+
+/* feature report received from the host (called from usb_service()) */
+void loopback_setreport( const unsigned char * report );
+
+/* fills in the feature report (called from usb_service()) */
+void loopback_getreport( unsigned char * report );
+
+#endif  /* defined LOOPBACK_H */
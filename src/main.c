@@ -1,206 +1,496 @@
-/* main.c */
-
-#include <p18cxxx.h>
-#include "debug.h"
-#include "usb.h"
-
-/* Configuration */
-#pragma config FOSC = XTPLL_XT    /* XT oscillator, PLL */
-#pragma config PLLDIV = 1         /* 4MHz input */
-#pragma config CPUDIV = OSC3_PLL4	/* CPU=96MHz PLL / 4 */
-#pragma config FCMEN = OFF        /* Fail-safe clock monitor */
-#pragma config IESO = OFF         /* internal/external switch over */
-#pragma config PWRT = ON          /* power-up timer */
-#pragma config BOR = OFF          /* brown-out reset */
-#pragma config WDT = OFF          /* watchdog timer */
-#pragma config LVP = OFF          /* low voltage ICSP */
-#pragma config VREGEN = ON        /* USB voltage regulator */
-#pragma config MCLRE = OFF        /* Master Clear Reset */
-#pragma config PBADEN = OFF       /* PORTB are digital I/O */
-
-/* pins on PortA */
-enum snes_pins
-{
-  SNES_LATCH = 0x04,
-  SNES_CLOCK = 0x20,
-  SNES_DATA  = 0x08,
-  SNES_VCC   = 0x10
-};
-
-/* SNES buttons */
-enum snes_buttons
-{
-  BUT_B      = 0x0001,
-  BUT_Y      = 0x0002,
-  BUT_SELECT = 0x0004,
-  BUT_START  = 0x0008,
-  BUT_UP     = 0x0010,
-  BUT_DOWN   = 0x0020,
-  BUT_LEFT   = 0x0040,
-  BUT_RIGHT  = 0x0080,
-  BUT_A      = 0x0100,
-  BUT_X      = 0x0200,
-  BUT_L      = 0x0400,
-  BUT_R      = 0x0800
-};
-
-/* local prototypes */
-void high_isr( void );
-static void delay( unsigned char timeus );
-
-
-/* Interrupt Vector */
-#pragma code high_vector = 0x08
-void interrupt_at_high_vector( void )
-{
-  _asm goto high_isr _endasm
-}
-#pragma code    /* default code section */
-
-
-/* Interrupt Service Routine */
-#pragma interrupt high_isr
-void high_isr( void )
-{
-  /* query interrupt flag bits */
-  if ( ( PIE1 & 0x10 ) && ( PIR1 & 0x10 ) )
-  {
-    /* EUSART TX interrupt */
-    debug_txint();
-  }
-  
-  if ( ( PIE2 & 0x20 ) && ( PIR2 & 0x20 ) )
-  {
-    /* USB interrupt */
-    usb_interrupt();
-  }
-  
-  /* other interrupt flags may be queried here */
-
-  /* clear interrupt flag bits */
-  PIR1 = 0x00;
-  PIR2 = 0x00;
-}
-
-
-/* wait a specific amount of cycles */
-static void delay( unsigned char timeus )
-{
-  _asm
-    MOVLW -2  /* operate on first function parameter */
-    start:
-      DECF PLUSW2, 1, 0
-      BZ done
-      NOP        /* 6 NOPs would take 1us */
-      NOP
-      BRA start
-    done:
-  _endasm
-}
-
-/* main entry point */
-void main( void )
-{
-  unsigned char  but;         /* current button number */
-  unsigned short buttons;     /* bit array of button states */
-  unsigned short old_buttons; /* old value of butstates */ 
-  
-  ADCON1 = 0x0F; /* all pins to digital */
-  LATA = 0x01; 
-  TRISA = 0x00;  /* all pins to output */
-  
-  TRISB = 0xC0;
-  TRISC = 0x00;
-
-  /* initialize interrupts */
-  /* IPEN in RCON is already 0 */
-  PIE1 = 0x00;    /* disable interrupt sources */
-  PIE2 = 0x00;
-
-  /* initializes power mode settings */
-  OSCCON = 0x00;  /* Sleep mode enabled, primary oscillator */
-  
-  /* initialize EUSART */
-  debug_init();
-
-  /* initialize USB */
-  usb_init();
-  
-  /* global interrupt enable */
-  INTCON = 0xC0;  
-  
-  /* initialization of SNES interface */
-  LATA  |= SNES_VCC;    /* RA4 (supply) to high */
-  LATA  |= SNES_CLOCK;  /* RA1 (clock) to high */
-  TRISA |= SNES_DATA;   /* RA3 (data) to input */
-  
-  while (1)
-  {
-    /* trigger controller to latch status of all buttons */
-    /* send positive pulse on LAT, 12us */
-    LATA |= SNES_LATCH;
-    delay( 12 );
-    LATA &= ~SNES_LATCH;
-    
-    /* wait 6us for controller to drive first button state */
-    delay( 6 );
-    
-    /* go over all 16 buttons */
-    old_buttons = buttons;
-    buttons = 0;
-    for ( but = 0; but < 16U; ++but )
-    {
-      /* issue falling edge on CLK */
-      LATA &= ~SNES_CLOCK;
-      
-      /* sample button state from DAT */
-      if ( ( PORTA & SNES_DATA ) == 0U )
-      {
-        /* button is pressed */
-        buttons |= (unsigned short)1 << but;
-      }
-      
-      /* wait 6us */
-      delay( 6 );
-      
-      /* issue rising edge on CLK, controller will drive next bit */
-      LATA |= SNES_CLOCK;
-
-      /* wait 6us for controller to drive next button state */
-      delay( 6 );
-    }
-    
-    /* interpret sampled button states */
-    if ( buttons != 0U )
-    {
-      LATA &= ~0x01;
-    }
-    else
-    {
-      LATA |= 0x01;
-    }
-    if ( buttons != old_buttons )
-    {
-      /* state of buttons changed -> re-interpret them */
-      g_hidreport[0] = 0;
-      g_hidreport[1] = 0;
-      
-      if ( buttons & BUT_LEFT )   g_hidreport[0] |= 0x03;
-      if ( buttons & BUT_RIGHT )  g_hidreport[0] |= 0x01;
-      if ( buttons & BUT_DOWN )   g_hidreport[0] |= 0x04;
-      if ( buttons & BUT_UP )     g_hidreport[0] |= 0x0C;
-      if ( buttons & BUT_B )      g_hidreport[1] |= 0x01;
-      if ( buttons & BUT_Y )      g_hidreport[1] |= 0x02;
-      if ( buttons & BUT_A )      g_hidreport[1] |= 0x04;
-      if ( buttons & BUT_X )      g_hidreport[1] |= 0x08;
-      if ( buttons & BUT_L )      g_hidreport[1] |= 0x10;
-      if ( buttons & BUT_R )      g_hidreport[1] |= 0x20;
-      if ( buttons & BUT_START )  g_hidreport[1] |= 0x40;
-      if ( buttons & BUT_SELECT ) g_hidreport[1] |= 0x80;
-      
-      /* inform USB that new values are present */
-      usb_reportchanged();
-    }
-  }
-}
- 
+/* main.c */
+
+#include <p18cxxx.h>
+#include "debug.h"
+#include "usb.h"
+#include "timebase.h"
+#include "snes.h"
+#include "loopback.h"
+#include "profile.h"
+#include "clock.h"
+#include "playback.h"
+#include "config.h"
+
+#if defined( PLAYBACK ) && ( defined( SNES_TIMED ) || defined( USB_LATCH ) )
+#error "PLAYBACK scans nothing, it excludes SNES_TIMED and USB_LATCH"
+#endif
+
+/* the timed scan (SNES_TIMED) or the playback's polling window (PLAYBACK)
+  is the only high priority interrupt, all others are at low priority */
+#if defined( SNES_TIMED ) || defined( PLAYBACK )
+#define CCP1_HIGH
+#endif
+
+/* Configuration, oscillator and clocks as in config.h */
+/* NOTE: an image started by the USB bootloader (BOOTLOADER defined, see
+  Makefile) runs with the configuration of the bootloader, config.h makes
+  sure it is built for it */
+#ifndef BOOTLOADER
+#if CONFIG_XTAL_MHZ == 4
+#pragma config FOSC = XTPLL_XT    /* XT oscillator, PLL */
+#pragma config PLLDIV = 1         /* 4MHz input */
+#else
+#pragma config FOSC = HSPLL_HS    /* HS oscillator, PLL */
+#if CONFIG_XTAL_MHZ == 8
+#pragma config PLLDIV = 2         /* 8MHz input */
+#elif CONFIG_XTAL_MHZ == 12
+#pragma config PLLDIV = 3         /* 12MHz input */
+#elif CONFIG_XTAL_MHZ == 16
+#pragma config PLLDIV = 4         /* 16MHz input */
+#elif CONFIG_XTAL_MHZ == 20
+#pragma config PLLDIV = 5         /* 20MHz input */
+#else
+#pragma config PLLDIV = 6         /* 24MHz input */
+#endif
+#endif
+#if CONFIG_CPU_MHZ == 48
+#pragma config CPUDIV = OSC1_PLL2 /* CPU=96MHz PLL / 2 */
+#elif CONFIG_CPU_MHZ == 32
+#pragma config CPUDIV = OSC2_PLL3 /* CPU=96MHz PLL / 3 */
+#elif CONFIG_CPU_MHZ == 24
+#pragma config CPUDIV = OSC3_PLL4 /* CPU=96MHz PLL / 4 */
+#else
+#pragma config CPUDIV = OSC4_PLL6 /* CPU=96MHz PLL / 6 */
+#endif
+#pragma config USBDIV = 2         /* full-speed USB clock=96MHz PLL / 2 */
+#pragma config FCMEN = OFF        /* Fail-safe clock monitor */
+#pragma config IESO = OFF         /* internal/external switch over */
+#pragma config PWRT = OFF         /* power-up timer, see below */
+#pragma config BOR = ON           /* brown-out reset, in hardware */
+#pragma config BORV = 1           /* at about 4.3 V */
+#pragma config WDT = OFF          /* watchdog timer */
+#pragma config LVP = OFF          /* low voltage ICSP */
+#pragma config VREGEN = ON        /* USB voltage regulator */
+#pragma config MCLRE = OFF        /* Master Clear Reset */
+#pragma config PBADEN = OFF       /* PORTB are digital I/O */
+/* NOTE: the oscillator start-up timer and the PLL lock time-out (about
+  2 ms) hold the device in reset until the clock is stable anyway. Instead
+  of the 66 ms of the power-up timer, brown-out reset holds it until the
+  supply is high enough for 48 MHz, so USB attaches that much earlier. */
+#endif
+
+/* local prototypes */
+void isr_dispatch( void );
+void fast_isr( void );
+void high_isr( void );
+static void service( void );
+
+
+/* Interrupt Vectors */
+/* NOTE: not in the host simulator build (../host/sim), which calls
+  isr_dispatch(), snes_ccpint() and playback_ccpint() directly */
+/* NOTE: with CCP1_HIGH, isr_dispatch() handles the others at low
+  priority */
+#if defined( __18CXX )
+#ifdef BOOTLOADER
+/* the bootloader occupies 0x0000..0x0FFF and forwards its vectors */
+extern void _startup( void );
+#pragma code app_reset_vector = 0x1000
+void app_reset( void )
+{
+  _asm goto _startup _endasm
+}
+#pragma code high_vector = 0x1008
+#else
+#pragma code high_vector = 0x08
+#endif
+void interrupt_at_high_vector( void )
+{
+#if defined( SNES_TIMED )
+  _asm goto snes_ccpint _endasm
+#elif defined( PLAYBACK )
+  _asm goto playback_ccpint _endasm
+#else
+  _asm goto isr_dispatch _endasm
+#endif
+}
+#ifdef CCP1_HIGH
+#ifdef BOOTLOADER
+#pragma code low_vector = 0x1018
+#else
+#pragma code low_vector = 0x18
+#endif
+void interrupt_at_low_vector( void )
+{
+  _asm goto isr_dispatch _endasm
+}
+#endif
+#pragma code    /* default code section */
+#endif
+
+
+/* Interrupt Dispatcher */
+/* The common interrupts, SOF, EP0 transactions (only latched for
+  usb_service()), EP1 IN completion while no report is pending, EP1 OUT
+  completion (USB_LATCH) and EP2 IN completion, go to fast_isr(), which
+  does not save the compiler's context. Everything else goes to
+  high_isr(). */
+/* NOTE: only bit tests on access RAM, which leave W, STATUS and BSR
+  untouched, so either handler finds the interrupted context in the
+  shadow registers (or, at low priority, still in place to save it) */
+#if defined( __18CXX )
+void isr_dispatch( void )
+{
+  _asm
+    /* Timer0 */
+    BTFSC INTCON, 2, 0      /* TMR0IF */
+    GOTO high_isr
+    /* EUSART TX, if enabled */
+    BTFSS PIE1, 4, 0        /* TXIE */
+    BRA no_tx
+    BTFSC PIR1, 4, 0        /* TXIF */
+    GOTO high_isr
+  no_tx:
+    /* USB conditions other than SOF and transaction complete */
+    BTFSC UIR, 0, 0         /* URSTIF */
+    GOTO high_isr
+    BTFSC UIR, 1, 0         /* UERRIF */
+    GOTO high_isr
+    BTFSC UIR, 2, 0         /* ACTVIF */
+    GOTO high_isr
+    BTFSC UIR, 4, 0         /* IDLEIF */
+    GOTO high_isr
+    BTFSC UIR, 5, 0         /* STALLIF */
+    GOTO high_isr
+    BTFSS UIR, 3, 0         /* TRNIF */
+    GOTO fast_isr           /* SOF only */
+    /* only EP0, EP1 and EP2 (USB_STREAM, PLAYBACK) are enabled, USTAT
+      bit 3 tells EP1 from the others */
+    BTFSS USTAT, 3, 0
+    GOTO fast_isr           /* EP0 or EP2 */
+    /* EP1: with a pending report the full handler sends it, the one for
+      EP1 OUT (USB_LATCH) passes it on as usb_fastint() does */
+    BTFSC g_report_pending, 0, 0
+    GOTO high_isr
+    GOTO fast_isr
+  _endasm
+}
+#else
+/* host simulator build: same decisions in C */
+void isr_dispatch( void )
+{
+  if ( ( INTCON & 0x04 ) || ( ( PIE1 & 0x10 ) && ( PIR1 & 0x10 ) ) ||
+    ( UIR & 0x37 ) ||
+    ( ( UIR & 0x08 ) && ( USTAT & 0x08 ) && g_report_pending ) )
+  {
+    high_isr();
+  }
+  else
+  {
+    fast_isr();
+  }
+}
+#endif
+
+
+/* Fast Interrupt Service Routine */
+/* NOTE: only WREG, STATUS and BSR are saved (in the shadow registers, or
+  in software at low priority, where the high priority interrupt may
+  overwrite them) */
+#ifdef CCP1_HIGH
+#pragma interruptlow fast_isr nosave=section(".tmpdata"),section("MATH_DATA"),PROD,TBLPTR,TABLAT,PCLATH,PCLATU,FSR0
+#else
+#pragma interrupt fast_isr nosave=section(".tmpdata"),section("MATH_DATA"),PROD,TBLPTR,TABLAT,PCLATH,PCLATU,FSR0
+#endif
+void fast_isr( void )
+{
+  PROFILE_IRQ();
+  usb_fastint();
+}
+
+
+/* Interrupt Service Routine */
+/* NOTE: at low priority with CCP1_HIGH, despite its name */
+#ifdef CCP1_HIGH
+#pragma interruptlow high_isr
+#else
+#pragma interrupt high_isr
+#endif
+void high_isr( void )
+{
+  PROFILE_IRQ();
+  service();
+}
+
+
+/* service all interrupt sources, called by high_isr() or, in the
+  USB_POLLED build, by the main loop */
+static void service( void )
+{
+  /* query interrupt flag bits */
+  if ( ( PIE1 & 0x10 ) && ( PIR1 & 0x10 ) )
+  {
+    /* EUSART TX interrupt */
+    debug_txint();
+  }
+  
+  if ( ( PIE2 & 0x20 ) && ( PIR2 & 0x20 ) )
+  {
+    /* USB interrupt */
+    usb_interrupt();
+  }
+  
+  if ( ( INTCON & 0x20 ) && ( INTCON & 0x04 ) )
+  {
+    /* Timer0 interrupt */
+    timebase_timerint();
+  }
+  
+  /* other interrupt flags may be queried here */
+
+  /* clear the flag bits handled here, only USBIF: TXIF is read-only,
+    TMR0IF is cleared by timebase_timerint() and CCP1IF belongs to the
+    CCP1 handler (CCP1_HIGH), which would miss a compare cleared here */
+  PIR2 &= ~0x20;
+}
+
+
+/* main entry point */
+void main( void )
+{
+  unsigned short buttons;     /* bit array of button states */
+  unsigned short old_buttons; /* old value of butstates */ 
+#ifndef PLAYBACK
+  unsigned char  scan;        /* a scan is due */
+#endif
+  unsigned char  scanned;     /* a scan finished in this pass */
+  unsigned char  settled;     /* the controller has settled */
+  unsigned short scan_ms;     /* start of the scan that just finished [ms] */
+#ifdef SNES_TIMED
+  unsigned short start_ms;    /* start of the scan in progress [ms] */
+#endif
+#ifdef USB_LATCH
+  unsigned char  request;     /* the host asked for a scan */
+  unsigned char  report;      /* the scan finished answers a request */
+#ifdef SNES_TIMED
+  unsigned char  answer;      /* the scan running answers a request */
+#endif
+#endif
+  
+  ADCON1 = 0x0F; /* all pins to digital */
+#ifdef PLAYBACK
+  /* the console drives latch, clock and supply, never drive them */
+  LATA = 0x01 | SNES_DATA;
+  TRISA = SNES_LATCH | SNES_CLOCK | SNES_VCC;
+#else
+  /* the controller is powered first, it settles while USB attaches and
+    the host enumerates (see SNES_SETTLE_MS) */
+  LATA = 0x01 | SNES_VCC | SNES_CLOCK;
+  TRISA = 0x00;  /* all pins to output */
+#endif
+  
+  TRISB = 0xC0;
+  TRISC = 0x00;
+
+  /* initialize interrupts */
+  /* NOTE: in the USB_POLLED build the enable bits are still needed, they
+    wake the device from SLEEP */
+  PIE1 = 0x00;    /* disable interrupt sources */
+  PIE2 = 0x00;
+#ifdef CCP1_HIGH
+  /* CCP1 at high priority, everything else low */
+  IPR1 = 0x04;    /* CCP1IP */
+  IPR2 = 0x00;
+  INTCON2 &= ~0x04; /* TMR0IP */
+  RCON |= 0x80;   /* IPEN */
+#endif
+  /* otherwise IPEN in RCON is already 0 */
+
+  /* initializes power mode settings and the clock profiles */
+  clock_init();
+  
+  /* initialize millisecond tick and timer wheel, which stamps the boot
+    phases */
+  timebase_init();
+  PROFILE_INIT();
+
+  /* initialize USB, the host resets the device not before 100 ms later */
+  usb_init();
+  PROFILE_BOOT( BOOT_ATTACHED );
+  
+  /* initialization of SNES interface */
+#ifdef PLAYBACK
+  playback_init();
+#else
+  snes_init();
+#endif
+  
+  /* initialize EUSART */
+  debug_init();
+  
+#ifndef USB_POLLED
+  /* global interrupt enable */
+  INTCON |= 0xC0;  /* (keeps TMR0 interrupt enabled by timebase_init) */
+#elif defined( CCP1_HIGH )
+  /* only the high priority interrupt */
+  INTCON |= 0x80;  /* GIEH */
+#endif
+  
+  buttons = 0;
+  settled = 0;
+  scan_ms = 0;
+#ifdef SNES_TIMED
+  start_ms = 0;
+#endif
+#ifdef USB_LATCH
+  request = 0;
+  report  = 0;
+#ifdef SNES_TIMED
+  answer  = 0;
+#endif
+#endif
+  while (1)
+  {
+    old_buttons = buttons;
+#ifdef PLAYBACK
+    /* the console reads the frames of the host, each one is reported (and
+      streamed) as if it had been scanned */
+    scanned = playback_poll( &buttons );
+    scan_ms = timebase_now();
+#else
+#ifdef USB_LATCH
+    if ( usb_latched() )
+    {
+      request = 1;
+      clock_activity();
+    }
+    if ( usb_ondemand() )
+    {
+      /* only the host's latch requests start scans, each is answered by
+        the next scan that starts after it; without one the core stops
+        until the next interrupt, which may be the request */
+      /* NOTE: a request that comes in the few cycles between the test in
+        usb_latched() and the SLEEP waits for the next SOF */
+      if ( !request )
+      {
+        clock_idle();
+      }
+      scan = request;
+    }
+    else
+#endif
+    {
+      scan = clock_scan();
+    }
+#ifdef SNES_TIMED
+    /* the scan runs in the background, the next one starts as soon as the
+      last one finished */
+    /* NOTE: a finished scan is picked up first, so a result never belongs
+      to the scan started in the same pass */
+    scanned = snes_poll( &buttons );
+    if ( scanned )
+    {
+      scan_ms = start_ms;
+#ifdef USB_LATCH
+      report = answer;
+      answer = 0;
+#endif
+    }
+    if ( scan && snes_start() )
+    {
+      start_ms = timebase_now();
+#ifdef USB_LATCH
+      answer  = request;
+      request = 0;
+#endif
+    }
+#else
+    scanned = 0;
+    if ( scan )
+    {
+      scan_ms = timebase_now();
+      PROFILE_BEGIN();
+      buttons = snes_read();
+      PROFILE_END_SCAN();
+      scanned = 1;
+#ifdef USB_LATCH
+      report  = request;
+      request = 0;
+#endif
+    }
+#endif
+#endif  /* !PLAYBACK */
+    
+#ifdef USB_STREAM
+    if ( scanned )
+    {
+      /* every scan as it came, also before the controller has settled */
+      usb_stream( buttons );
+    }
+#endif
+    
+    if ( !settled )
+    {
+      /* the first scan that started after SNES_SETTLE_MS is queued as the
+        first report, whatever it shows, so the host finds valid button
+        states at EP1 as soon as it is configured */
+      if ( scanned && scan_ms > SNES_SETTLE_MS )
+      {
+        settled = 1;
+        old_buttons = ~buttons;   /* reported below */
+        PROFILE_BOOT( BOOT_SETTLED );
+      }
+      else
+      {
+        buttons = 0;
+      }
+    }
+    
+#ifdef USB_LATCH
+    if ( report )
+    {
+      /* the scan the host asked for is reported below, changed or not */
+      report = 0;
+      old_buttons = ~buttons;
+    }
+#endif
+    
+#ifdef USB_POLLED
+    /* interrupt sources are polled between scans */
+    PROFILE_BEGIN();
+    service();
+    PROFILE_END_SERVICE();
+#endif
+    
+    /* control transfers, the SIE NAKs until they are prepared here */
+    PROFILE_BEGIN();
+    if ( usb_service() )
+    {
+      PROFILE_END_EP0();
+      clock_activity();
+    }
+    
+    /* loopback test mode replaces the controller */
+    loopback_poll( buttons );
+    
+    /* run expired timers */
+    timebase_poll();
+    PROFILE_POLL();
+    
+    if ( loopback_active() )
+    {
+      /* NOTE: loopback_poll() needs every scan, so no idle profile */
+      buttons = loopback_buttons();
+      clock_activity();
+    }
+    
+    /* interpret sampled button states */
+    if ( buttons != 0U )
+    {
+      LATA &= ~0x01;
+    }
+    else
+    {
+      LATA |= 0x01;
+    }
+    if ( buttons != old_buttons )
+    {
+      /* state of buttons changed -> re-interpret them */
+      snes_tohid( buttons, g_hidreport );
+      
+      /* inform USB that new values are present */
+      usb_reportchanged();
+      clock_activity();
+    }
+  }
+}
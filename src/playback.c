@@ -0,0 +1,458 @@
+/* playback.c */
+
+#include <p18cxxx.h>
+#include "playback.h"
+#include "snes.h"
+#include "usb.h"
+#include "clock.h"
+#include "config.h"
+#include "timebase.h"
+
+#ifdef PLAYBACK
+
+/* polling loops let virtual time pass in the host simulator build */
+#if defined( __18CXX )
+#define PB_WAIT()
+#else
+#define PB_WAIT()  sim_delay_us( 1 )
+#endif
+
+/* cycles from the timer read in pb_schedule() until CCP1 compares */
+#define PB_SETUP  64U
+
+/* answering the clock edges, in access RAM so the loops stay short */
+#pragma udata access playback_access
+static near unsigned char  g_pb_loops;   /* edge timeout, 0 = timed out */
+static near unsigned char  g_pb_bits;    /* clock pulses left */
+static near unsigned char  g_pb_next;    /* LATA for the next rising edge */
+static near unsigned short g_pb_shift;   /* bits to send, 1 = pressed */
+#pragma udata
+
+/* static data */
+static volatile unsigned char  g_pb_state;    /* PLAYBACK_PLAYING, _LOCKED */
+static unsigned short          g_pb_frame;    /* buttons for the next latch */
+static unsigned char           g_pb_empty;    /* g_pb_frame is no frame */
+static unsigned long           g_pb_period;   /* latch period [cycles] */
+static unsigned short          g_pb_lead;     /* PLAYBACK_LEAD_US [cycles] */
+static unsigned short          g_pb_latch;    /* Timer1 at the last latch */
+static unsigned short          g_pb_tick;     /* ms tick of it (search) */
+static unsigned char           g_pb_found;    /* the search found one */
+static unsigned char           g_pb_low;      /* it saw the latch low */
+static unsigned char           g_pb_wraps;    /* Timer1 wraps until window */
+static unsigned short          g_pb_played;
+static unsigned short          g_pb_underruns;
+static unsigned short          g_pb_lost;
+
+/* latch answered, picked up by playback_poll() */
+static volatile unsigned short g_pb_buttons;
+static volatile unsigned char  g_pb_answered;
+
+/* request from the host, applied by playback_poll() */
+/* NOTE: written by usb_service() only while g_pb_request is clear, read by
+  playback_poll() only while it is set */
+static unsigned char          g_pb_reqbuf;
+static volatile unsigned char g_pb_request;
+
+/* local prototypes */
+static void pb_search( void );
+static void pb_skip( void );
+static void pb_latched( void );
+static void pb_answer( void );
+static void pb_fetch( void );
+static void pb_present( void );
+static void pb_schedule( void );
+static unsigned short pb_timer( void );
+
+#pragma code
+
+
+/* pins and timer */
+void playback_init( void )
+{
+  /* the console drives latch, clock and supply, data shows no buttons */
+  LATA  |= SNES_DATA;
+  TRISA |= SNES_LATCH | SNES_CLOCK | SNES_VCC;
+  TRISA &= ~SNES_DATA;
+
+  /* Timer1 runs free at the instruction clock (as for profile.c), stamps
+    the latches, CCP1 compares against it */
+  g_pb_lead = PLAYBACK_LEAD_US * CONFIG_MIPS;
+  T1CON = 0x81;   /* 16 bit read/write, internal clock, no prescaler, on */
+  CCP1CON = 0x00;
+  g_pb_empty = 1;
+}
+
+/* called from the main loop */
+unsigned char playback_poll( unsigned short * buttons )
+{
+  unsigned char gie;
+
+  usb_playback();
+
+  if ( g_pb_request )
+  {
+    /* NOTE: the window must not take a frame meanwhile */
+    gie = INTCON & 0x80;
+    INTCON &= ~0x80;
+    if ( g_pb_reqbuf == 0U )
+    {
+      g_pb_state &= ~PLAYBACK_PLAYING;
+      usb_playback_flush();
+    }
+    else
+    {
+      g_pb_state |= PLAYBACK_PLAYING;
+      g_pb_played    = 0;
+      g_pb_underruns = 0;
+      g_pb_lost      = 0;
+    }
+    pb_fetch();
+    if ( !( g_pb_state & PLAYBACK_LOCKED ) )
+    {
+      pb_present();   /* locked, the window does that */
+    }
+    INTCON |= gie;
+    g_pb_request = 0;
+  }
+
+  if ( !( g_pb_state & PLAYBACK_LOCKED ) && ( PORTA & SNES_VCC ) )
+  {
+    pb_search();
+  }
+  else if ( !g_pb_answered )
+  {
+    /* locked, or the console is off: the window, the host or the tick
+      wakes the core */
+    /* NOTE: a latch answered in the few cycles between the test and the
+      SLEEP is reported with the next interrupt */
+    clock_idle();
+  }
+
+  if ( !g_pb_answered )
+  {
+    return 0;
+  }
+  gie = INTCON & 0x80;
+  INTCON &= ~0x80;
+  g_pb_answered = 0;
+  *buttons = g_pb_buttons;
+  INTCON |= gie;
+  return 1;
+}
+
+/* the polling window, PLAYBACK_LEAD_US before the predicted latch */
+/* NOTE: high priority, nothing else can delay it; calls functions, so the
+  full context is saved */
+#pragma interrupt playback_ccpint
+void playback_ccpint( void )
+{
+  unsigned short open;
+  unsigned short latch;
+
+  PIR1 &= ~0x04;    /* clear CCP1IF */
+  if ( g_pb_wraps != 0U )
+  {
+    --g_pb_wraps;   /* the match of a wrap before */
+    return;
+  }
+  CCP1CON = 0x00;
+  PIE1 &= ~0x04;    /* CCP1IE */
+
+  /* bit 0 goes to DATA now, after the last latch the console may have read
+    past the 16th bit; a frame may have come since that latch */
+  if ( g_pb_empty )
+  {
+    pb_fetch();
+  }
+  pb_present();
+
+  open  = CCPR1L;
+  open |= (unsigned short)CCPR1H << 8;
+  while ( !( PORTA & SNES_LATCH ) )
+  {
+    if ( (unsigned short)( pb_timer() - open ) >= 2 * g_pb_lead )
+    {
+      /* none came, back to the search */
+      ++g_pb_lost;
+      g_pb_found = 0;
+      g_pb_state &= ~PLAYBACK_LOCKED;
+      return;
+    }
+    PB_WAIT();
+  }
+  latch = pb_timer();
+
+  /* the window opened PLAYBACK_LEAD_US before the latch predicted, the
+    difference corrects the period */
+  g_pb_period += (unsigned short)( latch - open );
+  g_pb_period -= g_pb_lead;
+  g_pb_latch = latch;
+  pb_answer();
+  pb_fetch();
+  pb_schedule();
+}
+
+/* feature report received */
+void playback_setreport( const unsigned char * report )
+{
+  if ( g_pb_request )
+  {
+    return;   /* last request not yet applied, drop this one */
+  }
+  g_pb_reqbuf = report[0];
+  g_pb_request = 1;
+}
+
+/* fill in the feature report */
+void playback_getreport( unsigned char * report )
+{
+  unsigned char gie;
+  unsigned long period;
+
+  gie = INTCON & 0x80;
+  INTCON &= ~0x80;
+  report[0]  = g_pb_state;
+  report[1]  = g_pb_played & 0xFF;
+  report[2]  = g_pb_played >> 8;
+  report[3]  = g_pb_underruns & 0xFF;
+  report[4]  = g_pb_underruns >> 8;
+  report[5]  = g_pb_lost & 0xFF;
+  report[6]  = g_pb_lost >> 8;
+  period     = g_pb_period;
+  INTCON |= gie;
+
+  if ( PORTA & SNES_VCC )
+  {
+    report[0] |= PLAYBACK_POWERED;
+  }
+  report[7]  = usb_playback_buffered();
+  report[8]  = USB_PLAYBACK_SLOTS * USB_PLAYBACK_SIZE / 2;
+  period    /= CONFIG_MIPS;
+  report[9]  = period & 0xFF;
+  report[10] = period >> 8;
+}
+
+
+/* look for the latch for up to PLAYBACK_SEARCH_US, with interrupts */
+/* NOTE: only a latch that rose counts, one that stays high is no
+  console's (unplugged, the pins float) */
+static void pb_search( void )
+{
+  unsigned short start;
+  unsigned char  gie;
+
+  start = pb_timer();
+  while ( (unsigned short)( pb_timer() - start ) <
+    PLAYBACK_SEARCH_US * CONFIG_MIPS && !usb_playback_busy() )
+  {
+    if ( !( PORTA & SNES_LATCH ) )
+    {
+      g_pb_low = 1;
+    }
+    else if ( g_pb_low )
+    {
+      /* still high with interrupts blocked: the first clock edge is at
+        least 6 us away */
+      gie = INTCON & 0xC0;
+      INTCON &= ~0xC0;
+      if ( PORTA & SNES_LATCH )
+      {
+        g_pb_low = 0;
+        pb_latched();
+        INTCON |= gie;
+        return;
+      }
+      INTCON |= gie;
+    }
+    if ( !( PORTA & SNES_CLOCK ) )
+    {
+      /* an interrupt hid the latch, the console is reading already */
+      ++g_pb_lost;
+      g_pb_found = 0;
+      pb_skip();
+      return;
+    }
+    PB_WAIT();
+  }
+}
+
+/* wait until the console has read all bits */
+static void pb_skip( void )
+{
+  for ( ;; )
+  {
+    g_pb_loops = 255;
+    while ( !( PORTA & SNES_CLOCK ) && --g_pb_loops != 0U )
+    {
+      PB_WAIT();
+    }
+    if ( g_pb_loops == 0U )
+    {
+      break;
+    }
+    g_pb_loops = 255;
+    while ( ( PORTA & SNES_CLOCK ) && --g_pb_loops != 0U )
+    {
+      PB_WAIT();
+    }
+    if ( g_pb_loops == 0U )
+    {
+      break;    /* the clock stays high */
+    }
+  }
+}
+
+/* the search found a latch: answer it, and lock to the console once the
+  period is known */
+/* NOTE: interrupts are blocked */
+static void pb_latched( void )
+{
+  unsigned short latch;
+  unsigned short tick;
+  unsigned short ms;
+  unsigned long  cycles;
+  unsigned long  estimate;
+
+  latch = pb_timer();
+  tick  = timebase_now();
+  pb_answer();
+  pb_fetch();
+  pb_present();
+
+  /* the Timer1 difference, plus as many wraps as bring it closest to what
+    the ticks say (which are off by less than one ms) */
+  ms = tick - g_pb_tick;
+  if ( g_pb_found && ms >= PLAYBACK_MIN_MS && ms <= PLAYBACK_MAX_MS )
+  {
+    cycles   = (unsigned short)( latch - g_pb_latch );
+    estimate = (unsigned long)ms * 1000U * CONFIG_MIPS;
+    while ( cycles + 32768U < estimate )
+    {
+      cycles += 65536UL;
+    }
+    g_pb_period = cycles;
+    g_pb_latch  = latch;
+    g_pb_state |= PLAYBACK_LOCKED;
+    pb_schedule();
+    return;
+  }
+  g_pb_found = 1;
+  g_pb_latch = latch;
+  g_pb_tick  = tick;
+}
+
+/* answer the clock edges after the latch, bit 0 is on DATA already */
+/* NOTE: interrupts are blocked (or this is the high priority one) */
+static void pb_answer( void )
+{
+  if ( g_pb_state & PLAYBACK_PLAYING )
+  {
+    if ( g_pb_empty )
+    {
+      ++g_pb_underruns;
+    }
+    else
+    {
+      ++g_pb_played;
+    }
+  }
+  g_pb_buttons  = g_pb_frame;
+  g_pb_answered = 1;
+
+  /* the console samples after each falling edge, the next bit must be on
+    DATA before the next one: it is prepared while the clock is low and
+    written right after the rising edge */
+  g_pb_shift = g_pb_frame;
+  for ( g_pb_bits = 16; g_pb_bits != 0U; --g_pb_bits )
+  {
+    g_pb_loops = 255;
+    while ( ( PORTA & SNES_CLOCK ) && --g_pb_loops != 0U )
+    {
+      PB_WAIT();
+    }
+    if ( g_pb_loops == 0U )
+    {
+      break;    /* the console stopped reading */
+    }
+    /* a 4021 shifts in its grounded serial input: pressed after the 16th
+      bit, which tells the console that a controller is plugged in */
+    g_pb_shift = g_pb_shift >> 1 | 0x8000;
+    g_pb_next = ( g_pb_shift & 1U ) ? LATA & ~SNES_DATA : LATA | SNES_DATA;
+    g_pb_loops = 255;
+    while ( !( PORTA & SNES_CLOCK ) && --g_pb_loops != 0U )
+    {
+      PB_WAIT();
+    }
+    LATA = g_pb_next;
+    if ( g_pb_loops == 0U )
+    {
+      break;
+    }
+  }
+}
+
+/* the frame for the next latch */
+static void pb_fetch( void )
+{
+  g_pb_empty = !( g_pb_state & PLAYBACK_PLAYING ) ||
+    !usb_playback_next( &g_pb_frame );
+  if ( g_pb_empty )
+  {
+    g_pb_frame = 0;
+  }
+}
+
+/* its bit 0 to DATA, pressed buttons pull it low */
+static void pb_present( void )
+{
+  if ( g_pb_frame & 1U )
+  {
+    LATA &= ~SNES_DATA;
+  }
+  else
+  {
+    LATA |= SNES_DATA;
+  }
+}
+
+/* arm CCP1 for the window, one period after g_pb_latch */
+/* NOTE: the compare matches every Timer1 wrap, so those before are
+  counted off first */
+static void pb_schedule( void )
+{
+  unsigned long  delay;
+  unsigned short elapsed;
+  unsigned short compare;
+
+  delay   = g_pb_period - g_pb_lead;
+  elapsed = pb_timer() - g_pb_latch;
+  if ( (unsigned short)( (unsigned short)delay - elapsed ) < PB_SETUP )
+  {
+    /* it might match while CCP1 is set up, or not: a bit later */
+    delay += PB_SETUP;
+  }
+  g_pb_wraps = delay >> 16;
+  if ( (unsigned short)delay < elapsed )
+  {
+    /* passed already in this wrap, the first match is a wrap later */
+    --g_pb_wraps;
+  }
+  compare = g_pb_latch + (unsigned short)delay;
+  CCPR1H = compare >> 8;
+  CCPR1L = compare & 0xFF;
+  PIR1 &= ~0x04;    /* clear CCP1IF */
+  CCP1CON = 0x0A;   /* compare mode, interrupt only (pin RC2 unaffected) */
+  PIE1 |= 0x04;     /* CCP1IE */
+}
+
+/* Timer1 count */
+static unsigned short pb_timer( void )
+{
+  unsigned short count;
+
+  count  = TMR1L;   /* reading TMR1L latches TMR1H */
+  count |= (unsigned short)TMR1H << 8;
+  return count;
+}
+
+#endif  /* defined PLAYBACK */
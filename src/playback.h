@@ -0,0 +1,75 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+/* PLAYBACK: the adapter is the controller of a console instead of reading
+  one. The console drives latch and clock (SNES_VCC tells whether it is
+  on), the adapter answers with frame inputs which the host streams
+  through EP2 OUT (see usb_playback()), one per latch. Nothing is scanned,
+  the game pad reports show the frames played. Excludes SNES_TIMED and
+  USB_LATCH, which need Timer1's compare unit or a controller to scan.
+
+  NOTE: the latch and clock pins have neither an interrupt-on-change nor a
+  capture input, so the latch is caught by polling: Timer1 stamps each one,
+  and from the measured period CCP1 predicts the next and opens a polling
+  window PLAYBACK_LEAD_US before it at high priority. The clock edges are
+  answered from that window with interrupts blocked, the next bit is on
+  DATA about a microsecond after each rising edge. Until the period is
+  known (and after a latch missed the window) the main loop searches for
+  the latch between its other work. */
+#undef PLAYBACK
+
+/* the polling window opens this long before the predicted latch and closes
+  as long after it [us] */
+#define PLAYBACK_LEAD_US  250U
+
+/* the main loop searches for the latch this long per pass [us], unless a
+  control transfer or a playback packet waits (usb_playback_busy()) */
+#define PLAYBACK_SEARCH_US  1000U
+
+/* accepted latch period [ms] (NTSC 16.64, PAL 20.0) */
+#define PLAYBACK_MIN_MS  10U
+#define PLAYBACK_MAX_MS  30U
+
+/* Control and status of the playback, feature report PLAYBACK_REPORT_ID
+
+    byte 0      state: bit 0 playing, bit 1 locked to the console's latch,
+                bit 2 console powered (SNES_VCC)
+    byte 1..2   latches answered with a frame since the start
+    byte 3..4   underruns: latches answered while no frame was buffered,
+                they get no buttons and consume none
+    byte 5..6   latches lost: none came within the window (early, late, or
+                the game stopped reading), or the search saw one too late
+    byte 7      frames buffered
+    byte 8      buffer capacity in frames
+    byte 9..10  latch period [us], 0 until measured
+
+  counters are 16 bits, little endian, and wrap around. The host sets
+  byte 0: 1 starts playing with the frames buffered so far (the first one
+  goes to the next latch answered, counters are cleared), 0 stops and
+  flushes the buffer. Before the start and after the stop the console
+  reads no buttons. */
+#define PLAYBACK_REPORT_ID    5
+#define PLAYBACK_REPORT_SIZE  11  /* without report ID */
+
+#define PLAYBACK_PLAYING  0x01
+#define PLAYBACK_LOCKED   0x02
+#define PLAYBACK_POWERED  0x04
+
+/* configures the pins, no buttons pressed */
+void playback_init( void );
+
+/* applies requests and searches for the latch, to be called from the main
+  loop; returns whether a latch has been answered since the last call, and
+  stores the buttons the console read */
+unsigned char playback_poll( unsigned short * buttons );
+
+/* CCP1 compare interrupt, the polling window */
+void playback_ccpint( void );
+
+/* feature report received from the host (called from usb_service()) */
+void playback_setreport( const unsigned char * report );
+
+/* fills in the feature report (called from usb_service()) */
+void playback_getreport( unsigned char * report );
+
+#endif  /* defined PLAYBACK_H */
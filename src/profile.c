@@ -0,0 +1,229 @@
+/* profile.c */
+
+#include <p18cxxx.h>
+#include "profile.h"
+#include "debug.h"
+#include "timebase.h"
+#include "stats.h"
+
+/* the profile has no other output than the debug output */
+#if defined( PROFILE ) && !defined( DEBUG )
+#error "PROFILE needs DEBUG (see debug.h)"
+#endif
+
+/* boot phase not reached yet */
+#define PROF_NONE  0xFFFFU
+
+/* static data */
+volatile unsigned char g_profile_irqs;
+#ifdef PROFILE
+static unsigned short  g_prof_start;    /* Timer1 at profile_begin() */
+static unsigned short  g_prof_min;      /* fastest scan [cycles] */
+static unsigned long   g_prof_scans;    /* number of scans */
+static unsigned long   g_prof_total;    /* sum of scan times [cycles] */
+static unsigned long   g_prof_irqtotal; /* interrupts during scans */
+static unsigned long   g_prof_service;  /* cycles in polled service */
+static unsigned long   g_prof_ep0;      /* cycles in usb_service() */
+static unsigned short  g_prof_boot[ BOOT_PHASES ];  /* [ms], or PROF_NONE */
+static unsigned char   g_prof_logged;   /* boot log written */
+static struct tb_timer g_prof_timer;
+
+/* local prototypes */
+static unsigned short prof_now( void );
+static void prof_report( struct tb_timer * timer );
+static void prof_hex( unsigned long value );
+static void prof_bootlog( void );
+static void prof_dec( unsigned short value );
+#endif
+
+#pragma code
+
+
+/* start Timer1 and the report timer, call right after timebase_init() */
+void profile_init( void )
+{
+#ifdef PROFILE
+  unsigned char i;
+
+  T1CON = 0x81;   /* 16 bit read/write, internal clock, no prescaler, on */
+  g_prof_min = 0xFFFF;
+  for ( i = 0; i < BOOT_PHASES; ++i )
+  {
+    g_prof_boot[i] = PROF_NONE;
+  }
+  timebase_start( &g_prof_timer, prof_report, 1000, 1000 );
+#endif
+}
+
+/* start of a timed section */
+void profile_begin( void )
+{
+#ifdef PROFILE
+  g_profile_irqs = 0;
+  g_prof_start = prof_now();
+#endif
+}
+
+/* end of a SNES scan */
+void profile_end_scan( void )
+{
+#ifdef PROFILE
+  unsigned short time;
+
+  time = prof_now() - g_prof_start;
+  if ( time < g_prof_min )
+  {
+    g_prof_min = time;
+  }
+  ++g_prof_scans;
+  g_prof_total += time;
+  g_prof_irqtotal += g_profile_irqs;
+#endif
+}
+
+/* end of a polled service call */
+void profile_end_service( void )
+{
+#ifdef PROFILE
+  g_prof_service += (unsigned short)( prof_now() - g_prof_start );
+#endif
+}
+
+/* end of a usb_service() call that had work */
+void profile_end_ep0( void )
+{
+#ifdef PROFILE
+  g_prof_ep0 += (unsigned short)( prof_now() - g_prof_start );
+#endif
+}
+
+/* host has set the configuration */
+void profile_configured( void )
+{
+#ifdef PROFILE
+  DEBUG_OUT( 'E' );
+  prof_hex( timebase_now() );
+  prof_hex( g_prof_ep0 );
+  DEBUG_OUT( '\r' );
+  DEBUG_OUT( '\n' );
+#endif
+}
+
+/* a boot phase is reached, only the first time counts */
+/* NOTE: not from the fast interrupt path, timebase_now() returns in PROD */
+void profile_boot( unsigned char phase )
+{
+#ifdef PROFILE
+  if ( g_prof_boot[ phase ] == PROF_NONE )
+  {
+    g_prof_boot[ phase ] = timebase_now();
+  }
+#endif
+}
+
+/* called by the main loop, notices the first report sent */
+/* NOTE: EP1 IN completion usually takes the fast interrupt path */
+void profile_poll( void )
+{
+#ifdef PROFILE
+  if ( g_prof_boot[ BOOT_SENT ] == PROF_NONE && g_stats[ STATS_SENT ] != 0U )
+  {
+    profile_boot( BOOT_SENT );
+  }
+#endif
+}
+
+
+#ifdef PROFILE
+/* read Timer1 */
+static unsigned short prof_now( void )
+{
+  unsigned short now;
+
+  now  = TMR1L;   /* reading TMR1L latches TMR1H */
+  now |= (unsigned short)TMR1H << 8;
+  return now;
+}
+
+/* write totals of the last second */
+static void prof_report( struct tb_timer * timer )
+{
+  if ( g_prof_boot[ BOOT_SENT ] != PROF_NONE && !g_prof_logged )
+  {
+    /* NOTE: instead of the totals, both do not fit into the debug output
+      buffer at once */
+    g_prof_logged = 1;
+    prof_bootlog();
+  }
+  else
+  {
+    DEBUG_OUT( 'P' );
+    prof_hex( g_prof_irqtotal );
+    prof_hex( g_prof_total - g_prof_scans * g_prof_min );
+    prof_hex( g_prof_service );
+    DEBUG_OUT( '\r' );
+    DEBUG_OUT( '\n' );
+  }
+
+  g_prof_scans    = 0;
+  g_prof_total    = 0;
+  g_prof_irqtotal = 0;
+  g_prof_service  = 0;
+}
+
+/* write a 32 bit hex number */
+static void prof_hex( unsigned long value )
+{
+  unsigned char i;
+  unsigned char digit;
+
+  for ( i = 0; i < 8; ++i )
+  {
+    digit = ( value >> 28 ) & 0x0F;
+    DEBUG_OUT( digit < 10 ? '0' + digit : 'A' - 10 + digit );
+    value <<= 4;
+  }
+}
+
+/* write the boot log */
+static void prof_bootlog( void )
+{
+  static const rom char names[] = "USRACF";  /* enum profile_phase */
+  unsigned char i;
+
+  DEBUG_OUT( 'B' );
+  for ( i = 0; i < BOOT_PHASES; ++i )
+  {
+    DEBUG_OUT( ' ' );
+    DEBUG_OUT( names[i] );
+    if ( g_prof_boot[i] == PROF_NONE )
+    {
+      DEBUG_OUT( '-' );
+    }
+    else
+    {
+      prof_dec( g_prof_boot[i] );
+    }
+  }
+  DEBUG_OUT( '\r' );
+  DEBUG_OUT( '\n' );
+}
+
+/* write a decimal number without leading zeros */
+static void prof_dec( unsigned short value )
+{
+  unsigned short div;
+
+  div = 10000;
+  while ( div > 1U && value < div )
+  {
+    div /= 10;
+  }
+  while ( div != 0U )
+  {
+    DEBUG_OUT( '0' + value / div );
+    value %= div;
+    div /= 10;
+  }
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Interrupt cost profiling
+
+  Timer1 runs free at the instruction clock. Each SNES scan is timed, and
+  the time beyond the fastest scan is what interrupts took from it,
+  including entry and exit. Once per second the totals are written to the
+  debug output (enable DEBUG in debug.h):
+
+    P<interrupts><cycles taken by interrupts><cycles in polled service>
+
+  as 8 digit hex numbers. Polled service time only accumulates in the
+  USB_POLLED build (see usb.h). With SNES_TIMED (see snes.h) scans take a
+  fixed time and are not profiled.
+
+  Enumeration is timed once, when the host sets the configuration:
+
+    E<ms since timebase_init()><cycles in usb_service()>
+
+  The boot log is written once the first report has been sent, with the
+  ms since timebase_init() (right after reset) at which each phase was
+  first reached, in decimal:
+
+    B U<attached> S<first trusted scan, queued as the first report>
+      R<bus reset> A<address> C<configured> F<first report sent>
+
+  Before main() the reset time-out of the configuration words has passed
+  already (see main.c). */
+
+#undef PROFILE
+
+#ifdef PROFILE
+  #define PROFILE_INIT()        profile_init()
+  #define PROFILE_BEGIN()       profile_begin()
+  #define PROFILE_END_SCAN()    profile_end_scan()
+  #define PROFILE_END_SERVICE() profile_end_service()
+  #define PROFILE_END_EP0()     profile_end_ep0()
+  #define PROFILE_CONFIGURED()  profile_configured()
+  #define PROFILE_BOOT( phase ) profile_boot( phase )
+  #define PROFILE_POLL()        profile_poll()
+  #define PROFILE_IRQ()         ++g_profile_irqs
+#else
+  #define PROFILE_INIT()
+  #define PROFILE_BEGIN()
+  #define PROFILE_END_SCAN()
+  #define PROFILE_END_SERVICE()
+  #define PROFILE_END_EP0()
+  #define PROFILE_CONFIGURED()
+  #define PROFILE_BOOT( phase )
+  #define PROFILE_POLL()
+  #define PROFILE_IRQ()
+#endif
+
+/* boot phases, in the order of the boot log */
+enum profile_phase
+{
+  BOOT_ATTACHED,
+  BOOT_SETTLED,
+  BOOT_RESET,
+  BOOT_ADDRESS,
+  BOOT_CONFIGURED,
+  BOOT_SENT,
+  BOOT_PHASES
+};
+
+void profile_init( void );
+void profile_begin( void );
+void profile_end_scan( void );
+void profile_end_service( void );
+void profile_end_ep0( void );
+void profile_configured( void );
+void profile_boot( unsigned char phase );
+void profile_poll( void );
+
+/* interrupts since profile_begin() */
+/* NOTE: 8 bit, so the fast interrupt path can count without temporaries */
+extern volatile unsigned char g_profile_irqs;
+
+#endif  /* defined PROFILE_H */
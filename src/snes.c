@@ -0,0 +1,246 @@
+/* snes.c */
+
+#include <p18cxxx.h>
+#include "snes.h"
+#include "usb.h"
+#include "config.h"
+
+/* inner delay loop passes per us: one pass of the outer loop takes
+  4 + 3 * SNES_DELAY_LOOPS cycles, at least 1us */
+#if CONFIG_MIPS >= 5
+#define SNES_DELAY_LOOPS  ( ( CONFIG_MIPS - 2 ) / 3 )
+#else
+#define SNES_DELAY_LOOPS  1
+#endif
+
+/* delay loop counters (see delay()) */
+#pragma udata access snes_access
+static near unsigned char g_delay_loops;  /* inner loop passes per us */
+#if defined( __18CXX )
+static near unsigned char g_delay_us;
+static near unsigned char g_delay_count;
+#endif
+#pragma udata
+
+#ifdef SNES_TIMED
+/* timed scan, shared with snes_ccpint() */
+#pragma udata access snes_timed
+static near unsigned char           g_snes_step;     /* edges done */
+static near unsigned short          g_snes_shift;    /* buttons so far */
+static near unsigned short          g_snes_compare;  /* next edge [Timer1] */
+static near unsigned short          g_snes_period;   /* SNES_STEP_US */
+static near volatile unsigned short g_snes_buttons;  /* last result */
+static near volatile unsigned char  g_snes_busy;
+static near volatile unsigned char  g_snes_done;
+#pragma udata
+#endif
+
+/* local prototypes */
+static void delay( unsigned char timeus );
+
+#pragma code
+
+
+/* initialization of SNES interface */
+void snes_init( void )
+{
+  g_delay_loops = SNES_DELAY_LOOPS;
+  
+  LATA  |= SNES_VCC;    /* RA4 (supply) to high */
+  LATA  |= SNES_CLOCK;  /* RA1 (clock) to high */
+  TRISA |= SNES_DATA;   /* RA3 (data) to input */
+
+#ifdef SNES_TIMED
+  /* Timer1 runs free at the instruction clock (as for profile.c), CCP1
+    compares against it */
+  g_snes_period = SNES_STEP_US * CONFIG_MIPS;
+  T1CON = 0x81;   /* 16 bit read/write, internal clock, no prescaler, on */
+  CCP1CON = 0x00;
+#endif
+}
+
+/* read all buttons */
+unsigned short snes_read( void )
+{
+  unsigned char  but;         /* current button number */
+  unsigned short buttons;     /* bit array of button states */
+
+  /* trigger controller to latch status of all buttons */
+  /* send positive pulse on LAT, two steps (12us) */
+  LATA |= SNES_LATCH;
+  delay( 2 * SNES_STEP_US );
+  LATA &= ~SNES_LATCH;
+  
+  /* wait a step (6us) for controller to drive first button state */
+  delay( SNES_STEP_US );
+  
+  /* go over all 16 buttons */
+  buttons = 0;
+  for ( but = 0; but < 16U; ++but )
+  {
+    /* issue falling edge on CLK */
+    LATA &= ~SNES_CLOCK;
+    
+    /* sample button state from DAT */
+    if ( ( PORTA & SNES_DATA ) == 0U )
+    {
+      /* button is pressed */
+      buttons |= (unsigned short)1 << but;
+    }
+    
+    /* wait a step */
+    delay( SNES_STEP_US );
+    
+    /* issue rising edge on CLK, controller will drive next bit */
+    LATA |= SNES_CLOCK;
+
+    /* wait a step for controller to drive next button state */
+    delay( SNES_STEP_US );
+    
+#ifdef USB_POLLED
+    /* service USB between two bits, the controller does not mind a
+      longer clock high phase */
+    usb_poll();
+#endif
+  }
+
+  return buttons;
+}
+
+#ifdef SNES_TIMED
+/* start a timed scan */
+unsigned char snes_start( void )
+{
+  if ( g_snes_busy )
+  {
+    return 0;
+  }
+  g_snes_busy  = 1;
+  g_snes_step  = 0;
+  g_snes_shift = 0;
+
+  /* latch pulse of two steps, snes_ccpint() does the rest */
+  LATA |= SNES_LATCH;
+  g_snes_compare  = TMR1L;  /* reading TMR1L latches TMR1H */
+  g_snes_compare |= (unsigned short)TMR1H << 8;
+  g_snes_compare += 2 * g_snes_period;
+  CCPR1H = g_snes_compare >> 8;
+  CCPR1L = g_snes_compare & 0xFF;
+  PIR1 &= ~0x04;    /* clear CCP1IF */
+  CCP1CON = 0x0A;   /* compare mode, interrupt only (pin RC2 unaffected) */
+  PIE1 |= 0x04;     /* CCP1IE */
+  return 1;
+}
+
+/* result of a timed scan */
+unsigned char snes_poll( unsigned short * buttons )
+{
+  if ( !g_snes_done )
+  {
+#if !defined( __18CXX )
+    /* host simulator build: the main loop takes no virtual time, so it
+      has to wait here for the scan to proceed */
+    if ( g_snes_busy )
+    {
+      sim_delay_us( 1 );
+    }
+#endif
+    return 0;
+  }
+  g_snes_done = 0;
+  *buttons = g_snes_buttons;
+  return 1;
+}
+
+/* next edge of the timed scan: latch falls (step 0), then clock falls
+  and the button is sampled (odd steps) or clock rises (even steps) */
+/* NOTE: high priority, nothing else can delay it; only WREG, STATUS and
+  BSR (shadow registers) are saved */
+#pragma interrupt snes_ccpint nosave=section(".tmpdata"),section("MATH_DATA"),PROD,TBLPTR,TABLAT,PCLATH,PCLATU,FSR0
+void snes_ccpint( void )
+{
+  /* the edge first, it follows the compare match by the interrupt latency
+    only */
+  if ( g_snes_step == 0U )
+  {
+    LATA &= ~SNES_LATCH;
+  }
+  else if ( g_snes_step & 1U )
+  {
+    LATA &= ~SNES_CLOCK;
+    g_snes_shift >>= 1;
+    if ( ( PORTA & SNES_DATA ) == 0U )
+    {
+      /* button is pressed, the first one ends up in bit 0 */
+      g_snes_shift |= 0x8000;
+    }
+  }
+  else
+  {
+    LATA |= SNES_CLOCK;
+  }
+
+  if ( ++g_snes_step == 33U )
+  {
+    /* the 16th rising clock edge ends the scan */
+    CCP1CON = 0x00;
+    PIE1 &= ~0x04;  /* CCP1IE */
+    g_snes_buttons = g_snes_shift;
+    g_snes_done = 1;
+    g_snes_busy = 0;
+  }
+  else
+  {
+    /* relative to the last match, so interrupt latency does not add up */
+    g_snes_compare += g_snes_period;
+    CCPR1H = g_snes_compare >> 8;
+    CCPR1L = g_snes_compare & 0xFF;
+  }
+  PIR1 &= ~0x04;    /* clear CCP1IF */
+}
+#endif
+
+/* interpret sampled button states */
+void snes_tohid( unsigned short buttons, unsigned char * report )
+{
+  report[0] = 0;
+  report[1] = 0;
+  
+  if ( buttons & BUT_LEFT )   report[0] |= 0x03;
+  if ( buttons & BUT_RIGHT )  report[0] |= 0x01;
+  if ( buttons & BUT_DOWN )   report[0] |= 0x04;
+  if ( buttons & BUT_UP )     report[0] |= 0x0C;
+  if ( buttons & BUT_B )      report[1] |= 0x01;
+  if ( buttons & BUT_Y )      report[1] |= 0x02;
+  if ( buttons & BUT_A )      report[1] |= 0x04;
+  if ( buttons & BUT_X )      report[1] |= 0x08;
+  if ( buttons & BUT_L )      report[1] |= 0x10;
+  if ( buttons & BUT_R )      report[1] |= 0x20;
+  if ( buttons & BUT_START )  report[1] |= 0x40;
+  if ( buttons & BUT_SELECT ) report[1] |= 0x80;
+}
+
+
+/* wait at least timeus microseconds (1..255) at the CPU clock of the
+  build */
+static void delay( unsigned char timeus )
+{
+#if defined( __18CXX )
+  _asm
+    MOVLW -2  /* operate on first function parameter */
+    MOVF PLUSW2, 0, 0
+    MOVWF g_delay_us, 0
+    outer:
+      MOVF g_delay_loops, 0, 0
+      MOVWF g_delay_count, 0
+    inner:
+      DECFSZ g_delay_count, 1, 0
+      BRA inner
+      DECFSZ g_delay_us, 1, 0
+      BRA outer
+  _endasm
+#else
+  /* host simulator build (see ../host/sim) */
+  sim_delay_us( timeus );
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef SNES_H
+#define SNES_H
+
+#include "config.h"
+
+/* SNES_TIMED: Timer1 and CCP1 in compare mode time the latch and clock
+  edges, which the high priority interrupt snes_ccpint() writes and samples
+  every SNES_STEP_US; all other interrupts run at low priority. The main
+  loop starts scans and picks up their results without waiting, and the
+  waveform only varies by the interrupt latency of a few cycles. Without
+  it snes_read() generates the waveform with delay loops, and interrupts
+  stretch it. */
+#undef SNES_TIMED
+
+/* time between two edges of a scan [us], the latch pulse takes two */
+#define SNES_STEP_US  CONFIG_SNES_STEP_US
+
+/* time the controller needs after power-up [ms], scans before are not
+  trusted (the bootloader waits some ms before it reads the pad, too) */
+#define SNES_SETTLE_MS  CONFIG_SNES_SETTLE_MS
+
+/* pins on PortA */
+enum snes_pins
+{
+  SNES_LATCH = 0x04,
+  SNES_CLOCK = 0x20,
+  SNES_DATA  = 0x08,
+  SNES_VCC   = 0x10
+};
+
+/* SNES buttons */
+enum snes_buttons
+{
+  BUT_B      = 0x0001,
+  BUT_Y      = 0x0002,
+  BUT_SELECT = 0x0004,
+  BUT_START  = 0x0008,
+  BUT_UP     = 0x0010,
+  BUT_DOWN   = 0x0020,
+  BUT_LEFT   = 0x0040,
+  BUT_RIGHT  = 0x0080,
+  BUT_A      = 0x0100,
+  BUT_X      = 0x0200,
+  BUT_L      = 0x0400,
+  BUT_R      = 0x0800
+};
+
+/* powers the controller and configures the interface pins */
+void snes_init( void );
+
+/* latches the controller and shifts in all 16 buttons, returns bit array
+  of pressed buttons */
+unsigned short snes_read( void );
+
+/* SNES_TIMED: starts a scan, returns whether it did (nothing happens while
+  one is running) */
+unsigned char snes_start( void );
+
+/* SNES_TIMED: returns whether a scan finished since the last call, and
+  stores its bit array of pressed buttons */
+unsigned char snes_poll( unsigned short * buttons );
+
+/* SNES_TIMED: CCP1 compare interrupt, the next edge of the scan */
+void snes_ccpint( void );
+
+/* translates button states into the HID report (axes, buttons) */
+void snes_tohid( unsigned short buttons, unsigned char * report );
+
+#endif  /* defined SNES_H */
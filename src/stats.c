@@ -0,0 +1,48 @@
+/* stats.c */
+
+#include <p18cxxx.h>
+#include "stats.h"
+
+/* static data */
+volatile unsigned short g_stats[ STATS_COUNT ];
+
+#pragma code
+
+
+/* count USB error flags */
+void stats_usberror( unsigned char ueir )
+{
+  unsigned char i;
+
+  for ( i = 0; i < 5U; ++i )
+  {
+    if ( ueir & ( 1 << i ) )
+    {
+      STATS_INC( STATS_PID + i );
+    }
+  }
+  if ( ueir & 0x80 )
+  {
+    STATS_INC( STATS_BTS );
+  }
+}
+
+/* fill in the feature report */
+void stats_getreport( unsigned char * report )
+{
+  unsigned short value;
+  unsigned char  i;
+
+  for ( i = 0; i < STATS_COUNT; ++i )
+  {
+    /* NOTE: the ISR may count between the two bytes, read until two values
+      are identical (as timebase_now()) */
+    do
+    {
+      value = g_stats[i];
+    }
+    while ( value != g_stats[i] );
+    report[ 2 * i ] = value & 0xFF;
+    report[ 2 * i + 1 ] = value >> 8;
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* USB link statistics
+
+  Counts events that delay or lose reports. The counters are served as
+  feature report STATS_REPORT_ID. Each is 16 bits, little endian, and
+  wraps around, so the host takes differences:
+
+    byte 0..1    bus resets
+    byte 2..3    STALL handshakes sent
+    byte 4..5    PID check failures
+    byte 6..7    CRC5 errors (token packets)
+    byte 8..9    CRC16 errors (data packets)
+    byte 10..11  data field size errors
+    byte 12..13  bus turnaround timeouts (no handshake from the host)
+    byte 14..15  bit stuff errors
+    byte 16..17  reports sent (EP1 IN transactions acknowledged)
+    byte 18..19  reports coalesced (replaced before they were sent) */
+
+/* counters, in report order */
+enum stats_counter
+{
+  STATS_RESET,
+  STATS_STALL,
+  STATS_PID,      /* STATS_PID..STATS_BTO in the order of UEIR bits 0..4 */
+  STATS_CRC5,
+  STATS_CRC16,
+  STATS_DFN8,
+  STATS_BTO,
+  STATS_BTS,      /* UEIR bit 7 */
+  STATS_SENT,
+  STATS_COALESCED,
+  STATS_COUNT
+};
+
+#define STATS_REPORT_ID    3
+#define STATS_REPORT_SIZE  ( 2 * STATS_COUNT )  /* without report ID */
+
+/* counts an event (a macro, so the fast interrupt path can use it) */
+#define STATS_INC( counter )  ( ++g_stats[ counter ] )
+
+/* counts the error flags of UEIR (called from USB interrupt) */
+void stats_usberror( unsigned char ueir );
+
+/* fills in the feature report (called from usb_service()) */
+void stats_getreport( unsigned char * report );
+
+extern volatile unsigned short g_stats[ STATS_COUNT ];
+
+#endif  /* defined STATS_H */
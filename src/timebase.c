@@ -0,0 +1,251 @@
+/* timebase.c */
+
+#include <p18cxxx.h>
+#include "timebase.h"
+#include "config.h"
+
+/* Timer0: 16 bit, internal clock, no prescaler */
+/* 1ms takes 1000 * CONFIG_MIPS counts (6000 at 24MHz, 12000 at 48MHz) */
+#define TB_TMR0_CON     0x88
+#define TB_TMR0_RELOAD  (unsigned short)( 0U - 1000U * CONFIG_MIPS )
+/* counts lost while reloading the timer in timebase_timerint() */
+#define TB_TMR0_FIXUP   4U
+
+/* size of the timer wheel (must be a power of 2) */
+#define TB_WHEEL_BITS   4
+#define TB_WHEEL_SLOTS  ( 1 << TB_WHEEL_BITS )
+#define TB_WHEEL_MASK   ( TB_WHEEL_SLOTS - 1 )
+
+/* source of the millisecond tick */
+enum tb_source
+{
+  TB_SRC_TIMER,   /* Timer0 interrupt (bus suspended or low-speed) */
+  TB_SRC_SOF      /* USB start-of-frame token */
+};
+
+/* static data */
+static volatile unsigned short g_tb_ticks;  /* millisecond tick counter */
+static volatile enum tb_source g_tb_src;    /* current tick source */
+static unsigned short    g_tb_wheeltime;    /* tick the wheel has reached */
+static struct tb_timer * g_tb_wheel[ TB_WHEEL_SLOTS ];  /* timer lists */
+static struct tb_timer * g_tb_cursor;       /* next timer to be examined */
+
+/* local prototypes */
+static void tb_timer_start( void );
+static void tb_insert( struct tb_timer * timer, unsigned short delay );
+static void tb_unlink( struct tb_timer * timer );
+
+#pragma code
+
+
+/* initialize timebase */
+void timebase_init( void )
+{
+  g_tb_ticks     = 0;
+  g_tb_wheeltime = 0;
+  g_tb_cursor    = 0;
+
+  /* until the first SOF token arrives we count Timer0 periods */
+  /* NOTE: a low-speed bus carries no SOF tokens, only keep-alives, so on
+    low-speed the Timer0 tick is the only tick source */
+  tb_timer_start();
+}
+
+/* called whenever a SOF token was received, once per millisecond */
+void timebase_sof( void )
+{
+  if ( g_tb_src == TB_SRC_TIMER )
+  {
+    /* bus is running -> take frame timing from now on */
+    INTCON &= ~0x24;  /* disable TMR0 interrupt, clear its flag */
+    T0CON = 0x00;     /* stop Timer0 */
+    g_tb_src = TB_SRC_SOF;
+  }
+  ++g_tb_ticks;
+}
+
+/* called when the bus is suspended */
+void timebase_suspend( void )
+{
+  if ( g_tb_src == TB_SRC_SOF )
+  {
+    /* no more SOF tokens -> continue counting with Timer0 */
+    tb_timer_start();
+  }
+}
+
+/* called on Timer0 overflow */
+void timebase_timerint( void )
+{
+  unsigned short count;
+
+  /* advance the counter by one period relative to its current value,
+    so interrupt latency does not accumulate */
+  count  = TMR0L;   /* reading TMR0L latches TMR0H */
+  count |= (unsigned short)TMR0H << 8;
+  count += TB_TMR0_RELOAD + TB_TMR0_FIXUP;
+  TMR0H = count >> 8;
+  TMR0L = count & 0xFF;   /* writing TMR0L also writes TMR0H */
+
+  INTCON &= ~0x04;  /* clear TMR0 interrupt flag */
+  ++g_tb_ticks;
+}
+
+/* returns the millisecond tick counter */
+unsigned short timebase_now( void )
+{
+  unsigned short now;
+
+  /* NOTE: the counter is incremented by the ISR and may change between
+    reading its two bytes, so we read until two values are identical
+    instead of disabling interrupts */
+  do
+  {
+    now = g_tb_ticks;
+  }
+  while ( now != g_tb_ticks );
+
+  return now;
+}
+
+/* returns the current USB frame number */
+unsigned short timebase_frame( void )
+{
+  unsigned char hi;
+  unsigned char lo;
+
+  if ( g_tb_src == TB_SRC_SOF )
+  {
+    /* frame number register, re-read if a SOF came in between */
+    do
+    {
+      hi = UFRMH;
+      lo = UFRML;
+    }
+    while ( hi != UFRMH );
+    return ( (unsigned short)( hi & 0x07 ) << 8 ) | lo;
+  }
+
+  /* no frames on the bus -> use our own millisecond count instead */
+  return timebase_now() & 0x07FF;
+}
+
+/* process the timer wheel up to the current tick */
+void timebase_poll( void )
+{
+  unsigned short    now;
+  struct tb_timer * timer;
+
+  now = timebase_now();
+  while ( g_tb_wheeltime != now )
+  {
+    ++g_tb_wheeltime;
+    timer = g_tb_wheel[ g_tb_wheeltime & TB_WHEEL_MASK ];
+    while ( timer != 0 )
+    {
+      /* NOTE: the callback may stop any timer, tb_unlink() keeps
+        g_tb_cursor valid in that case */
+      g_tb_cursor = timer->next;
+      if ( timer->rounds != 0U )
+      {
+        /* expires in a later turn of the wheel */
+        --timer->rounds;
+      }
+      else
+      {
+        /* timer expired */
+        tb_unlink( timer );
+        if ( timer->period != 0U )
+        {
+          tb_insert( timer, timer->period );
+        }
+        timer->callback( timer );
+      }
+      timer = g_tb_cursor;
+    }
+  }
+}
+
+/* start a timer */
+void timebase_start( struct tb_timer * timer,
+  void (*callback)( struct tb_timer * timer ),
+  unsigned short delay, unsigned short period )
+{
+  if ( timer->slot != 0U )
+  {
+    tb_unlink( timer );
+  }
+  timer->callback = callback;
+  timer->period = period;
+  tb_insert( timer, delay );
+}
+
+/* stop a timer */
+void timebase_stop( struct tb_timer * timer )
+{
+  if ( timer->slot != 0U )
+  {
+    tb_unlink( timer );
+  }
+}
+
+
+/* start counting milliseconds with Timer0 */
+static void tb_timer_start( void )
+{
+  g_tb_src = TB_SRC_TIMER;
+  T0CON = TB_TMR0_CON & ~0x80;   /* configure, but keep stopped */
+  TMR0H = TB_TMR0_RELOAD >> 8;
+  TMR0L = TB_TMR0_RELOAD & 0xFF;
+  INTCON &= ~0x04;  /* clear TMR0 interrupt flag */
+  INTCON |= 0x20;   /* enable TMR0 interrupt */
+  T0CON = TB_TMR0_CON;
+}
+
+/* put timer into the wheel slot of its expiry tick, O(1) */
+static void tb_insert( struct tb_timer * timer, unsigned short delay )
+{
+  unsigned char slot;
+
+  if ( delay == 0U )
+  {
+    delay = 1;  /* earliest possible expiry is the next tick */
+  }
+  slot = ( g_tb_wheeltime + delay ) & TB_WHEEL_MASK;
+  timer->rounds = ( delay - 1 ) >> TB_WHEEL_BITS;
+  timer->slot = slot + 1;
+
+  /* insert at head of slot list */
+  timer->prev = 0;
+  timer->next = g_tb_wheel[ slot ];
+  if ( timer->next != 0 )
+  {
+    timer->next->prev = timer;
+  }
+  g_tb_wheel[ slot ] = timer;
+}
+
+/* remove timer from its wheel slot, O(1) */
+static void tb_unlink( struct tb_timer * timer )
+{
+  if ( timer == g_tb_cursor )
+  {
+    /* timer poll loop would continue with this timer -> skip it */
+    g_tb_cursor = timer->next;
+  }
+  if ( timer->prev != 0 )
+  {
+    timer->prev->next = timer->next;
+  }
+  else
+  {
+    g_tb_wheel[ timer->slot - 1 ] = timer->next;
+  }
+  if ( timer->next != 0 )
+  {
+    timer->next->prev = timer->prev;
+  }
+  timer->next = 0;
+  timer->prev = 0;
+  timer->slot = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+/* software timer, driven by the timer wheel in timebase_poll() */
+/* NOTE: the structure is owned by the timebase while the timer is running,
+  the caller must only provide the memory (static zero-initialization is
+  sufficient, a zeroed timer is a stopped timer) */
+struct tb_timer
+{
+  struct tb_timer * next;    /* next timer in same wheel slot */
+  struct tb_timer * prev;    /* previous timer in same wheel slot */
+  void (*callback)( struct tb_timer * timer );  /* called on expiry */
+  unsigned short    period;  /* reload value [ms], 0 for one-shot timers */
+  unsigned short    rounds;  /* full wheel turns left until expiry */
+  unsigned char     slot;    /* wheel slot + 1, 0 if timer is stopped */
+};
+
+/* initializes the timebase, hardware timer is the initial tick source */
+void timebase_init( void );
+
+/* a start-of-frame token was received (called from USB interrupt) */
+void timebase_sof( void );
+
+/* bus is suspended, no more SOF tokens (called from USB interrupt) */
+void timebase_suspend( void );
+
+/* a Timer0 interrupt occurred */
+void timebase_timerint( void );
+
+/* returns the millisecond tick counter (wraps around after 65.5 s) */
+unsigned short timebase_now( void );
+
+/* returns the current 11-bit USB frame number */
+unsigned short timebase_frame( void );
+
+/* runs expired timer callbacks, to be called from the main loop */
+void timebase_poll( void );
+
+/* starts (or restarts) a timer expiring after delay ms, then every
+  period ms (period = 0 for a one-shot timer) */
+void timebase_start( struct tb_timer * timer,
+  void (*callback)( struct tb_timer * timer ),
+  unsigned short delay, unsigned short period );
+
+/* stops a timer, nothing happens if it is not running */
+void timebase_stop( struct tb_timer * timer );
+
+#endif  /* defined TIMEBASE_H */
\ No newline at end of file
@@ -1,656 +1,1641 @@
-/* usb.c */
-
-#include <p18cxxx.h>
-#include <string.h>   /* for memcpy() */
-#include "debug.h"
-
-/* bit names of USB registers */
-/* BDnSTAT register */
-#define _UOWN     0x80
-#define _DTS      0x40
-#define _DTSEN    0x08
-#define _BSTALL   0x04
-/* UCON register */
-#define _PPBRST   0x40
-#define _SE0      0x20
-#define _PKTDIS   0x10
-#define _USBEN    0x08
-#define _RESUME   0x04
-#define _SUSPND   0x02
-/* USTAT register */
-#define _DIR      0x04
-/* UEPn register */
-#define _EPHSHK   0x10
-#define _EPCONDIS 0x08
-#define _EPOUTEN  0x04
-#define _EPINEN   0x02
-#define _EPSTALL  0x01
-/* UIR and UIE register */
-#define _SOFI     0x40
-#define _STALLI   0x20
-#define _IDLEI    0x10
-#define _TRNI     0x08
-#define _ACTVI    0x04
-#define _UERRI    0x02
-#define _URSTI    0x01
-
-/* PID values in BDnSTAT register */
-#define PID_OUT   (unsigned char)(0x1 << 2)
-#define PID_IN    (unsigned char)(0x9 << 2)
-#define PID_SETUP (unsigned char)(0xD << 2)
-
-/* USB request numbers */
-enum req_num
-{
-  REQ_GET_STATUS        = 0x00,
-  REQ_CLEAR_FEATURE     = 0x01,
-  REQ_SET_FEATURE       = 0x03,
-  REQ_SET_ADDRESS       = 0x05,
-  REQ_GET_DESCRIPTOR    = 0x06,
-  REQ_SET_DESCRIPTOR    = 0x07,
-  REQ_GET_CONFIGURATION = 0x08,
-  REQ_SET_CONFIGURATION = 0x09,
-  REQ_GET_INTERFACE     = 0x0A,
-  REQ_SET_INTERFACE     = 0x0B,
-  REQ_SYNC_FRAME        = 0x0C,
-  /* HID specific (see explanation below) */
-  REQ_GET_REPORT        = 0x81,
-  REQ_GET_IDLE          = 0x82,
-  REQ_GET_PROTOCOL      = 0x83,
-  REQ_SET_REPORT        = 0x89,
-  REQ_SET_IDLE          = 0x8A,
-  REQ_SET_PROTOCOL      = 0x8B
-};
-
-/* USB descriptor values */
-enum desc_num
-{
-  /* standard descriptors */
-  DESC_DEVICE        = 0x01,
-  DESC_CONFIGURATION = 0x02,
-  DESC_STRING        = 0x03,
-  DESC_INTERFACE     = 0x04,
-  DESC_ENDPOINT      = 0x05,
-  DESC_DEVICE_QUALIFIER          = 0x06,
-  DESC_OTHER_SPEED_CONFIGURATION = 0x07,
-  DESC_INTERFACE_POWER           = 0x08,
-  /* class descriptors */
-  DESC_HID           = 0x21,
-  DESC_HUB           = 0x29,
-  DESC_REPORT        = 0x22,
-  DESC_PHYSICAL      = 0x23
-};
-
-/* type of transfer currently performed */
-enum trf_type
-{
-  TRF_NONE,
-  TRF_IN,
-  TRF_OUT
-};
-
-/* for specifying if a transfer is in/from RAM or ROM */
-enum trf_mem
-{
-  TRF_RAM,
-  TRF_ROM
-};
-
-/* setup stage of a control transfer */
-struct ctrltrf_setup
-{
-  unsigned char  bmRequestType;
-  unsigned char  bRequest;
-  unsigned short wValue;
-  unsigned short wIndex;
-  unsigned short wLength;
-};
-
-/* one entry in the buffer descriptor table */
-struct bd_entry
-{
-  unsigned char  BDSTAT;  /* BD Status register */
-  unsigned char  BDCNT;   /* BD Byte Count register */
-  unsigned short BDADR;   /* BD Address register */
-};
-
-static const rom unsigned char report_desc[60];  /* forward declaration */
-
- 
-static const rom unsigned char dev_desc[18] =
-{
-  sizeof( dev_desc ), /* bLength: descriptor size in bytes */
-  DESC_DEVICE,        /* bDescriptorType */
-  0x00, 0x02,         /* bcdUSB: USB spec release number */
-  0x00,               /* bDeviceClass: class code */
-  0x00,               /* bDeviceSubclass: subclass code */
-  0x00,               /* bDeviceProtocol: protocol code */
-  0x08,               /* bMaxPacketSize: max packet size for EP0 */
-  0xD8, 0x04,         /* idVendor: vendor ID (0x04D8=Microchip) */
-  0x01, 0x00,         /* idProduct: product ID */
-  0x01, 0x00,         /* bcdDevice: device release number */
-  0x01,               /* iManufacturer: index of string desc. */
-  0x02,               /* iProduct: index of string desc. */
-  0x03,               /* iSerialNumber: index of string desc. */
-  0x01                /* bNumConfiguration: number of possible configs */
-};
-
-static const rom unsigned char cfg_desc[34] =
-{
-  /* configuration descriptor */
-  9,                  /* bLength: descriptor size in bytes */
-  DESC_CONFIGURATION, /* bDescriptorType */
-  sizeof( cfg_desc ), 0, /* wTotalLength: size of all data for this config */
-  1,                  /* bNumInterfaces: number of interfaces of config */
-  1,                  /* bConfigurationValue: identifier for this config */
-  0,                  /* iConfiguration: index of string descriptor */
-  0,                  /* bmAttributes: self/bus powered and remote wakeup */
-  15,                 /* MaxPower: bus power required [2*mA] */
-  /* interface descriptor */
-  9,                  /* bLength: descriptor size in bytes */
-  DESC_INTERFACE,     /* bDescriptorType */
-  0,                  /* bInterfaceNumber: identifier for this interface */
-  0,                  /* bAlternateSetting: disting. mutually exclusive IFs */
-  1,                  /* bNumEndpoints: endpoints in addition to EP0 */
-  0x03,               /* bInterfaceClass */
-  0,                  /* bInterfaceSubclass */
-  0,                  /* bInterfaceProtocol */
-  0,                  /* iInterface: index of string descriptor */
-  /* class descriptor */
-  9,                  /* bLength: descriptor size in bytes */
-  DESC_HID,           /* bDescriptorType */
-  0x10, 0x01,         /* bcdHID: HID spec release number */
-  0,                  /* bCountryCode: indentifies country for localized HW */
-  1,                  /* bNumDescriptors: number of subordinate class desc. */
-  DESC_REPORT,        /* bDescriptorType */
-  sizeof( report_desc ), 0x00, /* wDescriptorLength: length of report desc. */
-  /* endpoint descriptor */
-  7,                  /* bLength: descriptor size in bytes */
-  DESC_ENDPOINT,      /* bDescriptorType */
-  0x81,               /* bEndpointAddress: endpoint number and direction */
-  0x03,               /* bmAttributes: type of supported transfer */
-  0x08, 0x00,         /* wMaxPacketSize: max. packet size supported */
-  0x0A                /* bInterval: maximum latency for polling */  
-};
-
-static const rom unsigned char report_desc[60] =
-{
-    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
-    0x09, 0x05,                    // USAGE (Game Pad)
-    0xa1, 0x01,                    //   COLLECTION (Application)
-    0x09, 0x01,                    //   USAGE (Pointer)
-    0xa1, 0x00,                    //   COLLECTION (Physical)
-    0x09, 0x30,                    //     USAGE (X)
-    0x09, 0x31,                    //     USAGE (Y)
-    0x15, 0xff,                    //     LOGICAL_MINIMUM (-1)
-    0x25, 0x01,                    //     LOGICAL_MAXIMUM (1)
-    0x75, 0x02,                    //     REPORT_SIZE (2)
-    0x95, 0x02,                    //     REPORT_COUNT (2)
-    0x81, 0x02,                    //     INPUT (Data,Var,Abs)
-    0xc0,                          // END_COLLECTION
-    0x75, 0x01,                    //   REPORT_SIZE (1)
-    0x95, 0x04,                    //   REPORT_COUNT (4)
-    0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
-    0x05, 0x09,                    //   USAGE_PAGE (Button)
-    0x19, 0x01,                    //   USAGE_MINIMUM (Button 1)
-    0x29, 0x06,                    //   USAGE_MAXIMUM (Button 6)
-    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-    0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
-    0x75, 0x01,                    //   REPORT_SIZE (1)
-    0x95, 0x06,                    //   REPORT_COUNT (6)
-    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
-    0x05, 0x01,                    //   USAGE_PAGE (Generic Desktop)
-    0x09, 0x3d,                    //   USAGE (Start)
-    0x09, 0x3e,                    //   USAGE (akeup)
-    0x75, 0x01,                    //   REPORT_SIZE (1)
-    0x95, 0x02,                    //   REPORT_COUNT (2)
-    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
-    0xc0                           // END_COLLECTION
-};
-
-static const rom unsigned char string_desc_lang[4] =
-{
-  sizeof( string_desc_lang ),  /* bLength */
-  DESC_STRING,                 /* bDescriptorType */
-  0x09, 0x04                   /* wLANGID */
-};
-
-static const rom unsigned char string_desc_man[38] =
-{
-  sizeof( string_desc_man ),
-  DESC_STRING,
-  'C',0,'h',0,'r',0,'i',0,'s',0,'t',0,'i',0,'a',0,'n',0,' ',0,
-  'E',0,'t',0,'t',0,'i',0,'n',0,'g',0,'e',0,'r',0
-};
-
-static const rom unsigned char string_desc_prod[52] =
-{
-  sizeof( string_desc_prod ),
-  DESC_STRING,
-  'S',0,'u',0,'p',0,'e',0,'r',0,' ',0,'N',0,'i',0,'n',0,'t',0,'e',0,'n',0,
-  'd',0,'o',0,' ',0,'C',0,'o',0,'n',0,'t',0,'r',0,'o',0,'l',0,'l',0,'e',0,'r',0
-};
-
-static const rom unsigned char string_desc_serial[10] =
-{
-  sizeof( string_desc_serial ),
-  DESC_STRING,
-  '0',0,'0',0,'0',0,'1',0
-};
-
-
-/* USB Memory */
-#pragma udata usb_bdt = 0x400
-static volatile struct bd_entry BD0OUT;  /* buffer descriptor table */
-static volatile struct bd_entry BD0IN;
-static volatile struct bd_entry BD1OUT;
-static volatile struct bd_entry BD1IN;
-#pragma udata usb_mem = 0x480
-static volatile unsigned char   EP0RXBUF[ 8 ];  /* 8 byte buffer */
-static volatile unsigned char   EP0TXBUF[ 8 ];  /* 8 byte buffer */
-static volatile unsigned char   EP1RXBUF[ 8 ];  /* 8 byte buffer */
-static volatile unsigned char   EP1TXBUF[ 8 ];  /* 8 byte buffer */
-#pragma udata
-
-/* static data */
-static enum trf_type   g_curtrf;  /* indicates type of current transfer */
-static enum trf_mem    g_curtrf_mem;   /* whether data is in RAM or ROM */
-static unsigned char * g_curtrf_data;  /* data pointer for next transact. */
-static unsigned char   g_curtrf_left;  /* number of bytes still to transf */
-static unsigned char   g_curtrf_dts;   /* DTS value for next transaction */
-static unsigned char   g_addr;  /* TODO: rework */
-static unsigned char   g_config;       /* current configuration */
-static unsigned char   g_reportdts;    /* DTS value for next transaction */
-unsigned char          g_hidreport[2]; /* HID report with button states */
-
-/* local prototypes */
-static void process_ep0( void );
-static void process_ep1( void );
-
-#pragma code
-
-
-/* initialize USB module */
-void usb_init( void )
-{
-  PIE2 |= 0x20;     /* enable USB interrupts */
-  
-  UCFG = 0x10;   /* low speed, internal transciever, on-chip pullup */
-  UIE  = _IDLEI | _TRNI | _URSTI;       /* enable USB interrupts */
-  UEP0 = _EPHSHK | _EPOUTEN | _EPINEN;  /* permit control transfers */
-  UEP1 = _EPHSHK | _EPCONDIS | _EPINEN; /* only IN transfers */
-  BD0OUT.BDSTAT = _UOWN; /* reset&activate */
-  BD0OUT.BDCNT  = 8;     /* 8 Byte size for low-speed */
-  BD0OUT.BDADR  = (unsigned short)&EP0RXBUF;
-  BD0IN.BDSTAT  = 0x00;  /* reset */
-  BD0IN.BDCNT   = 0;
-  BD0IN.BDADR   = (unsigned short)&EP0TXBUF;
-  BD1OUT.BDSTAT = 0x00;  /* reset */
-  BD1OUT.BDCNT  = 8;     /* 8 Byte size for low-speed */
-  BD1OUT.BDADR  = (unsigned short)&EP1RXBUF;
-  BD1IN.BDSTAT  = 0x00;  /* reset */
-  BD1IN.BDCNT   = 2;
-  BD1IN.BDADR   = (unsigned short)&EP1TXBUF;
-  EP1TXBUF[0] = 0;
-  EP1TXBUF[1] = 0;
-  UCON = _PPBRST | _PKTDIS | _USBEN;  /* enable USB module */
-}
-
-/* called whenever g_hidreport was changed */
-/* NOTE: must not be called with interrupts disabled! */
-void usb_reportchanged( void )
-{
-  INTCON &= ~0x80;  /* protection against interruption */
-  
-  /* NOTE: We do NOT check the UOWN bit to see if we are allowed to modify
-    the buffer. Instead, we simply overwrite the buffer's current content,
-    so the host always receives the latest button states.
-    Let's hope we do not produce rubbish in case the SIE just transfers the
-    buffer while we write to it. */
-
-  EP1TXBUF[0] = g_hidreport[0];
-  EP1TXBUF[1] = g_hidreport[1];
-
-  if ( ( BD1IN.BDSTAT & _UOWN ) == 0U )
-  {
-    /* endpoint was free -> flag for transmission */
-    BD1IN.BDSTAT = _UOWN | _DTSEN | g_reportdts;
-  }
-  
-  INTCON |= 0x80;   /* enable interrupts again */
-}
-
-
-/* handle USB interrupt */
-void usb_interrupt( void ) 
-{
-  if ( ( UIE & _URSTI ) && ( UIR & _URSTI ) )
-  {
-    /* USB reset interrupt */
-    /* UADDR has already been set to 0 */
-    g_addr          = 0;
-    g_config        = 0;
-    g_reportdts     = 0;
-    /* EP0 is ready for SETUP transaction: */
-    BD0OUT.BDSTAT = _UOWN;
-    BD0OUT.BDCNT  = 8;
-    DEBUG_OUT( 'R' );
-    DEBUG_OUT( '\r' );
-    DEBUG_OUT( '\n' );
-    UIR = 0x00;         /* clear all other USB interrupts */
-  }
-  if ( ( UIE & _TRNI ) && ( UIR & _TRNI ) )
-  {
-    /* USB transaction complete interrupt */
-    /* read USTAT register */
-    switch ( USTAT & 0x78 )
-    {
-      case 0x00:
-        process_ep0();  /* process endpoint 0 */
-        break;
-      case 0x08:
-        process_ep1();  /* process endpoint 1 */
-        break;
-    }
-  }
-  if ( ( UIE & _UERRI ) && ( UIR & _UERRI ) )
-  {
-    /* USB error condition interrupt */
-    /* (currently not enabled) */
-    /* error condition flags may be queried here */
-    UEIR = 0x00;  /* clear USB error interrupt flags */
-  }
-  if ( ( UIE & _IDLEI ) && ( UIR & _IDLEI ) )
-  {
-    /* idle condition detected */
-    UCON |= _SUSPND;  /* place SIE in suspend state */
-    UIR  = 0x00;      /* clear all interrupt conditions */
-    PIR1 = 0x00;      /* (required for SLEEP mode) */
-    PIR2 = 0x00;
-    UIE = _ACTVI;     /* enable only ACTVIF interrupt */
-    Sleep();          /* enter SLEEP state */
-  }
-  if ( ( UIE & _ACTVI ) && ( UIR & _ACTVI ) )
-  {
-    /* bus activity detected */
-    UCON &= ~_SUSPND;   /* enable normal SIE operation again */
-    UIE = _IDLEI | _TRNI | _URSTI;   /* enable USB interrupts again */
-  }
-  
-  UIR = 0x00;  /* clear USB interrupt flags */
-}
-
-
-/* process interrupt at endpoint 0 */
-static void process_ep0( void )
-{
-  unsigned char  req;       /* bRequest field */
-  unsigned char  desc;      /* descriptor type requested */
-  unsigned char  tocopy;    /* amount of data to copy */
-  unsigned short requested; /* number of bytes requested by the host */
-  unsigned char  i;
-  
-  /* find out which BD caused interrupt */
-  if ( ( USTAT & _DIR ) == 0U )
-  {
-    /* last transaction was OUT or SETUP transaction */
-    if ( ( BD0OUT.BDSTAT & 0x3C ) == PID_SETUP )
-    {
-      /* received SETUP transaction */
-      DEBUG_OUT( 'S' );
-      g_curtrf = TRF_NONE;   /* abort any transfer currently running */
-      g_curtrf_dts = _DTS;   /* next transaction must be DATA1 */
-      
-      req = ((struct ctrltrf_setup *)EP0RXBUF)->bRequest;
-      if ( ( ((struct ctrltrf_setup *)EP0RXBUF)->bmRequestType & 0x60 ) == 0x20U )
-      {
-        /* Explanation: we "fold" bRequest and bmRequestType together into one
-          value. By that we can use the same code for handling class-specific
-          requests. */
-        req |= 0x80;  /* bit 7 identifies this as class-specific request */
-      }
-      
-      switch ( req )
-      {
-        case REQ_GET_DESCRIPTOR:
-          DEBUG_OUT( 'D' );
-          desc = ((struct ctrltrf_setup *)EP0RXBUF)->wValue >> 8;
-          requested = ((struct ctrltrf_setup *)EP0RXBUF)->wLength ;
-          DEBUG_OUT( '0' + ( requested >> 4 ) );
-          DEBUG_OUT( '0' + ( requested & 0x0F ) );
-          switch ( desc )
-          {
-            case DESC_DEVICE:
-              DEBUG_OUT( 'd' );
-              g_curtrf = TRF_IN;
-              g_curtrf_data = dev_desc;
-              g_curtrf_left = sizeof( dev_desc );
-              /* endpoint for IN transaction will be prepared below */
-              break;
-            case DESC_CONFIGURATION:
-              DEBUG_OUT( 'c' );
-              g_curtrf = TRF_IN;
-              g_curtrf_data = cfg_desc;
-              g_curtrf_left = sizeof( cfg_desc );
-              /* endpoint for IN transaction will be prepared below */
-              break;
-            case DESC_REPORT:
-              DEBUG_OUT( 'r' );
-              g_curtrf = TRF_IN;
-              g_curtrf_data = report_desc;
-              g_curtrf_left = sizeof( report_desc );
-              /* endpoint for IN transaction will be prepared below */
-              break;
-            case DESC_STRING:
-              DEBUG_OUT( 's' );
-              g_curtrf = TRF_IN;
-              switch ( ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0xFF )
-              {
-                case 0:
-                  DEBUG_OUT( '0' );
-                  g_curtrf_data = string_desc_lang;
-                  g_curtrf_left = sizeof( string_desc_lang );
-                  break;
-                case 1:
-                  DEBUG_OUT( '1' );
-                  g_curtrf_data = string_desc_man;
-                  g_curtrf_left = sizeof( string_desc_man );
-                  break;
-                case 2:
-                  DEBUG_OUT( '2' );
-                  g_curtrf_data = string_desc_prod;
-                  g_curtrf_left = sizeof( string_desc_prod );
-                  break;
-                case 3:
-                  DEBUG_OUT( '3' );
-                  g_curtrf_data = string_desc_serial;
-                  g_curtrf_left = sizeof( string_desc_serial );
-                  break;
-                default:
-                  DEBUG_OUT( 'u' );
-                  g_curtrf_left = 0;
-              }
-              /* endpoint for IN transaction will be prepared below */
-              break;
-            default:
-              /* unsupported descriptor -> send STALL */
-              /* (will be cleared with next SETUP transaction) */
-              DEBUG_OUT( 'u' );
-              DEBUG_OUT( desc );
-              BD0OUT.BDSTAT = _UOWN | _BSTALL;
-              BD0IN.BDSTAT = _UOWN | _BSTALL;
-          }
-
-          /* correct amount of bytes if necessary */
-          if ( requested < g_curtrf_left )
-          {
-            g_curtrf_left = requested;
-          }
-          
-          /* descriptors come from ROM */
-          g_curtrf_mem = TRF_ROM;
-          break;
-/*        case REQ_SET_DESCRIPTOR:
-          BD0OUT.BDSTAT = _UOWN | _BSTALL;
-          BD0IN.BDSTAT = _UOWN | _BSTALL;
-          /*
-          g_curtrf = TRF_OUT;
-          g_curtrf_mem = TRF_RAM;
-          g_curtrf_data = &buffermem;
-          g_curtrf_left = sizeof( buffermem );
-          break;  */
-        case REQ_SET_ADDRESS:
-          DEBUG_OUT( 'A' );
-          g_curtrf = TRF_OUT;
-          g_curtrf_left = 0;
-          g_addr = ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0x7F;
-          break;
-        case REQ_SET_CONFIGURATION:
-          /* the lower byte of wValue contains configuration number */
-          DEBUG_OUT( 'C' );
-          DEBUG_OUT( 's' );
-          g_curtrf = TRF_OUT;
-          g_curtrf_left = 0;
-          g_config = ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0xFF;
-          break;
-        case REQ_GET_CONFIGURATION:
-          DEBUG_OUT( 'C' );
-          DEBUG_OUT( 'g' );
-          g_curtrf = TRF_IN;
-          g_curtrf_mem = TRF_RAM;
-          g_curtrf_data = &g_config;
-          g_curtrf_left = 1;
-          break;
-        case REQ_GET_REPORT:
-          DEBUG_OUT( 'P' );
-          /* wValue: high-byte = report type, low-byte = report ID */
-          /* we support only one report, therefore we need not check here */
-          g_curtrf = TRF_IN;
-          g_curtrf_mem = TRF_RAM;
-          g_curtrf_data = g_hidreport;
-          g_curtrf_left = 2;
-          break;
-        case REQ_SET_IDLE:
-          DEBUG_OUT( 'L' );
-          g_curtrf = TRF_OUT;
-          g_curtrf_left = 0;
-          break;
-        default:
-          /* unsupported request -> send STALL */
-          /* (will be cleared with next SETUP transaction) */
-          DEBUG_OUT( 'U' );
-          DEBUG_OUT( req );
-          BD0OUT.BDSTAT = _UOWN | _BSTALL;
-          BD0IN.BDSTAT = _UOWN | _BSTALL;
-      }
-      
-      /* clear PKTDIS because it is set after each SETUP transaction */
-      UCON &= ~_PKTDIS;
-      
-    } /* if ( pid == PID_SETUP ) */
-    else
-    {
-      /* received OUT transaction */
-      
-      DEBUG_OUT( 'O' );
-      if ( g_curtrf == TRF_IN )
-      {
-        /* OUT transaction from host means Status stage */
-        /* -> transfer is complete */
-        g_curtrf = TRF_NONE;
-      }
-      else if ( g_curtrf == TRF_OUT )
-      {
-        /* copy received data to memory */
-        tocopy = BD0OUT.BDCNT;
-        memcpy( (void *)g_curtrf_data, (const void *)EP0RXBUF, tocopy );
-        g_curtrf_data += tocopy;
-        g_curtrf_left -= tocopy;
-        g_curtrf_dts ^= _DTS;       /* toggle DTS bit */
-      }
-    } /* if ( pid != PID_SETUP ) */
-    
-  } /* if ( ( USTAT & _DIR ) == 0 ) */
-  else
-  {
-    /* last transaction was IN transaction */
-    
-    DEBUG_OUT( 'I' );
-    if ( g_curtrf == TRF_IN )
-    {
-      /* host received our data transaction */
-      /* if we have more data to send, endpoint will be prepared below */
-      g_curtrf_dts ^= _DTS;     /* toggle DTS bit */
-    }
-    else if ( g_curtrf == TRF_OUT )
-    {
-      /* IN transaction from host means Status stage */
-      /* host sent acknowledge -> transfer complete */
-      g_curtrf = TRF_NONE;
-      if ( g_addr != 0U )
-      {
-        /* we received our new address in this transaction! */
-        DEBUG_OUT( '0' + ( g_addr >> 4 ) );
-        DEBUG_OUT( '0' + ( g_addr & 0x0F ) );
-        UADDR = g_addr;
-        g_addr = 0;
-      }
-    }
-  } /* if ( ( USTAT & _DIR ) != 0 ) */
-
- 
-  /* prepare next transaction */
-  if ( g_curtrf == TRF_IN )
-  {
-    /* transaction is IN, prepare next IN transaction */
-    /* NOTE: We send packet regardless of whether there is still data
-       remaining or not. When the host requests more data than we have,
-       we are required to send a zero-length data packet. */
-    tocopy = ( g_curtrf_left <= 8U ) ? g_curtrf_left : 8;
-    //DEBUG_OUT( '0' + tocopy );
-    if ( g_curtrf_mem == TRF_RAM )
-    {
-      memcpy( (void *)EP0TXBUF, (const void *)g_curtrf_data, tocopy );
-    }
-    else
-    {
-      /* copy from ROM */
-      memcpypgm2ram( (void *)EP0TXBUF, (rom void *)g_curtrf_data, tocopy );
-    }
-    g_curtrf_left -= tocopy;
-    g_curtrf_data += tocopy;
-    BD0IN.BDCNT  = tocopy;
-    BD0IN.BDSTAT = _UOWN | _DTSEN | g_curtrf_dts;
-    
-    /* also prepare RX buffer, for receiving Status transaction */
-    BD0OUT.BDCNT  = 0;    /* Status transaction has empty data packet */
-    BD0OUT.BDSTAT = _UOWN | _DTSEN | _DTS;  /* Status is always DATA1 */
-  }
-  else if ( g_curtrf == TRF_OUT )
-  {
-    /* transaction is OUT, prepare RX buffer further OUT transactions */
-    BD0OUT.BDCNT  = ( g_curtrf_left <= 8U ) ? g_curtrf_left : 8;
-    BD0OUT.BDSTAT = _UOWN | _DTSEN | g_curtrf_dts;
-    
-    /* also prepare TX buffer, for sending Status transaction */
-    BD0IN.BDCNT  = 0;       /* empty data packet */
-    BD0IN.BDSTAT = _UOWN | _DTSEN | _DTS;   /* Status is always DATA1 */
-  }
-  else
-  {
-    /* transfer has been completed (g_curtrf = TRF_NONE) */
-    /* prepare to receive next SETUP transaction */
-    BD0OUT.BDCNT  = 8;
-    BD0OUT.BDSTAT = _UOWN;
-  }
-}
-
-
-/* process interrupt at endpoint 1 */
-static void process_ep1( void )
-{
-  /* endpoint 1 only supports interrupt IN transfers */
-  /* therefore we need not check anything here */
-  /* we just change the DTS value for the next transmission */
-  g_reportdts ^= _DTS;
-}
+/* usb.c */
+
+#include <p18cxxx.h>
+#include <string.h>   /* for memcpy() */
+#include "debug.h"
+#include "usb.h"
+#include "timebase.h"
+#include "loopback.h"
+#include "config.h"
+#include "stats.h"
+#include "profile.h"
+#include "playback.h"
+
+/* endpoint set, laid out in USB RAM by usbmem.h */
+/* NOTE: the transfer handling below uses one buffer per endpoint
+  direction, so no ping-pong buffering here; EP0 IN alternates between
+  two buffers by itself (see ep0_prepare()) */
+#define USBMEM_PPB     USBMEM_PPB_NONE
+#if !CONFIG_FULLSPEED && \
+  ( defined( USB_LATCH ) || defined( USB_STREAM ) || defined( PLAYBACK ) )
+/* NOTE: low-speed interrupt endpoints are polled every 10 ms at most and
+  carry 8 bytes, which would delay a latch request by up to 10 ms and is
+  too little for the streams */
+#error "USB_LATCH, USB_STREAM and PLAYBACK need full-speed (config.h)"
+#endif
+#if defined( USB_STREAM ) || defined( PLAYBACK )
+/* EP2 IN: sample stream (USB_STREAM), EP2 OUT: playback stream (PLAYBACK),
+  received into one slot of the ring at a time */
+#ifdef USB_STREAM
+#define EP2_STREAM_SIZE  USB_STREAM_SIZE
+#else
+#define EP2_STREAM_SIZE  0
+#endif
+#ifdef PLAYBACK
+#define EP2_RING_SIZE    ( USB_PLAYBACK_SLOTS * USB_PLAYBACK_SIZE )
+#else
+#define EP2_RING_SIZE    0
+#endif
+#define USBMEM_NUM_EP  3
+#define USBMEM_TABLE \
+  USBMEM_EP( 0, CONFIG_EP0_SIZE, CONFIG_EP0_SIZE )  /* control transfers */ \
+  USBMEM_EP( 1, CONFIG_EP1_SIZE, CONFIG_EP1_SIZE )  /* HID reports */ \
+  USBMEM_EP( 2, 0, EP2_STREAM_SIZE )  /* sample stream */ \
+  USBMEM_BUF( EP0_IN2, CONFIG_EP0_SIZE )  /* next EP0 IN packet */ \
+  USBMEM_BUF( EP2_IN2, EP2_STREAM_SIZE )  /* samples being collected */ \
+  USBMEM_BUF( EP2_RING, EP2_RING_SIZE )  /* frames to play */
+#else
+#define USBMEM_NUM_EP  2
+#define USBMEM_TABLE \
+  USBMEM_EP( 0, CONFIG_EP0_SIZE, CONFIG_EP0_SIZE )  /* control transfers */ \
+  USBMEM_EP( 1, CONFIG_EP1_SIZE, CONFIG_EP1_SIZE )  /* HID reports */ \
+  USBMEM_BUF( EP0_IN2, CONFIG_EP0_SIZE )  /* next EP0 IN packet */
+#endif
+#include "usbmem.h"
+
+/* bit names of USB registers */
+/* BDnSTAT register */
+#define _UOWN     0x80
+#define _DTS      0x40
+#define _DTSEN    0x08
+#define _BSTALL   0x04
+/* UCON register */
+#define _PPBRST   0x40
+#define _SE0      0x20
+#define _PKTDIS   0x10
+#define _USBEN    0x08
+#define _RESUME   0x04
+#define _SUSPND   0x02
+/* USTAT register */
+#define _DIR      0x04
+/* UEPn register */
+#define _EPHSHK   0x10
+#define _EPCONDIS 0x08
+#define _EPOUTEN  0x04
+#define _EPINEN   0x02
+#define _EPSTALL  0x01
+/* UIR and UIE register */
+#define _SOFI     0x40
+#define _STALLI   0x20
+#define _IDLEI    0x10
+#define _TRNI     0x08
+#define _ACTVI    0x04
+#define _UERRI    0x02
+#define _URSTI    0x01
+
+/* PID values in BDnSTAT register */
+#define PID_OUT   (unsigned char)(0x1 << 2)
+#define PID_IN    (unsigned char)(0x9 << 2)
+#define PID_SETUP (unsigned char)(0xD << 2)
+
+/* USB request numbers */
+enum req_num
+{
+  REQ_GET_STATUS        = 0x00,
+  REQ_CLEAR_FEATURE     = 0x01,
+  REQ_SET_FEATURE       = 0x03,
+  REQ_SET_ADDRESS       = 0x05,
+  REQ_GET_DESCRIPTOR    = 0x06,
+  REQ_SET_DESCRIPTOR    = 0x07,
+  REQ_GET_CONFIGURATION = 0x08,
+  REQ_SET_CONFIGURATION = 0x09,
+  REQ_GET_INTERFACE     = 0x0A,
+  REQ_SET_INTERFACE     = 0x0B,
+  REQ_SYNC_FRAME        = 0x0C,
+  /* HID specific (see explanation below) */
+  REQ_GET_REPORT        = 0x81,
+  REQ_GET_IDLE          = 0x82,
+  REQ_GET_PROTOCOL      = 0x83,
+  REQ_SET_REPORT        = 0x89,
+  REQ_SET_IDLE          = 0x8A,
+  REQ_SET_PROTOCOL      = 0x8B,
+  /* vendor specific (bits 7 and 6 set) */
+  REQ_ENTER_BOOTLOADER  = 0xC1
+};
+
+/* HID report types (high byte of wValue in GET_REPORT/SET_REPORT) */
+enum report_type
+{
+  REPORT_INPUT   = 0x01,
+  REPORT_OUTPUT  = 0x02,
+  REPORT_FEATURE = 0x03
+};
+
+/* input report: report ID, axes, buttons, frame number (2 bytes) */
+#define REPORT_ID    1
+#define REPORT_SIZE  5
+#if CONFIG_EP1_SIZE < REPORT_SIZE
+#error "CONFIG_EP1_SIZE below the size of the input report"
+#endif
+
+/* USB descriptor values */
+enum desc_num
+{
+  /* standard descriptors */
+  DESC_DEVICE        = 0x01,
+  DESC_CONFIGURATION = 0x02,
+  DESC_STRING        = 0x03,
+  DESC_INTERFACE     = 0x04,
+  DESC_ENDPOINT      = 0x05,
+  DESC_DEVICE_QUALIFIER          = 0x06,
+  DESC_OTHER_SPEED_CONFIGURATION = 0x07,
+  DESC_INTERFACE_POWER           = 0x08,
+  /* class descriptors */
+  DESC_HID           = 0x21,
+  DESC_HUB           = 0x29,
+  DESC_REPORT        = 0x22,
+  DESC_PHYSICAL      = 0x23
+};
+
+/* type of transfer currently performed */
+enum trf_type
+{
+  TRF_NONE,
+  TRF_IN,
+  TRF_OUT
+};
+
+/* for specifying if a transfer is in/from RAM or ROM */
+enum trf_mem
+{
+  TRF_RAM,
+  TRF_ROM
+};
+
+/* setup stage of a control transfer */
+struct ctrltrf_setup
+{
+  unsigned char  bmRequestType;
+  unsigned char  bRequest;
+  unsigned short wValue;
+  unsigned short wIndex;
+  unsigned short wLength;
+};
+
+/* report descriptor, with the latch request of USB_LATCH and the playback
+  control of PLAYBACK */
+#ifdef USB_LATCH
+#define REPORT_DESC_LATCH     8
+#else
+#define REPORT_DESC_LATCH     0
+#endif
+#ifdef PLAYBACK
+#define REPORT_DESC_PLAYBACK  8
+#else
+#define REPORT_DESC_PLAYBACK  0
+#endif
+#define REPORT_DESC_SIZE  ( 91 + REPORT_DESC_LATCH + REPORT_DESC_PLAYBACK )
+static const rom unsigned char report_desc[ REPORT_DESC_SIZE ];  /* forward */
+
+ 
+static const rom unsigned char dev_desc[18] =
+{
+  sizeof( dev_desc ), /* bLength: descriptor size in bytes */
+  DESC_DEVICE,        /* bDescriptorType */
+  0x00, 0x02,         /* bcdUSB: USB spec release number */
+  0x00,               /* bDeviceClass: class code */
+  0x00,               /* bDeviceSubclass: subclass code */
+  0x00,               /* bDeviceProtocol: protocol code */
+  USBMEM_EP0_IN_SIZE, /* bMaxPacketSize: max packet size for EP0 */
+  0xD8, 0x04,         /* idVendor: vendor ID (0x04D8=Microchip) */
+  0x01, 0x00,         /* idProduct: product ID */
+  0x01, 0x00,         /* bcdDevice: device release number */
+  0x01,               /* iManufacturer: index of string desc. */
+  0x02,               /* iProduct: index of string desc. */
+  0x03,               /* iSerialNumber: index of string desc. */
+  0x01                /* bNumConfiguration: number of possible configs */
+};
+
+/* interface 0: the game pad, with endpoints in addition to EP0 */
+#define CFG_HID_SIZE  25
+#define CFG_HID_INTERFACE( endpoints ) \
+  /* interface descriptor */ \
+  9,                  /* bLength: descriptor size in bytes */ \
+  DESC_INTERFACE,     /* bDescriptorType */ \
+  0,                  /* bInterfaceNumber: identifier for this interface */ \
+  0,                  /* bAlternateSetting: disting. mutually exclusive IFs */ \
+  endpoints,          /* bNumEndpoints: endpoints in addition to EP0 */ \
+  0x03,               /* bInterfaceClass */ \
+  0,                  /* bInterfaceSubclass */ \
+  0,                  /* bInterfaceProtocol */ \
+  0,                  /* iInterface: index of string descriptor */ \
+  /* class descriptor */ \
+  9,                  /* bLength: descriptor size in bytes */ \
+  DESC_HID,           /* bDescriptorType */ \
+  0x10, 0x01,         /* bcdHID: HID spec release number */ \
+  0,                  /* bCountryCode: indentifies country for localized HW */ \
+  1,                  /* bNumDescriptors: number of subordinate class desc. */ \
+  DESC_REPORT,        /* bDescriptorType */ \
+  sizeof( report_desc ), 0x00, /* wDescriptorLength: length of report desc. */ \
+  /* endpoint descriptor */ \
+  7,                  /* bLength: descriptor size in bytes */ \
+  DESC_ENDPOINT,      /* bDescriptorType */ \
+  0x81,               /* bEndpointAddress: endpoint number and direction */ \
+  0x03,               /* bmAttributes: type of supported transfer */ \
+  USBMEM_EP1_IN_SIZE, 0x00, /* wMaxPacketSize: max. packet size supported */ \
+  CONFIG_POLL_MS      /* bInterval: maximum latency for polling */
+
+/* the game pad, the latch requests at EP1 OUT (USB_LATCH) and interface 1,
+  the sample stream (USB_STREAM) and the playback stream (PLAYBACK) */
+#ifdef USB_LATCH
+#define CFG_LATCH_SIZE      7
+#define CFG_HID_ENDPOINTS   2
+#else
+#define CFG_LATCH_SIZE      0
+#define CFG_HID_ENDPOINTS   1
+#endif
+#ifdef USB_STREAM
+#define CFG_STREAM_SIZE     7
+#else
+#define CFG_STREAM_SIZE     0
+#endif
+#ifdef PLAYBACK
+#define CFG_PLAYBACK_SIZE   7
+#else
+#define CFG_PLAYBACK_SIZE   0
+#endif
+#if defined( USB_STREAM ) || defined( PLAYBACK )
+#define CFG_VENDOR_SIZE     ( 9 + CFG_STREAM_SIZE + CFG_PLAYBACK_SIZE )
+#define CFG_INTERFACES      2
+#else
+#define CFG_VENDOR_SIZE     0
+#define CFG_INTERFACES      1
+#endif
+static const rom unsigned char cfg_desc[ 9 + CFG_HID_SIZE +
+  CFG_LATCH_SIZE + CFG_VENDOR_SIZE ] =
+{
+  /* configuration descriptor */
+  9,                  /* bLength: descriptor size in bytes */
+  DESC_CONFIGURATION, /* bDescriptorType */
+  sizeof( cfg_desc ), 0, /* wTotalLength: size of all data for this config */
+  CFG_INTERFACES,     /* bNumInterfaces: number of interfaces of config */
+  1,                  /* bConfigurationValue: identifier for this config */
+  0,                  /* iConfiguration: index of string descriptor */
+  0,                  /* bmAttributes: self/bus powered and remote wakeup */
+  15,                 /* MaxPower: bus power required [2*mA] */
+  CFG_HID_INTERFACE( CFG_HID_ENDPOINTS ),
+#ifdef USB_LATCH
+  /* endpoint descriptor: latch requests */
+  7,                  /* bLength: descriptor size in bytes */
+  DESC_ENDPOINT,      /* bDescriptorType */
+  0x01,               /* bEndpointAddress: endpoint number and direction */
+  0x03,               /* bmAttributes: type of supported transfer */
+  USBMEM_EP1_OUT_SIZE, 0x00, /* wMaxPacketSize: max. packet size supported */
+  0x01,               /* bInterval: every frame */
+#endif
+#if defined( USB_STREAM ) || defined( PLAYBACK )
+  /* interface descriptor: sample and playback streams */
+  9,                  /* bLength: descriptor size in bytes */
+  DESC_INTERFACE,     /* bDescriptorType */
+  1,                  /* bInterfaceNumber: identifier for this interface */
+  0,                  /* bAlternateSetting: disting. mutually exclusive IFs */
+  ( CFG_STREAM_SIZE + CFG_PLAYBACK_SIZE ) / 7, /* bNumEndpoints */
+  0xFF,               /* bInterfaceClass: vendor specific */
+  0,                  /* bInterfaceSubclass */
+  0,                  /* bInterfaceProtocol */
+  0,                  /* iInterface: index of string descriptor */
+#endif
+#ifdef USB_STREAM
+  /* endpoint descriptor: sample stream */
+  7,                  /* bLength: descriptor size in bytes */
+  DESC_ENDPOINT,      /* bDescriptorType */
+  0x82,               /* bEndpointAddress: endpoint number and direction */
+  0x03,               /* bmAttributes: type of supported transfer */
+  USB_STREAM_SIZE, 0x00, /* wMaxPacketSize: max. packet size supported */
+  0x01,               /* bInterval: every frame */
+#endif
+#ifdef PLAYBACK
+  /* endpoint descriptor: playback stream */
+  7,                  /* bLength: descriptor size in bytes */
+  DESC_ENDPOINT,      /* bDescriptorType */
+  0x02,               /* bEndpointAddress: endpoint number and direction */
+  0x03,               /* bmAttributes: type of supported transfer */
+  USB_PLAYBACK_SIZE, 0x00, /* wMaxPacketSize: max. packet size supported */
+  0x01,               /* bInterval: every frame */
+#endif
+};
+
+/* NOTE: every 8 bytes cost an EP0 IN transaction, so global items are
+  only repeated where they change, the 16 bit fields follow each other,
+  and X and Y go without a Physical collection */
+static const rom unsigned char report_desc[ REPORT_DESC_SIZE ] =
+{
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
+    0x09, 0x05,                    // USAGE (Game Pad)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, REPORT_ID,               //   REPORT_ID (1)
+    0x09, 0x30,                    //   USAGE (X)
+    0x09, 0x31,                    //   USAGE (Y)
+    0x15, 0xff,                    //   LOGICAL_MINIMUM (-1)
+    0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
+    0x75, 0x02,                    //   REPORT_SIZE (2)
+    0x95, 0x02,                    //   REPORT_COUNT (2)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x75, 0x01,                    //   REPORT_SIZE (1)
+    0x95, 0x04,                    //   REPORT_COUNT (4)
+    0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
+    0x05, 0x09,                    //   USAGE_PAGE (Button)
+    0x19, 0x01,                    //   USAGE_MINIMUM (Button 1)
+    0x29, 0x06,                    //   USAGE_MAXIMUM (Button 6)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x95, 0x06,                    //   REPORT_COUNT (6)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x05, 0x01,                    //   USAGE_PAGE (Generic Desktop)
+    0x09, 0x3d,                    //   USAGE (Start)
+    0x09, 0x3e,                    //   USAGE (Select)
+    0x95, 0x02,                    //   REPORT_COUNT (2)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x06, 0x00, 0xff,              //   USAGE_PAGE (Vendor Defined Page 1)
+    0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+    0x26, 0xff, 0x07,              //   LOGICAL_MAXIMUM (2047)
+    0x75, 0x10,                    //   REPORT_SIZE (16)
+    0x95, 0x01,                    //   REPORT_COUNT (1)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x85, STATS_REPORT_ID,         //   REPORT_ID (3)
+    0x09, 0x03,                    //   USAGE (Vendor Usage 3)
+    0x27, 0xff, 0xff, 0x00, 0x00,  //   LOGICAL_MAXIMUM (65535)
+    0x95, STATS_COUNT,             //   REPORT_COUNT (10)
+    0xb1, 0x02,                    //   FEATURE (Data,Var,Abs)
+    0x85, LOOPBACK_REPORT_ID,      //   REPORT_ID (2)
+    0x09, 0x02,                    //   USAGE (Vendor Usage 2)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+    0x95, LOOPBACK_REPORT_SIZE,    //   REPORT_COUNT (8)
+    0xb1, 0x02,                    //   FEATURE (Data,Var,Abs)
+#ifdef PLAYBACK
+    0x85, PLAYBACK_REPORT_ID,      //   REPORT_ID (5)
+    0x09, 0x05,                    //   USAGE (Vendor Usage 5)
+    0x95, PLAYBACK_REPORT_SIZE,    //   REPORT_COUNT (11)
+    0xb1, 0x02,                    //   FEATURE (Data,Var,Abs)
+#endif
+#ifdef USB_LATCH
+    0x85, USB_LATCH_REPORT_ID,     //   REPORT_ID (4)
+    0x09, 0x04,                    //   USAGE (Vendor Usage 4)
+    0x95, 0x01,                    //   REPORT_COUNT (1)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+#endif
+    0xc0                           // END_COLLECTION
+};
+
+static const rom unsigned char string_desc_lang[4] =
+{
+  sizeof( string_desc_lang ),  /* bLength */
+  DESC_STRING,                 /* bDescriptorType */
+  0x09, 0x04                   /* wLANGID */
+};
+
+static const rom unsigned char string_desc_man[38] =
+{
+  sizeof( string_desc_man ),
+  DESC_STRING,
+  'C',0,'h',0,'r',0,'i',0,'s',0,'t',0,'i',0,'a',0,'n',0,' ',0,
+  'E',0,'t',0,'t',0,'i',0,'n',0,'g',0,'e',0,'r',0
+};
+
+static const rom unsigned char string_desc_prod[52] =
+{
+  sizeof( string_desc_prod ),
+  DESC_STRING,
+  'S',0,'u',0,'p',0,'e',0,'r',0,' ',0,'N',0,'i',0,'n',0,'t',0,'e',0,'n',0,
+  'd',0,'o',0,' ',0,'C',0,'o',0,'n',0,'t',0,'r',0,'o',0,'l',0,'l',0,'e',0,'r',0
+};
+
+static const rom unsigned char string_desc_serial[10] =
+{
+  sizeof( string_desc_serial ),
+  DESC_STRING,
+  '0',0,'0',0,'0',0,'1',0
+};
+
+
+/* USB Memory (BDT and endpoint buffers, see usbmem.h) */
+/* NOTE: not static, the SIE model of the host simulator (../host/sim)
+  works on it */
+#pragma udata usb_ram = 0x400
+volatile unsigned char g_usbram[ USBMEM_SIZE ];
+#pragma udata
+
+/* buffer descriptor table */
+#define BD0OUT    USBMEM_BD( 0, USBMEM_OUT, 0 )
+#define BD0IN     USBMEM_BD( 0, USBMEM_IN, 0 )
+#define BD1OUT    USBMEM_BD( 1, USBMEM_OUT, 0 )
+#define BD1IN     USBMEM_BD( 1, USBMEM_IN, 0 )
+/* endpoint buffers */
+#define EP0RXBUF  USBMEM_PTR( EP0_OUT )
+#define EP0TXBUF  USBMEM_PTR( EP0_IN )
+#define EP1RXBUF  USBMEM_PTR( EP1_OUT )
+#define EP1TXBUF  USBMEM_PTR( EP1_IN )
+#ifdef USB_STREAM
+#define BD2IN     USBMEM_BD( 2, USBMEM_IN, 0 )
+#endif
+#ifdef PLAYBACK
+#define BD2OUT    USBMEM_BD( 2, USBMEM_OUT, 0 )
+#endif
+
+/* static data */
+static enum trf_type   g_curtrf;  /* indicates type of current transfer */
+static enum trf_mem    g_curtrf_mem;   /* whether data is in RAM or ROM */
+static unsigned char * g_curtrf_data;  /* data pointer for next transact. */
+static unsigned char   g_curtrf_left;  /* number of bytes still to transf */
+static unsigned char   g_curtrf_dts;   /* DTS value for next transaction */
+static unsigned char   g_addr;  /* TODO: rework */
+static unsigned char   g_config;       /* current configuration */
+static unsigned char   g_reboot;       /* reset after status stage */
+static unsigned char   g_reportdts;    /* DTS value for next transaction */
+static unsigned char   g_curtrf_report;  /* feature report being received */
+static unsigned char   g_featurebuf[ 1 + STATS_REPORT_SIZE ];  /* largest */
+unsigned char          g_hidreport[2]; /* HID report with button states */
+
+/* report handoff from main loop to EP1 (single producer, single consumer) */
+/* NOTE: the producer (usb_reportchanged) writes the snapshot which is not
+  published, the consumer (EP1 IN completion) only reads the published one.
+  The consumer runs in the ISR and cannot be interrupted by the producer,
+  so two snapshots are enough. */
+static unsigned char          g_report_snap[2][ REPORT_SIZE ];
+static volatile unsigned char g_report_pub;     /* published snapshot */
+static volatile unsigned char g_ep1_idle;       /* EP1 IN is not armed */
+#ifdef USB_LATCH
+/* latch requests, the ISR only notes that BD1OUT has been released, the
+  main loop reads it and arms it again (see usb_latched()) */
+static volatile unsigned char g_latch_request;  /* BD1OUT holds one */
+static unsigned char          g_latch_dts;      /* DTS for next request */
+static unsigned char          g_latch_ondemand; /* see usb_ondemand() */
+#endif
+#ifdef USB_STREAM
+/* sample stream, the main loop fills one buffer while the SIE sends the
+  other */
+/* NOTE: only usb_stream() arms EP2, and only while g_stream_idle is set,
+  which the ISR sets when the packet has been sent */
+static volatile unsigned char * g_stream_buf;   /* being filled */
+static unsigned char            g_stream_n;     /* samples in it */
+static unsigned char            g_stream_seq;
+static unsigned char            g_stream_drops;
+static unsigned char            g_stream_dts;   /* DTS for next packet */
+static volatile unsigned char   g_stream_idle;  /* EP2 IN is not armed */
+#endif
+#ifdef PLAYBACK
+/* playback stream, a ring of slots of one packet each: the main loop arms
+  BD2OUT for the next free slot, the consumer (high priority interrupt)
+  empties them in order */
+/* NOTE: a slot belongs to the consumer while its g_play_len is not 0, and
+  only the consumer clears it, single byte writes on both sides */
+static unsigned char            g_play_len[ USB_PLAYBACK_SLOTS ]; /* frames */
+static unsigned char            g_play_rx;      /* slot being received */
+static unsigned char            g_play_tail;    /* slot being played */
+static unsigned char            g_play_pos;     /* next frame in it */
+static unsigned char            g_play_dts;     /* DTS for next packet */
+static unsigned char            g_play_armed;   /* BD2OUT is with the SIE */
+static volatile unsigned char   g_play_received;  /* BD2OUT holds one */
+#endif
+#pragma udata access usb_access
+near volatile unsigned char   g_report_pending; /* published, not yet sent */
+#if defined( __18CXX )
+static near unsigned char     g_stream_count;   /* see desc_stream() */
+#endif
+#pragma udata
+
+/* EP0 events latched by the ISR, processed by usb_service() */
+/* NOTE: the ISR only sets EP0_OUT (EP0_IN) after the SIE has released
+  BD0OUT (BD0IN), and the SIE only gets it back from usb_service(), so
+  each bit is set at most once until usb_service() has cleared it. The
+  buffer descriptor and the received data stay untouched meanwhile. */
+#define EP0_OUT    0x01   /* SETUP or OUT transaction completed */
+#define EP0_IN     0x02   /* IN transaction completed */
+#define EP0_RESET  0x04   /* bus reset, EP0 must be initialized again */
+static volatile unsigned char g_ep0_events;
+
+/* data stage of a control read: usb_service() prepares each IN packet
+  while the one before is on the bus, latch_ep0() hands it to the SIE
+  right after that has been sent */
+/* NOTE: so EP0_IN may stand for more than one IN transaction, but the
+  packets do not depend on their count (see ep0_prepare()) */
+#define EP0_NONE   0xFF   /* g_ep0_nextcnt: no packet prepared */
+static volatile unsigned char  g_ep0_nextcnt;   /* size, set last */
+static volatile unsigned char  g_ep0_nextstat;  /* BDSTAT */
+static volatile unsigned short g_ep0_nextadr;   /* buffer address */
+static volatile unsigned char  g_ep0_starved;   /* BD0IN released while
+                                                   none was prepared */
+
+/* local prototypes */
+static void latch_ep0( void );
+static void process_ep0( unsigned char dir );
+static void ep0_prepare( void );
+static void desc_stream( volatile unsigned char * dst,
+  const rom unsigned char * src, unsigned char n );
+static void process_ep1( void );
+static void send_report( void );
+#ifdef USB_STREAM
+static void stream_send( void );
+#endif
+
+#pragma code
+
+
+/* initialize USB module */
+void usb_init( void )
+{
+  PIE2 |= 0x20;     /* enable USB interrupts */
+  
+  /* internal transciever, on-chip pullup, speed as configured */
+  UCFG = ( CONFIG_FULLSPEED ? 0x14 : 0x10 ) | USBMEM_PPB;
+  /* enable USB interrupts */
+  UIE  = _SOFI | _STALLI | _IDLEI | _TRNI | _UERRI | _URSTI;
+  UEIE = 0x9F;      /* all error conditions, counted in stats.c */
+  UEP0 = _EPHSHK | _EPOUTEN | _EPINEN;  /* permit control transfers */
+#ifdef USB_LATCH
+  UEP1 = _EPHSHK | _EPCONDIS | _EPINEN | _EPOUTEN; /* latch requests */
+#else
+  UEP1 = _EPHSHK | _EPCONDIS | _EPINEN; /* only IN transfers */
+#endif
+  BD0OUT.BDSTAT = _UOWN; /* reset&activate */
+  BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+  BD0OUT.BDADR  = USBMEM_ADDR( EP0_OUT );
+  BD0IN.BDSTAT  = 0x00;  /* reset */
+  BD0IN.BDCNT   = 0;
+  BD0IN.BDADR   = USBMEM_ADDR( EP0_IN );
+  g_ep0_nextcnt = EP0_NONE;
+  BD1OUT.BDSTAT = 0x00;  /* reset */
+  BD1OUT.BDCNT  = USBMEM_EP1_OUT_SIZE;
+  BD1OUT.BDADR  = USBMEM_ADDR( EP1_OUT );
+#ifdef USB_LATCH
+  BD1OUT.BDSTAT = _UOWN | _DTSEN;  /* first request is DATA0 */
+#endif
+  BD1IN.BDSTAT  = 0x00;  /* reset */
+  BD1IN.BDCNT   = REPORT_SIZE;
+  BD1IN.BDADR   = USBMEM_ADDR( EP1_IN );
+  g_report_snap[0][0] = REPORT_ID;
+  g_report_snap[1][0] = REPORT_ID;
+  g_report_pub     = 0;
+  g_report_pending = 0;
+  g_ep1_idle       = 1;
+#if defined( USB_STREAM ) && defined( PLAYBACK )
+  UEP2 = _EPHSHK | _EPCONDIS | _EPINEN | _EPOUTEN;
+#elif defined( USB_STREAM )
+  UEP2 = _EPHSHK | _EPCONDIS | _EPINEN; /* only IN transfers */
+#elif defined( PLAYBACK )
+  UEP2 = _EPHSHK | _EPCONDIS | _EPOUTEN; /* only OUT transfers */
+#endif
+#ifdef PLAYBACK
+  BD2OUT.BDSTAT = 0x00;  /* armed by usb_playback() once configured */
+#endif
+#ifdef USB_STREAM
+  BD2IN.BDSTAT  = 0x00;  /* reset */
+  BD2IN.BDADR   = USBMEM_ADDR( EP2_IN );
+  g_stream_buf  = USBMEM_PTR( EP2_IN2 );
+  g_stream_idle = 1;
+  T1CON = 0x81;   /* Timer1 stamps the samples, set up as in profile.c */
+#endif
+  UCON = _PPBRST | _PKTDIS | _USBEN;  /* enable USB module */
+}
+
+/* called whenever g_hidreport was changed */
+/* NOTE: does not disable interrupts, may be called with interrupts enabled
+  or disabled, but only from one context (it is the only producer) */
+void usb_reportchanged( void )
+{
+  unsigned char  snap;
+  unsigned short frame;
+
+  /* the report carries the frame number of the change, so the host can
+    tell how long it took to arrive */
+  frame = timebase_frame();
+
+  /* fill the snapshot which is not published, the ISR never reads it */
+  snap = g_report_pub ^ 1;
+  g_report_snap[snap][1] = g_hidreport[0];
+  g_report_snap[snap][2] = g_hidreport[1];
+  g_report_snap[snap][3] = frame & 0xFF;
+  g_report_snap[snap][4] = frame >> 8;
+
+  /* the last one has not been sent yet, the host never sees it */
+  /* NOTE: may be off by one if the ISR sends it right after this test */
+  if ( g_report_pending )
+  {
+    STATS_INC( STATS_COALESCED );
+  }
+
+  /* publish it (single byte write cannot be interrupted halfway) */
+  g_report_pub = snap;
+  g_report_pending = 1;
+
+  /* NOTE: g_report_pending must be set before g_ep1_idle is tested: if the
+    IN transaction completes in between, the ISR sends the new report and
+    leaves g_ep1_idle cleared. Once g_ep1_idle is set, nothing but this
+    function arms EP1, so we own BD1IN here. */
+  if ( g_ep1_idle )
+  {
+    /* endpoint was free -> flag for transmission */
+    g_ep1_idle = 0;
+    g_report_pending = 0;
+    send_report();
+  }
+}
+
+
+#ifdef USB_STREAM
+/* queue a scan result for EP2 */
+/* NOTE: called from the main loop only, like usb_service() */
+void usb_stream( unsigned short buttons )
+{
+  volatile unsigned char * p;
+  unsigned char            n;
+
+  if ( g_config == 0U )
+  {
+    return;
+  }
+
+  n = g_stream_n;
+  if ( n == USB_STREAM_SAMPLES && g_stream_idle )
+  {
+    /* the packet before has just gone out: the full buffer follows it,
+      the sample starts the other one */
+    stream_send();
+    n = 0;
+  }
+  if ( n == USB_STREAM_SAMPLES )
+  {
+    /* the host has not polled for a while, both buffers are full */
+    ++g_stream_drops;
+  }
+  else
+  {
+    p = g_stream_buf + USB_STREAM_HEADER + n * USB_STREAM_SAMPLE;
+    p[0] = buttons & 0xFF;
+    p[1] = buttons >> 8;
+    p[2] = timebase_now() & 0xFF;
+    p[3] = TMR1L;   /* reading TMR1L latches TMR1H */
+    p[4] = TMR1H;
+    g_stream_n = ++n;
+  }
+
+  if ( g_stream_idle )
+  {
+    stream_send();
+  }
+}
+
+/* arm EP2 IN with the buffer being filled, the samples after it are
+  collected in the other buffer */
+/* NOTE: only while g_stream_idle is set, the packet before has been sent */
+static void stream_send( void )
+{
+  volatile unsigned char * p;
+
+  p = g_stream_buf;
+  p[0] = g_stream_seq++;
+  p[1] = g_stream_drops;
+  p[2] = CONFIG_MIPS;
+  p[3] = g_stream_n;
+  g_stream_idle = 0;
+  if ( p == USBMEM_PTR( EP2_IN ) )
+  {
+    BD2IN.BDADR  = USBMEM_ADDR( EP2_IN );
+    g_stream_buf = USBMEM_PTR( EP2_IN2 );
+  }
+  else
+  {
+    BD2IN.BDADR  = USBMEM_ADDR( EP2_IN2 );
+    g_stream_buf = USBMEM_PTR( EP2_IN );
+  }
+  BD2IN.BDCNT  = USB_STREAM_HEADER + g_stream_n * USB_STREAM_SAMPLE;
+  BD2IN.BDSTAT = _UOWN | _DTSEN | g_stream_dts;
+  g_stream_dts ^= _DTS;
+  g_stream_n = 0;
+}
+#endif
+
+
+#ifdef USB_LATCH
+/* latch request from the host */
+/* NOTE: called from the main loop only, the ISR does not touch BD1OUT
+  while g_latch_request is set */
+unsigned char usb_latched( void )
+{
+  unsigned char latch;
+
+  if ( !g_latch_request )
+  {
+    return 0;
+  }
+  latch = 0;
+  if ( BD1OUT.BDCNT == 2U && EP1RXBUF[0] == USB_LATCH_REPORT_ID )
+  {
+    if ( EP1RXBUF[1] == USB_LATCH_FREE )
+    {
+      g_latch_ondemand = 0;
+    }
+    else
+    {
+      g_latch_ondemand = 1;
+      latch = 1;
+    }
+  }
+
+  /* ready for the next one */
+  g_latch_dts ^= _DTS;
+  g_latch_request = 0;
+  BD1OUT.BDCNT  = USBMEM_EP1_OUT_SIZE;
+  BD1OUT.BDSTAT = _UOWN | _DTSEN | g_latch_dts;
+  return latch;
+}
+
+/* whether the host drives the scans */
+unsigned char usb_ondemand( void )
+{
+  return g_latch_ondemand;
+}
+#endif
+
+
+#ifdef PLAYBACK
+/* producer side of the playback stream */
+/* NOTE: called from the main loop only, the ISR does not touch BD2OUT
+  while g_play_received is set */
+void usb_playback( void )
+{
+  unsigned char n;
+
+  if ( g_play_received )
+  {
+    /* the packet in slot g_play_rx goes to the consumer, a zero-length
+      one (or a single byte) is received into the same slot again */
+    g_play_received = 0;
+    g_play_armed = 0;
+    g_play_dts ^= _DTS;
+    n = BD2OUT.BDCNT >> 1;
+    if ( n != 0U )
+    {
+      g_play_len[ g_play_rx ] = n;
+      if ( ++g_play_rx == USB_PLAYBACK_SLOTS )
+      {
+        g_play_rx = 0;
+      }
+    }
+  }
+
+  /* while the next slot is still being played, the SIE NAKs */
+  if ( !g_play_armed && g_config != 0U && g_play_len[ g_play_rx ] == 0U )
+  {
+    g_play_armed  = 1;
+    BD2OUT.BDADR  = USBMEM_ADDR( EP2_RING ) + g_play_rx * USB_PLAYBACK_SIZE;
+    BD2OUT.BDCNT  = USB_PLAYBACK_SIZE;
+    BD2OUT.BDSTAT = _UOWN | _DTSEN | g_play_dts;
+  }
+}
+
+/* consumer side of the playback stream */
+unsigned char usb_playback_next( unsigned short * buttons )
+{
+  volatile unsigned char * p;
+
+  if ( g_play_len[ g_play_tail ] == 0U )
+  {
+    return 0;
+  }
+  p = USBMEM_PTR( EP2_RING ) + g_play_tail * USB_PLAYBACK_SIZE +
+    2 * g_play_pos;
+  *buttons = p[0] | (unsigned short)p[1] << 8;
+  if ( ++g_play_pos == g_play_len[ g_play_tail ] )
+  {
+    /* slot played, back to the producer */
+    g_play_pos = 0;
+    g_play_len[ g_play_tail ] = 0;
+    if ( ++g_play_tail == USB_PLAYBACK_SLOTS )
+    {
+      g_play_tail = 0;
+    }
+  }
+  return 1;
+}
+
+/* work for the main loop */
+unsigned char usb_playback_busy( void )
+{
+  return g_ep0_events != 0U || g_play_received;
+}
+
+/* frames buffered */
+/* NOTE: the consumer may take one meanwhile */
+unsigned char usb_playback_buffered( void )
+{
+  unsigned char i;
+  unsigned char n;
+
+  n = -g_play_pos;
+  for ( i = 0; i < USB_PLAYBACK_SLOTS; i++ )
+  {
+    n += g_play_len[i];
+  }
+  return n;
+}
+
+/* drop the frames buffered */
+void usb_playback_flush( void )
+{
+  unsigned char i;
+
+  /* a packet received meanwhile is dropped as well */
+  usb_playback();
+  for ( i = 0; i < USB_PLAYBACK_SLOTS; i++ )
+  {
+    g_play_len[i] = 0;
+  }
+  g_play_tail = g_play_rx;
+  g_play_pos  = 0;
+  usb_playback();
+}
+#endif
+
+
+#ifdef USB_POLLED
+/* polled service */
+void usb_poll( void )
+{
+  if ( UIR & UIE )
+  {
+    usb_interrupt();
+  }
+}
+#endif
+
+/* fast interrupt path */
+/* NOTE: runs without the compiler's temporary data being saved, so only
+  bit operations, increments and plain assignments here (timebase_sof()
+  and latch_ep0() are as simple). The dispatcher only comes here for SOF, for
+  EP0 transactions, for an EP1 IN completion while no report is pending
+  and for EP1 OUT and EP2 completions, everything else goes to
+  usb_interrupt(). */
+void usb_fastint( void )
+{
+  /* NOTE: USBIF is cleared first, so a flag raised while we are here
+    (next USTAT FIFO entry) triggers a new interrupt */
+  PIR2 &= ~0x20;
+  if ( UIR & _TRNI )
+  {
+    if ( USTAT & 0x08 )
+    {
+#ifdef USB_LATCH
+      if ( ( USTAT & _DIR ) == 0U )
+      {
+        /* EP1 OUT: a latch request, see usb_latched() */
+        g_latch_request = 1;
+      }
+      else
+#endif
+      {
+        /* EP1 IN completed, nothing to send -> as in process_ep1() */
+        STATS_INC( STATS_SENT );
+        g_reportdts ^= _DTS;
+        g_ep1_idle = 1;
+      }
+    }
+#if defined( USB_STREAM ) || defined( PLAYBACK )
+    else if ( USTAT & 0x10 )
+    {
+#ifdef PLAYBACK
+      if ( ( USTAT & _DIR ) == 0U )
+      {
+        /* EP2 OUT: frames to play, see usb_playback() */
+        g_play_received = 1;
+      }
+#endif
+#ifdef USB_STREAM
+      if ( USTAT & _DIR )
+      {
+        /* EP2 IN completed, usb_stream() sends the next packet */
+        g_stream_idle = 1;
+      }
+#endif
+    }
+#endif
+    else
+    {
+      latch_ep0();
+    }
+    UIR &= ~_TRNI;
+  }
+  if ( UIR & _SOFI )
+  {
+    timebase_sof();
+    UIR &= ~_SOFI;
+  }
+}
+
+/* handle USB interrupt */
+void usb_interrupt( void ) 
+{
+  if ( ( UIE & _URSTI ) && ( UIR & _URSTI ) )
+  {
+    /* USB reset interrupt */
+    /* UADDR has already been set to 0 */
+    g_reportdts     = 0;
+    /* pending EP0 events are void, usb_service() prepares EP0 for the
+      next SETUP transaction (the host waits at least 10 ms for that) */
+    g_ep0_events    = EP0_RESET;
+    STATS_INC( STATS_RESET );
+    UIR = 0x00;         /* clear all other USB interrupts */
+  }
+  if ( ( UIE & _TRNI ) && ( UIR & _TRNI ) )
+  {
+    /* USB transaction complete interrupt */
+    /* read USTAT register */
+    switch ( USTAT & 0x78 )
+    {
+      case 0x00:
+        latch_ep0();    /* endpoint 0, see usb_service() */
+        break;
+      case 0x08:
+        process_ep1();  /* process endpoint 1 */
+        break;
+#if defined( USB_STREAM ) || defined( PLAYBACK )
+      case 0x10:
+#ifdef PLAYBACK
+        if ( ( USTAT & _DIR ) == 0U )
+        {
+          g_play_received = 1;  /* see usb_playback() */
+        }
+#endif
+#ifdef USB_STREAM
+        if ( USTAT & _DIR )
+        {
+          g_stream_idle = 1;  /* see usb_stream() */
+        }
+#endif
+        break;
+#endif
+    }
+  }
+  if ( ( UIE & _SOFI ) && ( UIR & _SOFI ) )
+  {
+    /* start-of-frame token received, drives the millisecond tick */
+    timebase_sof();
+  }
+  if ( ( UIE & _UERRI ) && ( UIR & _UERRI ) )
+  {
+    /* USB error condition interrupt */
+    /* NOTE: the SIE has discarded the packet, the host retries */
+    stats_usberror( UEIR );
+    UEIR = 0x00;  /* clear USB error interrupt flags */
+  }
+  if ( ( UIE & _STALLI ) && ( UIR & _STALLI ) )
+  {
+    /* a STALL handshake was sent */
+    STATS_INC( STATS_STALL );
+  }
+  if ( ( UIE & _IDLEI ) && ( UIR & _IDLEI ) )
+  {
+    /* idle condition detected */
+    UCON |= _SUSPND;  /* place SIE in suspend state */
+    OSCCON &= ~0x80;  /* real SLEEP, also if we came from the idle profile */
+    timebase_suspend();  /* no more SOF tokens from now on */
+    UIR  = 0x00;      /* clear all interrupt conditions */
+    /* NOTE: only USBIF, CCP1IF belongs to the CCP1 handler (CCP1_HIGH) */
+    PIR2 &= ~0x20;    /* (required for SLEEP mode) */
+    UIE = _ACTVI;     /* enable only ACTVIF interrupt */
+    Sleep();          /* enter SLEEP state */
+  }
+  if ( ( UIE & _ACTVI ) && ( UIR & _ACTVI ) )
+  {
+    /* bus activity detected */
+    UCON &= ~_SUSPND;   /* enable normal SIE operation again */
+    /* enable USB interrupts again */
+    UIE = _SOFI | _STALLI | _IDLEI | _TRNI | _UERRI | _URSTI;
+  }
+  
+  UIR = 0x00;  /* clear USB interrupt flags */
+}
+
+
+/* EP0 transaction completed: latch it for usb_service() */
+/* NOTE: called from the ISR (fast path as well), the SIE NAKs further
+  transactions to the released buffer descriptor, after a SETUP also all
+  other transactions (PKTDIS) */
+static void latch_ep0( void )
+{
+  if ( USTAT & _DIR )
+  {
+    g_ep0_events |= EP0_IN;
+    if ( g_ep0_nextcnt != EP0_NONE )
+    {
+      /* next packet of a control read, the host gets it with its next IN
+        token instead of a NAK */
+      BD0IN.BDADR   = g_ep0_nextadr;
+      BD0IN.BDCNT   = g_ep0_nextcnt;
+      BD0IN.BDSTAT  = g_ep0_nextstat;
+      g_ep0_nextcnt = EP0_NONE;
+    }
+    else
+    {
+      g_ep0_starved = 1;
+    }
+  }
+  else
+  {
+    g_ep0_events |= EP0_OUT;
+    if ( BD0OUT.BDCNT == 0U && ( BD0OUT.BDSTAT & 0x3C ) != PID_SETUP )
+    {
+      /* zero-length OUT: status stage of a control read, the host may
+        send the next SETUP right away, so BD0OUT is prepared for it here
+        (usb_service() still finishes the transfer) */
+      BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+      BD0OUT.BDSTAT = _UOWN;
+    }
+  }
+}
+
+
+/* bottom half of EP0: processes the latched transactions */
+/* NOTE: called from the main loop between scans, so descriptor lookups,
+  copying and debug output do not delay the SNES clock phases */
+unsigned char usb_service( void )
+{
+  if ( g_ep0_events == 0U )
+  {
+    return 0;
+  }
+
+  if ( g_ep0_events & EP0_RESET )
+  {
+    /* bus reset */
+    g_ep0_events &= ~EP0_RESET;
+    g_addr   = 0;
+    g_config = 0;
+    g_curtrf = TRF_NONE;
+    g_ep0_nextcnt = EP0_NONE;
+    /* EP0 is ready for SETUP transaction: */
+    BD0IN.BDSTAT  = 0x00;
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN;
+#ifdef USB_LATCH
+    /* back to free-running scans, the next request is DATA0 again */
+    g_latch_request  = 0;
+    g_latch_dts      = 0;
+    g_latch_ondemand = 0;
+    BD1OUT.BDCNT  = USBMEM_EP1_OUT_SIZE;
+    BD1OUT.BDSTAT = _UOWN | _DTSEN;
+#endif
+#ifdef USB_STREAM
+    /* the packet on EP2 is void, the stream starts again when configured */
+    BD2IN.BDSTAT  = 0x00;
+    g_stream_n    = 0;
+    g_stream_dts  = 0;
+    g_stream_idle = 1;
+#endif
+#ifdef PLAYBACK
+    /* the frames buffered are void, the next packet is DATA0 again */
+    /* NOTE: the consumer may run meanwhile, at worst it plays a frame of
+      the old stream */
+    BD2OUT.BDSTAT   = 0x00;
+    g_play_received = 0;
+    g_play_armed    = 0;
+    g_play_dts      = 0;
+    usb_playback_flush();
+#endif
+    PROFILE_BOOT( BOOT_RESET );
+    DEBUG_OUT( 'R' );
+    DEBUG_OUT( '\r' );
+    DEBUG_OUT( '\n' );
+    return 1;
+  }
+
+  /* both directions may be pending, process them in bus order: the OUT
+    data stage of a control write comes before its IN status stage, the
+    IN data stage of a control read before its OUT status stage, and a
+    SETUP comes after everything else */
+  if ( ( g_ep0_events & EP0_OUT ) && g_curtrf == TRF_OUT &&
+    ( BD0OUT.BDSTAT & 0x3C ) != PID_SETUP )
+  {
+    g_ep0_events &= ~EP0_OUT;
+    process_ep0( 0 );
+  }
+  if ( g_ep0_events & EP0_IN )
+  {
+    g_ep0_events &= ~EP0_IN;
+    process_ep0( _DIR );
+  }
+  if ( g_ep0_events & EP0_OUT )
+  {
+    g_ep0_events &= ~EP0_OUT;
+    process_ep0( 0 );
+  }
+  return 1;
+}
+
+
+/* process transaction at endpoint 0 */
+/* dir: _DIR for IN transaction, 0 for SETUP or OUT transaction */
+static void process_ep0( unsigned char dir )
+{
+  unsigned char  req;       /* bRequest field */
+  unsigned char  desc;      /* descriptor type requested */
+  unsigned char  tocopy;    /* amount of data to copy */
+  unsigned short requested; /* number of bytes requested by the host */
+  unsigned short value;     /* wValue field */
+  unsigned char  setup;     /* this transaction was a SETUP */
+  unsigned char  i;
+  
+  setup = 0;
+  
+  /* find out which BD caused interrupt */
+  if ( dir == 0U )
+  {
+    /* last transaction was OUT or SETUP transaction */
+    if ( ( BD0OUT.BDSTAT & 0x3C ) == PID_SETUP )
+    {
+      /* received SETUP transaction */
+      DEBUG_OUT( 'S' );
+      setup = 1;
+      g_curtrf = TRF_NONE;   /* abort any transfer currently running */
+      g_curtrf_dts = _DTS;   /* next transaction must be DATA1 */
+      g_curtrf_report = 0;
+      /* take back BD0IN and the packet prepared for the last control read
+        (the SIE leaves both alone while PKTDIS is set) */
+      BD0IN.BDSTAT = 0x00;
+      g_ep0_nextcnt = EP0_NONE;
+      
+      req = ((struct ctrltrf_setup *)EP0RXBUF)->bRequest;
+      if ( ( ((struct ctrltrf_setup *)EP0RXBUF)->bmRequestType & 0x60 ) == 0x20U )
+      {
+        /* Explanation: we "fold" bRequest and bmRequestType together into one
+          value. By that we can use the same code for handling class-specific
+          requests. */
+        req |= 0x80;  /* bit 7 identifies this as class-specific request */
+      }
+      else if ( ( ((struct ctrltrf_setup *)EP0RXBUF)->bmRequestType & 0x60 ) == 0x40U )
+      {
+        req |= 0xC0;  /* bits 7 and 6 identify vendor-specific requests */
+      }
+      
+      switch ( req )
+      {
+        case REQ_GET_DESCRIPTOR:
+          DEBUG_OUT( 'D' );
+          desc = ((struct ctrltrf_setup *)EP0RXBUF)->wValue >> 8;
+          requested = ((struct ctrltrf_setup *)EP0RXBUF)->wLength ;
+          DEBUG_OUT( '0' + ( requested >> 4 ) );
+          DEBUG_OUT( '0' + ( requested & 0x0F ) );
+          switch ( desc )
+          {
+            case DESC_DEVICE:
+              DEBUG_OUT( 'd' );
+              g_curtrf = TRF_IN;
+              g_curtrf_data = dev_desc;
+              g_curtrf_left = sizeof( dev_desc );
+              /* endpoint for IN transaction will be prepared below */
+              break;
+            case DESC_CONFIGURATION:
+              DEBUG_OUT( 'c' );
+              g_curtrf = TRF_IN;
+              g_curtrf_data = cfg_desc;
+              g_curtrf_left = sizeof( cfg_desc );
+              /* endpoint for IN transaction will be prepared below */
+              break;
+            case DESC_REPORT:
+              DEBUG_OUT( 'r' );
+              g_curtrf = TRF_IN;
+              g_curtrf_data = report_desc;
+              g_curtrf_left = sizeof( report_desc );
+              /* endpoint for IN transaction will be prepared below */
+              break;
+            case DESC_STRING:
+              DEBUG_OUT( 's' );
+              g_curtrf = TRF_IN;
+              switch ( ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0xFF )
+              {
+                case 0:
+                  DEBUG_OUT( '0' );
+                  g_curtrf_data = string_desc_lang;
+                  g_curtrf_left = sizeof( string_desc_lang );
+                  break;
+                case 1:
+                  DEBUG_OUT( '1' );
+                  g_curtrf_data = string_desc_man;
+                  g_curtrf_left = sizeof( string_desc_man );
+                  break;
+                case 2:
+                  DEBUG_OUT( '2' );
+                  g_curtrf_data = string_desc_prod;
+                  g_curtrf_left = sizeof( string_desc_prod );
+                  break;
+                case 3:
+                  DEBUG_OUT( '3' );
+                  g_curtrf_data = string_desc_serial;
+                  g_curtrf_left = sizeof( string_desc_serial );
+                  break;
+                default:
+                  DEBUG_OUT( 'u' );
+                  g_curtrf_left = 0;
+              }
+              /* endpoint for IN transaction will be prepared below */
+              break;
+            default:
+              /* unsupported descriptor -> send STALL */
+              /* (will be cleared with next SETUP transaction) */
+              DEBUG_OUT( 'u' );
+              DEBUG_OUT( desc );
+              BD0OUT.BDSTAT = _UOWN | _BSTALL;
+              BD0IN.BDSTAT = _UOWN | _BSTALL;
+          }
+
+          /* correct amount of bytes if necessary */
+          if ( requested < g_curtrf_left )
+          {
+            g_curtrf_left = requested;
+          }
+          
+          /* descriptors come from ROM */
+          g_curtrf_mem = TRF_ROM;
+          break;
+/*        case REQ_SET_DESCRIPTOR:
+          BD0OUT.BDSTAT = _UOWN | _BSTALL;
+          BD0IN.BDSTAT = _UOWN | _BSTALL;
+          /*
+          g_curtrf = TRF_OUT;
+          g_curtrf_mem = TRF_RAM;
+          g_curtrf_data = &buffermem;
+          g_curtrf_left = sizeof( buffermem );
+          break;  */
+        case REQ_SET_ADDRESS:
+          DEBUG_OUT( 'A' );
+          g_curtrf = TRF_OUT;
+          g_curtrf_left = 0;
+          g_addr = ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0x7F;
+          break;
+        case REQ_SET_CONFIGURATION:
+          /* the lower byte of wValue contains configuration number */
+          DEBUG_OUT( 'C' );
+          DEBUG_OUT( 's' );
+          g_curtrf = TRF_OUT;
+          g_curtrf_left = 0;
+          g_config = ((struct ctrltrf_setup *)EP0RXBUF)->wValue & 0xFF;
+          PROFILE_CONFIGURED();
+          PROFILE_BOOT( BOOT_CONFIGURED );
+          break;
+        case REQ_GET_CONFIGURATION:
+          DEBUG_OUT( 'C' );
+          DEBUG_OUT( 'g' );
+          g_curtrf = TRF_IN;
+          g_curtrf_mem = TRF_RAM;
+          g_curtrf_data = &g_config;
+          g_curtrf_left = 1;
+          break;
+        case REQ_GET_REPORT:
+          DEBUG_OUT( 'P' );
+          /* wValue: high-byte = report type, low-byte = report ID */
+          value = ((struct ctrltrf_setup *)EP0RXBUF)->wValue;
+          g_curtrf_mem = TRF_RAM;
+          if ( value == ( REPORT_INPUT << 8 | REPORT_ID ) )
+          {
+            g_curtrf = TRF_IN;
+            g_curtrf_data = g_report_snap[ g_report_pub ];
+            g_curtrf_left = REPORT_SIZE;
+          }
+          else if ( value == ( REPORT_FEATURE << 8 | LOOPBACK_REPORT_ID ) )
+          {
+            g_curtrf = TRF_IN;
+            g_featurebuf[0] = LOOPBACK_REPORT_ID;
+            loopback_getreport( g_featurebuf + 1 );
+            g_curtrf_data = g_featurebuf;
+            g_curtrf_left = 1 + LOOPBACK_REPORT_SIZE;
+          }
+          else if ( value == ( REPORT_FEATURE << 8 | STATS_REPORT_ID ) )
+          {
+            g_curtrf = TRF_IN;
+            g_featurebuf[0] = STATS_REPORT_ID;
+            stats_getreport( g_featurebuf + 1 );
+            g_curtrf_data = g_featurebuf;
+            g_curtrf_left = 1 + STATS_REPORT_SIZE;
+          }
+#ifdef PLAYBACK
+          else if ( value == ( REPORT_FEATURE << 8 | PLAYBACK_REPORT_ID ) )
+          {
+            g_curtrf = TRF_IN;
+            g_featurebuf[0] = PLAYBACK_REPORT_ID;
+            playback_getreport( g_featurebuf + 1 );
+            g_curtrf_data = g_featurebuf;
+            g_curtrf_left = 1 + PLAYBACK_REPORT_SIZE;
+          }
+#endif
+          else
+          {
+            /* unknown report -> send STALL */
+            BD0OUT.BDSTAT = _UOWN | _BSTALL;
+            BD0IN.BDSTAT = _UOWN | _BSTALL;
+          }
+          requested = ((struct ctrltrf_setup *)EP0RXBUF)->wLength;
+          if ( requested < g_curtrf_left )
+          {
+            g_curtrf_left = requested;
+          }
+          break;
+        case REQ_SET_REPORT:
+          DEBUG_OUT( 'Q' );
+          value = ((struct ctrltrf_setup *)EP0RXBUF)->wValue;
+          if ( value == ( REPORT_FEATURE << 8 | LOOPBACK_REPORT_ID ) &&
+            ((struct ctrltrf_setup *)EP0RXBUF)->wLength ==
+              1 + LOOPBACK_REPORT_SIZE )
+          {
+            /* data stage goes to g_featurebuf, see OUT transaction below */
+            g_curtrf = TRF_OUT;
+            g_curtrf_mem = TRF_RAM;
+            g_curtrf_data = g_featurebuf;
+            g_curtrf_left = 1 + LOOPBACK_REPORT_SIZE;
+            g_curtrf_report = LOOPBACK_REPORT_ID;
+          }
+#ifdef PLAYBACK
+          else if ( value == ( REPORT_FEATURE << 8 | PLAYBACK_REPORT_ID ) &&
+            ((struct ctrltrf_setup *)EP0RXBUF)->wLength ==
+              1 + PLAYBACK_REPORT_SIZE )
+          {
+            g_curtrf = TRF_OUT;
+            g_curtrf_mem = TRF_RAM;
+            g_curtrf_data = g_featurebuf;
+            g_curtrf_left = 1 + PLAYBACK_REPORT_SIZE;
+            g_curtrf_report = PLAYBACK_REPORT_ID;
+          }
+#endif
+          else
+          {
+            /* unknown report -> send STALL */
+            BD0OUT.BDSTAT = _UOWN | _BSTALL;
+            BD0IN.BDSTAT = _UOWN | _BSTALL;
+          }
+          break;
+        case REQ_SET_IDLE:
+          DEBUG_OUT( 'L' );
+          g_curtrf = TRF_OUT;
+          g_curtrf_left = 0;
+          break;
+#ifdef BOOTLOADER
+        case REQ_ENTER_BOOTLOADER:
+          /* restart into the USB bootloader (see boot/), which stays
+            active after a RESET instruction */
+          DEBUG_OUT( 'B' );
+          g_curtrf = TRF_OUT;
+          g_curtrf_left = 0;
+          g_reboot = 1;
+          break;
+#endif
+        default:
+          /* unsupported request -> send STALL */
+          /* (will be cleared with next SETUP transaction) */
+          DEBUG_OUT( 'U' );
+          DEBUG_OUT( req );
+          BD0OUT.BDSTAT = _UOWN | _BSTALL;
+          BD0IN.BDSTAT = _UOWN | _BSTALL;
+      }
+      
+      /* clear PKTDIS because it is set after each SETUP transaction */
+      UCON &= ~_PKTDIS;
+      
+    } /* if ( pid == PID_SETUP ) */
+    else
+    {
+      /* received OUT transaction */
+      
+      DEBUG_OUT( 'O' );
+      if ( g_curtrf == TRF_IN )
+      {
+        /* OUT transaction from host means Status stage */
+        /* -> transfer is complete */
+        g_curtrf = TRF_NONE;
+        g_ep0_nextcnt = EP0_NONE;
+      }
+      else if ( g_curtrf == TRF_OUT )
+      {
+        /* copy received data to memory */
+        tocopy = BD0OUT.BDCNT;
+        memcpy( (void *)g_curtrf_data, (const void *)EP0RXBUF, tocopy );
+        g_curtrf_data += tocopy;
+        g_curtrf_left -= tocopy;
+        g_curtrf_dts ^= _DTS;       /* toggle DTS bit */
+        if ( g_curtrf_left == 0U && g_curtrf_report == LOOPBACK_REPORT_ID )
+        {
+          /* feature report complete */
+          loopback_setreport( g_featurebuf + 1 );
+        }
+#ifdef PLAYBACK
+        if ( g_curtrf_left == 0U && g_curtrf_report == PLAYBACK_REPORT_ID )
+        {
+          playback_setreport( g_featurebuf + 1 );
+        }
+#endif
+      }
+    } /* if ( pid != PID_SETUP ) */
+    
+  } /* if ( dir == 0 ) */
+  else
+  {
+    /* last transaction was IN transaction */
+    
+    DEBUG_OUT( 'I' );
+    /* data stage of a control read: latch_ep0() has already passed the
+      next packet to the SIE, the one after it will be prepared below */
+    if ( g_curtrf == TRF_OUT )
+    {
+      /* IN transaction from host means Status stage */
+      /* host sent acknowledge -> transfer complete */
+      g_curtrf = TRF_NONE;
+      if ( g_addr != 0U )
+      {
+        /* we received our new address in this transaction! */
+        DEBUG_OUT( '0' + ( g_addr >> 4 ) );
+        DEBUG_OUT( '0' + ( g_addr & 0x0F ) );
+        UADDR = g_addr;
+        g_addr = 0;
+        PROFILE_BOOT( BOOT_ADDRESS );
+      }
+      if ( g_reboot )
+      {
+        /* host has acknowledged the request -> restart */
+        Reset();
+      }
+    }
+  } /* if ( dir != 0 ) */
+
+ 
+  /* prepare next transaction */
+  if ( g_curtrf == TRF_IN )
+  {
+    /* transaction is IN, prepare next IN transaction */
+    if ( setup )
+    {
+      /* nothing is on the bus yet, the first packet goes out as soon as
+        it is ready */
+      g_ep0_starved = 1;
+      ep0_prepare();
+    }
+    if ( g_ep0_nextcnt == EP0_NONE )
+    {
+      ep0_prepare();
+    }
+    
+    /* also prepare RX buffer, for receiving Status transaction */
+    /* NOTE: only once after the SETUP: the host may send the Status
+      transaction before we have seen the last IN transaction, then BD0OUT
+      must stay with the SIE's result until we get to it */
+    if ( setup )
+    {
+      BD0OUT.BDCNT  = 0;  /* Status transaction has empty data packet */
+      BD0OUT.BDSTAT = _UOWN | _DTSEN | _DTS;  /* Status is always DATA1 */
+    }
+  }
+  else if ( g_curtrf == TRF_OUT )
+  {
+    /* transaction is OUT, prepare RX buffer further OUT transactions */
+    BD0OUT.BDCNT  = ( g_curtrf_left <= USBMEM_EP0_OUT_SIZE ) ?
+      g_curtrf_left : USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN | _DTSEN | g_curtrf_dts;
+    
+    /* also prepare TX buffer, for sending Status transaction */
+    /* (only once after the SETUP, see above) */
+    if ( setup )
+    {
+      BD0IN.BDCNT  = 0;     /* empty data packet */
+      BD0IN.BDSTAT = _UOWN | _DTSEN | _DTS; /* Status is always DATA1 */
+    }
+  }
+  else if ( ( BD0OUT.BDSTAT & _UOWN ) == 0U &&
+    ( g_ep0_events & EP0_OUT ) == 0U )
+  {
+    /* transfer has been completed (g_curtrf = TRF_NONE) */
+    /* prepare to receive next SETUP transaction */
+    /* (unless latch_ep0() has done so, or the SIE has already put one into
+      BD0OUT, which is still waiting for usb_service(); UOWN is tested
+      first, while we own BD0OUT no SETUP can come in between) */
+    BD0OUT.BDCNT  = USBMEM_EP0_OUT_SIZE;
+    BD0OUT.BDSTAT = _UOWN;
+  }
+}
+
+
+/* prepare the next IN packet of a control read */
+/* NOTE: only while none is prepared, so latch_ep0() does not touch BD0IN
+  meanwhile */
+static void ep0_prepare( void )
+{
+  volatile unsigned char * buf;
+  unsigned short           adr;
+  unsigned char            stat;
+  unsigned char            n;
+
+  /* the buffer which is not on the bus */
+  if ( BD0IN.BDADR == USBMEM_ADDR( EP0_IN ) )
+  {
+    buf = USBMEM_PTR( EP0_IN2 );
+    adr = USBMEM_ADDR( EP0_IN2 );
+  }
+  else
+  {
+    buf = USBMEM_PTR( EP0_IN );
+    adr = USBMEM_ADDR( EP0_IN );
+  }
+
+  /* NOTE: We send packet regardless of whether there is still data
+     remaining or not. When the host requests more data than we have,
+     we are required to send a zero-length data packet. */
+  n = ( g_curtrf_left <= USBMEM_EP0_IN_SIZE ) ?
+    g_curtrf_left : USBMEM_EP0_IN_SIZE;
+  if ( n != 0U )
+  {
+    if ( g_curtrf_mem == TRF_RAM )
+    {
+      memcpy( (void *)buf, (const void *)g_curtrf_data, n );
+    }
+    else
+    {
+      desc_stream( buf, (const rom unsigned char *)g_curtrf_data, n );
+    }
+  }
+  g_curtrf_left -= n;
+  g_curtrf_data += n;
+  stat = _UOWN | _DTSEN | g_curtrf_dts;
+  g_curtrf_dts ^= _DTS;       /* toggle DTS bit */
+
+  /* publish it, the size last */
+  g_ep0_nextadr  = adr;
+  g_ep0_nextstat = stat;
+  g_ep0_nextcnt  = n;
+
+  if ( g_ep0_starved )
+  {
+    /* the SIE released BD0IN before the packet was published, so it is
+      sent from here; no IN transaction can complete in between */
+    g_ep0_starved = 0;
+    g_ep0_nextcnt = EP0_NONE;
+    BD0IN.BDADR  = adr;
+    BD0IN.BDCNT  = n;
+    BD0IN.BDSTAT = stat;
+  }
+}
+
+/* copy n (1..255) bytes of a ROM descriptor, table reads without the
+  library's overhead per byte */
+static void desc_stream( volatile unsigned char * dst,
+  const rom unsigned char * src, unsigned char n )
+{
+#if defined( __18CXX )
+  TBLPTRU = 0;
+  TBLPTRH = (unsigned short)src >> 8;
+  TBLPTRL = (unsigned short)src & 0xFF;
+  FSR0H   = (unsigned short)dst >> 8;
+  FSR0L   = (unsigned short)dst & 0xFF;
+  g_stream_count = n;
+  _asm
+    stream:
+      TBLRDPOSTINC
+      MOVFF TABLAT, POSTINC0
+      DECFSZ g_stream_count, 1, 0
+      BRA stream
+  _endasm
+#else
+  /* host simulator build (see ../host/sim) */
+  memcpy( (void *)dst, (const void *)src, n );
+#endif
+}
+
+
+/* process interrupt at endpoint 1 */
+static void process_ep1( void )
+{
+#ifdef USB_LATCH
+  if ( ( USTAT & _DIR ) == 0U )
+  {
+    /* latch request, see usb_latched() */
+    g_latch_request = 1;
+    return;
+  }
+#endif
+
+  /* IN transfer completed */
+  /* we just change the DTS value for the next transmission */
+  STATS_INC( STATS_SENT );
+  g_reportdts ^= _DTS;
+
+  if ( g_report_pending )
+  {
+    /* report changed while the last one was on the bus -> send latest */
+    g_report_pending = 0;
+    send_report();
+  }
+  else
+  {
+    /* nothing to send, usb_reportchanged() will arm the endpoint */
+    g_ep1_idle = 1;
+  }
+}
+
+
+/* copy the published report snapshot to EP1 and flag for transmission */
+/* NOTE: caller must own BD1IN, i.e. be the EP1 ISR or have claimed
+  g_ep1_idle */
+static void send_report( void )
+{
+  unsigned char snap;
+
+  snap = g_report_pub;
+  memcpy( (void *)EP1TXBUF, (const void *)g_report_snap[snap], REPORT_SIZE );
+  BD1IN.BDCNT  = REPORT_SIZE;
+  BD1IN.BDSTAT = _UOWN | _DTSEN | g_reportdts;
+}
@@ -1,16 +1,120 @@
-#ifndef USB_H
-#define USB_H
-
-/* initializes the USB module */
-void usb_init( void );
-
-/* an USB interrupt occurred */
-void usb_interrupt( void );
-
-/* HID report data has been changed */
-void usb_reportchanged( void );
-
-/* HID report containing which button is pressed */
-extern unsigned char g_hidreport[2]; 
-
-#endif  /* defined USB_H */
\ No newline at end of file
+#ifndef USB_H
+#define USB_H
+
+/* USB_POLLED: no interrupts at all, usb_poll() is called between the
+  phases of the SNES scan, the other interrupt sources are serviced from
+  the main loop between scans */
+#undef USB_POLLED
+
+/* USB_STREAM: a second interface (vendor specific, full-speed only) streams
+  every scan result through EP2 IN, see usb_stream() */
+#undef USB_STREAM
+
+/* USB_LATCH: the game pad interface gets an interrupt OUT endpoint (EP1,
+  full-speed only) for the output report USB_LATCH_REPORT_ID, with which
+  the host asks for a scan at a moment it chooses, see usb_latched() */
+#undef USB_LATCH
+
+/* latch request (USB_LATCH), output report of one byte after the ID:
+
+    1  scan now and report the result, whether it changed or not; from
+       now on only these requests start scans (on demand)
+    0  back to scans on the device's own schedule
+
+  the device leaves the on-demand mode by itself on a bus reset. The answer
+  is the first report stamped with the frame of the request or later, a
+  report armed at EP1 before still goes out first. */
+#define USB_LATCH_REPORT_ID  4
+#define USB_LATCH_NOW        1
+#define USB_LATCH_FREE       0
+
+/* sample stream packet (USB_STREAM), at most one per frame:
+
+    [0] sequence number, counts packets
+    [1] samples dropped because both buffers were full (both wrap around)
+    [2] instruction cycles per us (CONFIG_MIPS, see config.h)
+    [3] number of samples n (0..USB_STREAM_SAMPLES), then n times
+        buttons (enum snes_buttons, 2 bytes), low byte of timebase_now(),
+        Timer1 (instruction cycles, 2 bytes)
+
+  all little-endian. The tick tells how many Timer1 wraps lie between two
+  samples (less than one per ms at any clock), Timer1 when within the ms
+  the scan finished. */
+#define USB_STREAM_SIZE     64
+#define USB_STREAM_HEADER   4
+#define USB_STREAM_SAMPLE   5
+#define USB_STREAM_SAMPLES  \
+  ( ( USB_STREAM_SIZE - USB_STREAM_HEADER ) / USB_STREAM_SAMPLE )
+
+/* playback stream (PLAYBACK, see playback.h), EP2 OUT at full-speed:
+  packets of up to USB_PLAYBACK_SIZE bytes, each two bytes one frame
+  (enum snes_buttons, little-endian), in the order of the latches they are
+  for. The adapter buffers USB_PLAYBACK_SLOTS packets; while all are taken
+  the endpoint NAKs, which paces the host. An odd byte is ignored. */
+#define USB_PLAYBACK_SIZE   32
+#ifdef USB_STREAM
+#define USB_PLAYBACK_SLOTS  2   /* what USB RAM has left beside the stream */
+#else
+#define USB_PLAYBACK_SLOTS  6
+#endif
+
+/* initializes the USB module */
+void usb_init( void );
+
+/* an USB interrupt occurred */
+void usb_interrupt( void );
+
+/* USB_POLLED: services the USB module if it has work */
+void usb_poll( void );
+
+/* fast interrupt path: EP0 transactions, EP1 IN completion without a
+  pending report, and SOF (see isr_dispatch() in main.c) */
+void usb_fastint( void );
+
+/* processes control transfers latched by the ISR, called from the main
+  loop, returns whether there was something to do */
+unsigned char usb_service( void );
+
+/* HID report data has been changed */
+void usb_reportchanged( void );
+
+/* USB_STREAM: queues a scan result for EP2, called from the main loop
+  after each scan */
+void usb_stream( unsigned short buttons );
+
+/* USB_LATCH: returns whether the host asked for a scan since the last
+  call, called from the main loop, which answers each request with the
+  next scan it starts (EP1 OUT NAKs the next request until this call) */
+unsigned char usb_latched( void );
+
+/* USB_LATCH: returns whether the host has taken over the scan schedule */
+unsigned char usb_ondemand( void );
+
+/* PLAYBACK: takes the packet received at EP2 OUT into the buffer and arms
+  the endpoint for the next one while a slot is free, called from the main
+  loop */
+void usb_playback( void );
+
+/* PLAYBACK: takes the next frame from the buffer, returns 0 if it is empty
+  (called from the high priority interrupt, or with it blocked) */
+unsigned char usb_playback_next( unsigned short * buttons );
+
+/* PLAYBACK: returns whether a control transfer stage or a playback packet
+  waits for the main loop, which then cuts its search for the latch short */
+unsigned char usb_playback_busy( void );
+
+/* PLAYBACK: returns the number of frames buffered */
+unsigned char usb_playback_buffered( void );
+
+/* PLAYBACK: drops all frames buffered (called from the main loop with the
+  high priority interrupt blocked) */
+void usb_playback_flush( void );
+
+/* HID report containing which button is pressed */
+extern unsigned char g_hidreport[2]; 
+
+/* a report waits for EP1 IN, tested by the interrupt dispatcher */
+/* NOTE: in access RAM, so it can be tested without changing BSR */
+extern near volatile unsigned char g_report_pending;
+
+#endif  /* defined USB_H */
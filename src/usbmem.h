@@ -0,0 +1,135 @@
+#ifndef USBMEM_H
+#define USBMEM_H
+
+/* Layout of the USB dual-port RAM (0x400..0x4FF)
+
+  The buffer descriptor table and all endpoint buffers are placed at build
+  time from an endpoint set declared by the including file:
+
+    #define USBMEM_NUM_EP  2                 number of endpoints
+    #define USBMEM_PPB     USBMEM_PPB_NONE   ping-pong buffering mode
+    #define USBMEM_TABLE \
+      USBMEM_EP( 0, 8, 8 ) \                 endpoint, OUT size, IN size
+      USBMEM_EP( 1, 0, 8 ) \
+      USBMEM_BUF( SCRATCH, 16 )              buffer without descriptor
+
+  Endpoints 0..USBMEM_NUM_EP-1 must be listed in ascending order without
+  gaps, a size of 0 means that the direction has no buffer. For each
+  endpoint direction with a ping-pong pair a second buffer of the same size
+  is allocated. The build fails if the endpoints are listed otherwise or if
+  the layout does not fit into USB RAM. */
+
+/* ping-pong buffering modes, value of UCFG bits PPB1:PPB0 */
+#define USBMEM_PPB_NONE     0   /* no ping-pong buffers */
+#define USBMEM_PPB_EP0OUT   1   /* ping-pong buffers for EP0 OUT only */
+#define USBMEM_PPB_ALL      2   /* ping-pong buffers for all endpoints */
+#define USBMEM_PPB_ALLBUT0  3   /* all endpoints except EP0 */
+
+#define USBMEM_BASE   0x400   /* BDT always starts at begin of USB RAM */
+#define USBMEM_LIMIT  256     /* size of USB RAM */
+
+/* directions */
+#define USBMEM_OUT    0
+#define USBMEM_IN     1
+
+/* one entry in the buffer descriptor table */
+struct bd_entry
+{
+  unsigned char  BDSTAT;  /* BD Status register */
+  unsigned char  BDCNT;   /* BD Byte Count register */
+  unsigned short BDADR;   /* BD Address register */
+};
+
+/* USBMEM_HAS_PP: whether an endpoint direction has a ping-pong pair */
+/* USBMEM_BDINDEX: position of a descriptor in the BDT, as used by the SIE */
+#if USBMEM_PPB == USBMEM_PPB_NONE
+  #define USBMEM_HAS_PP( ep, dir )        0
+  #define USBMEM_BDINDEX( ep, dir, odd )  ( (ep) * 2 + (dir) )
+#elif USBMEM_PPB == USBMEM_PPB_EP0OUT
+  #define USBMEM_HAS_PP( ep, dir )  ( (ep) == 0 && (dir) == USBMEM_OUT )
+  #define USBMEM_BDINDEX( ep, dir, odd ) \
+    ( (ep) == 0 ? ( (dir) == USBMEM_OUT ? (odd) : 2 ) : (ep) * 2 + (dir) + 1 )
+#elif USBMEM_PPB == USBMEM_PPB_ALL
+  #define USBMEM_HAS_PP( ep, dir )        1
+  #define USBMEM_BDINDEX( ep, dir, odd )  ( (ep) * 4 + (dir) * 2 + (odd) )
+#elif USBMEM_PPB == USBMEM_PPB_ALLBUT0
+  #define USBMEM_HAS_PP( ep, dir )        ( (ep) != 0 )
+  #define USBMEM_BDINDEX( ep, dir, odd ) \
+    ( (ep) == 0 ? (dir) : (ep) * 4 - 2 + (dir) * 2 + (odd) )
+#endif
+
+/* number of entries in the BDT (up to the last endpoint's IN descriptor) */
+#define USBMEM_NUM_BD \
+  ( USBMEM_BDINDEX( USBMEM_NUM_EP - 1, USBMEM_IN, \
+      USBMEM_HAS_PP( USBMEM_NUM_EP - 1, USBMEM_IN ) ) + 1 )
+
+/* buffer sizes: USBMEM_EPn_OUT_SIZE, USBMEM_EPn_IN_SIZE, USBMEM_name_SIZE */
+#define USBMEM_EP( ep, outsize, insize ) \
+  USBMEM_EP##ep##_OUT_SIZE = (outsize), \
+  USBMEM_EP##ep##_IN_SIZE = (insize),
+#define USBMEM_BUF( name, size ) \
+  USBMEM_##name##_SIZE = (size),
+enum usbmem_sizes
+{
+  USBMEM_TABLE
+  USBMEM_SIZES_END
+};
+#undef USBMEM_EP
+#undef USBMEM_BUF
+
+/* buffer offsets: USBMEM_EPn_OUT, USBMEM_EPn_OUT_ODD, USBMEM_EPn_IN,
+  USBMEM_EPn_IN_ODD, USBMEM_name */
+/* NOTE: each buffer is followed by an enumerator for its last byte, so the
+  compiler sums up the sizes for us */
+#define USBMEM_ALLOC( name, size ) \
+  USBMEM_##name, \
+  USBMEM_##name##_LAST = USBMEM_##name + (size) - 1,
+#define USBMEM_EP( ep, outsize, insize ) \
+  USBMEM_ALLOC( EP##ep##_OUT, outsize ) \
+  USBMEM_ALLOC( EP##ep##_OUT_ODD, \
+    USBMEM_HAS_PP( ep, USBMEM_OUT ) ? (outsize) : 0 ) \
+  USBMEM_ALLOC( EP##ep##_IN, insize ) \
+  USBMEM_ALLOC( EP##ep##_IN_ODD, \
+    USBMEM_HAS_PP( ep, USBMEM_IN ) ? (insize) : 0 )
+#define USBMEM_BUF( name, size ) \
+  USBMEM_ALLOC( name, size )
+enum usbmem_layout
+{
+  USBMEM_BDT_LAST = USBMEM_NUM_BD * 4 - 1,
+  USBMEM_TABLE
+  USBMEM_SIZE     /* total amount of USB RAM used */
+};
+#undef USBMEM_EP
+#undef USBMEM_BUF
+#undef USBMEM_ALLOC
+
+/* build fails here unless the table lists endpoints 0..USBMEM_NUM_EP-1
+  in ascending order without gaps: each endpoint must be numbered as its
+  position among the endpoint rows (a duplicate fails as a redefinition) */
+#define USBMEM_EP( ep, outsize, insize )  USBMEM_POS_EP##ep,
+#define USBMEM_BUF( name, size )
+enum usbmem_positions
+{
+  USBMEM_TABLE
+  USBMEM_POS_END  /* number of endpoint rows */
+};
+#undef USBMEM_EP
+#define USBMEM_EP( ep, outsize, insize ) \
+  typedef char usbmem_check_ep##ep[ ( (ep) == USBMEM_POS_EP##ep ) ? 1 : -1 ];
+USBMEM_TABLE
+#undef USBMEM_EP
+#undef USBMEM_BUF
+typedef char usbmem_check_num_ep[
+  ( USBMEM_POS_END == USBMEM_NUM_EP ) ? 1 : -1 ];
+
+/* build fails here if the layout does not fit into USB RAM */
+typedef char usbmem_check_size[ ( USBMEM_SIZE <= USBMEM_LIMIT ) ? 1 : -1 ];
+
+/* access to the RAM block, the includer defines g_usbram[ USBMEM_SIZE ]
+  located at USBMEM_BASE */
+#define USBMEM_BD( ep, dir, odd ) \
+  ( *(volatile struct bd_entry *)&g_usbram[ USBMEM_BDINDEX( ep, dir, odd ) * 4 ] )
+#define USBMEM_PTR( name )   ( &g_usbram[ USBMEM_##name ] )
+#define USBMEM_ADDR( name )  (unsigned short)( USBMEM_BASE + USBMEM_##name )
+
+#endif  /* defined USBMEM_H */
\ No newline at end of file